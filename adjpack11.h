@@ -1,9 +1,26 @@
 #pragma once
 
 #include <assert.h>
+#include <stdbool.h>
 
 #include "common.h"
 
+/* The pext/pdep kernels of the upper triangular keys are built on x86-64
+ * with a BMI2 target attribute, whatever the flags; ADJPACK_BMI2 tells that
+ * the flags allow BMI2 everywhere, so the kernels are used without dispatch.
+ */
+#if HAVE_UINT128 && defined(__x86_64__)
+#   include <immintrin.h>
+#   define ADJPACK_PEXT 1
+#else
+#   define ADJPACK_PEXT 0
+#endif
+#if ADJPACK_PEXT && defined(__BMI2__)
+#   define ADJPACK_BMI2 1
+#else
+#   define ADJPACK_BMI2 0
+#endif
+
 #define ADJPACK_N_BYTE   15u
 #define ADJPACK_N_SHIFT   4u
 #define ADJPACK_N_MASK 0x0Fu
@@ -68,17 +85,33 @@ static INLINE __uint128_t bitreverse128(__uint128_t x) {
     return bitreverse64(hi) | ((__uint128_t)bitreverse64(lo) << 64);
 }
 
+#if HAVE_UINT128
+// The rows of mat[n] side by side, row i at bit i*n, turned around with one
+// 128-bit reversal: row i, column j ends up at bit 127 - i*n - j, which is
+// the order of the key (and of nauty's set words) for all rows at once.
+// The rows go into two 64-bit words, which is cheaper than 128-bit shifts.
+static INLINE __uint128_t adjpack_reversed_rows(const vec_t *mat, unsigned n) {
+    const uint64_t row_mask = (1ull << n) - 1;
+    uint64_t lo = 0, hi = 0;
+    for (unsigned i = 0; i < n; ++i) {
+        const unsigned off = i * n;
+        const uint64_t row = mat[i] & row_mask;
+        if (off < 64) {
+            lo |= row << off;
+            if (off + n > 64) hi |= row >> (64 - off);
+        } else {
+            hi |= row << (off - 64);
+        }
+    }
+    return bitreverse128((__uint128_t)hi << 64 | lo);
+}
+#endif
+
 // Packs adjacency matrix mat[n] into key128_t (compatible with digraph6)
 static INLINE void adjpack_from_matrix(const vec_t *mat, unsigned n, key128_t *out) {
     assert(n >= 1 && n <= 11);
 #if HAVE_UINT128
-    out->u = 0;
-    uint64_t row;
-    for (unsigned i = 0; i < n; ++i) {
-        row = bitreverse64(mat[i]) >> (64 - n);
-        out->u <<= n;
-        out->u |= row;
-    }
+    out->u = adjpack_reversed_rows(mat, n) >> (128 - n * n);
 #else
     uint64_t lo = 0, hi = 0;
     unsigned pos = 0;
@@ -94,8 +127,8 @@ static INLINE void adjpack_from_matrix(const vec_t *mat, unsigned n, key128_t *o
     }
     memcpy(out->b + 0, &lo, 8);
     memcpy(out->b + 8, &hi, 8);
-#endif
     adjpack_zero_above_nsquare(out, n);
+#endif
     adjpack_set_n(out, n);
 }
 
@@ -124,10 +157,11 @@ static INLINE void adjpack_from_graph(const graph *g, unsigned n, int m, key128_
 static INLINE void adjpack_to_matrix(const key128_t *k, uint64_t *mat_out, unsigned n) {
     assert(n >= 1 && n <= 11);
 #if HAVE_UINT128
-    __uint128_t acc = k->u;
-    for (int i = n-1; i >= 0; --i) {
-        mat_out[i] = bitreverse64((uint64_t)acc) >> (64 - n);
-        acc >>= n;
+    // the inverse of adjpack_from_matrix(): one reversal, then plain rows
+    const uint64_t row_mask = (1ull << n) - 1;
+    __uint128_t acc = bitreverse128(k->u << (128 - n * n));
+    for (unsigned i = 0; i < n; ++i) {
+        mat_out[i] = (uint64_t)(acc >> (i * n)) & row_mask;
     }
 #else
     uint64_t lo, hi;
@@ -142,3 +176,109 @@ static INLINE void adjpack_to_matrix(const key128_t *k, uint64_t *mat_out, unsig
     }
 #endif
 }
+
+/*
+ * Upper triangular keys.
+ *
+ * A DAG in topological order has a strictly upper triangular matrix, so
+ * only the n(n-1)/2 bits above the diagonal of its key can be set, 55 for
+ * n = 11: they fit into a uint64_t. adjpack_upper_mask[n] marks them in the
+ * key (low and high word); with BMI2 a pext per word gathers them and a
+ * pdep per word puts them back, otherwise one shift per row does. The bits
+ * keep their order, so upper keys of the same n compare as their keys.
+ */
+static const uint64_t adjpack_upper_mask[12][2] = {
+    { 0x0000000000000000ull, 0x0000000000000000ull },  /*  0 */
+    { 0x0000000000000000ull, 0x0000000000000000ull },  /*  1 */
+    { 0x0000000000000004ull, 0x0000000000000000ull },  /*  2 */
+    { 0x00000000000000c8ull, 0x0000000000000000ull },  /*  3 */
+    { 0x0000000000007310ull, 0x0000000000000000ull },  /*  4 */
+    { 0x0000000000f38c20ull, 0x0000000000000000ull },  /*  5 */
+    { 0x00000007cf1c3040ull, 0x0000000000000000ull },  /*  6 */
+    { 0x0000fcf8f0e0c080ull, 0x0000000000000000ull },  /*  7 */
+    { 0x7f3f1f0f07030100ull, 0x0000000000000000ull },  /*  8 */
+    { 0x8fc3e0f0380c0200ull, 0x000000000000ff3full },  /*  9 */
+    { 0xf07c0f01c0300400ull, 0x00000007fcff1fc3ull },  /* 10 */
+    { 0x0f80f00e00c00800ull, 0x00ffcff8ff0fe0fcull },  /* 11 */
+};
+
+#if HAVE_UINT128
+// is_upper_triangular() of the matrix of k: no bits on or below the
+// diagonal, except that (as there) a loop at vertex 0, the top bit, passes.
+static INLINE bool adjpack_is_upper(const key128_t *k, unsigned n) {
+    assert(n >= 1 && n <= 11);
+    const __uint128_t upper = (__uint128_t)adjpack_upper_mask[n][1] << 64 | adjpack_upper_mask[n][0];
+    const __uint128_t below = ((__uint128_t)1 << (n * n - 1)) - 1;
+    return (k->u & below & ~upper) == 0;
+}
+
+// The bits of k above the diagonal, the first row highest; one shift per row.
+static INLINE uint64_t adjpack_upper_from_key_shifts(const key128_t *k, unsigned n) {
+    assert(n >= 1 && n <= 11);
+    // row i keeps its last n-1-i columns, the low bits of its n in the key
+    uint64_t u = 0;
+    for (unsigned i = 0; i + 1 < n; ++i) {
+        const unsigned w = n - 1 - i;
+        u = u << w | ((uint64_t)(k->u >> (w * n)) & ((1ull << w) - 1));
+    }
+    return u;
+}
+
+// The key of n vertices with the bits u of adjpack_upper_from_key() above
+// the diagonal; one shift per row.
+static INLINE void adjpack_upper_to_key_shifts(uint64_t u, unsigned n, key128_t *k) {
+    assert(n >= 1 && n <= 11);
+    k->u = 0;
+    for (unsigned w = 1; w < n; ++w) {
+        k->u |= (__uint128_t)(u & ((1ull << w) - 1)) << (w * n);
+        u >>= w;
+    }
+    adjpack_set_n(k, n);
+}
+
+#if ADJPACK_PEXT
+// The same with one pext or pdep per word. Not INLINE: they inline only
+// into code built for BMI2, elsewhere they are called (after a CPU check).
+static inline __attribute__((target("bmi2"))) uint64_t adjpack_upper_from_key_pext(const key128_t *k, unsigned n) {
+    assert(n >= 1 && n <= 11);
+    const uint64_t lo = _pext_u64((uint64_t)k->u, adjpack_upper_mask[n][0]);
+    const uint64_t hi = _pext_u64((uint64_t)(k->u >> 64), adjpack_upper_mask[n][1]);
+    return hi << __builtin_popcountll(adjpack_upper_mask[n][0]) | lo;
+}
+
+static inline __attribute__((target("bmi2"))) void adjpack_upper_to_key_pdep(uint64_t u, unsigned n, key128_t *k) {
+    assert(n >= 1 && n <= 11);
+    const uint64_t lo = _pdep_u64(u, adjpack_upper_mask[n][0]);
+    const uint64_t hi = _pdep_u64(u >> __builtin_popcountll(adjpack_upper_mask[n][0]), adjpack_upper_mask[n][1]);
+    k->u = (__uint128_t)hi << 64 | lo;
+    adjpack_set_n(k, n);
+}
+#endif
+
+#if CPU_DISPATCH && ADJPACK_PEXT
+// The pext kernels on x86-64-v3 CPUs (which have BMI2), the shifts on the
+// others: an ifunc in dag.c binds them when the program is loaded.
+uint64_t adjpack_upper_from_key(const key128_t *k, unsigned n);
+void adjpack_upper_to_key(uint64_t u, unsigned n, key128_t *k);
+#else
+static INLINE uint64_t adjpack_upper_from_key(const key128_t *k, unsigned n) {
+#if ADJPACK_BMI2
+    return adjpack_upper_from_key_pext(k, n);
+#else
+    return adjpack_upper_from_key_shifts(k, n);
+#endif
+}
+
+static INLINE void adjpack_upper_to_key(uint64_t u, unsigned n, key128_t *k) {
+#if ADJPACK_BMI2
+    adjpack_upper_to_key_pdep(u, n, k);
+#else
+    adjpack_upper_to_key_shifts(u, n, k);
+#endif
+}
+#endif
+#endif
+
+// The kernels of adjpack_upper_from_key() and adjpack_upper_to_key() on this
+// CPU: "pext" or "shifts" (dag.c).
+const char *adjpack_upper_variant(void);
@@ -1,67 +1,63 @@
 #include <omp.h>
 
 #include "bott.h"
-#include "dag.h"    /* matrix_to_d6 */
-#include "bucket.h"
+#include "cpudispatch.h"
+#include "dag.h"    /* matrix_to_key128_canon */
+#include "adjpack11.h"
+#include "dedup.h"
+#include "keystream.h"
+#include "parse_scaled.h"
+#include "reorder.h"
+#include "shardset.h"
 #include "tlsbuf.h"
+#include "zio.h"
 
 static void help(const char *name)
 {
     fprintf(stderr,
-        "Usage: %s [-j njobs] [-s start_dim] [-d dimension] [-a] [-p] [-n] [-v] [-h] [-o <path>|stdout|-]\n"
+        "Usage: %s [-j njobs] [-s start_dim] [-d dimension] [-a] [-p] [-n] [-v] [-h] [-m size] [-o <path>|stdout|-] [-O dir] [-B] [-D]\n"
         "-j: number of threads\n"
         "-d: target dimension to calculate\n"
         "-s: starting dimension, between 3 and 11, less than target dimension\n"
         "-a: calculate spin structures also\n"
         "-p: show progress during computation\n"
         "-n: suppress final numeric output\n"
-        "-o: write DAG codes (d6) to file; use '-' or 'stdout' to write to STDOUT\n"
+        "-o: write DAG codes (d6) to file; use '-' or 'stdout' to write to STDOUT;\n"
+        "    a file ending in .xz or .zst is compressed\n"
+        "-O: write DAG codes to one file per thread in dir, listed in dir/MANIFEST;\n"
+        "    shardcat checks, concatenates or merges them\n"
+        "-B: with -o or -O, write a binary key stream instead of d6 lines\n"
+        "-D: with -o, write the codes in state order, each at its first occurrence,\n"
+        "    so that every run and -j give the same output\n"
+        "-m: memory budget for seen codes, spilled to $TMPDIR beyond it (k/M/G suffixes)\n"
         "-v: be verbose\n",
         name);
 }
 
 /* global */
 int calculate_spin = 0;
-GHashBucket *g_canonical_set = NULL;
-
-/* --- I/O buffer per‑task for d6 codes --- */
-struct out_ctx {
-    int enabled;        /* whether -o is enabled */
-    FILE *fp;           /* where to write (stdout/file) */
-    char *buf;          /* buffer for batched I/O */
-    size_t used;        /* how many bytes are used */
-    size_t cap;         /* buffer capacity */
-};
-#define OUTBUF_CAP (1u<<26) /* ~64 MiB per task */
-
-static INLINE void out_flush(struct out_ctx *out)
-{
-    if (!out || !out->enabled || out->used == 0) return;
-    #pragma omp critical(output)
-    {
-        (void)fwrite(out->buf, 1, out->used, out->fp);
-        fflush(out->fp);
-    }
-    out->used = 0;
-}
+bool binary_output = false;
+DedupSet *g_canonical_set = NULL;
 
-static INLINE void out_append_line(struct out_ctx *out, const char *line)
-{
-    if (!out || !out->enabled) return;
+Reorder *g_order = NULL;
 
+/* --- codes go to the output ring through a buffer per task --- */
+static INLINE void out_append_matrix(OutputBuffer *out, const vec_t *mat, ind_t dim)
+{
     key128_t key;
-    d6_to_key128_canon(line, &key);
-    if (!g_bucket_insert_copy128(g_canonical_set, &key)) {
+    matrix_to_key128_canon(mat, dim, &key);
+    if (g_order) {
+        // -D: the dedup is done in state order, when the chunk is written
+        key128_t code;
+        adjpack_from_matrix(mat, dim, &code);
+        reorder_add_pair(out, &key, &code);
         return;
     }
-
-    size_t len = strlen(line);
-    if (out->used + len + 1 >= out->cap) {
-        out_flush(out);
+    if (!dedup_insert(g_canonical_set, &key)) {
+        return;
     }
-    memcpy(out->buf + out->used, line, len);
-    out->used += len;
-    out->buf[out->used++] = '\n';
+    adjpack_from_matrix(mat, dim, &key);
+    buffer_add_key(out, &key, binary_output);
 }
 
 /* --- Small helpers --- */
@@ -76,7 +72,45 @@ static INLINE void decrease_dimension(vec_t *mat, ind_t dim)
 
 /* --- Declarations --- */
 size_t backtrack(vec_t *mat, vec_t **cache, ind_t cdim, ind_t ddim,
-                 size_t *spinc, size_t *spin, struct out_ctx *out);
+                 size_t *spinc, size_t *spin, OutputBuffer *out);
+
+static unsigned long progress = 0;
+static size_t spinc = 0, spin = 0;
+
+/* Runs the states base..end of the starting dimension, the codes to 'out'
+ * (NULL without output), and adds the counts and the progress.
+ */
+static void run_states(unsigned long base, unsigned long end, vec_t **cache, ind_t sdim, ind_t dim,
+                       OutputBuffer *out)
+{
+    vec_t *tmat = init(dim);
+    vec_t row = dim - sdim;
+    size_t local_spinc = 0, local_spin = 0;
+
+    init_nauty_data(dim);
+    for (state_t s = (state_t)base; s <= (state_t)end; ++s) {
+        matrix_by_state(&tmat[row], cache[sdim], s, sdim);
+        if (is_spinc(&tmat[row], sdim)) {
+            backtrack(tmat, cache, sdim + 1, dim, &local_spinc, &local_spin, out);
+            decrease_dimension(tmat, dim);
+        }
+    }
+    free_nauty_data();
+    free(tmat);
+
+    /* update global counters */
+    #pragma omp atomic update
+    spinc += local_spinc;
+    if (calculate_spin) {
+        #pragma omp atomic update
+        spin += local_spin;
+    }
+
+    /* progress: entire chunk with a single atomic update */
+    unsigned long done = (unsigned long)(end - base + 1);
+    #pragma omp atomic update
+        progress += done;
+}
 
 /* -------------------- main -------------------- */
 int main(int argc, char *argv[])
@@ -84,26 +118,27 @@ int main(int argc, char *argv[])
     int opt = 1, no_output = 0;
     state_t test = 0;
     int progress_enabled = 0;
+    bool ordered = false;
 
     /* defaults */
     ind_t sdim = 0, dim = 6;
     vec_t *cache[12] = { 0,0,0,0,0,0,0,0,0,0,0,0 };
 
     state_t loop_start = 1, loop_stop = 1;
-    vec_t row;
-    size_t spinc = 0, spin = 0;
     size_t cache_size;
 
     int nthreads = omp_get_max_threads();
 
     /* -o */
     int output_enabled = 0;
-    const char *out_path = NULL;
+    const char *out_path = NULL, *shard_dir = NULL;
     FILE *out_fp = NULL;
+    OutRing *ring = NULL;
+    size_t mem_budget = 0;
 
     tic();
 
-    while ((opt = getopt(argc, argv, "vhj:d:s:anpt:o:")) != -1) {
+    while ((opt = getopt(argc, argv, "vhj:d:s:anpt:o:O:BDm:")) != -1) {
         switch (opt) {
         case 't': test = atol(optarg); break;
         case 'p': progress_enabled = 1; break;
@@ -114,11 +149,29 @@ int main(int argc, char *argv[])
         case 'd': dim  = (ind_t)atoi(optarg); break;
         case 's': sdim = (ind_t)atoi(optarg); break;
         case 'o': output_enabled = 1; out_path = optarg; break;
+        case 'O': output_enabled = 1; shard_dir = optarg; break;
+        case 'B': binary_output = true; break;
+        case 'D': ordered = true; break;
+        case 'm':
+            if (!parse_scaled_size(optarg, &mem_budget)) {
+                fprintf(stderr, "Invalid -m value: %s (examples: 512M, 8G, 4Gi)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
         case 'h': help(argv[0]); exit(EXIT_SUCCESS);
         default: help(argv[0]); exit(EXIT_FAILURE);
         }
     }
 
+    if (out_path && shard_dir) {
+        fprintf(stderr, "-o and -O exclude each other\n");
+        exit(EXIT_FAILURE);
+    }
+    if (ordered && shard_dir) {
+        fprintf(stderr, "-D cannot be combined with -O, shards follow the threads\n");
+        exit(EXIT_FAILURE);
+    }
+
     if (sdim == 0) {
         sdim = (dim > 11) ? 11 : dim - 1;
     }
@@ -135,7 +188,6 @@ int main(int argc, char *argv[])
     }
 
     state_t max_state = get_max_state(sdim);
-    row = dim - sdim;
 
     if (test > 0) {
         loop_start = (max_state + 1) / 2;
@@ -145,17 +197,28 @@ int main(int argc, char *argv[])
         loop_stop  = max_state;
     }
 
-    /* -o: open output */
-    if (output_enabled) {
+    if (progress_enabled) {
+        // one thread will be for showing progress, not calculations
+        omp_set_num_threads(nthreads+1);
+    }
+
+    /* -o: open output; -O: a shard per thread (of all threads, see above) */
+    if (shard_dir) {
+        ring = outring_open_shards(shardset_create(shard_dir, binary_output, dim, KEYSTREAM_UNIQUE), 0, 0);
+    } else if (output_enabled) {
         if (strcmp(out_path, "-") == 0 || strcasecmp(out_path, "stdout") == 0) {
             out_fp = stdout;
         } else {
-            out_fp = fopen(out_path, "w");
+            out_fp = zio_fopen_write(out_path);
             if (!out_fp) {
                 fprintf(stderr, "Cannot open output file '%s': %s\n", out_path, strerror(errno));
                 exit(EXIT_FAILURE);
             }
         }
+        if (binary_output) {
+            keystream_write_header(out_fp, dim, KEYSTREAM_UNIQUE);
+        }
+        ring = outring_open(out_fp, 0, 0);
     }
 
     const unsigned long total_iters = (unsigned long)(loop_stop - loop_start + 1);
@@ -166,106 +229,96 @@ int main(int argc, char *argv[])
     if (grain < 256ul)   grain = 256ul;
     if (grain > 131072ul) grain = 131072ul;
 
-    if (progress_enabled) {
-        // one thread will be for showing progress, not calculations
-        omp_set_num_threads(nthreads+1);
-    }
-
     printlog(2, "iteration range: %lu..%lu (total=%lu)",
              (unsigned long)loop_start, (unsigned long)loop_stop, total_iters);
     printlog(2, "openmp task grain set to %lu iterations", grain);
 
     /* progress and streams */
-    static unsigned long progress = 0;
     #pragma omp atomic write
     progress = 0;
 
     FILE *progress_stream = output_enabled ? stderr : stdout;
     FILE *summary_stream  = (output_enabled ? stderr : stdout);
 
-    g_canonical_set = g_bucket_new_128( NULL, 1023 );
-    if (g_canonical_set==NULL) {
-        fprintf(stderr, "error in creating GHashBucket, quitting...\n");
-        exit(1);
+    g_canonical_set = dedup_new(1023, mem_budget);
+    ReorderDedup order_dedup = { .set = g_canonical_set, .binary = binary_output, .added = 0 };
+    if (ordered && ring) {
+        g_order = reorder_open(ring, 0, reorder_commit_dedup, &order_dedup);
     }
+    cpu_dispatch_log(1);
     printlog(1, "%s: starting calculations", argv[0]);
-    /* ------------------ Parallelism (tasks) ------------------ */
-    #pragma omp parallel
-    #pragma omp single nowait
-    {
-        /* progress monitor */
-        if (progress_enabled) {
-            #pragma omp task untied firstprivate(total_iters, progress_stream)
-            {
-                monitor_progress(&progress, total_iters, progress_stream);
-            }
-        }
+    if (g_order) {
+        /* -D: chunks of states taken in increasing order from a counter by
+         * every thread (but the one of the progress monitor), so that the
+         * reorder window cannot wait for a chunk nobody works on
+         */
+        const unsigned long nchunks = (total_iters + grain - 1) / grain;
+        unsigned long next_chunk = 0;
 
-        /* worker tasks */
-        #pragma omp taskgroup
-        {
-            for (unsigned long base = (unsigned long)loop_start; base <= (unsigned long)loop_stop; ) {
+        #pragma omp parallel
+        if (progress_enabled && omp_get_thread_num() == 0) {
+            monitor_progress(&progress, total_iters, progress_stream);
+        } else {
+            for (;;) {
+                unsigned long c;
+                #pragma omp atomic capture
+                c = next_chunk++;
+                if (c >= nchunks) break;
+
+                unsigned long base = (unsigned long)loop_start + c * grain;
                 unsigned long end = base + grain - 1;
                 if (end > (unsigned long)loop_stop) end = (unsigned long)loop_stop;
 
-                #pragma omp task firstprivate(base, end, row, dim, sdim) shared(cache, calculate_spin, progress, out_fp, output_enabled) \
-                                 untied
+                OutputBuffer out;
+                reorder_begin(g_order, c, &out);
+                run_states(base, end, cache, sdim, dim, &out);
+                reorder_end(g_order, c, &out);
+            }
+        }
+        reorder_close(g_order);
+    } else {
+        /* ------------------ Parallelism (tasks) ------------------ */
+        #pragma omp parallel
+        #pragma omp single nowait
+        {
+            /* progress monitor */
+            if (progress_enabled) {
+                #pragma omp task untied firstprivate(total_iters, progress_stream)
                 {
-                    vec_t *tmat = init(dim);
-                    size_t local_spinc = 0, local_spin = 0;
-
-                    struct out_ctx out = {0};
-                    out.enabled = output_enabled;
-                    out.fp = out_fp ? out_fp : stdout;
-                    if (out.enabled) {
-                        out.cap = OUTBUF_CAP;
-                        out.buf = (char*)malloc(out.cap);
-                        out.used = 0;
-                        if (!out.buf) {
-                            fprintf(stderr, "malloc failed for output buffer\n");
-                            exit(EXIT_FAILURE);
-                        }
-                    }
+                    monitor_progress(&progress, total_iters, progress_stream);
+                }
+            }
 
-                    init_nauty_data(dim);
-                    for (state_t s = (state_t)base; s <= (state_t)end; ++s) {
-                        matrix_by_state(&tmat[row], cache[sdim], s, sdim);
-                        if (is_spinc(&tmat[row], sdim)) {
-                            backtrack(tmat, cache, sdim + 1, dim, &local_spinc, &local_spin, out.enabled ? &out : NULL);
-                            decrease_dimension(tmat, dim);
-                        }
-                    }
-                    free_nauty_data();
+            /* worker tasks */
+            #pragma omp taskgroup
+            {
+                for (unsigned long base = (unsigned long)loop_start; base <= (unsigned long)loop_stop; ) {
+                    unsigned long end = base + grain - 1;
+                    if (end > (unsigned long)loop_stop) end = (unsigned long)loop_stop;
 
-                    /* flush the code buffer and clean up */
-                    if (out.enabled) {
-                        out_flush(&out);
-                        free(out.buf);
-                    }
-                    free(tmat);
-
-                    /* update global counters */
-                    #pragma omp atomic update
-                    spinc += local_spinc;
-                    if (calculate_spin) {
-                        #pragma omp atomic update
-                        spin += local_spin;
+                    #pragma omp task firstprivate(base, end, dim, sdim) shared(cache, ring) \
+                                     untied
+                    {
+                        OutputBuffer out;
+                        buffer_init(&out, ring);
+
+                        run_states(base, end, cache, sdim, dim, ring ? &out : NULL);
+
+                        /* hand the last codes to the writer */
+                        if (ring) {
+                            buffer_destroy(&out);
+                        }
                     }
 
-                    /* progress: entire chunk with a single atomic update */
-                    unsigned long done = (unsigned long)(end - base + 1);
-                    #pragma omp atomic update
-                        progress += done;
+                    if (end == (unsigned long)loop_stop) break;
+                    base = end + 1;
                 }
-
-                if (end == (unsigned long)loop_stop) break;
-                base = end + 1;
             }
-        }
 
-        /* finalize progress */
-        #pragma omp atomic write
-        progress = total_iters;
+            /* finalize progress */
+            #pragma omp atomic write
+            progress = total_iters;
+        }
     }
 
     if (progress_enabled) {
@@ -294,11 +347,14 @@ int main(int argc, char *argv[])
     }
 
     /* close the file if it's not stdout */
+    if (ring) {
+        outring_close(ring);
+    }
     if (output_enabled && out_fp && out_fp != stdout) {
         fclose(out_fp);
     }
 
-    g_bucket_destroy(g_canonical_set);
+    dedup_destroy(g_canonical_set);
 
     /* clean up cache */
     for (int i = sdim; i < 12; ++i) { free(cache[i]); }
@@ -308,7 +364,7 @@ int main(int argc, char *argv[])
 
 /* --- Actual backtrack --- */
 size_t backtrack(vec_t *mat, vec_t **cache, ind_t cdim, ind_t ddim,
-                 size_t *spinc, size_t *spin, struct out_ctx *out)
+                 size_t *spinc, size_t *spin, OutputBuffer *out)
 {
     vec_t max = 1 << (cdim - 2);
     vec_t r;
@@ -326,11 +382,9 @@ size_t backtrack(vec_t *mat, vec_t **cache, ind_t cdim, ind_t ddim,
          */
         mat[0] = 0;
         *spinc += 1;
-        /* d6 code output only in the last recursion step */
-        char code_buf[256];
-        if (out && out->enabled) {
-            matrix_to_d6(mat, ddim, code_buf);
-            out_append_line(out, code_buf);
+        /* code output only in the last recursion step */
+        if (out) {
+            out_append_matrix(out, mat, ddim);
         }
 
         if (calculate_spin) {
@@ -340,9 +394,8 @@ size_t backtrack(vec_t *mat, vec_t **cache, ind_t cdim, ind_t ddim,
                 if (is_spinc(mat, ddim)) {
                     *spinc += 1;
                     *spin  += is_spin(mat, ddim);
-                    if (out && out->enabled) {
-                        matrix_to_d6(mat, ddim, code_buf);
-                        out_append_line(out, code_buf);
+                    if (out) {
+                        out_append_matrix(out, mat, ddim);
                     }
                 }
             }
@@ -351,9 +404,8 @@ size_t backtrack(vec_t *mat, vec_t **cache, ind_t cdim, ind_t ddim,
                 mat[0] = cache[ddim][r];
                 if (is_spinc(mat, ddim)) {
                     *spinc += 1;
-                    if (out && out->enabled) {
-                        matrix_to_d6(mat, ddim, code_buf);
-                        out_append_line(out, code_buf);
+                    if (out) {
+                        out_append_matrix(out, mat, ddim);
                     }
                 }
             }
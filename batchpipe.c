@@ -0,0 +1,164 @@
+#include "common.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "batchpipe.h"
+
+#define BATCHPIPE_KEYS    100000
+#define BATCHPIPE_BATCHES 3
+
+struct _BatchPipe {
+    KeyStream       *in;
+    KeyBatch        *batches;
+    size_t           batch_keys;
+    unsigned         nbatches;
+    key128_t         first;
+    bool             has_first;
+
+    pthread_t        reader;
+    pthread_mutex_t  lock;
+    pthread_cond_t   filled;            /* a batch was read, or the end */
+    pthread_cond_t   freed;             /* a batch was released, or stop */
+    uint64_t         produced, consumed, released;
+    bool             eof, stop;
+
+    uint64_t         wait_ns;           /* consumer only */
+    uint64_t         read_ns;           /* reader only */
+};
+
+static void *reader_main(void *arg)
+{
+    BatchPipe *p = (BatchPipe*)arg;
+    uint64_t records = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&p->lock);
+        while (!p->stop && p->produced - p->released == p->nbatches) {
+            pthread_cond_wait(&p->freed, &p->lock);
+        }
+        bool stop = p->stop;
+        KeyBatch *b = &p->batches[p->produced % p->nbatches];
+        pthread_mutex_unlock(&p->lock);
+        if (stop) {
+            break;
+        }
+
+        uint64_t t0 = ns_now_monotonic();
+        size_t cnt = 0;
+        if (p->has_first) {
+            b->keys[cnt++] = p->first;
+            p->has_first = false;
+        }
+        cnt += keystream_read(p->in, b->keys + cnt, p->batch_keys - cnt);
+        b->count = cnt;
+        b->first = records;
+        records += cnt;
+        p->read_ns += ns_now_monotonic() - t0;
+
+        pthread_mutex_lock(&p->lock);
+        if (cnt > 0) {
+            p->produced++;
+        } else {
+            p->eof = true;
+        }
+        pthread_cond_signal(&p->filled);
+        pthread_mutex_unlock(&p->lock);
+        if (cnt == 0) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+BatchPipe *batchpipe_open(KeyStream *in, const key128_t *first, size_t batch_keys, unsigned nbatches)
+{
+    BatchPipe *p = (BatchPipe*)calloc(1, sizeof(BatchPipe));
+    if (p == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    p->in         = in;
+    p->batch_keys = batch_keys ? batch_keys : BATCHPIPE_KEYS;
+    p->nbatches   = nbatches ? nbatches : BATCHPIPE_BATCHES;
+    if (first) {
+        p->first     = *first;
+        p->has_first = true;
+    }
+    p->batches = (KeyBatch*)calloc(p->nbatches, sizeof(KeyBatch));
+    if (p->batches == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    for (unsigned i = 0; i < p->nbatches; ++i) {
+        p->batches[i].keys = (key128_t*)malloc(p->batch_keys * sizeof(key128_t));
+        if (p->batches[i].keys == NULL) {
+            fprintf(stderr, "out of memory for %u input batches of %zu keys\n", p->nbatches, p->batch_keys);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->filled, NULL);
+    pthread_cond_init(&p->freed, NULL);
+    int err = pthread_create(&p->reader, NULL, reader_main, p);
+    if (err != 0) {
+        fprintf(stderr, "cannot start the reader thread: %s\n", strerror(err));
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+KeyBatch *batchpipe_next(BatchPipe *p)
+{
+    uint64_t t0 = ns_now_monotonic();
+    pthread_mutex_lock(&p->lock);
+    while (p->consumed == p->produced && !p->eof) {
+        pthread_cond_wait(&p->filled, &p->lock);
+    }
+    KeyBatch *b = NULL;
+    if (p->consumed < p->produced) {
+        b = &p->batches[p->consumed++ % p->nbatches];
+    }
+    pthread_mutex_unlock(&p->lock);
+    p->wait_ns += ns_now_monotonic() - t0;
+    return b;
+}
+
+void batchpipe_release(BatchPipe *p, KeyBatch *b)
+{
+    pthread_mutex_lock(&p->lock);
+    assert(b == &p->batches[p->released % p->nbatches] && p->released < p->consumed);
+    p->released++;
+    pthread_cond_signal(&p->freed);
+    pthread_mutex_unlock(&p->lock);
+}
+
+void batchpipe_close(BatchPipe *p)
+{
+    pthread_mutex_lock(&p->lock);
+    p->stop = true;
+    pthread_cond_signal(&p->freed);
+    pthread_mutex_unlock(&p->lock);
+    pthread_join(p->reader, NULL);
+
+    printlog(2, "input: reading took %.3fs in the background, waiting for it %.3fs",
+             p->read_ns / 1e9, p->wait_ns / 1e9);
+
+    for (unsigned i = 0; i < p->nbatches; ++i) {
+        free(p->batches[i].keys);
+    }
+    free(p->batches);
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->filled);
+    pthread_cond_destroy(&p->freed);
+    free(p);
+}
+
+double batchpipe_wait_time(const BatchPipe *p)
+{
+    return p->wait_ns / 1e9;
+}
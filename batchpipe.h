@@ -0,0 +1,44 @@
+#pragma once
+
+#include "common.h"
+#include "keystream.h"
+
+/*
+ * Batch pipe: the input of a tool, read ahead by a thread of its own.
+ *
+ * A reader thread fills a small pool of key batches (two or three are
+ * enough) from a KeyStream while the tool computes on the batch before, and
+ * the output ring writes the one before that; reading, computing and
+ * writing overlap. Batches come out in input order and go back to the pool
+ * in the same order. The pipe has one consumer: in a parallel region one
+ * thread takes the batch (e.g. in an omp single) and all share it.
+ *
+ * The KeyStream belongs to the reader thread until batchpipe_close().
+ */
+typedef struct {
+    key128_t *keys;
+    size_t    count;
+    uint64_t  first;            /* number of keys before this batch */
+} KeyBatch;
+
+typedef struct _BatchPipe BatchPipe;
+
+/* Starts reading 'in' into 'nbatches' batches of 'batch_keys' keys (0 for
+ * 100000 keys and 3 batches). A non-NULL 'first' is a key already taken
+ * from the stream, which goes in front of the first batch.
+ */
+BatchPipe *batchpipe_open(KeyStream *in, const key128_t *first, size_t batch_keys, unsigned nbatches);
+
+/* The next batch, waiting for the reader if needed; NULL at the end. */
+KeyBatch *batchpipe_next(BatchPipe *p);
+
+/* Gives the oldest batch taken back to the reader. */
+void batchpipe_release(BatchPipe *p, KeyBatch *b);
+
+/* Stops the reader (also before the end of the input) and frees the pool;
+ * logs the time the consumer waited for input at verbosity 2.
+ */
+void batchpipe_close(BatchPipe *p);
+
+/* Seconds the consumer spent waiting in batchpipe_next(). */
+double batchpipe_wait_time(const BatchPipe *p);
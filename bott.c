@@ -53,7 +53,7 @@ static INLINE bool equal_cols(const vec_t *mat, const ind_t dim, const ind_t i,
     return true;
 }
 
-bool is_spinc(const vec_t *mat, const ind_t dim)
+CPU_CLONES bool is_spinc(const vec_t *mat, const ind_t dim)
 {
     if (!is_orientable(mat, dim)) {
         return false;
@@ -75,7 +75,7 @@ bool is_spinc(const vec_t *mat, const ind_t dim)
     return true;
 }
 
-bool is_spin(const vec_t *mat, const ind_t dim)
+CPU_CLONES bool is_spin(const vec_t *mat, const ind_t dim)
 {
     if (!is_orientable(mat, dim)) {
         return false;
@@ -146,7 +146,7 @@ bool conditional_add_row(const vec_t *src, vec_t *dst, ind_t dim, ind_t l, ind_t
 }
 
 /* return the numbers of ones in the matrix */
-int matrix_weight(const vec_t *mat, const ind_t dim)
+CPU_CLONES int matrix_weight(const vec_t *mat, const ind_t dim)
 {
     int w = 0;
     for (ind_t i=0; i<dim; i++) {
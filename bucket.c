@@ -1,6 +1,10 @@
 #include "common.h"
 
+#include <assert.h>
 #include <omp.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #if NAUTY_HAS_TLS
 
@@ -15,6 +19,8 @@
 #endif
 
 #include "bucket.h"
+#include "hugemem.h"
+#include "shmset.h"
 
 #ifndef MIN_TRUE
 #define MIN_TRUE 0.20
@@ -28,6 +34,54 @@
 #define MAX_OCCUPIED 0.80
 #endif
 
+/* Old-table slots moved to the new table on every insert/remove while a
+ * resize is in progress, at least. Every resize leaves the new table about
+ * MAX_TRUE / 2 full at most, and the step is raised so that the old table is
+ * empty after half of the inserts the new one takes before its next resize
+ * (see flat_start_resize()); no insert ever waits for a whole migration.
+ */
+#ifndef FLAT_MIGRATE_STEP
+#define FLAT_MIGRATE_STEP 64
+#endif
+
+/* Statistics (configure --enable-bucket-stats). The bucket points cur_stats
+ * at the counters of the shard it has locked, so the FlatSet code records
+ * into the right shard and standalone FlatSets record nothing.
+ * Probes of g_bucket_remove() are counted as lookups.
+ */
+#if BUCKET_STATS
+
+#define PROBE_HIST 16   /* log2 buckets: 1, 2-3, 4-7, ..., >= 2^15 */
+
+typedef struct {
+    uint64_t insert_hist[PROBE_HIST];
+    uint64_t lookup_hist[PROBE_HIST];
+    uint64_t inserts, insert_probes;
+    uint64_t lookups, lookup_probes;
+    uint64_t resizes, resize_ns;
+    uint64_t lock_waits, lock_wait_ns;
+} ShardStats;
+
+static TLS_ATTR ShardStats *cur_stats = NULL;
+
+static INLINE void stats_probe(uint64_t *hist, uint64_t *count, uint64_t *sum, size_t steps)
+{
+    int k = 63 - __builtin_clzll((unsigned long long)steps);
+    hist[k < PROBE_HIST ? k : PROBE_HIST - 1]++;
+    (*count)++;
+    *sum += steps;
+}
+
+#   define STATS(stmt) do { if (cur_stats) { stmt; } } while (0)
+#   define STATS_PROBE(kind, steps) STATS(stats_probe(cur_stats->kind##_hist, &cur_stats->kind##s, &cur_stats->kind##_probes, steps))
+
+#else
+
+#   define STATS(stmt) do { } while (0)
+#   define STATS_PROBE(kind, steps) do { (void)(steps); } while (0)
+
+#endif
+
 #define CTRL_EMPTY   ((uint8_t)0)
 #define CTRL_FULL    ((uint8_t)1)
 #define CTRL_DELETED ((uint8_t)2)
@@ -50,74 +104,180 @@ static size_t next_pow2(size_t x) {
 #endif
 }
 
-void flat_init(FlatSet *s, size_t cap_hint) {
+static INLINE void flat_alloc(FlatSet *s) {
+    s->keys = (key128_t*)mem_table_alloc(s->cap * sizeof(key128_t), s->node);
+    s->ctrl = (uint8_t*) mem_table_alloc(s->cap * sizeof(uint8_t), s->node);
+}
+
+/* flat_init() without touching the NUMA node set by the owner. */
+static void flat_setup(FlatSet *s, size_t cap_hint) {
     s->cap  = next_pow2(cap_hint ? cap_hint : 1024);
     s->size = 0;
     s->dels = 0;
-    s->keys = (key128_t*)calloc(s->cap, sizeof(key128_t));
-    s->ctrl = (uint8_t*) calloc(s->cap, sizeof(uint8_t) );
+    flat_alloc(s);
+    s->old_keys = NULL;
+    s->old_ctrl = NULL;
+    s->old_cap  = 0;
+    s->old_pos  = 0;
+    s->old_step = FLAT_MIGRATE_STEP;
+    s->borrowed = s->old_borrowed = false;
+}
+
+void flat_init(FlatSet *s, size_t cap_hint) {
+    s->node = -1;
+    flat_setup(s, cap_hint);
+}
+
+static void flat_free_old(FlatSet *s) {
+    if (!s->old_borrowed) {
+        mem_table_free(s->old_keys, s->old_cap * sizeof(key128_t));
+        mem_table_free(s->old_ctrl, s->old_cap * sizeof(uint8_t));
+    }
+    s->old_borrowed = false;
+    s->old_keys = NULL;
+    s->old_ctrl = NULL;
+    s->old_cap = s->old_pos = 0;
 }
 
 void flat_free(FlatSet *s) {
     if (!s){
         return;
     }
-    free(s->keys);
-    free(s->ctrl);
+    if (!s->borrowed) {
+        mem_table_free(s->keys, s->cap * sizeof(key128_t));
+        mem_table_free(s->ctrl, s->cap * sizeof(uint8_t));
+    }
+    s->borrowed = false;
     s->keys = NULL;
     s->ctrl = NULL;
     s->cap = s->size = s->dels = 0;
+    flat_free_old(s);
 }
 
-static void flat_rehash(FlatSet *s, size_t new_cap) {
-    FlatSet dst;
-    dst.cap = 0;
-    dst.size = dst.dels = 0;
-    dst.keys = NULL;
-    dst.ctrl = NULL;
-    flat_init(&dst, new_cap);
-
-    for (size_t i = 0; i < s->cap; ++i) {
-        if (s->ctrl[i] == CTRL_FULL) {
-            key128_t k = s->keys[i];
-            uint64_t h = hash16(&k);
-            size_t m = dst.cap - 1;
-            size_t j = (size_t)(h & m);
-            while (dst.ctrl[j] == CTRL_FULL) {
-                j = (j + 1) & m;
-            }
-            dst.keys[j] = k;
-            dst.ctrl[j] = CTRL_FULL;
-            dst.size++;
+/* Put a key known to be absent into the current table (no duplicate check). */
+static INLINE void flat_place(FlatSet *s, const key128_t *k) {
+    size_t m = s->cap - 1;
+    size_t j = (size_t)(hash16(k) & m);
+    while (s->ctrl[j] == CTRL_FULL) {
+        j = (j + 1) & m;
+    }
+    if (s->ctrl[j] == CTRL_DELETED) {
+        s->dels--;
+    }
+    s->keys[j] = *k;
+    s->ctrl[j] = CTRL_FULL;
+}
+
+/* Move up to 'nslots' slots of the old table into the current one.
+ * Migrated slots become tombstones, so probe chains in the old table
+ * stay intact for the keys that are still waiting there.
+ */
+static void flat_migrate(FlatSet *s, size_t nslots) {
+    if (s->old_cap == 0) return;
+#if BUCKET_STATS
+    uint64_t t0 = cur_stats ? ns_now_monotonic() : 0;
+#endif
+
+    size_t end = (nslots > s->old_cap - s->old_pos) ? s->old_cap : s->old_pos + nslots;
+    for (size_t i = s->old_pos; i < end; ++i) {
+        if (s->old_ctrl[i] == CTRL_FULL) {
+            flat_place(s, &s->old_keys[i]);
+            s->old_ctrl[i] = CTRL_DELETED;
         }
     }
-    free(s->keys);
-    free(s->ctrl);
-    *s = dst;
+    s->old_pos = end;
+    if (s->old_pos == s->old_cap) {
+        flat_free_old(s);
+    }
+    STATS(cur_stats->resize_ns += ns_now_monotonic() - t0);
 }
 
-bool flat_lookup(const FlatSet *s, const key128_t *k) {
-    if (s->cap == 0) return false;
-    uint64_t h = hash16(k);
-    size_t m = s->cap - 1, i = (size_t)(h & m);
-    for (;;) {
-        uint8_t c = s->ctrl[i];
+/* Capacity for a resize: 'size' keys fill at most MAX_TRUE / 2 of it, and
+ * it is at least 'min_cap'.
+ */
+static INLINE size_t flat_roomy_cap(size_t size, size_t min_cap) {
+    size_t need = (size_t)((double)size / (MAX_TRUE / 2)) + 1;
+    return need > min_cap ? need : min_cap;
+}
+
+/* Allocate a new table of (at least) new_cap slots and keep the current one
+ * as the old table; its keys are moved over by flat_migrate(), old_step
+ * slots per call. The step follows from the inserts the new table takes
+ * before it is MAX_OCCUPIED full: the old table is drained after half of
+ * them. No resize may be in progress (flat_rehash() completes it).
+ */
+static void flat_start_resize(FlatSet *s, size_t new_cap) {
+    assert(s->old_cap == 0);
+#if BUCKET_STATS
+    uint64_t t0 = cur_stats ? ns_now_monotonic() : 0;
+#endif
+
+    s->old_keys = s->keys;
+    s->old_ctrl = s->ctrl;
+    s->old_cap  = s->cap;
+    s->old_pos  = 0;
+    s->old_borrowed = s->borrowed;
+    s->borrowed = false;
+
+    s->cap  = next_pow2(new_cap ? new_cap : 1024);
+    s->dels = 0;
+    flat_alloc(s);
+
+    size_t room = (size_t)(MAX_OCCUPIED * (double)s->cap);
+    room = room > s->size + 2 ? (room - s->size) / 2 : 1;
+    s->old_step = (s->old_cap + room - 1) / room;
+    if (s->old_step < FLAT_MIGRATE_STEP) s->old_step = FLAT_MIGRATE_STEP;
+
+    if (s->size == 0) {
+        flat_free_old(s);
+    }
+    STATS(cur_stats->resizes++; cur_stats->resize_ns += ns_now_monotonic() - t0);
+}
+
+/* Synchronous rehash: start a resize and migrate everything at once. */
+static void flat_rehash(FlatSet *s, size_t new_cap) {
+    flat_migrate(s, SIZE_MAX);
+    flat_start_resize(s, new_cap);
+    flat_migrate(s, SIZE_MAX);
+}
+
+/* 'steps' is increased by the number of slots inspected. */
+static INLINE bool flat_probe(const key128_t *keys, const uint8_t *ctrl, size_t cap,
+                              uint64_t h, const key128_t *k, size_t *pos, size_t *steps) {
+    size_t m = cap - 1, i = (size_t)(h & m);
+    for (size_t n = 1;; ++n) {
+        uint8_t c = ctrl[i];
         if (c == CTRL_EMPTY) {
+            *steps += n;
             return false;
         }
-        if (c == CTRL_FULL && key128_equal(&s->keys[i], k)){
+        if (c == CTRL_FULL && key128_equal(&keys[i], k)){
+            *pos = i;
+            *steps += n;
             return TRUE;
         }
         i = (i + 1) & m;
     }
 }
 
+CPU_CLONES bool flat_lookup(const FlatSet *s, const key128_t *k) {
+    if (s->cap == 0) return false;
+    uint64_t h = hash16(k);
+    size_t pos, steps = 0;
+    bool found = flat_probe(s->keys, s->ctrl, s->cap, h, k, &pos, &steps)
+              || (s->old_cap && flat_probe(s->old_keys, s->old_ctrl, s->old_cap, h, k, &pos, &steps));
+    STATS_PROBE(lookup, steps);
+    return found;
+}
+
 
 static INLINE double flat_load(const FlatSet *s) {
     return (double)(s->size + s->dels) / (double)s->cap;
 }
 
 // --- New: separate real (true) load and occupied load (FULL + DELETED)
+// While resizing, 'size' also counts the keys still waiting in the old table,
+// so both loads describe the current table once the migration is done.
 static INLINE double true_load(const FlatSet *s) {
     return s->cap ? (double)s->size / (double)s->cap : 0.0;
 }
@@ -132,10 +292,9 @@ static void flat_maybe_shrink(FlatSet *s)
     const size_t MIN_CAP  = 16;
 
     if (s->cap > MIN_CAP && true_load(s) < MIN_TRUE) {
-        size_t target = (size_t)((double)s->size / MAX_TRUE) + 1;
-        if (target < MIN_CAP) target = MIN_CAP;
-        if (target < s->cap) {
-            flat_rehash(s, target); // aligns to next_pow2
+        size_t target = flat_roomy_cap(s->size, MIN_CAP);
+        if (next_pow2(target) < s->cap) {
+            flat_start_resize(s, target); // aligns to next_pow2
         }
     }
 }
@@ -143,52 +302,66 @@ static void flat_maybe_shrink(FlatSet *s)
 bool flat_remove(FlatSet *s, const key128_t *k) {
     if (s->cap == 0) return false;
 
-    uint64_t h = hash16(k);
-    size_t m = s->cap - 1;
-    size_t i = (size_t)(h & m);
+    flat_migrate(s, s->old_step);
 
-    for (;;) {
-        uint8_t c = s->ctrl[i];
-        if (c == CTRL_EMPTY){
-            return false;
-        }
-        if (c == CTRL_FULL && key128_equal(&s->keys[i], k)) {
-            s->ctrl[i] = CTRL_DELETED;
-            s->size--;
-            s->dels++;
-            if (s->dels > s->size && s->dels > s->cap / 8) {
-                flat_rehash(s, s->cap);
-            } else {
-                // possible shrink with hysteresis (only if true load is low)
-                flat_maybe_shrink(s);
-            }
+    uint64_t h = hash16(k);
+    size_t i, steps = 0;
+
+    if (flat_probe(s->keys, s->ctrl, s->cap, h, k, &i, &steps)) {
+        STATS_PROBE(lookup, steps);
+        s->ctrl[i] = CTRL_DELETED;
+        s->size--;
+        s->dels++;
+    } else if (s->old_cap && flat_probe(s->old_keys, s->old_ctrl, s->old_cap, h, k, &i, &steps)) {
+        STATS_PROBE(lookup, steps);
+        // tombstones of the old table are dropped with it, no need to count them
+        s->old_ctrl[i] = CTRL_DELETED;
+        s->size--;
+        return TRUE;
+    } else {
+        STATS_PROBE(lookup, steps);
+        return false;
+    }
 
-            return TRUE;
+    if (s->old_cap == 0) {
+        if (s->dels > s->size && s->dels > s->cap / 8) {
+            flat_start_resize(s, flat_roomy_cap(s->size, s->cap));
+        } else {
+            // possible shrink with hysteresis (only if true load is low)
+            flat_maybe_shrink(s);
         }
-        i = (i + 1) & m;
     }
+    return TRUE;
 }
 
-bool flat_insert(FlatSet *s, const key128_t *k) {
-    if (s->cap == 0) flat_init(s, 1024);
+CPU_CLONES bool flat_insert(FlatSet *s, const key128_t *k) {
+    if (s->cap == 0) flat_setup(s, 1024);
+
+    flat_migrate(s, s->old_step);
 
     if (occupied_load(s) > MAX_OCCUPIED) {
-        if (true_load(s) <= MAX_TRUE) {
+        // the old table is empty by now, see flat_start_resize()
+        if (true_load(s) <= MAX_TRUE / 2) {
             // lots of tombstones -> compact
-            flat_rehash(s, s->cap);
+            flat_start_resize(s, s->cap);
         } else {
-            // tight -> grow
-            size_t need = (size_t)((double)(s->size + 1) / MAX_TRUE) + 1;
-            flat_rehash(s, need);  // next_pow2 will get the right size
+            // tight -> grow; the table was at most MAX_OCCUPIED full
+            flat_start_resize(s, 2 * s->cap);
         }
     }
 
     uint64_t h = hash16(k);
     size_t m = s->cap - 1, i = (size_t)(h & m), first_del = (size_t)(-1);
-    for (;;) {
+    for (size_t steps = 1;; ++steps) {
         uint8_t c = s->ctrl[i];
         if (c == CTRL_EMPTY) {
-            size_t pos = (first_del != (size_t)(-1)) ? first_del : i;
+            size_t pos;
+            bool old = s->old_cap && flat_probe(s->old_keys, s->old_ctrl, s->old_cap, h, k, &pos, &steps);
+            STATS_PROBE(insert, steps);
+            if (old) {
+                return false;
+            }
+            pos = (first_del != (size_t)(-1)) ? first_del : i;
             s->keys[pos] = *k;
             s->ctrl[pos] = CTRL_FULL;
             s->size++;
@@ -203,6 +376,7 @@ bool flat_insert(FlatSet *s, const key128_t *k) {
             }
         } else {
             if (key128_equal(&s->keys[i], k)) {
+                STATS_PROBE(insert, steps);
                 return false;
             }
         }
@@ -220,7 +394,7 @@ static void flat_reserve(FlatSet *s, size_t n_expected, double max_true) {
 
     if (s->cap < need) {
         flat_rehash(s, need);  // will round up to the nearest power of two
-    } else if (s->dels > 0) {
+    } else if (s->dels > 0 || s->old_cap) {
         // It's worth compacting tombstones if we already have capacity
         flat_rehash(s, s->cap);
     }
@@ -238,8 +412,51 @@ struct _GHashBucket {
     destroy_func_t key_destroy_func;
 
     FlatSet   *flat;
+
+    /* snapshot mapping the shards were restored from (NULL if none) */
+    void      *map;
+    size_t     map_len;
+
+    /* shared-memory backend: all operations go to this set instead */
+    ShmSet    *shm;
+
+#if BUCKET_STATS
+    ShardStats *stats;
+#endif
 };
 
+#if BUCKET_STATS
+
+/* Contended acquisitions are timed; cur_stats is set while the lock is held. */
+static INLINE void shard_lock(GHashBucket *b, size_t idx)
+{
+#if NAUTY_HAS_TLS
+    if (!omp_test_lock(&b->locks[idx])) {
+        uint64_t t0 = ns_now_monotonic();
+        omp_set_lock(&b->locks[idx]);
+        b->stats[idx].lock_waits++;
+        b->stats[idx].lock_wait_ns += ns_now_monotonic() - t0;
+    }
+#endif
+    cur_stats = &b->stats[idx];
+}
+
+static INLINE void shard_unlock(GHashBucket *b, size_t idx)
+{
+    cur_stats = NULL;
+    MUTEX_UNLOCK(&b->locks[idx]);
+}
+
+#   define SHARD_LOCK(b, idx)   shard_lock(b, idx)
+#   define SHARD_UNLOCK(b, idx) shard_unlock(b, idx)
+
+#else
+
+#   define SHARD_LOCK(b, idx)   MUTEX_LOCK(&(b)->locks[idx])
+#   define SHARD_UNLOCK(b, idx) MUTEX_UNLOCK(&(b)->locks[idx])
+
+#endif
+
 static INLINE size_t shard_index_flat(const GHashBucket *b, const key128_t *k) {
     return (size_t)(hash16(k) % (uint64_t)b->nshards);
 }
@@ -259,43 +476,75 @@ GHashBucket* g_bucket_new_128(
     for (size_t i = 0; i < bucket->nshards; ++i) omp_init_lock(&bucket->locks[i]);
 
     bucket->flat = (FlatSet*)calloc(bucket->nshards, sizeof(FlatSet));
+    for (size_t i = 0; i < bucket->nshards; ++i) bucket->flat[i].node = mem_shard_node(i);
+    bucket->map = NULL;
+    bucket->map_len = 0;
+    bucket->shm = NULL;
+#if BUCKET_STATS
+    bucket->stats = (ShardStats*)calloc(bucket->nshards, sizeof(ShardStats));
+#endif
 
     return bucket;
 }
 
+GHashBucket* g_bucket_new_shm(const char *name, size_t capacity)
+{
+    ShmSet *shm = shm_set_open(name, capacity);
+    if (!shm) return NULL;
+    GHashBucket *b = g_bucket_new_128(NULL, 1);
+    b->shm = shm;
+    return b;
+}
+
+bool g_bucket_is_shared(GHashBucket *b) {
+    return b && b->shm;
+}
+
 void g_bucket_destroy(GHashBucket *b)
 {
     if (!b) return;
+    shm_set_close(b->shm);
     for (size_t i = 0; i < b->nshards; ++i) flat_free(&b->flat[i]);
     free(b->flat);
     for (size_t i = 0; i < b->nshards; ++i) omp_destroy_lock(&b->locks[i]);
     free(b->locks);
+    if (b->map) munmap(b->map, b->map_len);
+#if BUCKET_STATS
+    free(b->stats);
+#endif
     free(b);
 }
 
 size_t g_bucket_size(GHashBucket *b) {
+    if (b && b->shm) return shm_set_size(b->shm);
     return b ? ATOMIC_GET(b->number_of_elements) : 0;
 }
 
+size_t g_bucket_shards(GHashBucket *b) {
+    return b ? b->nshards : 0;
+}
+
 void *g_bucket_lookup(GHashBucket* b, const key128_t* k)
 {
     if (!b) return NULL;
+    if (b->shm) return shm_set_lookup(b->shm, k) ? GINT_TO_POINTER(TRUE) : NULL;
     size_t idx = shard_index_flat(b, k);
-    MUTEX_LOCK(&b->locks[idx]);
+    SHARD_LOCK(b, idx);
     bool ok = flat_lookup(&b->flat[idx], k);
-    MUTEX_UNLOCK(&b->locks[idx]);
+    SHARD_UNLOCK(b, idx);
     return ok ? GINT_TO_POINTER(TRUE) : NULL;
 }
 
 bool g_bucket_remove(GHashBucket* b, const key128_t* k)
 {
     if (!b) return false;
+    if (b->shm) return shm_set_remove(b->shm, k);
     bool res = false;
 
     size_t idx = shard_index_flat(b, k);
-    MUTEX_LOCK(&b->locks[idx]);
+    SHARD_LOCK(b, idx);
     res = flat_remove(&b->flat[idx], k);
-    MUTEX_UNLOCK(&b->locks[idx]);
+    SHARD_UNLOCK(b, idx);
     if (res) {
         ATOMIC_DEC(b->number_of_elements);
     }
@@ -306,12 +555,13 @@ bool g_bucket_remove(GHashBucket* b, const key128_t* k)
 bool g_bucket_insert(GHashBucket *b, const key128_t* kptr, void *value)
 {
     (void)value; if (!b) return false;
+    if (b->shm) return shm_set_insert(b->shm, kptr);
 
     size_t idx = shard_index_flat(b, kptr);
-    MUTEX_LOCK(&b->locks[idx]);
+    SHARD_LOCK(b, idx);
 
     bool ins = flat_insert(&b->flat[idx], kptr);
-    MUTEX_UNLOCK(&b->locks[idx]);
+    SHARD_UNLOCK(b, idx);
     /* We copied bytes; respect caller ownership per contract. */
 
     if (ins) {
@@ -323,12 +573,13 @@ bool g_bucket_insert(GHashBucket *b, const key128_t* kptr, void *value)
 bool g_bucket_insert_copy128(GHashBucket *b, const key128_t *key)
 {
     if (!b) return false;
+    if (b->shm) return shm_set_insert(b->shm, key);
 
     size_t idx = shard_index_flat(b, key);
-    MUTEX_LOCK(&b->locks[idx]);
-    if (b->flat[idx].cap == 0) flat_init(&b->flat[idx], 1024);
+    SHARD_LOCK(b, idx);
+    if (b->flat[idx].cap == 0) flat_setup(&b->flat[idx], 1024);
     bool ins = flat_insert(&b->flat[idx], key);
-    MUTEX_UNLOCK(&b->locks[idx]);
+    SHARD_UNLOCK(b, idx);
     if (ins) ATOMIC_INC(b->number_of_elements);
     return ins;
 }
@@ -336,6 +587,10 @@ bool g_bucket_insert_copy128(GHashBucket *b, const key128_t *key)
 void g_bucket_foreach128(GHashBucket *b, GKey128ForeachFunc func, void *user_data)
 {
     if (!b || !func) return;
+    if (b->shm) {
+        shm_set_foreach(b->shm, func, user_data);
+        return;
+    }
 
     for (size_t s = 0; s < b->nshards; ++s) {
         MUTEX_LOCK(&b->locks[s]);
@@ -343,6 +598,9 @@ void g_bucket_foreach128(GHashBucket *b, GKey128ForeachFunc func, void *user_dat
         for (size_t i = 0; i < fs->cap; ++i) {
             if (fs->ctrl[i] == CTRL_FULL) func(&fs->keys[i], user_data);
         }
+        for (size_t i = fs->old_pos; i < fs->old_cap; ++i) {
+            if (fs->old_ctrl[i] == CTRL_FULL) func(&fs->old_keys[i], user_data);
+        }
         MUTEX_UNLOCK(&b->locks[s]);
     }
 }
@@ -353,7 +611,7 @@ bool g_bucket_is_flat128(GHashBucket* b) { return b!=NULL; }
 // NOTE: call this before concurrent use. No locking inside.
 void g_bucket_reserve(GHashBucket *b, uint64_t total_expected)
 {
-    if (!b || total_expected == 0) return;
+    if (!b || b->shm || total_expected == 0) return;
 
     const double SKEW     = 1.15;
 
@@ -365,3 +623,386 @@ void g_bucket_reserve(GHashBucket *b, uint64_t total_expected)
         flat_reserve(&b->flat[i], per_shard_expected, MAX_TRUE);
     }
 }
+
+/* ---- Statistics ---- */
+
+typedef struct {
+    size_t   cap, size, dels;
+    uint64_t bytes;
+#if BUCKET_STATS
+    ShardStats st;
+#endif
+} ShardInfo;
+
+typedef struct {
+    size_t   size_min, size_max;
+    double   size_mean, size_cv;
+    uint64_t bytes, dels;
+#if BUCKET_STATS
+    ShardStats total;
+    uint64_t   lock_wait_max;
+#endif
+} BucketSummary;
+
+static void shard_info(GHashBucket *b, size_t s, ShardInfo *info)
+{
+    if (b->shm) {
+        memset(info, 0, sizeof(*info));
+        info->cap   = shm_set_capacity(b->shm);
+        info->size  = shm_set_size(b->shm);
+        info->dels  = shm_set_tombstones(b->shm);
+        info->bytes = (uint64_t)info->cap * (sizeof(key128_t) + 1);
+        return;
+    }
+    MUTEX_LOCK(&b->locks[s]);
+    const FlatSet *fs = &b->flat[s];
+    info->cap   = fs->cap;
+    info->size  = fs->size;
+    info->dels  = fs->dels;
+    info->bytes = (uint64_t)(fs->cap + fs->old_cap) * (sizeof(key128_t) + 1);
+#if BUCKET_STATS
+    info->st = b->stats[s];
+#endif
+    MUTEX_UNLOCK(&b->locks[s]);
+}
+
+/* Collects all shards; 'info' (nshards entries) may be NULL. */
+static void bucket_summary(GHashBucket *b, BucketSummary *sum, ShardInfo *info)
+{
+    double s1 = 0.0, s2 = 0.0;
+
+    memset(sum, 0, sizeof(*sum));
+    sum->size_min = SIZE_MAX;
+    for (size_t s = 0; s < b->nshards; ++s) {
+        ShardInfo tmp, *in = info ? &info[s] : &tmp;
+        shard_info(b, s, in);
+        if (in->size < sum->size_min) sum->size_min = in->size;
+        if (in->size > sum->size_max) sum->size_max = in->size;
+        s1 += (double)in->size;
+        s2 += (double)in->size * (double)in->size;
+        sum->bytes += in->bytes;
+        sum->dels  += in->dels;
+#if BUCKET_STATS
+        ShardStats *t = &sum->total;
+        for (int k = 0; k < PROBE_HIST; ++k) {
+            t->insert_hist[k] += in->st.insert_hist[k];
+            t->lookup_hist[k] += in->st.lookup_hist[k];
+        }
+        t->inserts       += in->st.inserts;
+        t->insert_probes += in->st.insert_probes;
+        t->lookups       += in->st.lookups;
+        t->lookup_probes += in->st.lookup_probes;
+        t->resizes       += in->st.resizes;
+        t->resize_ns     += in->st.resize_ns;
+        t->lock_waits    += in->st.lock_waits;
+        t->lock_wait_ns  += in->st.lock_wait_ns;
+        if (in->st.lock_wait_ns > sum->lock_wait_max) sum->lock_wait_max = in->st.lock_wait_ns;
+#endif
+    }
+    sum->size_mean = s1 / (double)b->nshards;
+    double var = s2 / (double)b->nshards - sum->size_mean * sum->size_mean;
+    sum->size_cv = sum->size_mean > 0.0 ? sqrt(var > 0.0 ? var : 0.0) / sum->size_mean : 0.0;
+}
+
+static INLINE double ratio(double a, double b) {
+    return b > 0.0 ? a / b : 0.0;
+}
+
+#if BUCKET_STATS
+/* Upper bound of the probe length below which 'q' of the operations fall. */
+static unsigned long hist_quantile(const uint64_t *hist, uint64_t total, double q)
+{
+    uint64_t acc = 0;
+    for (int k = 0; k < PROBE_HIST; ++k) {
+        acc += hist[k];
+        if ((double)acc >= q * (double)total) return (2ul << k) - 1;
+    }
+    return (2ul << (PROBE_HIST - 1)) - 1;
+}
+
+static void json_hist(FILE *f, const char *key, const uint64_t *hist)
+{
+    fprintf(f, "\"%s\": [", key);
+    for (int k = 0; k < PROBE_HIST; ++k) {
+        fprintf(f, "%s%lu", k ? ", " : "", (unsigned long)hist[k]);
+    }
+    fprintf(f, "]");
+}
+#endif
+
+void g_bucket_stats_log(GHashBucket *b, unsigned int v, const char *name)
+{
+    if (!b) return;
+    BucketSummary sum;
+    bucket_summary(b, &sum, NULL);
+
+    printlog(v, "%s: %zu keys in %zu shards, %.1f MiB, %lu tombstones; shard size min/mean/max %zu/%.0f/%zu, cv %.3f",
+             name, g_bucket_size(b), b->nshards, sum.bytes / 1048576.0, (unsigned long)sum.dels,
+             sum.size_min, sum.size_mean, sum.size_max, sum.size_cv);
+#if BUCKET_STATS
+    const ShardStats *t = &sum.total;
+    printlog(v, "%s: probes insert mean %.2f p99 <= %lu, lookup mean %.2f p99 <= %lu; %lu resizes (%.3fs)",
+             name, ratio(t->insert_probes, t->inserts), hist_quantile(t->insert_hist, t->inserts, 0.99),
+             ratio(t->lookup_probes, t->lookups), hist_quantile(t->lookup_hist, t->lookups, 0.99),
+             (unsigned long)t->resizes, t->resize_ns / 1e9);
+    printlog(v, "%s: %lu lock waits (%.3fs), slowest shard waited %.2fx the mean",
+             name, (unsigned long)t->lock_waits, t->lock_wait_ns / 1e9,
+             ratio((double)sum.lock_wait_max * b->nshards, t->lock_wait_ns));
+#endif
+}
+
+bool g_bucket_stats_json(GHashBucket *b, const char *path, const char *name)
+{
+    if (!b) return false;
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        fprintf(stderr, "Cannot write statistics '%s': %s\n", path, strerror(errno));
+        return false;
+    }
+    ShardInfo *info = (ShardInfo*)calloc(b->nshards, sizeof(ShardInfo));
+    BucketSummary sum;
+    bucket_summary(b, &sum, info);
+
+    fprintf(f, "{\"name\": \"%s\", \"shards\": %zu, \"elements\": %zu, \"bytes\": %lu, \"tombstones\": %lu,\n",
+            name, b->nshards, g_bucket_size(b), (unsigned long)sum.bytes, (unsigned long)sum.dels);
+    fprintf(f, " \"size_min\": %zu, \"size_mean\": %.2f, \"size_max\": %zu, \"size_cv\": %.4f, \"size_skew\": %.4f,\n",
+            sum.size_min, sum.size_mean, sum.size_max, sum.size_cv, ratio(sum.size_max, sum.size_mean));
+#if BUCKET_STATS
+    const ShardStats *t = &sum.total;
+    fprintf(f, " \"stats\": true, \"inserts\": %lu, \"insert_probes\": %lu, \"lookups\": %lu, \"lookup_probes\": %lu,\n ",
+            (unsigned long)t->inserts, (unsigned long)t->insert_probes, (unsigned long)t->lookups, (unsigned long)t->lookup_probes);
+    json_hist(f, "insert_hist", t->insert_hist);
+    fprintf(f, ", ");
+    json_hist(f, "lookup_hist", t->lookup_hist);
+    fprintf(f, ",\n \"resizes\": %lu, \"resize_ns\": %lu, \"lock_waits\": %lu, \"lock_wait_ns\": %lu, \"lock_wait_skew\": %.4f,\n",
+            (unsigned long)t->resizes, (unsigned long)t->resize_ns, (unsigned long)t->lock_waits,
+            (unsigned long)t->lock_wait_ns, ratio((double)sum.lock_wait_max * b->nshards, t->lock_wait_ns));
+#else
+    fprintf(f, " \"stats\": false,\n");
+#endif
+    fprintf(f, " \"per_shard\": [\n");
+    for (size_t s = 0; s < b->nshards; ++s) {
+        const ShardInfo *in = &info[s];
+        fprintf(f, "  {\"cap\": %zu, \"size\": %zu, \"tombstones\": %zu, \"bytes\": %lu",
+                in->cap, in->size, in->dels, (unsigned long)in->bytes);
+#if BUCKET_STATS
+        fprintf(f, ", \"resizes\": %lu, \"resize_ns\": %lu, \"lock_waits\": %lu, \"lock_wait_ns\": %lu, ",
+                (unsigned long)in->st.resizes, (unsigned long)in->st.resize_ns,
+                (unsigned long)in->st.lock_waits, (unsigned long)in->st.lock_wait_ns);
+        json_hist(f, "insert_hist", in->st.insert_hist);
+        fprintf(f, ", ");
+        json_hist(f, "lookup_hist", in->st.lookup_hist);
+#endif
+        fprintf(f, "}%s\n", s + 1 < b->nshards ? "," : "");
+    }
+    fprintf(f, " ]}\n");
+    free(info);
+    return fclose(f) == 0;
+}
+
+/* ---- Snapshots ---- */
+
+#define SNAPSHOT_MAGIC   "GBKTSNAP"
+#define SNAPSHOT_VERSION 1u
+#define SNAPSHOT_ALIGN   4096u
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t key_size;      /* sizeof(key128_t) */
+    uint64_t nshards;
+    uint64_t nelements;
+    uint64_t meta[G_BUCKET_SNAPSHOT_META];
+    uint64_t file_size;
+    uint64_t checksum;      /* header (with checksum = 0) and shard table */
+} SnapshotHeader;
+
+typedef struct {
+    uint64_t cap;
+    uint64_t size;
+    uint64_t dels;
+    uint64_t offset;        /* keys, followed by cap control bytes */
+    uint64_t checksum;      /* keys and control bytes */
+} SnapshotShard;
+
+static INLINE uint64_t snapshot_align(uint64_t x) {
+    return (x + SNAPSHOT_ALIGN - 1) & ~(uint64_t)(SNAPSHOT_ALIGN - 1);
+}
+
+static uint64_t snapshot_checksum(const SnapshotHeader *h, const SnapshotShard *table)
+{
+    SnapshotHeader tmp = *h;
+    tmp.checksum = 0;
+    return XXH3_64bits_withSeed(table, h->nshards * sizeof(SnapshotShard),
+                                XXH3_64bits(&tmp, sizeof(tmp)));
+}
+
+static bool pwrite_all(int fd, const void *buf, size_t bytes, uint64_t off)
+{
+    const char *p = (const char*)buf;
+    while (bytes > 0) {
+        ssize_t w = pwrite(fd, p, bytes, (off_t)off);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p += w; off += (uint64_t)w; bytes -= (size_t)w;
+    }
+    return TRUE;
+}
+
+bool g_bucket_save(GHashBucket *b, const char *path, const uint64_t *meta)
+{
+    if (!b || !path) return false;
+    if (b->shm) {
+        fprintf(stderr, "Cannot write snapshot '%s': the set lives in shared memory\n", path);
+        return false;
+    }
+
+    size_t plen = strlen(path);
+    char *tmp_path = (char*)malloc(plen + 5);
+    memcpy(tmp_path, path, plen);
+    memcpy(tmp_path + plen, ".tmp", 5);
+
+    SnapshotHeader h;
+    SnapshotShard *table = (SnapshotShard*)calloc(b->nshards, sizeof(SnapshotShard));
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SNAPSHOT_MAGIC, 8);
+    h.version  = SNAPSHOT_VERSION;
+    h.key_size = (uint32_t)sizeof(key128_t);
+    h.nshards  = b->nshards;
+    if (meta) memcpy(h.meta, meta, sizeof(h.meta));
+
+    for (size_t s = 0; s < b->nshards; ++s) MUTEX_LOCK(&b->locks[s]);
+
+    /* layout: header and shard table, then page aligned slot arrays */
+    uint64_t off = snapshot_align(sizeof(h) + b->nshards * sizeof(SnapshotShard));
+    for (size_t s = 0; s < b->nshards; ++s) {
+        FlatSet *fs = &b->flat[s];
+        flat_migrate(fs, SIZE_MAX);
+        h.nelements += fs->size;
+        table[s].cap  = fs->cap;
+        table[s].size = fs->size;
+        table[s].dels = fs->dels;
+        if (fs->cap) {
+            table[s].offset   = off;
+            table[s].checksum = XXH3_64bits_withSeed(fs->keys, fs->cap * sizeof(key128_t),
+                                                     XXH3_64bits(fs->ctrl, fs->cap));
+            off = snapshot_align(off + fs->cap * (sizeof(key128_t) + 1));
+        }
+    }
+    h.file_size = off;
+    h.checksum  = snapshot_checksum(&h, table);
+
+    bool ok = false;
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+        ok = ftruncate(fd, (off_t)h.file_size) == 0
+          && pwrite_all(fd, &h, sizeof(h), 0)
+          && pwrite_all(fd, table, b->nshards * sizeof(SnapshotShard), sizeof(h));
+        for (size_t s = 0; ok && s < b->nshards; ++s) {
+            FlatSet *fs = &b->flat[s];
+            if (fs->cap == 0) continue;
+            ok = pwrite_all(fd, fs->keys, fs->cap * sizeof(key128_t), table[s].offset)
+              && pwrite_all(fd, fs->ctrl, fs->cap, table[s].offset + fs->cap * sizeof(key128_t));
+        }
+    }
+
+    for (size_t s = 0; s < b->nshards; ++s) MUTEX_UNLOCK(&b->locks[s]);
+
+    ok = ok && fsync(fd) == 0;
+    if (fd >= 0 && close(fd) != 0) ok = false;
+    ok = ok && rename(tmp_path, path) == 0;
+    if (!ok) {
+        fprintf(stderr, "Cannot write snapshot '%s': %s\n", path, strerror(errno));
+        unlink(tmp_path);
+    }
+
+    free(table);
+    free(tmp_path);
+    return ok;
+}
+
+GHashBucket* g_bucket_load(const char *path, destroy_func_t key_destroy_func, bool verify, uint64_t *meta)
+{
+    SnapshotHeader h;
+    SnapshotShard *table = NULL;
+    struct stat st;
+    const char *err = NULL;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot open snapshot '%s': %s\n", path, strerror(errno));
+        return NULL;
+    }
+    if (pread(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h) || memcmp(h.magic, SNAPSHOT_MAGIC, 8) != 0) {
+        err = "not a bucket snapshot";
+    } else if (h.version != SNAPSHOT_VERSION || h.key_size != sizeof(key128_t)) {
+        err = "unsupported snapshot version";
+    } else if (fstat(fd, &st) != 0 || (uint64_t)st.st_size != h.file_size || h.nshards == 0
+               || h.nshards > h.file_size / sizeof(SnapshotShard)) {
+        err = "truncated snapshot";
+    } else {
+        size_t tlen = h.nshards * sizeof(SnapshotShard);
+        table = (SnapshotShard*)malloc(tlen);
+        if (pread(fd, table, tlen, sizeof(h)) != (ssize_t)tlen || snapshot_checksum(&h, table) != h.checksum) {
+            err = "corrupted snapshot header";
+        }
+    }
+    for (size_t s = 0; !err && s < h.nshards; ++s) {
+        uint64_t cap = table[s].cap;
+        if ((cap & (cap - 1)) != 0 || table[s].size + table[s].dels > cap
+            || (cap && (table[s].offset > h.file_size
+                        || cap * (sizeof(key128_t) + 1) > h.file_size - table[s].offset))) {
+            err = "corrupted shard table";
+        }
+    }
+
+    void *map = MAP_FAILED;
+    if (!err) {
+        /* private and writable: lazily faulted, copied on first write */
+        map = mmap(NULL, h.file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            err = strerror(errno);
+        } else {
+            /* hash lookups touch random pages, read-ahead would only waste I/O */
+            madvise(map, h.file_size, MADV_RANDOM);
+        }
+    }
+    close(fd);
+
+    for (size_t s = 0; !err && verify && s < h.nshards; ++s) {
+        if (table[s].cap == 0) continue;
+        const char *keys = (const char*)map + table[s].offset;
+        const char *ctrl = keys + table[s].cap * sizeof(key128_t);
+        if (XXH3_64bits_withSeed(keys, table[s].cap * sizeof(key128_t), XXH3_64bits(ctrl, table[s].cap)) != table[s].checksum) {
+            err = "checksum mismatch in slot arrays";
+        }
+    }
+
+    if (err) {
+        fprintf(stderr, "Cannot load snapshot '%s': %s\n", path, err);
+        if (map != MAP_FAILED) munmap(map, h.file_size);
+        free(table);
+        return NULL;
+    }
+
+    GHashBucket *b = g_bucket_new_128(key_destroy_func, h.nshards);
+    for (size_t s = 0; s < h.nshards; ++s) {
+        FlatSet *fs = &b->flat[s];
+        if (table[s].cap == 0) continue;
+        fs->keys = (key128_t*)((char*)map + table[s].offset);
+        fs->ctrl = (uint8_t*)(fs->keys + table[s].cap);
+        fs->cap  = table[s].cap;
+        fs->size = table[s].size;
+        fs->dels = table[s].dels;
+        fs->borrowed = TRUE;
+    }
+    b->number_of_elements = h.nelements;
+    b->map = map;
+    b->map_len = h.file_size;
+    if (meta) memcpy(meta, h.meta, sizeof(h.meta));
+
+    free(table);
+    return b;
+}
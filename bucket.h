@@ -13,8 +13,24 @@ typedef struct {
     key128_t *keys;   /* inline keys */
     uint8_t  *ctrl;   /* 0=empty, 1=full, 2=deleted */
     size_t    cap;    /* power of two */
-    size_t    size;   /* # FULL slots */
+    size_t    size;   /* # FULL slots (in both tables while resizing) */
     size_t    dels;   /* # tombstones */
+
+    /* Incremental resizing: after a resize the previous table stays alive
+     * and is drained old_step slots per insert/remove (see FLAT_MIGRATE_STEP).
+     * old_cap == 0 means no resize is in progress.
+     */
+    key128_t *old_keys;
+    uint8_t  *old_ctrl;
+    size_t    old_cap;
+    size_t    old_pos;  /* next slot of the old table to migrate */
+    size_t    old_step;
+
+    /* The table (or the old one) lives in a snapshot mapping, not on the heap. */
+    bool      borrowed;
+    bool      old_borrowed;
+
+    int       node;     /* preferred NUMA node of the tables, -1 = none */
 } FlatSet;
 
 void flat_init(FlatSet *s, size_t cap_hint);
@@ -44,6 +60,16 @@ GHashBucket* g_bucket_new_128(
     size_t         shards
 );
 
+/* Bucket kept in the POSIX shared-memory segment 'name' (see shmset.h) and
+ * shared with every process on the host that opens the same name; created
+ * with room for 'capacity' keys if it does not exist yet. It is one lock-free
+ * table, so the shard count is 1, and it cannot be saved as a snapshot.
+ * Returns NULL with a message on stderr on failure.
+ */
+GHashBucket* g_bucket_new_shm(const char *name, size_t capacity);
+
+bool g_bucket_is_shared(GHashBucket *b);
+
 /* Destroy the whole bucket and free internal storage. */
 void    g_bucket_destroy (GHashBucket *b);
 
@@ -68,6 +94,8 @@ void *g_bucket_lookup (GHashBucket *b, const key128_t* key);
 /* Number of elements (sum over shards). */
 size_t    g_bucket_size   (GHashBucket *b);
 
+size_t    g_bucket_shards (GHashBucket *b);
+
 /* Iterate all keys (16-byte) — only meaningful for FLAT128 mode.
  * 'func' is called with the address of each inline key.
  * Safe under concurrent use because we lock shards internally for iteration.
@@ -75,6 +103,36 @@ size_t    g_bucket_size   (GHashBucket *b);
 typedef void (*GKey128ForeachFunc)(const key128_t *key, void *user_data);
 void     g_bucket_foreach128 (GHashBucket *b, GKey128ForeachFunc func, void *user_data);
 
+/* Statistics.
+ * Element counts, memory, tombstones and the skew between shards are always
+ * reported; probe-length histograms (log2 buckets), resizes and the time spent
+ * waiting on shard locks only when built with --enable-bucket-stats.
+ * g_bucket_stats_log() prints a short summary with printlog(v, ...),
+ * g_bucket_stats_json() writes all of it, per shard, as one JSON object to
+ * 'path' (returns false with a message on stderr if that fails).
+ */
+void g_bucket_stats_log (GHashBucket *b, unsigned int v, const char *name);
+bool g_bucket_stats_json(GHashBucket *b, const char *path, const char *name);
+
+/* Snapshots.
+ * g_bucket_save() writes the shard count, the capacities and the raw slot
+ * arrays of every shard (page aligned, native byte order) together with XXH3
+ * checksums. The file is written under a temporary name and renamed, so an
+ * existing snapshot is replaced atomically. All shards are locked meanwhile.
+ * 'meta' (may be NULL) stores G_BUCKET_SNAPSHOT_META caller-defined values,
+ * e.g. how much input was consumed.
+ *
+ * g_bucket_load() maps the file privately: pages are faulted in lazily on
+ * first access and copied on first write, so restoring takes about as long
+ * as reading the header and the file itself is never modified. Slot checksums
+ * are checked only with 'verify' (this reads the whole file). Returns NULL
+ * with a message on stderr if the file is missing, damaged or incompatible.
+ */
+#define G_BUCKET_SNAPSHOT_META 4
+
+bool         g_bucket_save(GHashBucket *b, const char *path, const uint64_t *meta);
+GHashBucket* g_bucket_load(const char *path, destroy_func_t key_destroy_func, bool verify, uint64_t *meta);
+
 /* Hash & equal for 16-byte keys. */
 static INLINE unsigned int key128_hash(const unsigned char *p) {
     return (unsigned int)XXH3_64bits(p, 16);
@@ -96,6 +154,14 @@ static INLINE bool key128_lt(const key128_t* a, const key128_t* b) {
 #endif
 }
 
+static INLINE int key128_cmp(const key128_t* a, const key128_t* b) {
+#if HAVE_UINT128
+    return (a->u > b->u) - (a->u < b->u);
+#else
+    return memcmp(a, b, 16);
+#endif
+}
+
 /* Mode probe (optional; handy for assertions in debugging). */
 bool g_bucket_is_flat128 (GHashBucket *b);
 
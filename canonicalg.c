@@ -1,30 +1,59 @@
 #include "dag.h"
+#include "batchpipe.h"
+#include "keystream.h"
+#include "tlsbuf.h"
 
 /*
- * This program reads a digraph6 code from stdin, one per line, and prints
- * the canonical digraph6 code to stdout.
+ * This program reads digraph6 codes (or a key stream) from stdin, one graph
+ * per line, and prints the canonical digraph6 codes (or keys, with -B) to
+ * stdout.
  */
 
-int main(void) {
+int main(int argc, char *argv[]) {
 
     int n;
-    char line[MAXLINE]; // Buffer for reading input lines
-    char d6[MAXLINE];
+    key128_t k, can;
+    bool binary = false;
+    KeyStream in;
 
-    if (fgets(line, sizeof(line), stdin) == NULL) {
+    int opt;
+    while ((opt = getopt(argc, argv, "B")) != -1) {
+        if (opt != 'B') {
+            fprintf(stderr, "Usage: %s [-B] < input > output\n  -B  write a binary key stream\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        binary = true;
+    }
+    if (!keystream_open(&in, stdin)) {
+        exit(EXIT_FAILURE);
+    }
+
+    if (!keystream_next(&in, &k)) {
         return 0;
     }
-    n = graphsize(line);
+    n = (int)d6pack_get_n(&k);
     if (n==0) {
         return 1;
     }
     init_nauty_data(n);
-    printf("%s\n", d6_to_d6_canon(line, d6));
-    // Loop through each line of standard input
-    while (fgets(line, sizeof(line), stdin)) {
-        printf("%s\n", d6_to_d6_canon(line, d6)); 
+    if (binary) {
+        keystream_write_header(stdout, (unsigned)n, KEYSTREAM_CANONICAL);
     }
+    // Loop through each graph of standard input, read ahead in batches
+    BatchPipe *pipe = batchpipe_open(&in, &k, 0, 0);
+    OutRing *ring = outring_open(stdout, 0, 0);
+    OutputBuffer out;
+    buffer_init(&out, ring);
 
+    for (KeyBatch *b; (b = batchpipe_next(pipe)) != NULL; batchpipe_release(pipe, b)) {
+        for (size_t j = 0; j < b->count; ++j) {
+            buffer_add_key(&out, key128_to_key128_canon(&b->keys[j], &can), binary);
+        }
+    }
+    buffer_destroy(&out);
+    outring_close(ring);
+    batchpipe_close(pipe);
+
+    keystream_close(&in);
     return 0;
 }
-
@@ -0,0 +1,105 @@
+#include "common.h"
+
+#include <xxhash.h>
+
+#include "cbloom.h"
+#include "hugemem.h"
+
+#define BLOCK_BYTES    64
+#define BLOCK_COUNTERS (2 * BLOCK_BYTES)
+#define COUNTER_MAX    15
+
+/* High half of the hash picks the block, 7-bit slices of the low half the
+ * counters in it (which may repeat; then one counter counts twice).
+ */
+static INLINE uint8_t *cbloom_block(const CountingBloom *f, const key128_t *k, uint64_t *pos)
+{
+    XXH128_hash_t h = XXH3_128bits(k->b, 16);
+    *pos = h.low64;
+    return f->blocks + (size_t)(((unsigned __int128)h.high64 * f->nblocks) >> 64) * BLOCK_BYTES;
+}
+
+static INLINE unsigned counter_get(const uint8_t *b, unsigned i)
+{
+    return (b[i >> 1] >> ((i & 1) * 4)) & 0x0F;
+}
+
+static INLINE void counter_set(uint8_t *b, unsigned i, unsigned c)
+{
+    unsigned shift = (i & 1) * 4;
+    b[i >> 1] = (uint8_t)((b[i >> 1] & ~(0x0F << shift)) | (c << shift));
+}
+
+CountingBloom *cbloom_new(size_t bytes)
+{
+    CountingBloom *f = (CountingBloom*)calloc(1, sizeof(CountingBloom));
+    f->nblocks = bytes / BLOCK_BYTES ? bytes / BLOCK_BYTES : 1;
+    f->bytes   = f->nblocks * BLOCK_BYTES;
+    f->blocks  = (uint8_t*)mem_table_alloc(f->bytes, -1);
+    return f;
+}
+
+void cbloom_free(CountingBloom *f)
+{
+    if (!f) return;
+    mem_table_free(f->blocks, f->bytes);
+    free(f);
+}
+
+void cbloom_add(CountingBloom *f, const key128_t *k)
+{
+    uint64_t pos;
+    uint8_t *b = cbloom_block(f, k, &pos);
+    for (int j = 0; j < CBLOOM_K; ++j, pos >>= 7) {
+        unsigned i = (unsigned)(pos & (BLOCK_COUNTERS - 1)), c = counter_get(b, i);
+        if (c < COUNTER_MAX) {
+            counter_set(b, i, c + 1);
+            f->saturated += (c + 1 == COUNTER_MAX);
+        }
+    }
+    f->keys++;
+}
+
+void cbloom_remove(CountingBloom *f, const key128_t *k)
+{
+    uint64_t pos;
+    uint8_t *b = cbloom_block(f, k, &pos);
+    for (int j = 0; j < CBLOOM_K; ++j, pos >>= 7) {
+        unsigned i = (unsigned)(pos & (BLOCK_COUNTERS - 1)), c = counter_get(b, i);
+        /* a saturated counter lost track of its count */
+        if (c < COUNTER_MAX) {
+            counter_set(b, i, c - 1);
+        }
+    }
+    f->keys--;
+}
+
+bool cbloom_maybe(CountingBloom *f, const key128_t *k)
+{
+    uint64_t pos;
+    const uint8_t *b = cbloom_block(f, k, &pos);
+    f->queries++;
+    for (int j = 0; j < CBLOOM_K; ++j, pos >>= 7) {
+        if (counter_get(b, (unsigned)(pos & (BLOCK_COUNTERS - 1))) == 0) {
+            f->negatives++;
+            return false;
+        }
+    }
+    return TRUE;
+}
+
+static INLINE double ratio_pct(uint64_t a, uint64_t b)
+{
+    return b ? 100.0 * (double)a / (double)b : 0.0;
+}
+
+void cbloom_log(const CountingBloom *f, unsigned int v, const char *name)
+{
+    if (!f) return;
+    printlog(v, "%s: %.1f MiB, %lu keys (%.1f per block), %lu saturated counters; %lu queries, "
+             "%.1f%% answered without the table, false-positive rate %.2f%%",
+             name, f->bytes / 1048576.0, (unsigned long)f->keys, (double)f->keys / (double)f->nblocks,
+             (unsigned long)f->saturated, (unsigned long)f->queries,
+             ratio_pct(f->negatives, f->queries),
+             ratio_pct(f->false_pos, f->false_pos + f->negatives));
+}
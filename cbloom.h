@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "common.h"
+
+/*
+ * Counting blocked Bloom filter for 16-byte keys.
+ *
+ * Every key maps to one 64-byte block (a cache line) and sets CBLOOM_K of
+ * its 128 4-bit counters, so a query costs one cache miss at most and is
+ * cheap when the filter fits in the LLC. Removal decrements the counters;
+ * a counter that reached 15 stays there, so the filter never gives a false
+ * negative, only false positives. Not thread-safe.
+ *
+ * Meant to sit in front of a GHashBucket: cbloom_maybe() == false means the
+ * key is definitely not in the table, and the probe can be skipped. The
+ * filter counts its queries and negative answers; the caller reports the
+ * positives the table did not confirm with cbloom_false_positive().
+ */
+#define CBLOOM_K 5
+
+typedef struct {
+    uint8_t  *blocks;
+    size_t    nblocks;
+    size_t    bytes;
+    uint64_t  keys;         /* added minus removed */
+    uint64_t  queries;
+    uint64_t  negatives;
+    uint64_t  false_pos;
+    uint64_t  saturated;    /* counters stuck at 15 */
+} CountingBloom;
+
+/* 'bytes' is rounded down to whole blocks (at least one). */
+CountingBloom *cbloom_new(size_t bytes);
+void cbloom_free(CountingBloom *f);
+
+void cbloom_add(CountingBloom *f, const key128_t *k);
+
+/* Only for keys that were added. */
+void cbloom_remove(CountingBloom *f, const key128_t *k);
+
+/* false: definitely absent; TRUE: possibly present. */
+bool cbloom_maybe(CountingBloom *f, const key128_t *k);
+
+static INLINE void cbloom_false_positive(CountingBloom *f) {
+    f->false_pos++;
+}
+
+/* printlog() size, keys per block, the share of queries answered without
+ * the table and the measured false-positive rate (false positives over all
+ * queries for absent keys).
+ */
+void cbloom_log(const CountingBloom *f, unsigned int v, const char *name);
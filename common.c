@@ -29,4 +29,13 @@ void printlog(unsigned int v, const char *format, ...)
 void increase_verbosity(void)
 {
     ++verbosity_level;
-}
\ No newline at end of file
+}
+FILE *fopen_resume(const char *path, uint64_t offset)
+{
+    FILE *f = fopen(path, "r+");
+    if (f == NULL || ftruncate(fileno(f), (off_t)offset) != 0 || fseeko(f, (off_t)offset, SEEK_SET) != 0) {
+        fprintf(stderr, "Cannot resume output file '%s': %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    return f;
+}
@@ -17,6 +17,14 @@
 #   define UNLIKELY(x) (x)
 #endif
 
+/* Hot kernels are built once per x86-64 level with --enable-dispatch; the
+ * loader picks the variant for the CPU (see cpudispatch.h). */
+#if CPU_DISPATCH
+#   define CPU_CLONES __attribute__((target_clones("arch=x86-64-v4", "arch=x86-64-v3", "arch=x86-64-v2", "default")))
+#else
+#   define CPU_CLONES
+#endif
+
 #if defined(PROFILE) || defined(DEBUG)
 #   ifdef INLINE
 #       undef INLINE
@@ -111,6 +119,11 @@ void printlog(unsigned int v, const char *format, ...);
 
 void increase_verbosity(void);
 
+/* Open the output file of an interrupted run: its first 'offset' bytes (what
+ * was written up to the checkpoint) are kept and writing continues after them.
+ */
+FILE *fopen_resume(const char *path, uint64_t offset);
+
 static INLINE void remove_newline(char *s)
 {
     s[strcspn(s, "\r\n")] = 0;
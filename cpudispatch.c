@@ -0,0 +1,22 @@
+#include "cpudispatch.h"
+#include "dag.h"
+#include "adjpack11.h"
+#include "d6batch.h"
+
+const char *cpu_level_name(CpuLevel level)
+{
+    static const char *names[] = { "x86-64", "x86-64-v2", "x86-64-v3", "x86-64-v4" };
+    return names[level];
+}
+
+void cpu_dispatch_log(unsigned int v)
+{
+#if CPU_DISPATCH
+    const char *level = cpu_level_name(cpu_level());
+    printlog(v, "CPU dispatch: %s; bott, packer and set kernels: %s clones; digraph6 codec: %s; upper key packer: %s",
+             level, level, d6batch_variant(), adjpack_upper_variant());
+#else
+    printlog(v, "CPU dispatch: off, kernels built for the compiler's target; digraph6 codec: %s; upper key packer: %s",
+             d6batch_variant(), adjpack_upper_variant());
+#endif
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "common.h"
+
+/*
+ * Runtime CPU dispatch.
+ *
+ * The default build is tuned with -march=native and runs only on CPUs like
+ * the build host. configure --enable-dispatch builds for any x86-64 CPU
+ * instead, and the hot kernels come in variants for the x86-64 levels v2
+ * (SSSE3, SSE4.2, POPCNT), v3 (AVX2, BMI2) and v4 (AVX-512):
+ *
+ *  - functions marked CPU_CLONES (common.h) are cloned by the compiler:
+ *    is_spinc(), is_spin() and matrix_weight() with the popcount helpers of
+ *    bott.h, the matrix packers of dag.c, the probing of FlatSet (bucket.c)
+ *    and the orbit search of minimalf with its packers and set inlined;
+ *  - the batch digraph6 codec has its own variants (d6batch.c), and so do
+ *    the pext/pdep packers of upper triangular keys (adjpack11.h, dag.c).
+ *
+ * Either way an ifunc resolver picks the variant once, when the program is
+ * loaded, and calls cost what they did before. Code inside a clone that
+ * selects a path with #if sees the baseline in every clone, hence the
+ * explicit variants. cpu_dispatch_log() reports the choice at -v.
+ */
+typedef enum {
+    CPU_BASELINE,
+    CPU_X86_64_V2,
+    CPU_X86_64_V3,
+    CPU_X86_64_V4,
+} CpuLevel;
+
+/* The level of this CPU, as the resolvers see it; safe in a resolver. */
+static INLINE CpuLevel cpu_level(void)
+{
+#if CPU_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("x86-64-v4")) return CPU_X86_64_V4;
+    if (__builtin_cpu_supports("x86-64-v3")) return CPU_X86_64_V3;
+    if (__builtin_cpu_supports("x86-64-v2")) return CPU_X86_64_V2;
+#endif
+    return CPU_BASELINE;
+}
+
+const char *cpu_level_name(CpuLevel level);
+
+/* Logs (printlog() level v) which kernel variants run on this CPU. */
+void cpu_dispatch_log(unsigned int v);
@@ -0,0 +1,88 @@
+#include "common.h"
+
+#include "cpudispatch.h"
+#include "d6batch.h"
+
+#if D6BATCH_DISPATCH
+/* The variants for x86-64-v3 and -v2 CPUs and the scalar one; an ifunc
+ * resolver binds d6batch_decode() and d6batch_encode() to the best when
+ * the program is loaded.
+ */
+#pragma GCC push_options
+#pragma GCC target("arch=x86-64-v3")
+#define D6B_FN(f)  f##_avx2
+#define D6B_SIMD   1
+#define D6B_AVX2   1
+#define D6B_BATCH  1
+#include "d6batch_tmpl.h"
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("arch=x86-64-v2")
+#define D6B_FN(f)  f##_ssse3
+#define D6B_SIMD   1
+#define D6B_BATCH  1
+#include "d6batch_tmpl.h"
+#pragma GCC pop_options
+
+#define D6B_FN(f)  f##_scalar
+#define D6B_BATCH  1
+#include "d6batch_tmpl.h"
+
+typedef size_t (*DecodeFn)(const char *text, size_t bytes, key128_t *keys, size_t max, size_t *used);
+typedef size_t (*EncodeFn)(const key128_t *keys, size_t count, char *out);
+
+static DecodeFn resolve_decode(void)
+{
+    CpuLevel level = cpu_level();
+    return level >= CPU_X86_64_V3 ? decode_avx2 : level >= CPU_X86_64_V2 ? decode_ssse3 : decode_scalar;
+}
+
+static EncodeFn resolve_encode(void)
+{
+    CpuLevel level = cpu_level();
+    return level >= CPU_X86_64_V3 ? encode_avx2 : level >= CPU_X86_64_V2 ? encode_ssse3 : encode_scalar;
+}
+
+size_t d6batch_decode(const char *text, size_t bytes, key128_t *keys, size_t max, size_t *used)
+    __attribute__((ifunc("resolve_decode")));
+
+size_t d6batch_encode(const key128_t *keys, size_t count, char *out)
+    __attribute__((ifunc("resolve_encode")));
+
+const char *d6batch_variant(void)
+{
+    CpuLevel level = cpu_level();
+    return level >= CPU_X86_64_V3 ? "avx2" : level >= CPU_X86_64_V2 ? "ssse3" : "scalar";
+}
+#else
+/* Built for one CPU: the variant its flags allow. */
+#define D6B_FN(f)  f##_native
+#define D6B_SIMD   D6BATCH_SIMD
+#if D6BATCH_SIMD && defined(__AVX2__)
+#   define D6B_AVX2 1
+#endif
+#define D6B_BATCH  1
+#include "d6batch_tmpl.h"
+
+size_t d6batch_decode(const char *text, size_t bytes, key128_t *keys, size_t max, size_t *used)
+{
+    return decode_native(text, bytes, keys, max, used);
+}
+
+size_t d6batch_encode(const key128_t *keys, size_t count, char *out)
+{
+    return encode_native(keys, count, out);
+}
+
+const char *d6batch_variant(void)
+{
+#if D6BATCH_SIMD && defined(__AVX2__)
+    return "avx2";
+#elif D6BATCH_SIMD
+    return "ssse3";
+#else
+    return "scalar";
+#endif
+}
+#endif
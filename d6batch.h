@@ -0,0 +1,109 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "common.h"
+#include "d6pack11.h"
+
+#if defined(__SSSE3__) && HAVE_UINT128
+#   define D6BATCH_SIMD 1
+#else
+#   define D6BATCH_SIMD 0
+#endif
+
+/* Built for a generic CPU (configure --enable-dispatch), d6batch.c has an
+ * SSSE3, an AVX2 and a scalar variant of the batch functions; the loader
+ * picks one for the CPU. */
+#if CPU_DISPATCH && HAVE_UINT128 && !defined(__AVX2__)
+#   define D6BATCH_DISPATCH 1
+#else
+#   define D6BATCH_DISPATCH 0
+#endif
+
+#if D6BATCH_SIMD || D6BATCH_DISPATCH
+#   include <immintrin.h>
+#endif
+
+/*
+ * Batch digraph6 codec: whole lines to and from keys with SIMD.
+ *
+ * Every digraph6 line of n vertices has the same length, '&', N(n) and
+ * g = ceil(n*n / 6) characters of 63 + six bits each, the bit stream
+ * R(x) first bit highest, the last group padded with zero bits. With SSSE3
+ * a line is read as two 16-byte vectors of digits: 63 is subtracted from
+ * every byte, pmaddubsw and pmaddwd pack four 6-bit digits into 24 bits
+ * (as in base64 decoding), one pshufb per vector puts the bytes into the
+ * order of a little-endian 128-bit number, and a 128-bit shift by 128 - n*n
+ * leaves the key of d6pack_decode(). Encoding runs the same steps backwards
+ * (the multiply-shift split of base64 encoding). All characters are checked
+ * at once with two compares and a mask.
+ *
+ * The kernels load and store 32 bytes from the third byte of a line, so
+ * they need D6BATCH_SLACK bytes behind the start of the line; the batch
+ * functions leave the lines near the end of their span to the caller.
+ * Without SSSE3 the same functions run the scalar code of d6pack11.h, so
+ * the results never differ. The kernels are stamped out of d6batch_tmpl.h.
+ */
+#define D6BATCH_SLACK 34
+
+/* The scalar line kernels, also where there is no SSSE3 variant. */
+static INLINE bool d6batch_scalar_decode_line(const char *p, unsigned n, key128_t *k)
+{
+    const unsigned groups = (n * n + 5) / 6;
+    if (p[0] != '&' || (unsigned char)p[1] != 63 + n || p[2 + groups] != '\n') {
+        return false;
+    }
+    for (unsigned i = 2; i < 2 + groups; ++i) {
+        if ((unsigned char)p[i] < 63 || (unsigned char)p[i] > 126) return false;
+    }
+    return d6pack_decode(p, k, NULL);
+}
+
+static INLINE unsigned d6batch_scalar_encode_line(const key128_t *k, char *out)
+{
+    unsigned len = d6pack_encode_from_key(k, out);
+    if (len) out[len++] = '\n';
+    return len;
+}
+
+/* Decodes the lines at the start of text[0..bytes) while they are digraph6
+ * codes of n vertices (from the first line) ended by '\n', at most 'max'.
+ * Returns the keys and sets *used to the bytes of their lines; stops early,
+ * maybe at 0, at a line of another form or within D6BATCH_SLACK bytes of
+ * the end, which the caller reads with d6pack_decode_span().
+ */
+size_t d6batch_decode(const char *text, size_t bytes, key128_t *keys, size_t max, size_t *used);
+
+/* Writes the lines of count keys, n taken from every key; 'out' needs room
+ * for count * 24 + D6BATCH_SLACK bytes. Returns the bytes written.
+ */
+size_t d6batch_encode(const key128_t *keys, size_t count, char *out);
+
+/* The variant of the batch functions in use: "avx2", "ssse3" or "scalar". */
+const char *d6batch_variant(void);
+
+#if D6BATCH_SIMD
+/* d6batch_decode_line(p, n, k): the key of a line p[0..] of n vertices
+ * ending in '\n'; false if it is not one.
+ * d6batch_encode_line(k, out): writes the line of 'k' with its '\n' and
+ * returns its length; stores D6BATCH_SLACK bytes from out.
+ */
+#   define D6B_FN(f) d6batch_##f
+#   define D6B_SIMD  1
+#   include "d6batch_tmpl.h"
+#else
+static INLINE bool d6batch_decode_line(const char *p, unsigned n, key128_t *k)
+{
+    return d6batch_scalar_decode_line(p, n, k);
+}
+
+static INLINE unsigned d6batch_encode_line(const key128_t *k, char *out)
+{
+#if D6BATCH_DISPATCH
+    // through the variant the loader picked
+    return (unsigned)d6batch_encode(k, 1, out);
+#else
+    return d6batch_scalar_encode_line(k, out);
+#endif
+}
+#endif
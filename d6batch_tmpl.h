@@ -0,0 +1,224 @@
+/*
+ * Kernels of the batch digraph6 codec (d6batch.h); include once per variant
+ * (no include guard), where the instructions of the variant are enabled.
+ *
+ *   D6B_FN(f)   name of the variant of kernel f
+ *   D6B_SIMD    1: the SSSE3 line kernels, 0: the scalar ones of d6batch.h
+ *   D6B_AVX2    1: the batch loops take two lines per 256-bit vector
+ *   D6B_BATCH   1: also the batch loops D6B_FN(decode) and D6B_FN(encode)
+ *
+ * The parameters are #undef'd at the end.
+ */
+
+#ifndef D6B_FN
+#error "d6batch_tmpl.h: define D6B_FN first"
+#endif
+
+#if D6B_SIMD
+/* Key of a line p[0..] of n vertices ending in '\n'; false if it is not one. */
+static INLINE bool D6B_FN(decode_line)(const char *p, unsigned n, key128_t *k)
+{
+    const unsigned L = n * n, groups = (L + 5) / 6;
+    if (UNLIKELY(p[0] != '&' || (unsigned char)p[1] != 63 + n || p[2 + groups] != '\n')) {
+        return false;
+    }
+    __m128i a = _mm_loadu_si128((const __m128i*)(p + 2));
+    __m128i w = _mm_loadu_si128((const __m128i*)(p + 18));
+
+    // digits are 63..126; below (negative as signed bytes too) or 127 is bad
+    const __m128i lo = _mm_set1_epi8(63), hi = _mm_set1_epi8(126);
+    unsigned bad = (unsigned)_mm_movemask_epi8(_mm_or_si128(_mm_cmplt_epi8(a, lo), _mm_cmpgt_epi8(a, hi)))
+                 | (unsigned)_mm_movemask_epi8(_mm_or_si128(_mm_cmplt_epi8(w, lo), _mm_cmpgt_epi8(w, hi))) << 16;
+    if (UNLIKELY(bad & ((1u << groups) - 1u))) {
+        return false;
+    }
+    // the bytes after the line are clamped to six bits, so that they only
+    // reach the bits shifted out below
+    a = _mm_min_epu8(_mm_sub_epi8(a, lo), lo);
+    w = _mm_min_epu8(_mm_sub_epi8(w, lo), lo);
+
+    // d0 d1 d2 d3 -> d0 << 18 | d1 << 12 | d2 << 6 | d3 in every 32-bit lane
+    const __m128i m1 = _mm_set1_epi32(0x01400140), m2 = _mm_set1_epi32(0x00011000);
+    a = _mm_madd_epi16(_mm_maddubs_epi16(a, m1), m2);
+    w = _mm_madd_epi16(_mm_maddubs_epi16(w, m1), m2);
+
+    // the stream is bytes 2, 1, 0 of the lanes of a, then of w; the first
+    // 16 bytes of it, reversed, are the top of the number
+    a = _mm_shuffle_epi8(a, _mm_setr_epi8(-1, -1, -1, -1, 12, 13, 14, 8, 9, 10, 4, 5, 6, 0, 1, 2));
+    w = _mm_shuffle_epi8(w, _mm_setr_epi8(6, 0, 1, 2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1));
+    __uint128_t x;
+    _mm_storeu_si128((__m128i*)&x, _mm_or_si128(a, w));
+    k->u = x >> (128 - L) | (__uint128_t)n << 124;
+    return true;
+}
+
+/* Writes the line of 'k' with its '\n' and returns its length; stores
+ * D6BATCH_SLACK bytes from out.
+ */
+static INLINE unsigned D6B_FN(encode_line)(const key128_t *k, char *out)
+{
+    const unsigned n = d6pack_get_n(k);
+    if (UNLIKELY(n < 1 || n > 11)) return 0;
+    const unsigned L = n * n, groups = (L + 5) / 6;
+
+    __uint128_t x = k->u << (128 - L);
+    __m128i v = _mm_loadu_si128((const __m128i*)&x);
+
+    // lanes of three stream bytes b0 b1 b2 as b1 b0 b2 b1, then split into
+    // four 6-bit digits with a multiply-high and a multiply-low
+    __m128i a = _mm_shuffle_epi8(v, _mm_setr_epi8(14, 15, 13, 14, 11, 12, 10, 11, 8, 9, 7, 8, 5, 6, 4, 5));
+    __m128i w = _mm_shuffle_epi8(v, _mm_setr_epi8(2, 3, 1, 2, -1, 0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1));
+    const __m128i mh = _mm_set1_epi32(0x0fc0fc00), kh = _mm_set1_epi32(0x04000040);
+    const __m128i ml = _mm_set1_epi32(0x003f03f0), kl = _mm_set1_epi32(0x01000010);
+    a = _mm_or_si128(_mm_mulhi_epu16(_mm_and_si128(a, mh), kh), _mm_mullo_epi16(_mm_and_si128(a, ml), kl));
+    w = _mm_or_si128(_mm_mulhi_epu16(_mm_and_si128(w, mh), kh), _mm_mullo_epi16(_mm_and_si128(w, ml), kl));
+
+    const __m128i bias = _mm_set1_epi8(63);
+    out[0] = '&';
+    out[1] = (char)(63 + n);
+    _mm_storeu_si128((__m128i*)(out + 2), _mm_add_epi8(a, bias));
+    _mm_storeu_si128((__m128i*)(out + 18), _mm_add_epi8(w, bias));
+    out[2 + groups] = '\n';
+    return 3 + groups;
+}
+#else
+static INLINE bool D6B_FN(decode_line)(const char *p, unsigned n, key128_t *k)
+{
+    return d6batch_scalar_decode_line(p, n, k);
+}
+
+static INLINE unsigned D6B_FN(encode_line)(const key128_t *k, char *out)
+{
+    return d6batch_scalar_encode_line(k, out);
+}
+#endif
+
+#if D6B_BATCH
+#if D6B_AVX2
+/* Two lines of n vertices at p and p + stride in the two halves of 256-bit
+ * vectors: the steps of decode_line() once for both.
+ */
+static INLINE bool D6B_FN(decode_pair)(const char *p, size_t stride, unsigned n, key128_t *k)
+{
+    const unsigned L = n * n, groups = (L + 5) / 6;
+    const char *q = p + stride;
+    if (UNLIKELY(p[0] != '&' || (unsigned char)p[1] != 63 + n || p[2 + groups] != '\n'
+                 || q[0] != '&' || (unsigned char)q[1] != 63 + n || q[2 + groups] != '\n')) {
+        return false;
+    }
+    __m256i a = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(p + 2))),
+                                        _mm_loadu_si128((const __m128i*)(q + 2)), 1);
+    __m256i w = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(p + 18))),
+                                        _mm_loadu_si128((const __m128i*)(q + 18)), 1);
+
+    const __m256i lo = _mm256_set1_epi8(63), hi = _mm256_set1_epi8(126);
+    uint64_t ba = (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpgt_epi8(lo, a), _mm256_cmpgt_epi8(a, hi)));
+    uint64_t bw = (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpgt_epi8(lo, w), _mm256_cmpgt_epi8(w, hi)));
+    const uint64_t valid = (1u << groups) - 1u;
+    if (UNLIKELY(((ba & 0xFFFF) | (bw & 0xFFFF) << 16 | (ba >> 16) << 32 | (bw >> 16) << 48) & (valid | valid << 32))) {
+        return false;
+    }
+    a = _mm256_min_epu8(_mm256_sub_epi8(a, lo), lo);
+    w = _mm256_min_epu8(_mm256_sub_epi8(w, lo), lo);
+
+    const __m256i m1 = _mm256_set1_epi32(0x01400140), m2 = _mm256_set1_epi32(0x00011000);
+    a = _mm256_madd_epi16(_mm256_maddubs_epi16(a, m1), m2);
+    w = _mm256_madd_epi16(_mm256_maddubs_epi16(w, m1), m2);
+    a = _mm256_shuffle_epi8(a, _mm256_setr_epi8(-1, -1, -1, -1, 12, 13, 14, 8, 9, 10, 4, 5, 6, 0, 1, 2,
+                                                -1, -1, -1, -1, 12, 13, 14, 8, 9, 10, 4, 5, 6, 0, 1, 2));
+    w = _mm256_shuffle_epi8(w, _mm256_setr_epi8(6, 0, 1, 2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                                6, 0, 1, 2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1));
+    __uint128_t x[2];
+    _mm256_storeu_si256((__m256i*)x, _mm256_or_si256(a, w));
+    k[0].u = x[0] >> (128 - L) | (__uint128_t)n << 124;
+    k[1].u = x[1] >> (128 - L) | (__uint128_t)n << 124;
+    return true;
+}
+
+/* The lines of two keys of any n, as encode_line() twice. */
+static INLINE unsigned D6B_FN(encode_pair)(const key128_t *k, char *out)
+{
+    const unsigned n0 = d6pack_get_n(&k[0]), n1 = d6pack_get_n(&k[1]);
+    if (UNLIKELY(n0 < 1 || n0 > 11 || n1 < 1 || n1 > 11)) {
+        unsigned len = D6B_FN(encode_line)(&k[0], out);
+        return len + D6B_FN(encode_line)(&k[1], out + len);
+    }
+    const unsigned g0 = (n0 * n0 + 5) / 6, g1 = (n1 * n1 + 5) / 6;
+    __uint128_t x[2] = { k[0].u << (128 - n0 * n0), k[1].u << (128 - n1 * n1) };
+    __m256i v = _mm256_loadu_si256((const __m256i*)x);
+
+    __m256i a = _mm256_shuffle_epi8(v, _mm256_setr_epi8(14, 15, 13, 14, 11, 12, 10, 11, 8, 9, 7, 8, 5, 6, 4, 5,
+                                                        14, 15, 13, 14, 11, 12, 10, 11, 8, 9, 7, 8, 5, 6, 4, 5));
+    __m256i w = _mm256_shuffle_epi8(v, _mm256_setr_epi8(2, 3, 1, 2, -1, 0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                                        2, 3, 1, 2, -1, 0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1));
+    const __m256i mh = _mm256_set1_epi32(0x0fc0fc00), kh = _mm256_set1_epi32(0x04000040);
+    const __m256i ml = _mm256_set1_epi32(0x003f03f0), kl = _mm256_set1_epi32(0x01000010);
+    const __m256i bias = _mm256_set1_epi8(63);
+    a = _mm256_add_epi8(_mm256_or_si256(_mm256_mulhi_epu16(_mm256_and_si256(a, mh), kh),
+                                        _mm256_mullo_epi16(_mm256_and_si256(a, ml), kl)), bias);
+    w = _mm256_add_epi8(_mm256_or_si256(_mm256_mulhi_epu16(_mm256_and_si256(w, mh), kh),
+                                        _mm256_mullo_epi16(_mm256_and_si256(w, ml), kl)), bias);
+
+    // the second line overwrites the tail stored behind the first
+    char *q = out + 3 + g0;
+    out[0] = '&';
+    out[1] = (char)(63 + n0);
+    _mm_storeu_si128((__m128i*)(out + 2), _mm256_castsi256_si128(a));
+    _mm_storeu_si128((__m128i*)(out + 18), _mm256_castsi256_si128(w));
+    out[2 + g0] = '\n';
+    q[0] = '&';
+    q[1] = (char)(63 + n1);
+    _mm_storeu_si128((__m128i*)(q + 2), _mm256_extracti128_si256(a, 1));
+    _mm_storeu_si128((__m128i*)(q + 18), _mm256_extracti128_si256(w, 1));
+    q[2 + g1] = '\n';
+    return 6 + g0 + g1;
+}
+#endif
+
+static size_t D6B_FN(decode)(const char *text, size_t bytes, key128_t *keys, size_t max, size_t *used)
+{
+    *used = 0;
+    if (bytes < D6BATCH_SLACK || text[0] != '&') {
+        return 0;
+    }
+    const unsigned n = (unsigned char)text[1] - 63u;
+    if (n < 1 || n > 11) {
+        return 0;
+    }
+    const size_t stride = d6pack_expected_len(n) + 1;
+    size_t cnt = 0, pos = 0;
+#if D6B_AVX2
+    while (cnt + 2 <= max && pos + stride + D6BATCH_SLACK <= bytes
+           && D6B_FN(decode_pair)(text + pos, stride, n, keys + cnt)) {
+        cnt += 2;
+        pos += 2 * stride;
+    }
+#endif
+    while (cnt < max && pos + D6BATCH_SLACK <= bytes && D6B_FN(decode_line)(text + pos, n, keys + cnt)) {
+        cnt++;
+        pos += stride;
+    }
+    *used = pos;
+    return cnt;
+}
+
+static size_t D6B_FN(encode)(const key128_t *keys, size_t count, char *out)
+{
+    char *q = out;
+    size_t i = 0;
+#if D6B_AVX2
+    for (; i + 2 <= count; i += 2) {
+        q += D6B_FN(encode_pair)(keys + i, q);
+    }
+#endif
+    for (; i < count; ++i) {
+        q += D6B_FN(encode_line)(keys + i, q);
+    }
+    return (size_t)(q - out);
+}
+#endif
+
+#undef D6B_FN
+#undef D6B_SIMD
+#undef D6B_AVX2
+#undef D6B_BATCH
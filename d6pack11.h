@@ -102,6 +102,15 @@ static INLINE int d6pack_decode(const char *d6, key128_t *out, unsigned *out_n)
     return 1;
 }
 
+// ---- Decode a line span of 'len' chars (no NUL needed); returns 1/0. ----
+static INLINE int d6pack_decode_span(const char *d6, size_t len, key128_t *out, unsigned *out_n)
+{
+    if (UNLIKELY(len < 2)) return 0;
+    unsigned n = (unsigned char)d6[1] - 63u;
+    if (UNLIKELY(n == 0 || n > 11 || len < 2 + (n * n + 5) / 6)) return 0;
+    return d6pack_decode(d6, out, out_n);
+}
+
 // ---- Encode from key (uses n stored in nibble). Returns chars without '\0'. ----
 static INLINE unsigned d6pack_encode_from_key(const key128_t *k, char *out_d6)
 {
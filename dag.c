@@ -1,5 +1,6 @@
 #include "dag.h"
 #include "adjpack11.h"
+#include "cpudispatch.h"
 
 /*
  * Check at compile time if everything is as expected.
@@ -83,6 +84,14 @@ char* matrix_to_d6(const vec_t *mat, int dim, char *dag_gcode)
     char *p,x;
     int n = dim;
 
+    // up to 11 vertices the key packs a whole row at a time
+    if (n >= 1 && n <= 11) {
+        key128_t key;
+        adjpack_from_matrix(mat, (unsigned)n, &key);
+        d6pack_encode_from_key(&key, dag_gcode);
+        return dag_gcode;
+    }
+
     p = dag_gcode;
     *p++ = '&';
     encodegraphsize(n,&p);
@@ -275,17 +284,23 @@ static bool topo_sort(const graph *g, int n, int m, int *in_degree, int *q, int
     return outc == n;
 }
 
-char *d6_to_d6_upper(char *src, char *dst)
+key128_t* key128_to_key128_canon(const key128_t *src, key128_t *key)
 {
-    stringtograph( src, dag_g, dag_m );
+    vec_t mat[dag_n];
+    adjpack_to_matrix(src, mat, dag_n);
+    return matrix_to_key128_canon(mat, dag_n, key);
+}
 
+/* relabels dag_g in topological order into dag_upperg */
+static bool upper_from_dag_g(void)
+{
     memset( dag_in_deg, 0, dag_int_arr_sz );
     memset( dag_queue , 0, dag_int_arr_sz );
     memset( dag_order , 0, dag_int_arr_sz );
     memset( dag_pos   , 0, dag_pos_sz     );
 
     if (!topo_sort(dag_g, dag_n, dag_m, dag_in_deg, dag_queue, dag_order)) {
-        return NULL;
+        return false;
     }
     EMPTYGRAPH( dag_upperg, dag_m, dag_n );
 
@@ -301,16 +316,46 @@ char *d6_to_d6_upper(char *src, char *dst)
             }
         }
     }
+    return true;
+}
+
+char *d6_to_d6_upper(char *src, char *dst)
+{
+    stringtograph( src, dag_g, dag_m );
+    if (!upper_from_dag_g()) {
+        return NULL;
+    }
     graph_to_d6(dag_upperg, dag_m, dag_n, dst);
     return dst;
 }
 
-int matrix_from_graph(graph *g, vec_t *mat)
+key128_t *key128_to_key128_upper(const key128_t *src, key128_t *dst)
+{
+    vec_t mat[dag_n];
+    adjpack_to_matrix(src, mat, dag_n);
+    matrix_to_graph(dag_g, mat);
+    if (!upper_from_dag_g()) {
+        return NULL;
+    }
+    adjpack_from_graph(dag_upperg, dag_n, dag_m, dst);
+    return dst;
+}
+
+CPU_CLONES int matrix_from_graph(graph *g, vec_t *mat)
 {
     if (g == NULL || mat == NULL) {
         return -1;
     }
 
+#if HAVE_UINT128
+    if (dag_n <= 11) {
+        // the rows as a key, then adjpack_to_matrix() reverses them at once
+        key128_t k;
+        adjpack_from_graph(g, dag_n, dag_m, &k);
+        adjpack_to_matrix(&k, mat, dag_n);
+        return 0;
+    }
+#endif
     for (int i = 0; i < dag_n; ++i) {
         set *gi = GRAPHROW(g,i,dag_m);
         mat[i] = bitreverse64((uint64_t)*gi) & dag_mask;
@@ -318,15 +363,57 @@ int matrix_from_graph(graph *g, vec_t *mat)
     return 0;
 }
 
-int matrix_to_graph(graph *g, const vec_t *mat)
+CPU_CLONES int matrix_to_graph(graph *g, const vec_t *mat)
 {
     if (g == NULL || mat == NULL) {
         return -1;
     }
 
+#if HAVE_UINT128
+    if (dag_n <= 11) {
+        // one reversal for all rows; row i is at the top after a shift by i*n
+        const __uint128_t rev = adjpack_reversed_rows(mat, dag_n);
+        const setword top = ~(~(setword)0 >> dag_n);
+        for (int i = 0; i < dag_n; ++i) {
+            *GRAPHROW(g,i,dag_m) = (setword)((rev << (i * dag_n)) >> 64) & top;
+        }
+        return 0;
+    }
+#endif
     for (int i = 0; i < dag_n; ++i) {
         set *gi = GRAPHROW(g,i,dag_m);
         *gi = bitreverse64((uint64_t)(mat[i] & dag_mask));
     }
     return 0;
 }
+
+#if CPU_DISPATCH && ADJPACK_PEXT
+typedef uint64_t (*UpperFromKeyFn)(const key128_t *k, unsigned n);
+typedef void (*UpperToKeyFn)(uint64_t u, unsigned n, key128_t *k);
+
+static UpperFromKeyFn resolve_upper_from_key(void)
+{
+    return cpu_level() >= CPU_X86_64_V3 ? adjpack_upper_from_key_pext : adjpack_upper_from_key_shifts;
+}
+
+static UpperToKeyFn resolve_upper_to_key(void)
+{
+    return cpu_level() >= CPU_X86_64_V3 ? adjpack_upper_to_key_pdep : adjpack_upper_to_key_shifts;
+}
+
+uint64_t adjpack_upper_from_key(const key128_t *k, unsigned n)
+    __attribute__((ifunc("resolve_upper_from_key")));
+
+void adjpack_upper_to_key(uint64_t u, unsigned n, key128_t *k)
+    __attribute__((ifunc("resolve_upper_to_key")));
+
+const char *adjpack_upper_variant(void)
+{
+    return cpu_level() >= CPU_X86_64_V3 ? "pext" : "shifts";
+}
+#else
+const char *adjpack_upper_variant(void)
+{
+    return ADJPACK_BMI2 ? "pext" : "shifts";
+}
+#endif
@@ -87,8 +87,14 @@ char* d6_to_d6_canon(const char *src, char *dst);
 
 key128_t* d6_to_key128_canon(const char *src, key128_t *key);
 
+/* The same for keys (adjpack11.h), without the digraph6 text. */
+key128_t* key128_to_key128_canon(const key128_t *src, key128_t *key);
+
 char *d6_to_d6_upper(char *src, char *dst);
 
+/* NULL if the graph has a cycle. */
+key128_t *key128_to_key128_upper(const key128_t *src, key128_t *dst);
+
 int matrix_from_graph(graph *g, vec_t *mat);
 int matrix_to_graph(graph *g, const vec_t *mat);
 
@@ -0,0 +1,591 @@
+#include <assert.h>
+#include <omp.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+#include "dedup.h"
+#include "keysort.h"
+
+/* Merge all runs into one when there are that many of them. */
+#ifndef DEDUP_MAX_RUNS
+#define DEDUP_MAX_RUNS 16
+#endif
+
+/* Keys per block of a run; the first key of every block is kept in memory. */
+#ifndef DEDUP_INDEX_STRIDE
+#define DEDUP_INDEX_STRIDE 512
+#endif
+
+/* Peak memory per in-memory key, reached during a spill. The bucket is
+ * reserved for max_keys at MAX_TRUE load, 17 bytes per slot, and every shard
+ * is rounded up to a power of two: 21 to 43 bytes per key. The sort adds a
+ * 16-byte copy of every key and the radix buffer of the same size; the copy
+ * is still alive when the next bucket is reserved, after the old one is
+ * gone. So at most about 75 bytes, and some room for the run indexes.
+ */
+#define DEDUP_BYTES_PER_KEY 80
+
+/* Keys per buffered read/write when streaming runs. */
+#define DEDUP_IO_KEYS 4096
+
+typedef struct {
+    int       fd;
+    size_t    count;
+    key128_t *index;    /* first key of every DEDUP_INDEX_STRIDE block */
+    size_t    nindex;
+    key128_t  last;
+} DedupRun;
+
+/* Per-thread reader counter, padded to its own cache line. */
+typedef struct {
+    atomic_size_t n;
+    char pad[64 - sizeof(atomic_size_t)];
+} DedupReader;
+
+struct _DedupSet {
+    GHashBucket *mem;
+    size_t       shards;
+    size_t       max_keys;  /* 0 = never spill */
+
+    DedupRun    *runs;
+    size_t       nruns;
+    size_t       disk_keys;
+
+    /* "big reader" lock: readers only touch their own counter,
+     * a spilling thread raises the flag and waits for all counters to drop.
+     */
+    DedupReader *readers;
+    size_t       nreaders;
+    atomic_bool  spilling;
+    bool         merging;   /* a thread merges the oldest runs; under the flag */
+};
+
+/* ---- low level I/O ---- */
+
+static int spill_file(void)
+{
+    const char *dir = getenv("TMPDIR");
+    char path[4096];
+
+    snprintf(path, sizeof(path), "%s/dedup-XXXXXX", (dir && *dir) ? dir : "/tmp");
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot create spill file '%s': %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    /* the file lives as long as the descriptor */
+    unlink(path);
+    return fd;
+}
+
+static void write_all(int fd, const void *buf, size_t bytes)
+{
+    const char *p = (const char*)buf;
+    while (bytes > 0) {
+        ssize_t w = write(fd, p, bytes);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "Error writing spill file: %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        p += w; bytes -= (size_t)w;
+    }
+}
+
+static void pread_all(int fd, void *buf, size_t bytes, off_t off)
+{
+    char *p = (char*)buf;
+    while (bytes > 0) {
+        ssize_t r = pread(fd, p, bytes, off);
+        if (r <= 0) {
+            if (r < 0 && errno == EINTR) continue;
+            fprintf(stderr, "Error reading spill file: %s\n", r < 0 ? strerror(errno) : "unexpected end of file");
+            exit(EXIT_FAILURE);
+        }
+        p += r; off += r; bytes -= (size_t)r;
+    }
+}
+
+/* ---- runs: streaming writer and reader ---- */
+
+typedef struct {
+    DedupRun *run;
+    size_t    cap_index;
+    key128_t  buf[DEDUP_IO_KEYS];
+    size_t    used;
+} RunWriter;
+
+static void run_writer_init(RunWriter *w, DedupRun *run)
+{
+    run->fd = spill_file();
+    run->count = 0;
+    run->nindex = 0;
+    run->index = NULL;
+    w->run = run;
+    w->cap_index = 0;
+    w->used = 0;
+}
+
+static INLINE void run_writer_add(RunWriter *w, const key128_t *k)
+{
+    DedupRun *run = w->run;
+    if (run->count % DEDUP_INDEX_STRIDE == 0) {
+        if (run->nindex == w->cap_index) {
+            w->cap_index = w->cap_index ? 2 * w->cap_index : 64;
+            run->index = (key128_t*)realloc(run->index, w->cap_index * sizeof(key128_t));
+            assert(run->index != NULL);
+        }
+        run->index[run->nindex++] = *k;
+    }
+    run->last = *k;
+    run->count++;
+    w->buf[w->used++] = *k;
+    if (w->used == DEDUP_IO_KEYS) {
+        write_all(run->fd, w->buf, w->used * sizeof(key128_t));
+        w->used = 0;
+    }
+}
+
+static void run_writer_close(RunWriter *w)
+{
+    if (w->used > 0) {
+        write_all(w->run->fd, w->buf, w->used * sizeof(key128_t));
+        w->used = 0;
+    }
+}
+
+static void run_free(DedupRun *run)
+{
+    close(run->fd);
+    free(run->index);
+    run->index = NULL;
+    run->count = run->nindex = 0;
+}
+
+/* A merge source: either a run on disk or a sorted array in memory. */
+typedef struct {
+    const DedupRun *run;
+    const key128_t *keys;   /* current buffer */
+    key128_t       *buf;
+    size_t          pos, len;
+    size_t          next;   /* next key of the run to read */
+    size_t          total;
+} MergeSource;
+
+static void source_from_run(MergeSource *src, const DedupRun *run)
+{
+    src->run = run;
+    src->buf = (key128_t*)malloc(DEDUP_IO_KEYS * sizeof(key128_t));
+    assert(src->buf != NULL);
+    src->keys = src->buf;
+    src->pos = src->len = 0;
+    src->next = 0;
+    src->total = run->count;
+}
+
+static void source_from_array(MergeSource *src, const key128_t *keys, size_t n)
+{
+    src->run = NULL;
+    src->buf = NULL;
+    src->keys = keys;
+    src->pos = 0;
+    src->len = n;
+    src->next = n;
+    src->total = n;
+}
+
+/* Returns the current key of the source, or NULL when it is exhausted. */
+static INLINE const key128_t *source_peek(MergeSource *src)
+{
+    if (src->pos < src->len) {
+        return &src->keys[src->pos];
+    }
+    if (src->run == NULL || src->next == src->total) {
+        return NULL;
+    }
+    size_t n = src->total - src->next;
+    if (n > DEDUP_IO_KEYS) n = DEDUP_IO_KEYS;
+    pread_all(src->run->fd, src->buf, n * sizeof(key128_t), (off_t)(src->next * sizeof(key128_t)));
+    src->next += n;
+    src->pos = 0;
+    src->len = n;
+    return &src->keys[0];
+}
+
+/* k-way merge of the sources; equal keys are reported once */
+static void merge_sources(MergeSource *src, size_t nsrc, GKey128ForeachFunc func, void *user_data)
+{
+    key128_t prev;
+    bool have_prev = false;
+
+    for (;;) {
+        const key128_t *min = NULL;
+        size_t which = 0;
+        for (size_t i = 0; i < nsrc; ++i) {
+            const key128_t *k = source_peek(&src[i]);
+            if (k != NULL && (min == NULL || key128_lt(k, min))) {
+                min = k;
+                which = i;
+            }
+        }
+        if (min == NULL) {
+            break;
+        }
+        if (!have_prev || !key128_equal(&prev, min)) {
+            prev = *min;
+            have_prev = true;
+            func(&prev, user_data);
+        }
+        src[which].pos++;
+    }
+    for (size_t i = 0; i < nsrc; ++i) {
+        free(src[i].buf);
+    }
+}
+
+static bool run_lookup(const DedupRun *run, const key128_t *k)
+{
+    if (run->count == 0 || key128_lt(k, &run->index[0]) || key128_lt(&run->last, k)) {
+        return false;
+    }
+    /* last block whose first key is <= k */
+    size_t lo = 0, hi = run->nindex;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (key128_lt(k, &run->index[mid])) hi = mid; else lo = mid + 1;
+    }
+    size_t first = (lo - 1) * DEDUP_INDEX_STRIDE;
+    size_t n = run->count - first;
+    if (n > DEDUP_INDEX_STRIDE) n = DEDUP_INDEX_STRIDE;
+
+    key128_t block[DEDUP_INDEX_STRIDE];
+    pread_all(run->fd, block, n * sizeof(key128_t), (off_t)(first * sizeof(key128_t)));
+
+    lo = 0; hi = n;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        int c = key128_cmp(&block[mid], k);
+        if (c == 0) return TRUE;
+        if (c < 0) lo = mid + 1; else hi = mid;
+    }
+    return false;
+}
+
+static INLINE bool runs_lookup(const DedupSet *d, const key128_t *k)
+{
+    for (size_t i = 0; i < d->nruns; ++i) {
+        if (run_lookup(&d->runs[i], k)) {
+            return TRUE;
+        }
+    }
+    return false;
+}
+
+/* ---- reader/writer exclusion ---- */
+
+static INLINE DedupReader *reader_enter(DedupSet *d)
+{
+    DedupReader *r = &d->readers[(size_t)omp_get_thread_num() % d->nreaders];
+    for (;;) {
+        atomic_fetch_add(&r->n, 1);
+        if (!atomic_load(&d->spilling)) {
+            return r;
+        }
+        atomic_fetch_sub(&r->n, 1);
+        while (atomic_load_explicit(&d->spilling, memory_order_relaxed)) {
+            sched_yield();
+        }
+    }
+}
+
+static INLINE void reader_leave(DedupReader *r)
+{
+    atomic_fetch_sub_explicit(&r->n, 1, memory_order_release);
+}
+
+/* Returns false if another thread is already spilling. */
+static bool writer_enter(DedupSet *d)
+{
+    bool expected = false;
+    if (!atomic_compare_exchange_strong(&d->spilling, &expected, true)) {
+        return false;
+    }
+    for (size_t i = 0; i < d->nreaders; ++i) {
+        while (atomic_load(&d->readers[i].n) != 0) {
+            sched_yield();
+        }
+    }
+    return true;
+}
+
+static INLINE void writer_leave(DedupSet *d)
+{
+    atomic_store(&d->spilling, false);
+}
+
+/* ---- spilling ---- */
+
+typedef struct {
+    key128_t *keys;
+    size_t    n;
+} KeyCollector;
+
+static void collect_key(const key128_t *key, void *user_data)
+{
+    KeyCollector *c = (KeyCollector*)user_data;
+    c->keys[c->n++] = *key;
+}
+
+/* Sorted copy of the in-memory keys; caller frees. */
+static key128_t *mem_sorted(DedupSet *d, size_t *n)
+{
+    KeyCollector c;
+    c.keys = (key128_t*)malloc((g_bucket_size(d->mem) + 1) * sizeof(key128_t));
+    assert(c.keys != NULL);
+    c.n = 0;
+    g_bucket_foreach128(d->mem, collect_key, &c);
+    key128_t *tmp = (key128_t*)malloc((c.n + 1) * sizeof(key128_t));
+    assert(tmp != NULL);
+    keys_radix_sort(c.keys, c.n, tmp);
+    free(tmp);
+    *n = c.n;
+    return c.keys;
+}
+
+static GHashBucket *mem_new(size_t shards, size_t max_keys)
+{
+    GHashBucket *b = g_bucket_new_128(NULL, shards);
+    g_bucket_reserve(b, max_keys);
+    return b;
+}
+
+static void write_key(const key128_t *key, void *user_data)
+{
+    run_writer_add((RunWriter*)user_data, key);
+}
+
+/* Merges copies of the oldest runs into one. The runs are immutable, so
+ * this needs no exclusion: readers keep using them until the swap.
+ */
+static void merge_runs(DedupRun *runs, size_t nruns, DedupRun *merged)
+{
+    MergeSource *src = (MergeSource*)malloc(nruns * sizeof(MergeSource));
+    RunWriter   *w   = (RunWriter*)malloc(sizeof(RunWriter));
+
+    assert(src != NULL && w != NULL);
+    for (size_t i = 0; i < nruns; ++i) {
+        source_from_run(&src[i], &runs[i]);
+    }
+    run_writer_init(w, merged);
+    merge_sources(src, nruns, write_key, w);
+    run_writer_close(w);
+
+    free(w);
+    free(src);
+}
+
+/* Replaces the 'nold' oldest runs by 'merged'; spills since then were
+ * appended after them. Waits for a concurrent spill to finish.
+ */
+static void swap_merged(DedupSet *d, size_t nold, const DedupRun *merged)
+{
+    while (!writer_enter(d)) {
+        sched_yield();
+    }
+    for (size_t i = 0; i < nold; ++i) {
+        run_free(&d->runs[i]);
+    }
+    d->runs[0] = *merged;
+    memmove(&d->runs[1], &d->runs[nold], (d->nruns - nold) * sizeof(DedupRun));
+    d->nruns -= nold - 1;
+    d->merging = false;
+    writer_leave(d);
+}
+
+static void dedup_spill(DedupSet *d)
+{
+    if (!writer_enter(d)) {
+        return;
+    }
+    DedupRun *old = NULL;
+    size_t nold = 0;
+    if (g_bucket_size(d->mem) >= d->max_keys) {
+        size_t n;
+        key128_t *keys = mem_sorted(d, &n);
+
+        g_bucket_destroy(d->mem);
+        d->mem = mem_new(d->shards, d->max_keys);
+
+        RunWriter *w = (RunWriter*)malloc(sizeof(RunWriter));
+        assert(w != NULL);
+        d->runs = (DedupRun*)realloc(d->runs, (d->nruns + 1) * sizeof(DedupRun));
+        assert(d->runs != NULL);
+        run_writer_init(w, &d->runs[d->nruns]);
+        for (size_t i = 0; i < n; ++i) {
+            run_writer_add(w, &keys[i]);
+        }
+        run_writer_close(w);
+        d->nruns++;
+        d->disk_keys += n;
+        free(w);
+        free(keys);
+
+        printlog(2, "dedup: spilled %zu keys, %zu keys in %zu run(s) on disk", n, d->disk_keys, d->nruns);
+
+        if (d->nruns >= DEDUP_MAX_RUNS && !d->merging) {
+            /* d->runs moves on later spills, the runs themselves do not */
+            nold = d->nruns;
+            old = (DedupRun*)malloc(nold * sizeof(DedupRun));
+            assert(old != NULL);
+            memcpy(old, d->runs, nold * sizeof(DedupRun));
+            d->merging = true;
+        }
+    }
+    writer_leave(d);
+
+    if (old != NULL) {
+        DedupRun merged;
+        merge_runs(old, nold, &merged);
+        swap_merged(d, nold, &merged);
+        printlog(2, "dedup: merged %zu runs into one of %zu keys", nold, merged.count);
+        free(old);
+    }
+}
+
+/* ---- public API ---- */
+
+static DedupSet *dedup_alloc(size_t shards, size_t mem_budget)
+{
+    DedupSet *d = (DedupSet*)calloc(1, sizeof(DedupSet));
+    assert(d != NULL);
+
+    d->shards = shards ? shards : 1;
+    d->max_keys = mem_budget / DEDUP_BYTES_PER_KEY;
+    if (mem_budget > 0 && d->max_keys == 0) {
+        d->max_keys = 1;
+    }
+
+    d->nreaders = (size_t)omp_get_max_threads() + 1;
+    d->readers = (DedupReader*)aligned_alloc(64, d->nreaders * sizeof(DedupReader));
+    assert(d->readers != NULL);
+    for (size_t i = 0; i < d->nreaders; ++i) {
+        atomic_init(&d->readers[i].n, 0);
+    }
+    atomic_init(&d->spilling, false);
+
+    return d;
+}
+
+DedupSet *dedup_new(size_t shards, size_t mem_budget)
+{
+    DedupSet *d = dedup_alloc(shards, mem_budget);
+    d->mem = d->max_keys ? mem_new(d->shards, d->max_keys) : g_bucket_new_128(NULL, d->shards);
+    return d;
+}
+
+DedupSet *dedup_new_shared(const char *name, size_t capacity)
+{
+    GHashBucket *mem = g_bucket_new_shm(name, capacity);
+    if (!mem) {
+        return NULL;
+    }
+    DedupSet *d = dedup_alloc(1, 0);
+    d->mem = mem;
+    return d;
+}
+
+DedupSet *dedup_load(const char *path, size_t mem_budget, uint64_t *meta)
+{
+    GHashBucket *mem = g_bucket_load(path, NULL, false, meta);
+    if (!mem) {
+        return NULL;
+    }
+    /* the shard count of the snapshot wins, keys are placed by it */
+    DedupSet *d = dedup_alloc(g_bucket_shards(mem), mem_budget);
+    d->mem = mem;
+    return d;
+}
+
+bool dedup_save(DedupSet *d, const char *path, const uint64_t *meta)
+{
+    if (d->nruns > 0) {
+        fprintf(stderr, "Cannot write snapshot '%s': the set has spilled to disk\n", path);
+        return false;
+    }
+    return g_bucket_save(d->mem, path, meta);
+}
+
+void dedup_destroy(DedupSet *d)
+{
+    if (!d) return;
+    for (size_t i = 0; i < d->nruns; ++i) {
+        run_free(&d->runs[i]);
+    }
+    free(d->runs);
+    free(d->readers);
+    g_bucket_destroy(d->mem);
+    free(d);
+}
+
+bool dedup_insert(DedupSet *d, const key128_t *key)
+{
+    if (d->max_keys == 0) {
+        return g_bucket_insert_copy128(d->mem, key);
+    }
+
+    DedupReader *r = reader_enter(d);
+    bool ins = !runs_lookup(d, key) && g_bucket_insert_copy128(d->mem, key);
+    bool full = ins && g_bucket_size(d->mem) >= d->max_keys;
+    reader_leave(r);
+
+    if (full) {
+        dedup_spill(d);
+    }
+    return ins;
+}
+
+bool dedup_lookup(DedupSet *d, const key128_t *key)
+{
+    if (d->max_keys == 0) {
+        return g_bucket_lookup(d->mem, key) != NULL;
+    }
+
+    DedupReader *r = reader_enter(d);
+    bool found = g_bucket_lookup(d->mem, key) != NULL || runs_lookup(d, key);
+    reader_leave(r);
+    return found;
+}
+
+size_t dedup_size(DedupSet *d)
+{
+    return d ? g_bucket_size(d->mem) + d->disk_keys : 0;
+}
+
+size_t dedup_runs(DedupSet *d)
+{
+    return d ? d->nruns : 0;
+}
+
+GHashBucket *dedup_bucket(DedupSet *d)
+{
+    return d ? d->mem : NULL;
+}
+
+void dedup_foreach_sorted(DedupSet *d, GKey128ForeachFunc func, void *user_data)
+{
+    if (!d || !func) return;
+
+    size_t n;
+    key128_t *keys = mem_sorted(d, &n);
+    MergeSource *src = (MergeSource*)malloc((d->nruns + 1) * sizeof(MergeSource));
+    assert(src != NULL);
+
+    for (size_t i = 0; i < d->nruns; ++i) {
+        source_from_run(&src[i], &d->runs[i]);
+    }
+    source_from_array(&src[d->nruns], keys, n);
+    merge_sources(src, d->nruns + 1, func, user_data);
+
+    free(src);
+    free(keys);
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "bucket.h"
+
+/*
+ * Deduplicating set of 16-byte keys with a memory budget.
+ *
+ * Keys are kept in an in-memory GHashBucket. When the bucket reaches the
+ * budget, its keys are sorted and spilled as a run to an (unlinked) file in
+ * $TMPDIR. Membership checks consult the bucket and then every run through
+ * a sparse in-memory index, so at most one block per run is read from disk.
+ * Runs are merged into a single one once there are DEDUP_MAX_RUNS of them;
+ * the spilling thread merges them while the other callers go on.
+ *
+ * dedup_insert() and dedup_lookup() are safe under concurrent use. A spill
+ * collects, sorts and writes the whole bucket while all other callers are
+ * blocked, so they wait for its duration. With mem_budget == 0 the set
+ * never spills and behaves exactly like the underlying bucket.
+ */
+typedef struct _DedupSet DedupSet;
+
+DedupSet *dedup_new(size_t shards, size_t mem_budget);
+
+/* Set in the shared-memory bucket 'name' (see g_bucket_new_shm()), shared
+ * with other processes; it never spills. NULL on failure.
+ */
+DedupSet *dedup_new_shared(const char *name, size_t capacity);
+
+void dedup_destroy(DedupSet *d);
+
+/* Returns TRUE iff the key was not present (and has been added). */
+bool dedup_insert(DedupSet *d, const key128_t *key);
+
+bool dedup_lookup(DedupSet *d, const key128_t *key);
+
+/* Number of keys in memory and on disk. */
+size_t dedup_size(DedupSet *d);
+
+/* Number of runs currently on disk. */
+size_t dedup_runs(DedupSet *d);
+
+/* The in-memory part; it is replaced on every spill, so e.g. its statistics
+ * only cover the keys inserted since the last one.
+ */
+GHashBucket *dedup_bucket(DedupSet *d);
+
+/* Snapshot of the in-memory keys, see g_bucket_save()/g_bucket_load().
+ * Runs are temporary files, so a set that has spilled cannot be saved.
+ */
+bool dedup_save(DedupSet *d, const char *path, const uint64_t *meta);
+
+DedupSet *dedup_load(const char *path, size_t mem_budget, uint64_t *meta);
+
+/* Streaming k-way merge of all runs and the in-memory keys: 'func' is called
+ * for every key in increasing order. Not safe under concurrent inserts.
+ */
+void dedup_foreach_sorted(DedupSet *d, GKey128ForeachFunc func, void *user_data);
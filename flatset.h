@@ -0,0 +1,112 @@
+#pragma once
+
+#include <stdbool.h>
+#include <xxhash.h>
+
+#include "bucket.h"
+
+/*
+ * Specialised open-addressing sets for 8-, 16- and 32-byte keys.
+ *
+ * FlatSet (bucket.h) serves GHashBucket and is fixed to 16-byte keys, XXH3
+ * and linear probing. The variants below are stamped out of flatset_tmpl.h
+ * with the key width, hash and probing scheme as compile-time parameters, so
+ * callers pick one by type and pay no dispatch. Suffix X hashes with XXH3,
+ * M with the multiply-xorshift mixer below; Q probes quadratically.
+ * test-flatset shows which one wins for which key distribution.
+ */
+
+typedef union {
+    unsigned char b[32];
+    uint64_t      w[4];
+} key256_t;
+
+/* Finaliser of SplitMix64: two multiplies and three xorshifts. */
+static INLINE uint64_t mix64(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBULL;
+    x ^= x >> 31;
+    return x;
+}
+
+static INLINE uint64_t key64_mix(const uint64_t *k)    { return mix64(*k); }
+static INLINE uint64_t key64_xxh(const uint64_t *k)    { return XXH3_64bits(k, 8); }
+static INLINE bool     key64_equal(const uint64_t *a, const uint64_t *b) { return *a == *b; }
+
+static INLINE uint64_t key128_mix(const key128_t *k)
+{
+    uint64_t lo, hi;
+    memcpy(&lo, k->b + 0, 8);
+    memcpy(&hi, k->b + 8, 8);
+    return mix64(lo ^ mix64(hi));
+}
+
+static INLINE uint64_t key128_xxh(const key128_t *k)   { return XXH3_64bits(k->b, 16); }
+
+static INLINE uint64_t key256_mix(const key256_t *k)
+{
+    return mix64(k->w[0] ^ mix64(k->w[1] ^ mix64(k->w[2] ^ mix64(k->w[3]))));
+}
+
+static INLINE uint64_t key256_xxh(const key256_t *k)   { return XXH3_64bits(k->b, 32); }
+
+static INLINE bool key256_equal(const key256_t *a, const key256_t *b)
+{
+    return ((a->w[0] ^ b->w[0]) | (a->w[1] ^ b->w[1]) | (a->w[2] ^ b->w[2]) | (a->w[3] ^ b->w[3])) == 0;
+}
+
+/* 8-byte keys */
+#define FS_TYPE   Set64M
+#define FS_PREFIX set64m
+#define FS_KEY    uint64_t
+#define FS_HASH   key64_mix
+#define FS_EQUAL  key64_equal
+#include "flatset_tmpl.h"
+
+#define FS_TYPE   Set64X
+#define FS_PREFIX set64x
+#define FS_KEY    uint64_t
+#define FS_HASH   key64_xxh
+#define FS_EQUAL  key64_equal
+#include "flatset_tmpl.h"
+
+/* 16-byte keys */
+#define FS_TYPE   Set128M
+#define FS_PREFIX set128m
+#define FS_KEY    key128_t
+#define FS_HASH   key128_mix
+#define FS_EQUAL  key128_equal
+#include "flatset_tmpl.h"
+
+#define FS_TYPE   Set128MQ
+#define FS_PREFIX set128mq
+#define FS_KEY    key128_t
+#define FS_HASH   key128_mix
+#define FS_EQUAL  key128_equal
+#define FS_PROBE  FS_QUADRATIC
+#include "flatset_tmpl.h"
+
+#define FS_TYPE   Set128X
+#define FS_PREFIX set128x
+#define FS_KEY    key128_t
+#define FS_HASH   key128_xxh
+#define FS_EQUAL  key128_equal
+#include "flatset_tmpl.h"
+
+/* 32-byte keys */
+#define FS_TYPE   Set256M
+#define FS_PREFIX set256m
+#define FS_KEY    key256_t
+#define FS_HASH   key256_mix
+#define FS_EQUAL  key256_equal
+#include "flatset_tmpl.h"
+
+#define FS_TYPE   Set256X
+#define FS_PREFIX set256x
+#define FS_KEY    key256_t
+#define FS_HASH   key256_xxh
+#define FS_EQUAL  key256_equal
+#include "flatset_tmpl.h"
@@ -0,0 +1,173 @@
+/*
+ * Open-addressing set template; include once per variant (no include guard).
+ *
+ *   FS_TYPE    name of the set type
+ *   FS_PREFIX  prefix of its functions (FS_PREFIX_insert(), ...)
+ *   FS_KEY     key type, copied by value
+ *   FS_HASH    FS_HASH(const FS_KEY *k) -> uint64_t
+ *   FS_EQUAL   FS_EQUAL(const FS_KEY *a, const FS_KEY *b) -> bool
+ *   FS_PROBE   FS_LINEAR (default) or FS_QUADRATIC
+ *
+ * Control bytes: 0 = empty, 1 = deleted, 0x80 | top 7 hash bits = full, so
+ * most mismatching slots are skipped without comparing keys. All functions
+ * are static INLINE, every call site gets code for one key width, hash and
+ * probing scheme. Tables resize synchronously, which suits small per-thread
+ * sets; large shared sets belong in a GHashBucket.
+ *
+ * The parameters are #undef'd at the end.
+ */
+
+#if !defined(FS_TYPE) || !defined(FS_PREFIX) || !defined(FS_KEY) || !defined(FS_HASH) || !defined(FS_EQUAL)
+#error "flatset_tmpl.h: define FS_TYPE, FS_PREFIX, FS_KEY, FS_HASH and FS_EQUAL first"
+#endif
+
+#ifndef FS_LINEAR
+#define FS_LINEAR    1
+#define FS_QUADRATIC 2
+#endif
+
+#ifndef FS_PROBE
+#define FS_PROBE FS_LINEAR
+#endif
+
+#define FS_CAT_(a, b) a##_##b
+#define FS_CAT(a, b)  FS_CAT_(a, b)
+#define FS_FN(f)      FS_CAT(FS_PREFIX, f)
+
+typedef struct {
+    FS_KEY  *keys;
+    uint8_t *ctrl;
+    size_t   cap;    /* power of two */
+    size_t   size;   /* # full slots */
+    size_t   dels;   /* # tombstones */
+} FS_TYPE;
+
+static INLINE void FS_FN(init)(FS_TYPE *s, size_t cap_hint)
+{
+    size_t cap = 16;
+    while (cap < cap_hint) cap <<= 1;
+    s->cap  = cap;
+    s->size = s->dels = 0;
+    s->keys = (FS_KEY*)malloc(cap * sizeof(FS_KEY));
+    s->ctrl = (uint8_t*)calloc(cap, 1);
+}
+
+static INLINE void FS_FN(free)(FS_TYPE *s)
+{
+    free(s->keys);
+    free(s->ctrl);
+    s->keys = NULL;
+    s->ctrl = NULL;
+    s->cap = s->size = s->dels = 0;
+}
+
+/* Empties the set but keeps its memory. */
+static INLINE void FS_FN(clear)(FS_TYPE *s)
+{
+    memset(s->ctrl, 0, s->cap);
+    s->size = s->dels = 0;
+}
+
+static INLINE size_t FS_FN(next)(size_t i, size_t *step, size_t m)
+{
+#if FS_PROBE == FS_QUADRATIC
+    /* triangular steps visit every slot of a power-of-two table */
+    return (i + ++*step) & m;
+#else
+    (void)step;
+    return (i + 1) & m;
+#endif
+}
+
+static INLINE bool FS_FN(lookup)(const FS_TYPE *s, const FS_KEY *k)
+{
+    uint64_t h = FS_HASH(k);
+    uint8_t tag = (uint8_t)(0x80 | (h >> 57));
+    size_t m = s->cap - 1, i = (size_t)h & m, step = 0;
+    for (;;) {
+        uint8_t c = s->ctrl[i];
+        if (c == 0) return false;
+        if (c == tag && FS_EQUAL(&s->keys[i], k)) return TRUE;
+        i = FS_FN(next)(i, &step, m);
+    }
+}
+
+static void FS_FN(rehash)(FS_TYPE *s, size_t new_cap)
+{
+    FS_KEY  *keys = s->keys;
+    uint8_t *ctrl = s->ctrl;
+    size_t   cap  = s->cap;
+
+    s->keys = (FS_KEY*)malloc(new_cap * sizeof(FS_KEY));
+    s->ctrl = (uint8_t*)calloc(new_cap, 1);
+    s->cap  = new_cap;
+    s->dels = 0;
+    for (size_t j = 0; j < cap; ++j) {
+        if (!(ctrl[j] & 0x80)) continue;
+        size_t m = new_cap - 1, i = (size_t)FS_HASH(&keys[j]) & m, step = 0;
+        while (s->ctrl[i] != 0) i = FS_FN(next)(i, &step, m);
+        s->keys[i] = keys[j];
+        s->ctrl[i] = ctrl[j];
+    }
+    free(keys);
+    free(ctrl);
+}
+
+/* Returns TRUE iff the key was not present. */
+static INLINE bool FS_FN(insert)(FS_TYPE *s, const FS_KEY *k)
+{
+    if ((s->size + s->dels + 1) * 5 > s->cap * 4) {
+        /* grow when really full, otherwise only drop the tombstones */
+        FS_FN(rehash)(s, (s->size + 1) * 2 > s->cap ? s->cap * 2 : s->cap);
+    }
+    uint64_t h = FS_HASH(k);
+    uint8_t tag = (uint8_t)(0x80 | (h >> 57));
+    size_t m = s->cap - 1, i = (size_t)h & m, step = 0, first_del = SIZE_MAX;
+    for (;;) {
+        uint8_t c = s->ctrl[i];
+        if (c == 0) break;
+        if (c == 1) {
+            if (first_del == SIZE_MAX) first_del = i;
+        } else if (c == tag && FS_EQUAL(&s->keys[i], k)) {
+            return false;
+        }
+        i = FS_FN(next)(i, &step, m);
+    }
+    if (first_del != SIZE_MAX) {
+        i = first_del;
+        s->dels--;
+    }
+    s->keys[i] = *k;
+    s->ctrl[i] = tag;
+    s->size++;
+    return TRUE;
+}
+
+/* Returns TRUE iff the key was present. */
+static INLINE bool FS_FN(remove)(FS_TYPE *s, const FS_KEY *k)
+{
+    uint64_t h = FS_HASH(k);
+    uint8_t tag = (uint8_t)(0x80 | (h >> 57));
+    size_t m = s->cap - 1, i = (size_t)h & m, step = 0;
+    for (;;) {
+        uint8_t c = s->ctrl[i];
+        if (c == 0) return false;
+        if (c == tag && FS_EQUAL(&s->keys[i], k)) {
+            s->ctrl[i] = 1;
+            s->size--;
+            s->dels++;
+            return TRUE;
+        }
+        i = FS_FN(next)(i, &step, m);
+    }
+}
+
+#undef FS_FN
+#undef FS_CAT
+#undef FS_CAT_
+#undef FS_TYPE
+#undef FS_PREFIX
+#undef FS_KEY
+#undef FS_HASH
+#undef FS_EQUAL
+#undef FS_PROBE
@@ -45,7 +45,7 @@ cat $OUTDIR/9_*.out > $dag
 rm -f $OUTDIR/9_*.out
 bott=$OUTDIR/09-rbm-all.d6
 echo "[INFO] Generating RBMs of dimension 9 ..." >&2
-# xzcat $dag| ./minimalf -o $bott -l 100M -n 1023 -vv -j $NJOBS
+# ./minimalf -i $OUTDIR/09-dag-all.xz -o $bott -l 100M -n 1023 -vv -j $NJOBS
 ./minimalf -i $dag -o $bott -l 100M -n 1023 -vv -j $NJOBS
 orientable=$OUTDIR/09-rbm-orientable.d6
 cat $bott | ./orientedf > $orientable
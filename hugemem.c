@@ -0,0 +1,262 @@
+#include "common.h"
+
+#include <omp.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "hugemem.h"
+
+#define HUGE_PAGE ((size_t)2 << 20)
+#define MAX_NODES 64
+
+/* from <numaif.h>, we call the system call directly to avoid libnuma */
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED  1
+#endif
+#ifndef MPOL_INTERLEAVE
+#define MPOL_INTERLEAVE 3
+#endif
+
+static unsigned policy = 0;
+
+static pthread_once_t nodes_once = PTHREAD_ONCE_INIT;
+static int node_ids[MAX_NODES];
+static int num_nodes = 1;
+
+/* Parses a sysfs list like "0-3,8,10-11"; calls 'add' for every number. */
+static void parse_list(const char *path, void (*add)(int, void*), void *data)
+{
+    char buf[4096];
+    FILE *f = fopen(path, "r");
+    if (f == NULL) return;
+    if (fgets(buf, sizeof(buf), f) != NULL) {
+        char *p = buf;
+        while (*p >= '0' && *p <= '9') {
+            int lo = (int)strtol(p, &p, 10), hi = lo;
+            if (*p == '-') hi = (int)strtol(p + 1, &p, 10);
+            for (int i = lo; i <= hi; ++i) add(i, data);
+            if (*p == ',') ++p;
+        }
+    }
+    fclose(f);
+}
+
+static void add_node(int id, void *data)
+{
+    int *n = (int*)data;
+    if (*n < MAX_NODES) node_ids[(*n)++] = id;
+}
+
+static void nodes_init(void)
+{
+    int n = 0;
+    parse_list("/sys/devices/system/node/online", add_node, &n);
+    if (n == 0) {
+        node_ids[0] = 0;
+        n = 1;
+    }
+    num_nodes = n;
+}
+
+int mem_numa_nodes(void)
+{
+    pthread_once(&nodes_once, nodes_init);
+    return num_nodes;
+}
+
+bool mem_policy_parse(const char *spec)
+{
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%s", spec);
+    for (char *save = NULL, *w = strtok_r(buf, ",", &save); w != NULL; w = strtok_r(NULL, ",", &save)) {
+        if      (strcmp(w, "huge") == 0)       policy |= MEM_HUGEPAGES;
+        else if (strcmp(w, "hugetlb") == 0)    policy |= MEM_HUGETLB;
+        else if (strcmp(w, "interleave") == 0) policy |= MEM_INTERLEAVE;
+        else if (strcmp(w, "spread") == 0)     policy |= MEM_SPREAD;
+        else if (strcmp(w, "pin") == 0)        policy |= MEM_PIN;
+        else if (strcmp(w, "none") == 0)       policy = 0;
+        else return false;
+    }
+    return TRUE;
+}
+
+unsigned mem_policy(void)
+{
+    return policy;
+}
+
+int mem_shard_node(size_t shard)
+{
+    if (!(policy & MEM_SPREAD) || mem_numa_nodes() < 2) return -1;
+    return node_ids[shard % (size_t)num_nodes];
+}
+
+static void apply_numa(void *p, size_t bytes, int node)
+{
+#ifdef SYS_mbind
+    unsigned long mask[MAX_NODES / (8 * sizeof(unsigned long))] = { 0 };
+    int mode;
+
+    if (mem_numa_nodes() < 2) return;
+    if (node >= 0 && node < MAX_NODES) {
+        mode = MPOL_PREFERRED;
+        mask[node / (8 * sizeof(unsigned long))] |= 1ul << (node % (8 * sizeof(unsigned long)));
+    } else if (policy & MEM_INTERLEAVE) {
+        mode = MPOL_INTERLEAVE;
+        for (int i = 0; i < num_nodes; ++i) {
+            mask[node_ids[i] / (8 * sizeof(unsigned long))] |= 1ul << (node_ids[i] % (8 * sizeof(unsigned long)));
+        }
+    } else {
+        return;
+    }
+    /* the kernel expects one more than the number of bits */
+    if (syscall(SYS_mbind, p, bytes, mode, mask, (unsigned long)MAX_NODES + 1, 0ul) != 0) {
+        printlog(2, "mbind failed: %s", strerror(errno));
+    }
+#else
+    (void)p; (void)bytes; (void)node;
+#endif
+}
+
+/* Anonymous mapping aligned to a huge page, so THP can back all of it. */
+static void *map_aligned(size_t bytes)
+{
+    char *p = (char*)mmap(NULL, bytes + HUGE_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) return NULL;
+    size_t head = (HUGE_PAGE - ((uintptr_t)p & (HUGE_PAGE - 1))) & (HUGE_PAGE - 1);
+    if (head) munmap(p, head);
+    munmap(p + head + bytes, HUGE_PAGE - head);
+    return p + head;
+}
+
+void *mem_table_alloc(size_t bytes, int node)
+{
+    void *p = NULL;
+
+    if (bytes < MEM_MMAP_MIN) {
+        p = calloc(1, bytes);
+    } else {
+        /* bytes is a power of two, hence a multiple of the huge page size */
+#ifdef MAP_HUGETLB
+        if (policy & MEM_HUGETLB) {
+            p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (p == MAP_FAILED) p = NULL;
+        }
+#endif
+        if (p == NULL) {
+            p = map_aligned(bytes);
+#ifdef MADV_HUGEPAGE
+            if (p != NULL && (policy & (MEM_HUGEPAGES | MEM_HUGETLB))) {
+                madvise(p, bytes, MADV_HUGEPAGE);
+            }
+#endif
+        }
+        /* nothing is touched yet, so the policy decides where pages go */
+        if (p != NULL) apply_numa(p, bytes, node);
+    }
+    if (p == NULL) {
+        fprintf(stderr, "Out of memory allocating a table of %zu bytes\n", bytes);
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+void mem_table_free(void *p, size_t bytes)
+{
+    if (p == NULL) return;
+    if (bytes < MEM_MMAP_MIN) {
+        free(p);
+    } else {
+        munmap(p, bytes);
+    }
+}
+
+typedef struct {
+    int *cpus;
+    int  n;
+    cpu_set_t allowed;
+} CpuList;
+
+static void add_cpu(int id, void *data)
+{
+    CpuList *l = (CpuList*)data;
+    if (id < CPU_SETSIZE && CPU_ISSET(id, &l->allowed)) l->cpus[l->n++] = id;
+}
+
+void mem_pin_threads(void)
+{
+    int nodes = mem_numa_nodes();
+    int *per_node = (int*)calloc((size_t)nodes, sizeof(int));
+    int **cpus = (int**)calloc((size_t)nodes, sizeof(int*));
+    int *order = (int*)malloc(CPU_SETSIZE * sizeof(int));
+    int norder = 0;
+    CpuList l;
+
+    if (sched_getaffinity(0, sizeof(l.allowed), &l.allowed) != 0) {
+        CPU_ZERO(&l.allowed);
+        for (int i = 0; i < CPU_SETSIZE; ++i) CPU_SET(i, &l.allowed);
+    }
+    for (int i = 0; i < nodes; ++i) {
+        char path[128];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node_ids[i]);
+        cpus[i] = l.cpus = (int*)malloc(CPU_SETSIZE * sizeof(int));
+        l.n = 0;
+        parse_list(path, add_cpu, &l);
+        per_node[i] = l.n;
+    }
+    /* round-robin over the nodes: thread t lands on node t % nodes */
+    for (int k = 0; norder < CPU_SETSIZE; ++k) {
+        int added = 0;
+        for (int i = 0; i < nodes; ++i) {
+            if (k < per_node[i]) {
+                order[norder++] = cpus[i][k];
+                added = 1;
+            }
+        }
+        if (!added) break;
+    }
+    if (norder == 0) {
+        /* no sysfs: use the allowed CPUs in order */
+        for (int i = 0; i < CPU_SETSIZE; ++i) {
+            if (CPU_ISSET(i, &l.allowed)) order[norder++] = i;
+        }
+    }
+
+    if (norder > 0) {
+        #pragma omp parallel
+        {
+            cpu_set_t set;
+            int cpu = order[omp_get_thread_num() % norder];
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+                printlog(2, "cannot pin thread %d to cpu %d: %s", omp_get_thread_num(), cpu, strerror(errno));
+            }
+        }
+    }
+
+    for (int i = 0; i < nodes; ++i) free(cpus[i]);
+    free(cpus);
+    free(per_node);
+    free(order);
+}
+
+void mem_policy_log(unsigned int v)
+{
+    char thp[128] = "unknown";
+    FILE *f = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+    if (f != NULL) {
+        if (fgets(thp, sizeof(thp), f) != NULL) remove_newline(thp);
+        fclose(f);
+    }
+    printlog(v, "Table memory: %s%s%s%s%s%s; %d NUMA node(s); THP: %s",
+             policy ? "" : "default",
+             (policy & MEM_HUGEPAGES)  ? " huge" : "",
+             (policy & MEM_HUGETLB)    ? " hugetlb" : "",
+             (policy & MEM_INTERLEAVE) ? " interleave" : "",
+             (policy & MEM_SPREAD)     ? " spread" : "",
+             (policy & MEM_PIN)        ? " pin" : "",
+             mem_numa_nodes(), thp);
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "common.h"
+
+/*
+ * Placement of large hash tables.
+ *
+ * Arrays of at least MEM_MMAP_MIN bytes are mapped with mmap() instead of
+ * calloc(), so that they can be backed by huge pages and follow a NUMA
+ * policy; pages are placed when first touched, i.e. by the inserting thread
+ * unless a policy says otherwise. The policy is process-wide and must be set
+ * before the first bucket is created.
+ */
+#define MEM_MMAP_MIN ((size_t)2 << 20)
+
+enum {
+    MEM_HUGEPAGES  = 1u << 0,   /* transparent huge pages (MADV_HUGEPAGE) */
+    MEM_HUGETLB    = 1u << 1,   /* hugetlbfs pages, falls back to MEM_HUGEPAGES */
+    MEM_INTERLEAVE = 1u << 2,   /* every table interleaved over all nodes */
+    MEM_SPREAD     = 1u << 3,   /* tables of shard i preferably on node i % nodes */
+    MEM_PIN        = 1u << 4,   /* OpenMP thread t pinned to a CPU of node t % nodes */
+};
+
+/* Comma separated list of: huge, hugetlb, interleave, spread, pin, none.
+ * Returns false on an unknown word.
+ */
+bool     mem_policy_parse(const char *spec);
+unsigned mem_policy(void);
+
+/* Number of online NUMA nodes (1 if unknown). */
+int  mem_numa_nodes(void);
+
+/* Preferred node for the tables of a shard, -1 for none. */
+int  mem_shard_node(size_t shard);
+
+/* Zeroed array for a table; 'node' is a preferred NUMA node or -1.
+ * Exits if there is no memory left.
+ */
+void *mem_table_alloc(size_t bytes, int node);
+void  mem_table_free(void *p, size_t bytes);
+
+/* Pins the threads of the current OpenMP team size (see MEM_PIN).
+ * Call outside of parallel regions, after omp_set_num_threads().
+ */
+void mem_pin_threads(void);
+
+/* printlog() the policy, the number of nodes and the THP mode. */
+void mem_policy_log(unsigned int v);
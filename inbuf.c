@@ -0,0 +1,151 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "inbuf.h"
+
+/* Moves the unread input over to the compressed side and starts decoding. */
+static void start_decoder(InputBuffer *in, ZioCodec codec)
+{
+    in->codec = codec;
+    in->z     = zio_decoder_new(codec);
+    in->zpos  = in->pos;
+    in->zend  = in->end;
+    in->zeof  = in->eof;
+    if (!in->map) {
+        in->zbuf      = in->buf;
+        in->buf       = NULL;
+        in->buf_bytes = 0;
+    }
+    in->pos = in->end = NULL;
+    in->eof = false;
+}
+
+void inbuf_open(InputBuffer *in, FILE *fp)
+{
+    memset(in, 0, sizeof(*in));
+    in->fp = fp;
+
+    struct stat st;
+    off_t off = ftello(fp);
+    if (off >= 0 && fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode)) {
+        if (st.st_size <= off) {
+            in->eof = true;
+            return;
+        }
+        void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+        if (map != MAP_FAILED) {
+            madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+            in->map       = (char*)map;
+            in->map_bytes = (size_t)st.st_size;
+            in->pos       = in->map + off;
+            in->end       = in->map + in->map_bytes;
+            in->eof       = true;
+            printlog(2, "input: mapped %zu bytes", in->map_bytes - (size_t)off);
+            ZioCodec codec = zio_detect(in->pos, (size_t)(in->end - in->pos));
+            if (codec != ZIO_NONE) {
+                start_decoder(in, codec);
+            }
+            return;
+        }
+        // not mappable: read it like a pipe
+    }
+
+    // the first block of a pipe tells whether it is compressed
+    inbuf_fill(in, ZIO_MAGIC_MAX);
+    ZioCodec codec = zio_detect(in->pos, (size_t)(in->end - in->pos));
+    if (codec != ZIO_NONE) {
+        start_decoder(in, codec);
+    }
+}
+
+void inbuf_close(InputBuffer *in)
+{
+    if (in->map) {
+        munmap(in->map, in->map_bytes);
+    }
+    free(in->buf);
+    free(in->zbuf);
+    zio_decoder_free(in->z);
+    memset(in, 0, sizeof(*in));
+}
+
+/* Decodes until 'have' reaches 'want' or the input ends; every step fills as
+ * much of the block as it can.
+ */
+static size_t decode(InputBuffer *in, size_t have, size_t want)
+{
+    while (have < want) {
+        if (in->zpos == in->zend && !in->zeof) {
+            if (in->zbuf == NULL && (in->zbuf = malloc(INBUF_BLOCK)) == NULL) {
+                fprintf(stderr, "out of memory for the input buffer\n");
+                exit(EXIT_FAILURE);
+            }
+            size_t got = fread(in->zbuf, 1, INBUF_BLOCK, in->fp);
+            if (got == 0) {
+                if (ferror(in->fp)) {
+                    perror("Error reading input");
+                    exit(EXIT_FAILURE);
+                }
+                in->zeof = true;
+            }
+            in->zpos = in->zbuf;
+            in->zend = in->zbuf + got;
+        }
+        size_t used = 0;
+        bool done = zio_decode(in->z, in->zpos, (size_t)(in->zend - in->zpos), &used,
+                               in->buf, in->buf_bytes, &have, in->zeof);
+        in->zpos += used;
+        if (done) {
+            in->eof = true;
+            break;
+        }
+    }
+    return have;
+}
+
+size_t inbuf_fill(InputBuffer *in, size_t want)
+{
+    size_t have = (size_t)(in->end - in->pos);
+    if (have >= want || in->eof) {
+        return have;
+    }
+
+    if (want > in->buf_bytes) {
+        size_t bytes = in->buf_bytes ? in->buf_bytes : INBUF_BLOCK;
+        while (bytes < want) bytes *= 2;
+        char *buf = malloc(bytes);
+        if (buf == NULL) {
+            fprintf(stderr, "out of memory for the input buffer\n");
+            exit(EXIT_FAILURE);
+        }
+        if (have) memcpy(buf, in->pos, have);
+        free(in->buf);
+        in->buf       = buf;
+        in->buf_bytes = bytes;
+    } else if (have) {
+        memmove(in->buf, in->pos, have);
+    }
+    in->pos = in->buf;
+
+    if (in->z) {
+        have = decode(in, have, want);
+        in->end = in->buf + have;
+        return have;
+    }
+
+    // one large read normally; more only for a short read of a slow pipe
+    while (have < want) {
+        size_t got = fread(in->buf + have, 1, in->buf_bytes - have, in->fp);
+        have += got;
+        if (got == 0) {
+            if (ferror(in->fp)) {
+                perror("Error reading input");
+                exit(EXIT_FAILURE);
+            }
+            in->eof = true;
+            break;
+        }
+    }
+    in->end = in->buf + have;
+    return have;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "common.h"
+#include "zio.h"
+
+#if defined(__SSE2__)
+#   include <emmintrin.h>
+#endif
+
+/*
+ * Input buffer: the unread input as one contiguous span, without stdio.
+ *
+ * A regular file is mapped as a whole (from the current offset of the
+ * FILE) and read in place. A pipe or terminal is read with large fread()s
+ * into a block that grows as needed; what was not consumed yet is moved to
+ * the front before the next read. Lines are handed out as (pointer, length)
+ * spans into the map or the block, found with a 16-byte SIMD compare where
+ * SSE2 is available and memchr() otherwise, so no line is ever copied.
+ *
+ * Compressed input (xz or zstd, see zio.h) is recognised by its first
+ * bytes and decoded into the block instead of being read into it; the
+ * compressed bytes come from the map or from fread()s of their own.
+ *
+ * A span stays valid until the next inbuf_fill() (of a pipe or compressed
+ * input; spans of a plain map live until inbuf_close()).
+ */
+#define INBUF_BLOCK ((size_t)1 << 20)
+
+typedef struct {
+    FILE        *fp;
+    const char  *pos, *end;     /* unread input */
+    char        *map;           /* mapped file, or NULL */
+    size_t       map_bytes;
+    char        *buf;           /* block read from a pipe, or decoded */
+    size_t       buf_bytes;
+    bool         eof;           /* nothing left to read beyond 'end' */
+
+    ZioDecoder  *z;             /* decoder of compressed input, or NULL */
+    ZioCodec     codec;
+    const char  *zpos, *zend;   /* compressed bytes not decoded yet */
+    char        *zbuf;          /* compressed block read from a pipe */
+    bool         zeof;          /* nothing to read beyond 'zend' */
+} InputBuffer;
+
+/* Maps 'fp' if it is a regular file; otherwise reads happen on demand. A
+ * compressed input is detected here, which reads a first block of a pipe.
+ */
+void inbuf_open(InputBuffer *in, FILE *fp);
+
+/* Unmaps or frees; does not close fp. */
+void inbuf_close(InputBuffer *in);
+
+/* Makes at least 'want' unread bytes contiguous at in->pos, unless the
+ * input ends first; returns the number of unread bytes.
+ */
+size_t inbuf_fill(InputBuffer *in, size_t want);
+
+static INLINE const char *inbuf_find_newline(const char *p, const char *end)
+{
+#if defined(__SSE2__)
+    const __m128i nl = _mm_set1_epi8('\n');
+    while (end - p >= 16) {
+        unsigned m = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), nl));
+        if (m) {
+            return p + __builtin_ctz(m);
+        }
+        p += 16;
+    }
+#endif
+    return (const char*)memchr(p, '\n', (size_t)(end - p));
+}
+
+/* Next line, without its '\n'; false at the end of the input. A last line
+ * without '\n' counts.
+ */
+static INLINE bool inbuf_line(InputBuffer *in, const char **line, size_t *len)
+{
+    size_t scanned = 0;
+    while (true) {
+        const char *nl = inbuf_find_newline(in->pos + scanned, in->end);
+        if (nl != NULL) {
+            *line   = in->pos;
+            *len    = (size_t)(nl - in->pos);
+            in->pos = nl + 1;
+            return true;
+        }
+        scanned = (size_t)(in->end - in->pos);
+        if (in->eof || inbuf_fill(in, scanned + 1) == scanned) {
+            if (scanned == 0) {
+                return false;
+            }
+            *line   = in->pos;
+            *len    = scanned;
+            in->pos = in->end;
+            return true;
+        }
+    }
+}
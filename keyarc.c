@@ -0,0 +1,275 @@
+#include <assert.h>
+#include <getopt.h>
+#include <omp.h>
+#include <sys/stat.h>
+
+#include "cpudispatch.h"
+#include "d6batch.h"
+#include "keyarchive.h"
+#include "keysort.h"
+#include "keystream.h"
+
+void help(const char *progname) {
+    if (progname == NULL) progname = "keyarc";
+    printf("Usage: %s [options]\n", progname);
+    printf("Write sorted unique d6-packed graphs (or a key stream) from stdin as a key\n");
+    printf("archive to stdout, or read an archive back.\n\n");
+    printf("Options:\n");
+    printf("  -s           Sort the input and drop duplicates first (in memory); without it\n");
+    printf("               the input must be sorted and unique already (uniqueg --sort).\n");
+    printf("  -b NUM       Keys per block (default: %d).\n", KEYARCHIVE_BLOCK_KEYS);
+    printf("  -x           Extract: write the keys of the archive as digraph6 lines,\n");
+    printf("               decoding the blocks in parallel if the archive is a file.\n");
+    printf("  -B           With -x, write a binary key stream instead.\n");
+    printf("  -l           List the archive: header, blocks, sizes; decodes every block.\n");
+    printf("  -q FILE      Write the graphs of FILE that are in the archive.\n");
+    printf("  -j NUM       Number of OpenMP threads (default: %d).\n", omp_get_max_threads());
+    printf("  -v           Increase verbosity (can be repeated).\n");
+    printf("  -i FILE      Read input from FILE instead of stdin.\n");
+    printf("  -o FILE      Write output to FILE instead of stdout.\n");
+    printf("  -h           Show this help message and exit.\n\n");
+    printf("Every tool reads archives as input, also from a pipe.\n\n");
+    printf("Examples:\n");
+    printf("  %s -s -i 09-rbm-all.d6 -o 09-rbm-all.d6a\n", progname);
+    printf("  %s -x -i 09-rbm-all.d6a | ./orientedf\n", progname);
+    printf("  ./orientedf < 09-rbm-all.d6a | wc -l\n");
+}
+
+static void write_archive(KeyStream *in, FILE *out, bool sort, uint32_t block_keys)
+{
+    KeyArchiveWriter w;
+    keyarchive_writer_init(&w, out, in->n, in->flags & KEYSTREAM_CANONICAL, block_keys);
+
+    key128_t k;
+    if (sort) {
+        size_t cap = 1 << 20, cnt = 0;
+        key128_t *keys = malloc(cap * sizeof(key128_t));
+        assert(keys != NULL);
+        while ((cnt += keystream_read(in, keys + cnt, cap - cnt)) == cap) {
+            cap *= 2;
+            keys = realloc(keys, cap * sizeof(key128_t));
+            assert(keys != NULL);
+        }
+        key128_t *tmp = malloc(cnt * sizeof(key128_t) + 1);
+        assert(tmp != NULL);
+        keys_radix_sort(keys, cnt, tmp);
+        free(tmp);
+        cnt = keys_unique(keys, cnt);
+        for (size_t i = 0; i < cnt; ++i) {
+            keyarchive_put(&w, &keys[i]);
+        }
+        free(keys);
+    } else {
+        while (keystream_next(in, &k)) {
+            if (!keyarchive_put(&w, &k)) {
+                fprintf(stderr, "input is not sorted and unique at graph %lu (use -s or uniqueg --sort)\n",
+                        (unsigned long)in->records);
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    uint64_t records = w.records, blocks = w.nblocks + (w.count > 0);
+    uint64_t bytes = keyarchive_writer_close(&w);
+    printlog(1, "Archived %lu keys in %lu blocks, %lu bytes (%.2f per key)",
+             (unsigned long)records, (unsigned long)blocks, (unsigned long)bytes,
+             records ? (double)bytes / records : 0.0);
+}
+
+/* Decodes every block of 'a' in parallel; with 'out' the keys are written
+ * in order, as text or as a key stream. Returns the bytes of the keys as
+ * digraph6 text.
+ */
+static uint64_t decode_all(const KeyArchive *a, FILE *out, bool binary)
+{
+    uint64_t text_bytes = 0;
+
+    #pragma omp parallel reduction(+:text_bytes)
+    {
+        key128_t *keys = malloc(a->block_keys * sizeof(key128_t));
+        char *text = malloc((size_t)a->block_keys * (MAXLINE + 1) + D6BATCH_SLACK);
+        assert(keys != NULL && text != NULL);
+
+        #pragma omp for ordered schedule(dynamic, 1)
+        for (size_t i = 0; i < a->nblocks; ++i) {
+            size_t cnt = keyarchive_block(a, i, keys);
+            size_t len = d6batch_encode(keys, cnt, text);
+            text_bytes += len;
+
+            #pragma omp ordered
+            if (out != NULL) {
+                const void *p = binary ? (const void*)keys : (const void*)text;
+                size_t bytes  = binary ? cnt * sizeof(key128_t) : len;
+                if (fwrite(p, 1, bytes, out) != bytes) {
+                    perror("Error writing output");
+                    exit(EXIT_FAILURE);
+                }
+            }
+        }
+        free(keys);
+        free(text);
+    }
+    return text_bytes;
+}
+
+static void list_archive(const KeyArchive *a)
+{
+    uint64_t text_bytes = decode_all(a, NULL, false);
+    printf("n:           %u\n", a->n);
+    printf("flags:      %s%s%s\n",
+           (a->flags & KEYSTREAM_CANONICAL) ? " canonical" : "",
+           (a->flags & KEYSTREAM_UNIQUE) ? " unique" : "",
+           (a->flags & KEYSTREAM_SORTED) ? " sorted" : "");
+    printf("keys:        %lu\n", (unsigned long)a->records);
+    printf("blocks:      %zu of up to %u keys\n", a->nblocks, a->block_keys);
+    printf("bytes:       %lu (%.2f per key)\n", (unsigned long)a->bytes,
+           a->records ? (double)a->bytes / a->records : 0.0);
+    printf("as digraph6: %lu bytes (%.1fx), as key stream: %lu bytes (%.1fx)\n",
+           (unsigned long)text_bytes, a->bytes ? (double)text_bytes / a->bytes : 0.0,
+           (unsigned long)(KEYSTREAM_HEADER + 16 * a->records),
+           a->bytes ? (double)(KEYSTREAM_HEADER + 16 * a->records) / a->bytes : 0.0);
+}
+
+static void query(const KeyArchive *a, FILE *fp, FILE *out)
+{
+    KeyStream ks;
+    if (!keystream_open(&ks, fp)) {
+        exit(EXIT_FAILURE);
+    }
+    key128_t k;
+    uint64_t found = 0;
+    while (keystream_next(&ks, &k)) {
+        if (keyarchive_find(a, &k)) {
+            keystream_put(out, &k, false);
+            found++;
+        }
+    }
+    printlog(1, "%lu of %lu graphs are in the archive", (unsigned long)found, (unsigned long)ks.records);
+    keystream_close(&ks);
+}
+
+int main(int argc, char *argv[]) {
+
+    tic();
+    FILE *in = stdin, *out = stdout;
+    bool sort = false, extract = false, list = false, binary = false;
+    const char *query_path = NULL;
+    uint32_t block_keys = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "sb:xBlq:j:vi:o:h")) != -1) {
+        switch (opt) {
+        case 's':
+            sort = true;
+            break;
+        case 'b':
+            block_keys = (uint32_t)atol(optarg);
+            if (block_keys == 0) {
+                fprintf(stderr, "Invalid -b value: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'x':
+            extract = true;
+            break;
+        case 'B':
+            binary = true;
+            break;
+        case 'l':
+            list = true;
+            break;
+        case 'q':
+            query_path = optarg;
+            break;
+        case 'j':
+            omp_set_num_threads(atoi(optarg));
+            break;
+        case 'v':
+            increase_verbosity();
+            break;
+        case 'i':
+            in = fopen(optarg, "r");
+            if (in == NULL) {
+                perror("Error opening input file");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'o':
+            out = fopen(optarg, "w");
+            if (out == NULL) {
+                perror("Error opening output file");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'h':
+            help(argv[0]);
+            exit(EXIT_SUCCESS);
+        default: /* '?' */
+            help(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    cpu_dispatch_log(1);
+    if (extract + list + (query_path != NULL) > 1) {
+        fprintf(stderr, "-x, -l and -q cannot be combined\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (!extract && !list && query_path == NULL) {
+        KeyStream ks;
+        if (!keystream_open(&ks, in)) {
+            exit(EXIT_FAILURE);
+        }
+        keystream_log(&ks, 1);
+        write_archive(&ks, out, sort, block_keys);
+        keystream_close(&ks);
+    } else {
+        struct stat st;
+        if (extract && (fstat(fileno(in), &st) != 0 || !S_ISREG(st.st_mode))) {
+            // a pipe: decode the blocks one after the other
+            KeyStream ks;
+            if (!keystream_open(&ks, in)) {
+                exit(EXIT_FAILURE);
+            }
+            if (!ks.archive) {
+                fprintf(stderr, "input is not a key archive\n");
+                exit(EXIT_FAILURE);
+            }
+            if (binary) {
+                keystream_write_header(out, ks.n, ks.flags);
+            }
+            key128_t k;
+            while (keystream_next(&ks, &k)) {
+                keystream_put(out, &k, binary);
+            }
+            keystream_close(&ks);
+        } else {
+            KeyArchive a;
+            if (!keyarchive_load(&a, in)) {
+                exit(EXIT_FAILURE);
+            }
+            printlog(1, "Archive of %lu keys in %zu blocks", (unsigned long)a.records, a.nblocks);
+            if (extract) {
+                if (binary) {
+                    keystream_write_header(out, a.n, a.flags);
+                }
+                decode_all(&a, out, binary);
+            } else if (list) {
+                list_archive(&a);
+            } else {
+                FILE *fp = fopen(query_path, "r");
+                if (fp == NULL) {
+                    perror("Error opening query file");
+                    exit(EXIT_FAILURE);
+                }
+                query(&a, fp, out);
+                fclose(fp);
+            }
+            keyarchive_free(&a);
+        }
+    }
+
+    if (in != stdin) fclose(in);
+    if (out != stdout) fclose(out);
+    return 0;
+}
@@ -0,0 +1,394 @@
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "common.h"
+
+#include "keyarchive.h"
+#include "keystream.h"
+
+#define TRAILER_MAGIC "D6AI"
+
+/* A key as the 128-bit integer of key128_cmp(), in two halves. */
+typedef struct {
+    uint64_t lo, hi;
+} u128;
+
+static INLINE u128 key_u128(const key128_t *k)
+{
+    u128 x;
+    memcpy(&x.lo, k->b, 8);
+    memcpy(&x.hi, k->b + 8, 8);
+    return x;
+}
+
+static INLINE void u128_key(u128 x, key128_t *k)
+{
+    memcpy(k->b, &x.lo, 8);
+    memcpy(k->b + 8, &x.hi, 8);
+}
+
+static INLINE void put_u32(unsigned char *p, uint32_t v)
+{
+    for (int i = 0; i < 4; ++i) p[i] = (unsigned char)(v >> (8 * i));
+}
+
+static INLINE void put_u64(unsigned char *p, uint64_t v)
+{
+    for (int i = 0; i < 8; ++i) p[i] = (unsigned char)(v >> (8 * i));
+}
+
+static INLINE uint32_t get_u32(const unsigned char *p)
+{
+    uint32_t v = 0;
+    for (int i = 3; i >= 0; --i) v = (v << 8) | p[i];
+    return v;
+}
+
+static INLINE uint64_t get_u64(const unsigned char *p)
+{
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; --i) v = (v << 8) | p[i];
+    return v;
+}
+
+static INLINE size_t varint_put(unsigned char *p, u128 d)
+{
+    size_t len = 0;
+    while (d.hi || d.lo >= 0x80) {
+        p[len++] = (unsigned char)(d.lo | 0x80);
+        d.lo = (d.lo >> 7) | (d.hi << 57);
+        d.hi >>= 7;
+    }
+    p[len++] = (unsigned char)d.lo;
+    return len;
+}
+
+/* prev + the delta at *p; advances *p, NULL if the delta runs past 'end'
+ * or is longer than any 128-bit one.
+ */
+static INLINE const unsigned char *varint_add(const unsigned char *p, const unsigned char *end, u128 *x)
+{
+    u128 d = { 0, 0 };
+    unsigned shift = 0;
+    unsigned char c;
+    do {
+        if (p == end || shift >= 7 * KEYARCHIVE_VARINT_MAX) return NULL;
+        c = *p++;
+        uint64_t v = c & 0x7F;
+        if (shift < 64) {
+            d.lo |= v << shift;
+            if (shift > 57) d.hi |= v >> (64 - shift);
+        } else {
+            d.hi |= v << (shift - 64);
+        }
+        shift += 7;
+    } while (c & 0x80);
+    uint64_t lo = x->lo + d.lo;
+    x->hi += d.hi + (lo < x->lo);
+    x->lo = lo;
+    return p;
+}
+
+static void write_bytes(KeyArchiveWriter *w, const void *p, size_t len)
+{
+    if (fwrite(p, 1, len, w->fp) != len) {
+        perror("Error writing archive");
+        exit(EXIT_FAILURE);
+    }
+    w->offset += len;
+}
+
+void keyarchive_writer_init(KeyArchiveWriter *w, FILE *fp, unsigned n, unsigned flags, uint32_t block_keys)
+{
+    memset(w, 0, sizeof(*w));
+    w->fp         = fp;
+    w->block_keys = block_keys ? block_keys : KEYARCHIVE_BLOCK_KEYS;
+    w->deltas     = malloc((size_t)w->block_keys * KEYARCHIVE_VARINT_MAX);
+    if (w->deltas == NULL) {
+        fprintf(stderr, "out of memory for an archive block\n");
+        exit(EXIT_FAILURE);
+    }
+
+    unsigned char h[KEYARCHIVE_HEADER] = { 0 };
+    memcpy(h, KEYARCHIVE_MAGIC, 4);
+    h[4] = KEYARCHIVE_VERSION;
+    h[5] = (unsigned char)n;
+    flags |= KEYSTREAM_SORTED | KEYSTREAM_UNIQUE;
+    h[6] = (unsigned char)(flags & 0xFF);
+    h[7] = (unsigned char)(flags >> 8);
+    put_u32(h + 8, w->block_keys);
+    write_bytes(w, h, sizeof(h));
+}
+
+static void flush_block(KeyArchiveWriter *w)
+{
+    if (w->count == 0) return;
+    if (w->nblocks == w->index_cap) {
+        w->index_cap = w->index_cap ? 2 * w->index_cap : 1024;
+        w->index = realloc(w->index, w->index_cap * sizeof(*w->index));
+        if (w->index == NULL) {
+            fprintf(stderr, "out of memory for the archive index\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    w->index[w->nblocks++] = (KeyArchiveEntry){ w->offset, w->records - w->count, w->first };
+
+    unsigned char h[8];
+    put_u32(h, w->count);
+    put_u32(h + 4, (uint32_t)w->used);
+    write_bytes(w, h, sizeof(h));
+    write_bytes(w, &w->first, sizeof(key128_t));
+    write_bytes(w, w->deltas, w->used);
+    w->count = 0;
+    w->used  = 0;
+}
+
+bool keyarchive_put(KeyArchiveWriter *w, const key128_t *k)
+{
+    u128 x = key_u128(k);
+    if (w->records > 0) {
+        u128 p = key_u128(&w->prev);
+        if (x.hi < p.hi || (x.hi == p.hi && x.lo <= p.lo)) {
+            return false;
+        }
+        if (w->count > 0) {
+            u128 d = { x.lo - p.lo, x.hi - p.hi - (x.lo < p.lo) };
+            w->used += varint_put(w->deltas + w->used, d);
+        }
+    }
+    if (w->count == 0) {
+        w->first = *k;
+    }
+    w->prev = *k;
+    w->records++;
+    if (++w->count == w->block_keys) {
+        flush_block(w);
+    }
+    return true;
+}
+
+uint64_t keyarchive_writer_close(KeyArchiveWriter *w)
+{
+    flush_block(w);
+
+    unsigned char end[8] = { 0 };
+    write_bytes(w, end, sizeof(end));
+
+    uint64_t index_offset = w->offset;
+    for (size_t i = 0; i < w->nblocks; ++i) {
+        unsigned char e[32];
+        put_u64(e, w->index[i].offset);
+        put_u64(e + 8, w->index[i].first_record);
+        memcpy(e + 16, &w->index[i].first, sizeof(key128_t));
+        write_bytes(w, e, sizeof(e));
+    }
+
+    unsigned char t[KEYARCHIVE_TRAILER] = { 0 };
+    memcpy(t, TRAILER_MAGIC, 4);
+    put_u64(t + 8, w->nblocks);
+    put_u64(t + 16, w->records);
+    put_u64(t + 24, index_offset);
+    write_bytes(w, t, sizeof(t));
+    if (fflush(w->fp) != 0) {
+        perror("Error writing archive");
+        exit(EXIT_FAILURE);
+    }
+
+    free(w->deltas);
+    free(w->index);
+    w->deltas = NULL;
+    w->index  = NULL;
+    return w->offset;
+}
+
+bool keyarchive_parse_header(const unsigned char *h, unsigned *n, unsigned *flags, uint32_t *block_keys)
+{
+    if (memcmp(h, KEYARCHIVE_MAGIC, 4) != 0) {
+        fprintf(stderr, "input is not a key archive\n");
+        return false;
+    }
+    if (h[4] != KEYARCHIVE_VERSION) {
+        fprintf(stderr, "key archive version %u is not supported (expected %u)\n", h[4], KEYARCHIVE_VERSION);
+        return false;
+    }
+    *block_keys = get_u32(h + 8);
+    if (h[5] > 11 || *block_keys == 0) {
+        fprintf(stderr, "key archive header is damaged\n");
+        return false;
+    }
+    *n     = h[5];
+    *flags = (unsigned)h[6] | ((unsigned)h[7] << 8);
+    return true;
+}
+
+static void damaged(const char *what)
+{
+    fprintf(stderr, "key archive is damaged: %s\n", what);
+    exit(EXIT_FAILURE);
+}
+
+size_t keyarchive_block_size(const unsigned char *h)
+{
+    uint32_t count = get_u32(h), bytes = get_u32(h + 4);
+    if (count == 0) {
+        return 0;
+    }
+    if (bytes > (uint64_t)(count - 1) * KEYARCHIVE_VARINT_MAX) damaged("bad block header");
+    return 8 + sizeof(key128_t) + bytes;
+}
+
+void keyarchive_cursor_start(KeyArchiveCursor *c, const unsigned char *b, key128_t *k)
+{
+    c->left = get_u32(b) - 1;
+    c->p    = b + 8 + sizeof(key128_t);
+    c->end  = c->p + get_u32(b + 4);
+    memcpy(&c->prev, b + 8, sizeof(key128_t));
+    *k = c->prev;
+}
+
+bool keyarchive_cursor_next(KeyArchiveCursor *c, key128_t *k)
+{
+    if (c->left == 0) {
+        if (c->p != c->end) damaged("block longer than its keys");
+        return false;
+    }
+    u128 x = key_u128(&c->prev);
+    if ((c->p = varint_add(c->p, c->end, &x)) == NULL) damaged("bad delta");
+    u128_key(x, &c->prev);
+    c->left--;
+    *k = c->prev;
+    return true;
+}
+
+bool keyarchive_load(KeyArchive *a, FILE *fp)
+{
+    memset(a, 0, sizeof(*a));
+    a->fd = fileno(fp);
+
+    struct stat st;
+    if (fstat(a->fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        fprintf(stderr, "key archive must be a regular file for random access\n");
+        return false;
+    }
+    a->bytes = (uint64_t)st.st_size;
+
+    unsigned char h[KEYARCHIVE_HEADER], t[KEYARCHIVE_TRAILER];
+    if (a->bytes < KEYARCHIVE_HEADER + 8 + KEYARCHIVE_TRAILER ||
+        pread(a->fd, h, sizeof(h), 0) != (ssize_t)sizeof(h) ||
+        pread(a->fd, t, sizeof(t), (off_t)(a->bytes - sizeof(t))) != (ssize_t)sizeof(t)) {
+        fprintf(stderr, "input is too short for a key archive\n");
+        return false;
+    }
+    if (!keyarchive_parse_header(h, &a->n, &a->flags, &a->block_keys)) {
+        return false;
+    }
+
+    a->nblocks = get_u64(t + 8);
+    a->records = get_u64(t + 16);
+    uint64_t index_offset = get_u64(t + 24);
+    if (memcmp(t, TRAILER_MAGIC, 4) != 0 ||
+        index_offset + 32 * (uint64_t)a->nblocks + KEYARCHIVE_TRAILER != a->bytes) {
+        fprintf(stderr, "key archive has no valid index (truncated?)\n");
+        return false;
+    }
+
+    size_t bytes = 32 * a->nblocks;
+    unsigned char *raw = malloc(bytes + 1);
+    a->index = malloc((a->nblocks + 1) * sizeof(KeyArchiveEntry));
+    if (raw == NULL || a->index == NULL) {
+        fprintf(stderr, "out of memory for the archive index\n");
+        exit(EXIT_FAILURE);
+    }
+    if (pread(a->fd, raw, bytes, (off_t)index_offset) != (ssize_t)bytes) {
+        perror("Error reading archive index");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < a->nblocks; ++i) {
+        a->index[i].offset       = get_u64(raw + 32 * i);
+        a->index[i].first_record = get_u64(raw + 32 * i + 8);
+        memcpy(&a->index[i].first, raw + 32 * i + 16, sizeof(key128_t));
+    }
+    // the sentinel ends the last block at its end mark
+    a->index[a->nblocks].offset       = index_offset - 8;
+    a->index[a->nblocks].first_record = a->records;
+    free(raw);
+    return true;
+}
+
+void keyarchive_free(KeyArchive *a)
+{
+    free(a->index);
+    a->index = NULL;
+}
+
+size_t keyarchive_block(const KeyArchive *a, size_t i, key128_t *keys)
+{
+    const KeyArchiveEntry *e = &a->index[i];
+    uint64_t count = e[1].first_record - e->first_record;
+    uint64_t bytes = e[1].offset - e->offset;
+    if (count == 0 || count > a->block_keys || bytes < 8 + sizeof(key128_t) ||
+        bytes > 8 + sizeof(key128_t) + count * KEYARCHIVE_VARINT_MAX) {
+        damaged("bad index entry");
+    }
+
+    unsigned char *buf = malloc(bytes);
+    if (buf == NULL) {
+        fprintf(stderr, "out of memory for an archive block\n");
+        exit(EXIT_FAILURE);
+    }
+    if (pread(a->fd, buf, bytes, (off_t)e->offset) != (ssize_t)bytes) {
+        perror("Error reading archive");
+        exit(EXIT_FAILURE);
+    }
+    if (get_u32(buf) != count || get_u32(buf + 4) != bytes - 8 - sizeof(key128_t)) {
+        damaged("block does not match the index");
+    }
+
+    const unsigned char *p = buf + 8 + sizeof(key128_t), *end = buf + bytes;
+    memcpy(&keys[0], buf + 8, sizeof(key128_t));
+    u128 x = key_u128(&keys[0]);
+    for (size_t j = 1; j < count; ++j) {
+        if ((p = varint_add(p, end, &x)) == NULL) damaged("bad delta");
+        u128_key(x, &keys[j]);
+    }
+    if (p != end) damaged("block longer than its keys");
+    free(buf);
+    return (size_t)count;
+}
+
+static INLINE int cmp_u128(u128 a, u128 b)
+{
+    if (a.hi != b.hi) return a.hi < b.hi ? -1 : 1;
+    return (a.lo > b.lo) - (a.lo < b.lo);
+}
+
+bool keyarchive_find(const KeyArchive *a, const key128_t *k)
+{
+    u128 x = key_u128(k);
+    // the last block whose first key is <= k
+    size_t lo = 0, hi = a->nblocks;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (cmp_u128(key_u128(&a->index[mid].first), x) <= 0) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo == 0) {
+        return false;
+    }
+
+    key128_t *keys = malloc(a->block_keys * sizeof(key128_t));
+    if (keys == NULL) {
+        fprintf(stderr, "out of memory for an archive block\n");
+        exit(EXIT_FAILURE);
+    }
+    size_t cnt = keyarchive_block(a, lo - 1, keys);
+    size_t l = 0, h = cnt;
+    while (l < h) {
+        size_t mid = l + (h - l) / 2;
+        if (cmp_u128(key_u128(&keys[mid]), x) < 0) l = mid + 1;
+        else h = mid;
+    }
+    bool found = l < cnt && cmp_u128(key_u128(&keys[l]), x) == 0;
+    free(keys);
+    return found;
+}
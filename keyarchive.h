@@ -0,0 +1,148 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "common.h"
+
+/*
+ * Key archives: sorted unique key sets, delta and varint coded in blocks.
+ *
+ * A census is a set of canonical forms; sorted, neighbouring keys share
+ * their high bits (the first rows of the matrix), so the difference of two
+ * neighbours is a much smaller number than the key. An archive stores
+ * every key but the first of a block as that difference to its predecessor,
+ * a 128-bit unsigned integer in LEB128 (7 bits per byte, low groups first,
+ * high bit set on all bytes but the last).
+ *
+ *   offset  size  field
+ *        0     4  magic "\x89D6A"
+ *        4     1  version, KEYARCHIVE_VERSION
+ *        5     1  n, as in a key stream; 0 if not fixed
+ *        6     2  flags, KEYSTREAM_* of keystream.h (SORTED and UNIQUE always)
+ *        8     4  keys per block the writer used
+ *       12     4  reserved, zero
+ *       16        blocks
+ *
+ *   block:  4  count of keys (> 0)
+ *           4  bytes of deltas
+ *          16  first key, as in a key stream
+ *              count - 1 deltas
+ *   end:    4  zero
+ *           4  zero
+ *   index:     one entry per block, 32 bytes:
+ *           8  offset of the block
+ *           8  number of keys before the block
+ *          16  first key of the block
+ *   trailer:4  magic "D6AI"
+ *           4  reserved, zero
+ *           8  number of blocks
+ *           8  number of keys
+ *           8  offset of the index
+ *
+ * Integers are little endian, keys are laid out as in a key stream (see
+ * keystream.h). Blocks decode independently of each other: a reader of a
+ * pipe goes through the blocks up to the end mark, a reader of a file
+ * finds the index from the trailer at the end and decodes any block, or
+ * many in parallel, by its offset.
+ */
+#define KEYARCHIVE_MAGIC      "\x89" "D6A"
+#define KEYARCHIVE_VERSION    1
+#define KEYARCHIVE_HEADER     16
+#define KEYARCHIVE_TRAILER    32
+#define KEYARCHIVE_BLOCK_KEYS 4096
+#define KEYARCHIVE_VARINT_MAX 19    /* bytes of the largest 128-bit delta */
+
+typedef struct {
+    uint64_t offset;
+    uint64_t first_record;
+    key128_t first;
+} KeyArchiveEntry;
+
+/* Writing: keys must come in increasing key128_cmp() order. */
+typedef struct {
+    FILE            *fp;
+    uint32_t         block_keys;
+    uint32_t         count;         /* keys of the open block */
+    key128_t         first, prev;
+    unsigned char   *deltas;
+    size_t           used;
+    uint64_t         offset;        /* bytes written so far */
+    uint64_t         records;
+    KeyArchiveEntry *index;
+    size_t           nblocks, index_cap;
+} KeyArchiveWriter;
+
+/* Writes the header to 'fp', which must be at the start of the output;
+ * 'block_keys' 0 selects KEYARCHIVE_BLOCK_KEYS.
+ */
+void keyarchive_writer_init(KeyArchiveWriter *w, FILE *fp, unsigned n, unsigned flags, uint32_t block_keys);
+
+/* Appends a key; false (and nothing written) unless it is greater than the
+ * previous one.
+ */
+bool keyarchive_put(KeyArchiveWriter *w, const key128_t *k);
+
+/* Writes the last block, the end mark, the index and the trailer, and
+ * flushes 'fp'. Returns the size of the archive.
+ */
+uint64_t keyarchive_writer_close(KeyArchiveWriter *w);
+
+/* Header of an archive; 'h' holds its KEYARCHIVE_HEADER bytes. False, with
+ * a message, unless they are a supported archive header.
+ */
+bool keyarchive_parse_header(const unsigned char *h, unsigned *n, unsigned *flags, uint32_t *block_keys);
+
+/* Sequential reading of the blocks after the header, e.g. from a pipe: the
+ * reader makes each block contiguous in memory and decodes it in place.
+ */
+typedef struct {
+    const unsigned char *p, *end;   /* deltas left in the current block */
+    uint32_t left;                  /* keys left in the current block */
+    bool     done;                  /* the end mark was read */
+    key128_t prev;
+} KeyArchiveCursor;
+
+/* Size of the block whose 8-byte header is at 'h', header included; 0 for
+ * the end mark. Exits on a damaged header.
+ */
+size_t keyarchive_block_size(const unsigned char *h);
+
+/* Starts on the block at 'b' (keyarchive_block_size() bytes, which must
+ * stay in place while its keys are read) and returns its first key in 'k'.
+ */
+void keyarchive_cursor_start(KeyArchiveCursor *c, const unsigned char *b, key128_t *k);
+
+/* Next key of the current block; false when it has no more. Exits on a
+ * damaged block.
+ */
+bool keyarchive_cursor_next(KeyArchiveCursor *c, key128_t *k);
+
+/* Random access to an archive in a regular file. */
+typedef struct {
+    int              fd;
+    unsigned         n, flags;
+    uint32_t         block_keys;
+    uint64_t         records;
+    uint64_t         bytes;         /* size of the archive */
+    size_t           nblocks;
+    KeyArchiveEntry *index;         /* plus a sentinel entry at the index offset */
+} KeyArchive;
+
+/* Reads the header, trailer and index of the archive in 'fp' (which is
+ * not closed by the archive). False, with a message, if 'fp' is not a
+ * seekable complete archive.
+ */
+bool keyarchive_load(KeyArchive *a, FILE *fp);
+void keyarchive_free(KeyArchive *a);
+
+/* Decodes block 'i' into 'keys' (room for block_keys) and returns the
+ * number of keys. Safe to call from several threads; exits on a damaged
+ * block.
+ */
+size_t keyarchive_block(const KeyArchive *a, size_t i, key128_t *keys);
+
+/* Whether 'k' is in the archive: a binary search of the index, then of one
+ * decoded block.
+ */
+bool keyarchive_find(const KeyArchive *a, const key128_t *k);
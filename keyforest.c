@@ -0,0 +1,125 @@
+#include "common.h"
+
+#include "flatset.h"   /* key128_mix */
+#include "keyforest.h"
+
+static size_t index_slot(const KeyForest *f, const key128_t *k)
+{
+    return (size_t)key128_mix(k) & (f->index_cap - 1);
+}
+
+static void index_rebuild(KeyForest *f, size_t cap)
+{
+    free(f->index);
+    f->index_cap = cap;
+    f->index = (uint32_t*)calloc(cap, sizeof(uint32_t));
+    if (f->index == NULL) {
+        fprintf(stderr, "keyforest: out of memory for %zu slots\n", cap);
+        exit(EXIT_FAILURE);
+    }
+    for (size_t v = 0; v < f->count; ++v) {
+        size_t i = index_slot(f, &f->keys[v]);
+        while (f->index[i]) i = (i + 1) & (cap - 1);
+        f->index[i] = (uint32_t)v + 1;
+    }
+}
+
+void keyforest_init(KeyForest *f, size_t cap_hint)
+{
+    memset(f, 0, sizeof(*f));
+    f->cap    = cap_hint > 16 ? cap_hint : 16;
+    f->keys   = (key128_t*)malloc(f->cap * sizeof(key128_t));
+    f->parent = (_Atomic uint32_t*)malloc(f->cap * sizeof(uint32_t));
+    size_t icap = 32;
+    while (icap < 2 * f->cap) icap *= 2;
+    index_rebuild(f, icap);
+}
+
+void keyforest_free(KeyForest *f)
+{
+    free(f->keys);
+    free((void*)f->parent);
+    free(f->index);
+    memset(f, 0, sizeof(*f));
+}
+
+int64_t keyforest_lookup(const KeyForest *f, const key128_t *k)
+{
+    for (size_t i = index_slot(f, k); f->index[i]; i = (i + 1) & (f->index_cap - 1)) {
+        uint32_t v = f->index[i] - 1;
+        if (key128_equal(&f->keys[v], k)) {
+            return v;
+        }
+    }
+    return -1;
+}
+
+uint32_t keyforest_add(KeyForest *f, const key128_t *k, bool *added)
+{
+    int64_t found = keyforest_lookup(f, k);
+    *added = found < 0;
+    if (found >= 0) {
+        return (uint32_t)found;
+    }
+    if (f->count == UINT32_MAX) {
+        fprintf(stderr, "keyforest: more than %u keys\n", UINT32_MAX);
+        exit(EXIT_FAILURE);
+    }
+    if (f->count == f->cap) {
+        f->cap *= 2;
+        f->keys   = (key128_t*)realloc(f->keys, f->cap * sizeof(key128_t));
+        f->parent = (_Atomic uint32_t*)realloc((void*)f->parent, f->cap * sizeof(uint32_t));
+        if (f->keys == NULL || f->parent == NULL) {
+            fprintf(stderr, "keyforest: out of memory for %zu keys\n", f->cap);
+            exit(EXIT_FAILURE);
+        }
+    }
+    uint32_t v = (uint32_t)f->count++;
+    f->keys[v] = *k;
+    atomic_init(&f->parent[v], v);
+    if (2 * f->count > f->index_cap) {
+        index_rebuild(f, 2 * f->index_cap);
+    } else {
+        size_t i = index_slot(f, k);
+        while (f->index[i]) i = (i + 1) & (f->index_cap - 1);
+        f->index[i] = v + 1;
+    }
+    return v;
+}
+
+uint32_t keyforest_find(KeyForest *f, uint32_t v)
+{
+    for (;;) {
+        uint32_t p = atomic_load_explicit(&f->parent[v], memory_order_relaxed);
+        if (p == v) {
+            return v;
+        }
+        uint32_t g = atomic_load_explicit(&f->parent[p], memory_order_relaxed);
+        if (g != p) {
+            // path halving; losing the race only leaves the path longer
+            atomic_compare_exchange_weak_explicit(&f->parent[v], &p, g,
+                                                  memory_order_relaxed, memory_order_relaxed);
+        }
+        v = g;
+    }
+}
+
+void keyforest_union(KeyForest *f, uint32_t a, uint32_t b)
+{
+    for (;;) {
+        a = keyforest_find(f, a);
+        b = keyforest_find(f, b);
+        if (a == b) {
+            return;
+        }
+        if (key128_lt(&f->keys[a], &f->keys[b])) {
+            uint32_t t = a; a = b; b = t;
+        }
+        // a has the larger key: it goes below b if it is still a root
+        uint32_t expected = a;
+        if (atomic_compare_exchange_strong_explicit(&f->parent[a], &expected, b,
+                                                    memory_order_relaxed, memory_order_relaxed)) {
+            return;
+        }
+    }
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include "bucket.h"
+
+/*
+ * Concurrent union-find over 16-byte keys.
+ *
+ * Keys are numbered in the order they are added (vertices 0, 1, ...), and
+ * a hash index maps a key back to its vertex. Adding keys is sequential;
+ * keyforest_lookup(), keyforest_find() and keyforest_union() may run in
+ * any number of threads at once as long as nothing is added meanwhile.
+ *
+ * The union is lock-free: the root with the larger key is linked below the
+ * other root with a compare-and-swap, retried when another thread changed
+ * either root first, and finds halve the paths with plain CAS as well. So
+ * the root of every set is its smallest key in key128_lt() order.
+ */
+typedef struct {
+    key128_t         *keys;     /* vertex -> key */
+    _Atomic uint32_t *parent;
+    size_t            count;
+    size_t            cap;
+    uint32_t         *index;    /* open addressing: vertex + 1, 0 = empty */
+    size_t            index_cap;    /* power of two */
+} KeyForest;
+
+void keyforest_init(KeyForest *f, size_t cap_hint);
+void keyforest_free(KeyForest *f);
+
+/* The vertex of k, added as a set of its own if new (*added tells). */
+uint32_t keyforest_add(KeyForest *f, const key128_t *k, bool *added);
+
+/* The vertex of k, or -1 if it was never added. */
+int64_t keyforest_lookup(const KeyForest *f, const key128_t *k);
+
+/* The root of the set of v. */
+uint32_t keyforest_find(KeyForest *f, uint32_t v);
+
+/* Joins the sets of a and b. */
+void keyforest_union(KeyForest *f, uint32_t a, uint32_t b);
+
+static INLINE bool keyforest_is_root(const KeyForest *f, uint32_t v)
+{
+    return atomic_load_explicit(&f->parent[v], memory_order_relaxed) == v;
+}
@@ -0,0 +1,239 @@
+#include "common.h"
+
+#include <omp.h>
+#include <assert.h>
+
+#include "keysort.h"
+
+#define RADIX        256
+#define RADIX_PASSES 16
+
+/* Below this many keys one thread sorts alone. */
+#define RADIX_PAR_MIN 65536
+
+/* Buckets up to this size are finished by insertion sort. */
+#define RADIX_INSERTION 32
+
+/* Buckets up to this size (1 MiB) are finished by LSD passes in cache. */
+#define RADIX_CACHE_KEYS 65536
+
+/* Byte of the key that is digit p (p = 0 least significant) in the order
+ * of key128_cmp(): the integer order of 'u' or, without it, memcmp().
+ */
+#if HAVE_UINT128 && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#   define DIGIT(k, p) ((k)->b[p])
+#else
+#   define DIGIT(k, p) ((k)->b[RADIX_PASSES - 1 - (p)])
+#endif
+
+/* Sorts a bucket whose keys agree on all digits >= top: by LSD passes over
+ * the remaining digits once it fits in cache, otherwise by one more MSD pass
+ * and recursion. 'keys' holds the input and the result, 'tmp' is scratch of
+ * the same size.
+ */
+static void bucket_sort(key128_t *keys, size_t n, key128_t *tmp, const bool *skip, int top)
+{
+    size_t count[RADIX];
+
+    if (n < 2) return;
+    if (n <= RADIX_INSERTION) {
+        for (size_t i = 1; i < n; ++i) {
+            key128_t k = keys[i];
+            size_t j = i;
+            for (; j > 0 && key128_lt(&k, &keys[j - 1]); --j) keys[j] = keys[j - 1];
+            keys[j] = k;
+        }
+        return;
+    }
+
+    if (n > RADIX_CACHE_KEYS) {
+        int p = top - 1;
+        while (p >= 0 && skip[p]) --p;
+        if (p < 0) return;
+
+        size_t start[RADIX + 1];
+        memset(count, 0, sizeof(count));
+        for (size_t i = 0; i < n; ++i) count[DIGIT(&keys[i], p)]++;
+        start[0] = 0;
+        for (int d = 0; d < RADIX; ++d) {
+            start[d + 1] = start[d] + count[d];
+            count[d] = start[d];
+        }
+        for (size_t i = 0; i < n; ++i) tmp[count[DIGIT(&keys[i], p)]++] = keys[i];
+        memcpy(keys, tmp, n * sizeof(key128_t));
+        for (int d = 0; d < RADIX; ++d) {
+            bucket_sort(keys + start[d], start[d + 1] - start[d], tmp + start[d], skip, p);
+        }
+        return;
+    }
+
+    key128_t *src = keys, *dst = tmp;
+    for (int p = 0; p < top; ++p) {
+        if (skip[p]) continue;
+        memset(count, 0, sizeof(count));
+        for (size_t i = 0; i < n; ++i) count[DIGIT(&src[i], p)]++;
+        size_t off = 0;
+        for (int d = 0; d < RADIX; ++d) {
+            size_t c = count[d];
+            count[d] = off;
+            off += c;
+        }
+        for (size_t i = 0; i < n; ++i) dst[count[DIGIT(&src[i], p)]++] = src[i];
+        key128_t *x = src;
+        src = dst;
+        dst = x;
+    }
+    if (src != keys) {
+        memcpy(keys, src, n * sizeof(key128_t));
+    }
+}
+
+void keys_radix_sort(key128_t *keys, size_t n, key128_t *tmp)
+{
+    if (n < 2) return;
+
+    int nt = n < RADIX_PAR_MIN ? 1 : omp_get_max_threads();
+    size_t (*count)[RADIX] = (size_t(*)[RADIX])calloc((size_t)nt, sizeof(*count));
+    size_t total[RADIX_PASSES][RADIX];
+    size_t start[RADIX + 1];
+    bool   skip[RADIX_PASSES];
+    int    top = -1;
+    assert(count != NULL);
+
+    /* one read of all digits finds the passes that would not move anything;
+     * the team may be smaller than nt (e.g. when nested), so each parallel
+     * region splits the keys by its actual size
+     */
+    memset(total, 0, sizeof(total));
+    #pragma omp parallel num_threads(nt)
+    {
+        size_t local[RADIX_PASSES][RADIX];
+        int t = omp_get_thread_num(), nth = omp_get_num_threads();
+        size_t lo = n / (size_t)nth * (size_t)t, hi = (t == nth - 1) ? n : lo + n / (size_t)nth;
+
+        memset(local, 0, sizeof(local));
+        for (size_t i = lo; i < hi; ++i) {
+            for (int p = 0; p < RADIX_PASSES; ++p) local[p][DIGIT(&keys[i], p)]++;
+        }
+        #pragma omp critical
+        for (int p = 0; p < RADIX_PASSES; ++p) {
+            for (int d = 0; d < RADIX; ++d) total[p][d] += local[p][d];
+        }
+    }
+    for (int p = 0; p < RADIX_PASSES; ++p) {
+        skip[p] = false;
+        for (int d = 0; d < RADIX; ++d) {
+            if (total[p][d] == n) skip[p] = TRUE;
+        }
+        if (!skip[p]) top = p;
+    }
+    if (top < 0) {
+        free(count);
+        return;     /* all keys equal */
+    }
+
+    /* MSD pass on the most significant varying digit, threads scatter their
+     * blocks into 'tmp' (thread t after the keys with the same digit of
+     * threads < t)...
+     */
+    start[0] = 0;
+    for (int d = 0; d < RADIX; ++d) start[d + 1] = start[d] + total[top][d];
+
+    #pragma omp parallel num_threads(nt)
+    {
+        int t = omp_get_thread_num(), nth = omp_get_num_threads();
+        size_t lo = n / (size_t)nth * (size_t)t, hi = (t == nth - 1) ? n : lo + n / (size_t)nth;
+
+        memset(count[t], 0, sizeof(count[t]));
+        for (size_t i = lo; i < hi; ++i) count[t][DIGIT(&keys[i], top)]++;
+        #pragma omp barrier
+        #pragma omp single
+        {
+            for (int d = 0; d < RADIX; ++d) {
+                size_t off = start[d];
+                for (int u = 0; u < nth; ++u) {
+                    size_t c = count[u][d];
+                    count[u][d] = off;
+                    off += c;
+                }
+            }
+        }
+        for (size_t i = lo; i < hi; ++i) tmp[count[t][DIGIT(&keys[i], top)]++] = keys[i];
+    }
+
+    /* ...and every bucket is sorted on the remaining digits on its own,
+     * back into 'keys'
+     */
+    #pragma omp parallel for schedule(dynamic, 1) num_threads(nt)
+    for (int d = 0; d < RADIX; ++d) {
+        size_t len = start[d + 1] - start[d];
+        memcpy(keys + start[d], tmp + start[d], len * sizeof(key128_t));
+        bucket_sort(keys + start[d], len, tmp + start[d], skip, top);
+    }
+    free(count);
+}
+
+size_t keys_unique(key128_t *keys, size_t n)
+{
+    if (n == 0) return 0;
+    size_t m = 1;
+    for (size_t i = 1; i < n; ++i) {
+        if (!key128_equal(&keys[i], &keys[m - 1])) keys[m++] = keys[i];
+    }
+    return m;
+}
+
+void keys_merge(key128_t *const *runs, const size_t *lens, size_t nruns,
+                GKey128ForeachFunc func, void *user_data)
+{
+    size_t *pos = (size_t*)calloc(nruns ? nruns : 1, sizeof(size_t));
+    key128_t prev;
+    bool have_prev = false;
+    assert(pos != NULL);
+
+    for (;;) {
+        const key128_t *min = NULL;
+        size_t which = 0;
+        for (size_t r = 0; r < nruns; ++r) {
+            if (pos[r] < lens[r] && (min == NULL || key128_lt(&runs[r][pos[r]], min))) {
+                min = &runs[r][pos[r]];
+                which = r;
+            }
+        }
+        if (min == NULL) {
+            break;
+        }
+        if (!have_prev || !key128_equal(&prev, min)) {
+            prev = *min;
+            have_prev = TRUE;
+            func(&prev, user_data);
+        }
+        pos[which]++;
+    }
+    free(pos);
+}
+
+typedef struct {
+    key128_t *keys;
+    size_t    n;
+} KeyArray;
+
+static void append_key(const key128_t *key, void *user_data)
+{
+    KeyArray *a = (KeyArray*)user_data;
+    a->keys[a->n++] = *key;
+}
+
+key128_t *keys_merge_array(key128_t *const *runs, const size_t *lens, size_t nruns, size_t *n)
+{
+    size_t total = 0;
+    for (size_t r = 0; r < nruns; ++r) total += lens[r];
+
+    KeyArray a;
+    a.keys = (key128_t*)malloc((total ? total : 1) * sizeof(key128_t));
+    assert(a.keys != NULL);
+    a.n = 0;
+    keys_merge(runs, lens, nruns, append_key, &a);
+    *n = a.n;
+    return a.keys;
+}
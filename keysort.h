@@ -0,0 +1,30 @@
+#pragma once
+
+#include "bucket.h"
+
+/*
+ * Sorting of 16-byte keys, in the order of key128_cmp().
+ *
+ * keys_radix_sort() is a radix sort with 8-bit digits: MSD passes, the
+ * first one with every thread of the OpenMP team scattering its own block,
+ * until a bucket fits in cache, then LSD passes per bucket, in parallel over
+ * the top-level buckets. Digits that are equal
+ * in all keys (e.g. the zero padding above n*n bits, or the dimension
+ * nibble) cost no pass at all. 'tmp' must hold n keys; the result ends up
+ * in 'keys'.
+ */
+void keys_radix_sort(key128_t *keys, size_t n, key128_t *tmp);
+
+/* Drops adjacent duplicates of a sorted array; returns the new length. */
+size_t keys_unique(key128_t *keys, size_t n);
+
+/* k-way merge of sorted arrays; 'func' gets every distinct key once, in
+ * increasing order.
+ */
+void keys_merge(key128_t *const *runs, const size_t *lens, size_t nruns,
+                GKey128ForeachFunc func, void *user_data);
+
+/* Merges sorted unique arrays into one new sorted unique array (malloc'd),
+ * its length in *n.
+ */
+key128_t *keys_merge_array(key128_t *const *runs, const size_t *lens, size_t nruns, size_t *n);
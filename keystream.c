@@ -0,0 +1,205 @@
+#include "common.h"
+
+#include "d6batch.h"
+#include "keystream.h"
+
+bool keystream_open(KeyStream *s, FILE *fp)
+{
+    memset(s, 0, sizeof(*s));
+    s->fp = fp;
+    inbuf_open(&s->in, fp);
+
+    size_t have = inbuf_fill(&s->in, KEYSTREAM_HEADER);
+    const unsigned char *h = (const unsigned char*)s->in.pos;
+    if (have == 0 || h[0] != (unsigned char)KEYSTREAM_MAGIC[0]) {
+        return true;
+    }
+    if (have < KEYSTREAM_HEADER) {
+        fprintf(stderr, "input is neither digraph6 nor a key stream\n");
+        return false;
+    }
+    s->in.pos += KEYSTREAM_HEADER;
+
+    if (memcmp(h, KEYARCHIVE_MAGIC, 4) == 0) {
+        uint32_t block_keys;
+        s->archive = keyarchive_parse_header(h, &s->n, &s->flags, &block_keys);
+        return s->archive;
+    }
+    if (memcmp(h, KEYSTREAM_MAGIC, 4) != 0) {
+        fprintf(stderr, "input is neither digraph6 nor a key stream\n");
+        return false;
+    }
+    if (h[4] != KEYSTREAM_VERSION) {
+        fprintf(stderr, "key stream version %u is not supported (expected %u)\n", h[4], KEYSTREAM_VERSION);
+        return false;
+    }
+    if (h[5] > 11) {
+        fprintf(stderr, "key stream for n = %u, at most 11 is supported\n", h[5]);
+        return false;
+    }
+    s->binary = true;
+    s->n      = h[5];
+    s->flags  = (unsigned)h[6] | ((unsigned)h[7] << 8);
+    return true;
+}
+
+void keystream_close(KeyStream *s)
+{
+    inbuf_close(&s->in);
+}
+
+static INLINE bool next_text(KeyStream *s, key128_t *k)
+{
+    const char *line;
+    size_t len;
+    unsigned n;
+    while (inbuf_line(&s->in, &line, &len)) {
+        if (d6pack_decode_span(line, len, k, &n)) {
+            return true;
+        }
+        if (len) s->skipped++;
+    }
+    return false;
+}
+
+static size_t read_binary(KeyStream *s, key128_t *keys, size_t max)
+{
+    size_t cnt = 0;
+    while (cnt < max) {
+        size_t bytes = inbuf_fill(&s->in, sizeof(key128_t)), have = bytes / sizeof(key128_t);
+        if (have == 0) {
+            if (bytes > 0) {
+                fprintf(stderr, "key stream is damaged: truncated key\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        }
+        if (have > max - cnt) have = max - cnt;
+        memcpy(keys + cnt, s->in.pos, have * sizeof(key128_t));
+        s->in.pos += have * sizeof(key128_t);
+        cnt += have;
+    }
+    return cnt;
+}
+
+static bool next_archive(KeyStream *s, key128_t *k)
+{
+    if (keyarchive_cursor_next(&s->cursor, k)) {
+        return true;
+    }
+    if (s->cursor.done) {
+        return false;
+    }
+    if (inbuf_fill(&s->in, 8) < 8) {
+        fprintf(stderr, "key archive is damaged: truncated block header\n");
+        exit(EXIT_FAILURE);
+    }
+    size_t bytes = keyarchive_block_size((const unsigned char*)s->in.pos);
+    if (bytes == 0) {
+        s->cursor.done = true;
+        return false;
+    }
+    if (inbuf_fill(&s->in, bytes) < bytes) {
+        fprintf(stderr, "key archive is damaged: truncated block\n");
+        exit(EXIT_FAILURE);
+    }
+    // the block stays in the buffer until the next fill, after its last key
+    keyarchive_cursor_start(&s->cursor, (const unsigned char*)s->in.pos, k);
+    s->in.pos += bytes;
+    return true;
+}
+
+bool keystream_next(KeyStream *s, key128_t *k)
+{
+    bool ok = s->binary  ? read_binary(s, k, 1) == 1 :
+              s->archive ? next_archive(s, k) :
+                           next_text(s, k);
+    s->records += ok;
+    return ok;
+}
+
+size_t keystream_read(KeyStream *s, key128_t *keys, size_t max)
+{
+    size_t cnt = 0;
+    if (s->binary) {
+        cnt = read_binary(s, keys, max);
+    } else if (s->archive) {
+        while (cnt < max && next_archive(s, &keys[cnt])) {
+            ++cnt;
+        }
+    } else {
+        // runs of regular lines are decoded with SIMD; a line of another
+        // form, or one near the end of the buffer, goes through next_text()
+        while (cnt < max) {
+            size_t used;
+            cnt += d6batch_decode(s->in.pos, (size_t)(s->in.end - s->in.pos), keys + cnt, max - cnt, &used);
+            s->in.pos += used;
+            if (cnt == max || !next_text(s, &keys[cnt])) {
+                break;
+            }
+            ++cnt;
+        }
+    }
+    s->records += cnt;
+    return cnt;
+}
+
+uint64_t keystream_skip(KeyStream *s, uint64_t count)
+{
+    key128_t buf[256];
+    uint64_t done = 0;
+    while (done < count) {
+        size_t want = count - done < 256 ? (size_t)(count - done) : 256;
+        size_t got  = keystream_read(s, buf, want);
+        done += got;
+        if (got < want) break;
+    }
+    return done;
+}
+
+void keystream_make_header(unsigned char *h, unsigned n, unsigned flags)
+{
+    memset(h, 0, KEYSTREAM_HEADER);
+    memcpy(h, KEYSTREAM_MAGIC, 4);
+    h[4] = KEYSTREAM_VERSION;
+    h[5] = (unsigned char)n;
+    h[6] = (unsigned char)(flags & 0xFF);
+    h[7] = (unsigned char)(flags >> 8);
+}
+
+void keystream_write_header(FILE *fp, unsigned n, unsigned flags)
+{
+    unsigned char h[KEYSTREAM_HEADER];
+    keystream_make_header(h, n, flags);
+    if (fwrite(h, 1, sizeof(h), fp) != sizeof(h) || fflush(fp) != 0) {
+        perror("Error writing output");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void keystream_put(FILE *fp, const key128_t *k, bool binary)
+{
+    if (binary) {
+        fwrite(k, sizeof(key128_t), 1, fp);
+    } else {
+        char d6[MAXLINE];
+        unsigned len = d6pack_encode_from_key(k, d6);
+        d6[len++] = '\n';
+        fwrite(d6, 1, len, fp);
+    }
+}
+
+void keystream_log(const KeyStream *s, unsigned int v)
+{
+    if (s->binary || s->archive) {
+        printlog(v, "input: key %s, n = %u%s%s%s", s->archive ? "archive" : "stream", s->n,
+                 (s->flags & KEYSTREAM_CANONICAL) ? ", canonical" : "",
+                 (s->flags & KEYSTREAM_UNIQUE) ? ", unique" : "",
+                 (s->flags & KEYSTREAM_SORTED) ? ", sorted" : "");
+    } else {
+        printlog(v, "input: digraph6 text");
+    }
+    if (s->skipped) {
+        printlog(v, "input: %lu lines were not digraph6 and were skipped", (unsigned long)s->skipped);
+    }
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "common.h"
+#include "d6pack11.h"
+#include "inbuf.h"
+#include "keyarchive.h"
+
+/*
+ * Binary key streams: graphs as packed 16-byte keys instead of digraph6 lines.
+ *
+ * A stream is a 16-byte header followed by the keys, 16 bytes each, with no
+ * separators:
+ *
+ *   offset  size  field
+ *        0     4  magic "\x89D6K" (never the first byte of a text line)
+ *        4     1  version, KEYSTREAM_VERSION
+ *        5     1  n, the number of vertices of every key; 0 if not fixed
+ *        6     2  flags, little endian, KEYSTREAM_* below
+ *        8     8  reserved, zero
+ *       16        keys
+ *
+ * A key is the key128_t of d6pack11.h/adjpack11.h as laid out in memory on a
+ * little-endian host: the n*n adjacency bits row-major in the low bits (the
+ * digraph6 bit stream, first bit highest), zero padding, n in the top
+ * nibble. The key of a digraph6 line is d6pack_decode() of the line, and
+ * d6pack_encode_from_key() gives the line back, so the two formats convert
+ * into each other without nauty. Reading a stream costs a fread() and no
+ * parsing; it is smaller than the digraph6 text from n = 9 on (16 against
+ * 24 bytes per graph at n = 11), a little larger below.
+ *
+ * Every tool detects the format of its input from the first byte, and
+ * writes a binary stream instead of text with -B. Key archives (see
+ * keyarchive.h) are detected and read as well.
+ */
+#define KEYSTREAM_MAGIC   "\x89" "D6K"
+#define KEYSTREAM_VERSION 1
+#define KEYSTREAM_HEADER  16
+
+/* header flags, properties of the whole stream */
+#define KEYSTREAM_CANONICAL 0x1     /* keys are canonical forms */
+#define KEYSTREAM_UNIQUE    0x2     /* no key occurs twice */
+#define KEYSTREAM_SORTED    0x4     /* keys are increasing in key128_cmp() order */
+
+typedef struct {
+    FILE             *fp;
+    InputBuffer       in;               /* the unread input, see inbuf.h */
+    bool              binary;
+    bool              archive;          /* a key archive, read through 'cursor' */
+    KeyArchiveCursor  cursor;
+    unsigned          n;                /* from the header; 0 for text */
+    unsigned          flags;            /* from the header; 0 for text */
+    uint64_t          records;          /* keys returned so far */
+    uint64_t          skipped;          /* text lines that were not digraph6 */
+} KeyStream;
+
+/* Detects the format of 'fp' and reads the header of a binary stream or
+ * an archive. From here on the stream reads 'fp' through its own buffer
+ * (or map), so 'fp' itself must not be read any more. Returns false, with
+ * a message, for a bad header.
+ */
+bool keystream_open(KeyStream *s, FILE *fp);
+
+/* Releases the input buffer; does not close the file. */
+void keystream_close(KeyStream *s);
+
+/* Next key; false at the end of the input. Text lines that do not decode
+ * are skipped and counted.
+ */
+bool keystream_next(KeyStream *s, key128_t *k);
+
+/* Up to 'max' keys into 'keys'; fewer only at the end of the input. */
+size_t keystream_read(KeyStream *s, key128_t *keys, size_t max);
+
+/* Skips 'count' records; returns how many there were. */
+uint64_t keystream_skip(KeyStream *s, uint64_t count);
+
+/* The KEYSTREAM_HEADER bytes of the header of a binary stream. */
+void keystream_make_header(unsigned char *h, unsigned n, unsigned flags);
+
+/* Writes (and flushes) the header of a binary stream. */
+void keystream_write_header(FILE *fp, unsigned n, unsigned flags);
+
+/* Writes one key as 16 bytes or as a digraph6 line. */
+void keystream_put(FILE *fp, const key128_t *k, bool binary);
+
+/* printlog() the format and flags of the input and the skipped lines. */
+void keystream_log(const KeyStream *s, unsigned int v);
@@ -1,11 +1,15 @@
 #include <omp.h>
 
 #include "bott.h"
+#include "cpudispatch.h"
 #include "dag.h"
+#include "adjpack11.h"
+#include "keystream.h"
+#include "tlsbuf.h"
 
 void help(const char *name)
 {
-    fprintf(stderr, "Usage: %s [-d dimension] [-j njobs] [-v] [-h] [-p]\n", name);
+    fprintf(stderr, "Usage: %s [-d dimension] [-j njobs] [-v] [-h] [-p [-B]]\n", name);
 }
 
 int main(int argc, char *argv[])
@@ -20,7 +24,8 @@ int main(int argc, char *argv[])
     size_t spinc, spin;
     size_t cache_size;
     int p = 0;
-    while ((opt = getopt(argc, argv, "vhj:d:p")) != -1) {
+    bool binary = false;
+    while ((opt = getopt(argc, argv, "vhj:d:pB")) != -1) {
         switch (opt) {
         case 'v':
             v = 1;
@@ -35,6 +40,9 @@ int main(int argc, char *argv[])
         case 'p':
             p = 1;
             break;
+        case 'B':
+            binary = true;
+            break;
         case 'h':
             help(argv[0]);
             exit(EXIT_SUCCESS);
@@ -53,22 +61,23 @@ int main(int argc, char *argv[])
 
     spinc = 0;
     spin  = 0;
+    if (p && binary) {
+        keystream_write_header(stdout, dim, 0);
+    }
+    OutRing *ring = p ? outring_open(stdout, 0, 0) : NULL;
     tic();
+    if (v) {
+        cpu_dispatch_log(0);
+    }
     #pragma omp parallel shared(cache, dim, max_state) reduction(+:spin,spinc)
     {
         vec_t *mat   = init(dim);
         size_t a = 0, b = 0;
 
-        char d6_buf[128];
-        size_t cnt = 0;
-        size_t siz = strlen( matrix_to_d6(mat, dim, d6_buf) );
-        char *buf = (char*)malloc( (siz+1)*10000+1 );
-        if (buf==NULL) {
-            fprintf(stderr, "Error in malloc\n");
-            exit(1);
-        }
-        char *pnt = buf;
-        
+        key128_t key;
+        OutputBuffer out;
+        buffer_init(&out, ring);
+
         #pragma omp for
         for (state=0; state<=max_state; state++) {
             matrix_by_state(mat, cache, state, dim);
@@ -76,34 +85,20 @@ int main(int argc, char *argv[])
                 a++;
                 b += is_spin(mat, dim);
                 if (p) {
-                    matrix_to_d6(mat, dim, d6_buf);
-                    memcpy( pnt, d6_buf, siz);
-                    pnt += siz;
-                    *pnt++ = '\n';
-                    if (++cnt == 10000) {
-                        cnt = 0;
-                        *pnt = '\0';
-                        pnt = buf;
-                        #pragma omp critical
-                        {
-                            printf("%s", buf);
-                        }
-                    }
+                    adjpack_from_matrix(mat, dim, &key);
+                    buffer_add_key(&out, &key, binary);
                 }
             }
         }
-        #pragma omp critical
-        {
-            *pnt = '\0';
-            printf("%s", buf);
-        }
-
-        free(buf);
+        buffer_destroy(&out);
         free(mat);
         spinc += a;
         spin  += b;
     }
     time = toc();
+    if (ring) {
+        outring_close(ring);
+    }
 
     free(cache);
 
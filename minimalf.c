@@ -1,21 +1,59 @@
 #include <omp.h>
 
 #include "bott.h"
-#include "bucket.h"
+#include "cpudispatch.h"
+#include "dedup.h"
+#include "flatset.h"
+#include "hugemem.h"
+#include "keyforest.h"
+#include "keysort.h"
+#include "batchpipe.h"
+#include "keystream.h"
+#include "orbitmemo.h"
+#include "orbitwalk.h"
 #include "dag.h"
 #include "adjpack11.h"
 #include "parse_scaled.h"
+#include "reorder.h"
+#include "shmset.h"
 #include "tlsbuf.h"
+#include "zio.h"
 
 static void help(const char *progname) {
     fprintf(stderr,
-        "Usage: %s [-j num_threads] [-n num_shards] [-l lines_capacity] [-i input] [-o output] [-v] [-u]\n"
+        "Usage: %s [-j num_threads] [-n num_shards] [-l lines_capacity] [-i input] [-o output] [-B] [-D] [-b] [-v] [-u | -C] [-m size | -x name[:keys]] [-M size] [-P len] [-J file] [-A list] [-s file [-c sec] [-r]]\n"
         "  -j NUM   Number of threads (default: max available)\n"
         "  -n NUM   Number of hash shards (default: 256)\n"
         "  -l NUM   Input lines per batch (default: 100000, accepts k/M/G suffixes)\n"
-        "  -i FILE  Input file (default: stdin)\n"
-        "  -o FILE  Output file (default: stdout), use '-' for stdout also\n"
+        "  -i FILE  Input file (default: stdin); xz or zstd compressed input is detected\n"
+        "  -o FILE  Output file (default: stdout), use '-' for stdout also; compressed\n"
+        "           with xz or zstd if FILE ends in .xz or .zst\n"
+        "  -B       Write a binary key stream instead of digraph6 lines (the input\n"
+        "           format is detected)\n"
+        "  -D       Write in input order, with -u each representative at its first\n"
+        "           occurrence: the output is the same for every run and -j\n"
+        "  -b       Walk each orbit best-first, least canonical key first, which finds\n"
+        "           a smaller key (and rejects the line) after fewer steps\n"
         "  -u       Output unique representatives only\n"
+        "  -C       Join the input lines and their neighbours into connected components\n"
+        "           and output the minimal canonical key of each, sorted; the orbits\n"
+        "           are held in memory (excludes -u, -D, -M, -s, -x)\n"
+        "  -m SIZE  With -u, memory budget for seen representatives; beyond it sorted\n"
+        "           runs are spilled to $TMPDIR (default: 0, unlimited, accepts k/M/G)\n"
+        "  -x NAME[:KEYS]  With -u, share the representatives with other processes through\n"
+        "           the shared-memory set NAME, created with room for KEYS (default: 16Mi)\n"
+        "           if it does not exist; it persists until /dev/shm/NAME is removed\n"
+        "  -s FILE  With -u, save the set of representatives to a snapshot file when done\n"
+        "  -c SEC   Also save a snapshot every SEC seconds, between batches (requires -s)\n"
+        "  -r       Resume from the snapshot given by -s; the input must be the same\n"
+        "  -M SIZE  Remember the verdicts of explored orbits in SIZE bytes shared by the\n"
+        "           threads, so that lines of a class seen before need no walk\n"
+        "           (default: 0, off, accepts k/M/G)\n"
+        "  -P LEN   Walk an orbit level by level with all idle threads once LEN\n"
+        "           matrices are queued (default: 10k, 0: never)\n"
+        "  -J FILE  With -u, write hash table statistics (JSON) to FILE when done\n"
+        "  -A LIST  Table memory: huge, hugetlb, interleave, spread (shards over NUMA\n"
+        "           nodes), pin (threads over nodes); comma separated\n"
         "  -v       Increase verbosity (can be repeated)\n"
         "  -h       Show this help message\n",
         progname);
@@ -23,6 +61,12 @@ static void help(const char *progname) {
 
 #define INITIAL_CAPACITY 1024
 
+/* Lines per chunk of the parallel loop, and per chunk of the output order (-D). */
+#define MIN_CHUNK 1000
+
+/* snapshot meta data */
+enum { SNAP_LINES, SNAP_REPS, SNAP_OUTPUT, SNAP_DIM };
+
 typedef struct {
     vec_t *rows;     // flat array of rows
     size_t len;      // number of matrices stored
@@ -53,9 +97,178 @@ static vec_t *matarray_get(MatArray *arr, size_t index) {
     return &arr->rows[index * arr->dim];
 }
 
+/* -M: verdicts of explored orbits, shared by the threads */
+static OrbitMemo *memo = NULL;
+
+/* Records the verdicts of a walk: when it explored the whole orbit, the
+ * seed's key is the minimum and every other key is not; when it stopped at
+ * a key 'smaller' than the seed's, every key seen above that one is not.
+ */
+typedef struct {
+    const key128_t *seed_key;
+    const key128_t *smaller;
+} MemoRecord;
+
+static void memo_record_key(const key128_t *v, void *user_data)
+{
+    const MemoRecord *r = user_data;
+    if (r->smaller == NULL) {
+        orbitmemo_insert(memo, v, key128_equal(v, r->seed_key));
+    } else if (key128_lt(r->smaller, v)) {
+        orbitmemo_insert(memo, v, false);
+    }
+}
+
+static void memo_record(const Set128MQ *visited, const key128_t *seed_key, const key128_t *smaller)
+{
+    MemoRecord r = { seed_key, smaller };
+    for (size_t i = 0; i < visited->cap; ++i) {
+        if (visited->ctrl[i] & 0x80) {
+            memo_record_key(&visited->keys[i], &r);
+        }
+    }
+}
+
+/* -P: a walk with this many matrices queued goes on in parallel, see
+ * orbitwalk.h (0: never). */
+static size_t parallel_walk_len = 10000;
+
+static bool not_below_seed(const key128_t *k, void *seed_key)
+{
+    return !key128_lt(k, (const key128_t*)seed_key);
+}
+
+/* -b: the walk expands the matrix of least canonical key first instead of
+ * the oldest. The matrices stay in the MatArray; a binary heap of at most
+ * WALK_HEAP entries (key, index) hands them out, and entries beyond it wait
+ * in FIFO order until the heap runs empty, so every matrix is expanded once.
+ */
+#define WALK_HEAP 4096
+
+typedef struct {
+    key128_t key;
+    size_t   idx;
+} WalkEntry;
+
+typedef struct {
+    bool       best_first;
+    size_t     next;            /* FIFO order: the next index */
+    WalkEntry *heap;
+    size_t     len;
+    WalkEntry *spill;
+    size_t     spill_head, spill_len, spill_cap;
+} WalkOrder;
+
+static bool best_first = false;
+
+static void walk_init(WalkOrder *w)
+{
+    memset(w, 0, sizeof(*w));
+    w->best_first = best_first;
+    if (w->best_first) {
+        w->heap = malloc(WALK_HEAP * sizeof(WalkEntry));
+    }
+}
+
+static void walk_free(WalkOrder *w)
+{
+    free(w->heap);
+    free(w->spill);
+}
+
+static void heap_push(WalkOrder *w, WalkEntry e)
+{
+    size_t i = w->len++;
+    while (i > 0 && key128_lt(&e.key, &w->heap[(i - 1) / 2].key)) {
+        w->heap[i] = w->heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    w->heap[i] = e;
+}
+
+static WalkEntry heap_pop(WalkOrder *w)
+{
+    WalkEntry top = w->heap[0], last = w->heap[--w->len];
+    size_t i = 0;
+    for (;;) {
+        size_t c = 2 * i + 1;
+        if (c >= w->len) break;
+        if (c + 1 < w->len && key128_lt(&w->heap[c + 1].key, &w->heap[c].key)) ++c;
+        if (!key128_lt(&w->heap[c].key, &last.key)) break;
+        w->heap[i] = w->heap[c];
+        i = c;
+    }
+    w->heap[i] = last;
+    return top;
+}
+
+/* The matrix q[idx] of canonical key k was queued. */
+static void walk_add(WalkOrder *w, const key128_t *k, size_t idx)
+{
+    if (!w->best_first) {
+        return;
+    }
+    WalkEntry e = { *k, idx };
+    if (w->len < WALK_HEAP) {
+        heap_push(w, e);
+        return;
+    }
+    if (w->spill_len == w->spill_cap) {
+        w->spill_cap = w->spill_cap ? 2 * w->spill_cap : 1024;
+        w->spill = realloc(w->spill, w->spill_cap * sizeof(WalkEntry));
+        assert(w->spill != NULL);
+    }
+    w->spill[w->spill_len++] = e;
+}
+
+/* The index of the next matrix to expand; false when all were. */
+static bool walk_next(WalkOrder *w, const MatArray *q, size_t *idx)
+{
+    if (!w->best_first) {
+        *idx = w->next++;
+        return *idx < q->len;
+    }
+    if (w->len == 0) {
+        while (w->spill_head < w->spill_len && w->len < WALK_HEAP) {
+            heap_push(w, w->spill[w->spill_head++]);
+        }
+        if (w->spill_head == w->spill_len) {
+            w->spill_head = w->spill_len = 0;
+        }
+        if (w->len == 0) {
+            return false;
+        }
+    }
+    *idx = heap_pop(w).idx;
+    return true;
+}
+
+/* Copies the matrices not expanded yet to 'out' (room for q->len). */
+static size_t walk_pending(const WalkOrder *w, const MatArray *q, vec_t *out)
+{
+    size_t cnt = 0;
+    if (!w->best_first) {
+        for (size_t i = w->next; i < q->len; ++i) {
+            memcpy(&out[cnt++ * q->dim], &q->rows[i * q->dim], sizeof(vec_t) * q->dim);
+        }
+        return cnt;
+    }
+    for (size_t i = 0; i < w->len; ++i) {
+        memcpy(&out[cnt++ * q->dim], &q->rows[w->heap[i].idx * q->dim], sizeof(vec_t) * q->dim);
+    }
+    for (size_t i = w->spill_head; i < w->spill_len; ++i) {
+        memcpy(&out[cnt++ * q->dim], &q->rows[w->spill[i].idx * q->dim], sizeof(vec_t) * q->dim);
+    }
+    return cnt;
+}
+
 /**
  * BFS over the forward closure under conditional_add_* (mod iso).
  * Returns false ASAP if any canonical neighbor key < canonical seed key.
+ * With -b the walk is best-first, see WalkOrder. A walk that grows past
+ * parallel_walk_len matrices goes on level by level in parallel, with
+ * the idle threads of the team. 'canons' counts the canonical forms
+ * computed.
  *
  * IMPORTANT: To match orbitg.c semantics, we:
  *  - enqueue NON-CANONICAL matrices produced by the operations,
@@ -63,17 +276,34 @@ static vec_t *matarray_get(MatArray *arr, size_t index) {
  */
 static ind_t dim = 0;
 
-static bool is_orbit_minimum(const key128_t *seedk) {
-    // Per-thread "visited" set holds canonical keys
-    FlatSet visited_set;
-    flat_init(&visited_set, 1024);
-
-    // Queue holds NON-CANONICAL matrices (like orbitg.c)
-    MatArray *q = matarray_create(dim);
+/* Finishes a walk with orbitwalk_parallel(), which gets the keys visited
+ * and the matrices not expanded yet. */
+static bool walk_in_parallel(const WalkOrder *walk, const MatArray *q, const Set128MQ *visited_set,
+                             const key128_t *seed_can_key, size_t *canons)
+{
+    vec_t *frontier = malloc(sizeof(vec_t) * dim * q->len);
+    size_t count = walk_pending(walk, q, frontier);
+    GHashBucket *visited = orbitwalk_visited_new(4 * visited_set->size);
+    for (size_t i = 0; i < visited_set->cap; ++i) {
+        if (visited_set->ctrl[i] & 0x80) {
+            g_bucket_insert_copy128(visited, &visited_set->keys[i]);
+        }
+    }
+    key128_t smaller;
+    bool is_min = orbitwalk_parallel(frontier, count, dim, visited, not_below_seed,
+                                     (void*)seed_can_key, &smaller, canons);
+    if (memo) {
+        MemoRecord r = { seed_can_key, is_min ? NULL : &smaller };
+        g_bucket_foreach128(visited, memo_record_key, &r);
+    }
+    g_bucket_destroy(visited);
+    free(frontier);
+    return is_min;
+}
 
+CPU_CLONES static bool is_orbit_minimum(const key128_t *seedk, size_t *canons) {
     vec_t initial_mat[dim],
           seed_can_mat[dim],
-          aux[dim],
           canon_neighbor[dim];
     key128_t k;
 
@@ -82,74 +312,285 @@ static bool is_orbit_minimum(const key128_t *seedk) {
 
     // Canonical seed key for comparisons and visited
     matrix_to_matrix_canon(initial_mat, dim, seed_can_mat);
+    ++*canons;
 
     key128_t seed_can_key;
     adjpack_from_matrix(seed_can_mat, dim, &seed_can_key);
-    flat_insert(&visited_set, &seed_can_key);
+
+    // An orbit walked before answers with one lookup
+    if (memo) {
+        OrbitVerdict verdict = orbitmemo_lookup(memo, &seed_can_key);
+        if (verdict != ORBITMEMO_UNKNOWN) {
+            return verdict == ORBITMEMO_MIN;
+        }
+    }
+
+    // Per-thread "visited" set holds canonical keys
+    Set128MQ visited_set;
+    set128mq_init(&visited_set, 1024);
+
+    // Queue holds NON-CANONICAL matrices (like orbitg.c)
+    MatArray *q = matarray_create(dim);
+    WalkOrder walk;
+    walk_init(&walk);
+
+    set128mq_insert(&visited_set, &seed_can_key);
 
     // Start BFS from the NON-CANONICAL seed (to match orbitg)
     matarray_append(q, initial_mat);
+    walk_add(&walk, &seed_can_key, 0);
 
     bool is_min = true;
 
-    for (size_t h = 0; h < q->len; ++h) {
-        vec_t *cur;
+    // the neighbours of one matrix: Op2 for every column, Op3 both ways
+    const size_t max_nb = (size_t)dim * dim;
+    vec_t nb[max_nb][dim];
+    int weight[max_nb];
+    size_t order[max_nb];
 
-        // Op2: column additions
+    for (size_t h; ; ) {
+        if (parallel_walk_len && q->len >= parallel_walk_len && omp_get_num_threads() > 1) {
+            // a giant orbit: the rest of it in parallel
+            is_min = walk_in_parallel(&walk, q, &visited_set, &seed_can_key, canons);
+            walk_free(&walk);
+            matarray_free(q);
+            set128mq_free(&visited_set);
+            return is_min;
+        }
+        if (!walk_next(&walk, q, &h)) {
+            break;
+        }
+        const vec_t *cur = matarray_get(q, h);
+        size_t cnt = 0;
         for (ind_t i = 0; i < dim; ++i) {
-            cur = matarray_get(q, h);                   // re-fetch every time (safe if realloc)
-            conditional_add_col(cur, aux, dim, i);      // aux: NON-CANON neighbor
-
-            // Canonicalize aux to get the visited key
-            // vec_t canon_neighbor[dim];
-            matrix_to_matrix_canon(aux, dim, canon_neighbor);
+            conditional_add_col(cur, nb[cnt], dim, i);
+            cnt += !best_first || memcmp(nb[cnt], cur, sizeof(vec_t) * dim) != 0;
+        }
+        for (ind_t i = 0; i < dim; ++i) {
+            for (ind_t j = i + 1; j < dim; ++j) {
+                cnt += conditional_add_row(cur, nb[cnt], dim, i, j);
+                cnt += conditional_add_row(cur, nb[cnt], dim, j, i);
+            }
+        }
+        for (size_t n = 0; n < cnt; ++n) {
+            order[n] = n;
+        }
+        if (best_first) {
+            // lighter matrices first: their canonical keys tend to be smaller
+            for (size_t n = 0; n < cnt; ++n) {
+                weight[n] = matrix_weight(nb[n], dim);
+                size_t m = n;
+                while (m > 0 && weight[order[m - 1]] > weight[n]) {
+                    order[m] = order[m - 1];
+                    --m;
+                }
+                order[m] = n;
+            }
+        }
 
-            // key128_t k;
+        for (size_t n = 0; n < cnt; ++n) {
+            // Canonicalize the neighbour to get the visited key
+            matrix_to_matrix_canon(nb[order[n]], dim, canon_neighbor);
+            ++*canons;
             adjpack_from_matrix(canon_neighbor, dim, &k);
 
             // Minimality test: neighbor < canonical seed?
             if (key128_lt(&k, &seed_can_key)) { is_min = false; goto cleanup; }
 
-            // First time we see this canonical element? Enqueue the NON-CANON aux
-            if (!flat_lookup(&visited_set, &k) && flat_insert(&visited_set, &k)) {
-                matarray_append(q, aux);
+            // First time we see this canonical element? Enqueue the NON-CANON neighbour
+            if (set128mq_insert(&visited_set, &k)) {
+                matarray_append(q, nb[order[n]]);
+                walk_add(&walk, &k, q->len - 1);
             }
         }
+    }
 
-        // Op3: row additions (both directions)
-        for (ind_t i = 0; i < dim; ++i) {
-            for (ind_t j = i + 1; j < dim; ++j) {
-                cur = matarray_get(q, h);
-                if (conditional_add_row(cur, aux, dim, i, j)) {
-                    //vec_t canon_neighbor[dim];
-                    matrix_to_matrix_canon(aux, dim, canon_neighbor);
-                    //key128_t k;
-                    adjpack_from_matrix(canon_neighbor, dim, &k);
-                    if (key128_lt(&k, &seed_can_key)) { is_min = false; goto cleanup; }
-                    if (!flat_lookup(&visited_set, &k) && flat_insert(&visited_set, &k)) {
-                        matarray_append(q, aux);
-                    }
-                }
+cleanup:
+    if (memo) {
+        memo_record(&visited_set, &seed_can_key, is_min ? NULL : &k);
+    }
+    walk_free(&walk);
+    matarray_free(q);
+    set128mq_free(&visited_set);
+    return is_min;
+}
 
-                cur = matarray_get(q, h);
-                if (conditional_add_row(cur, aux, dim, j, i)) {
-                    // vec_t canon_neighbor[dim];
-                    matrix_to_matrix_canon(aux, dim, canon_neighbor);
-                    // key128_t k;
-                    adjpack_from_matrix(canon_neighbor, dim, &k);
-                    if (key128_lt(&k, &seed_can_key)) { is_min = false; goto cleanup; }
-                    if (!flat_lookup(&visited_set, &k) && flat_insert(&visited_set, &k)) {
-                        matarray_append(q, aux);
-                    }
-                }
+/* -C: the canonical key of a matrix */
+static void canonical_key(const vec_t *mat, key128_t *k)
+{
+    vec_t can[dim];
+    matrix_to_matrix_canon(mat, dim, can);
+    adjpack_from_matrix(can, dim, k);
+}
+
+/* A neighbour not in the forest yet, joined after the round. */
+typedef struct {
+    uint32_t from;
+    key128_t key;
+} PendingEdge;
+
+typedef struct {
+    PendingEdge *edges;
+    size_t len, cap;
+} PendingList;
+
+static void pending_push(PendingList *l, uint32_t from, const key128_t *key)
+{
+    if (l->len == l->cap) {
+        l->cap = l->cap ? 2 * l->cap : 1024;
+        l->edges = realloc(l->edges, l->cap * sizeof(PendingEdge));
+        assert(l->edges != NULL);
+    }
+    l->edges[l->len++] = (PendingEdge){ from, *key };
+}
+
+/* The canonical neighbours of vertex v under Op2 and Op3: a neighbour in the
+ * forest is joined with v at once, a new one waits in 'pending'.
+ */
+static void join_neighbours(KeyForest *f, uint32_t v, PendingList *pending)
+{
+    vec_t mat[dim], aux[dim];
+    key128_t k;
+    adjpack_to_matrix(&f->keys[v], mat, dim);
+
+    for (ind_t i = 0; i < dim; ++i) {
+        conditional_add_col(mat, aux, dim, i);
+        canonical_key(aux, &k);
+        int64_t u = keyforest_lookup(f, &k);
+        if (u < 0) {
+            pending_push(pending, v, &k);
+        } else {
+            keyforest_union(f, v, (uint32_t)u);
+        }
+    }
+    for (ind_t i = 0; i < dim; ++i) {
+        for (ind_t j = 0; j < dim; ++j) {
+            if (i == j || !conditional_add_row(mat, aux, dim, i, j)) {
+                continue;
+            }
+            canonical_key(aux, &k);
+            int64_t u = keyforest_lookup(f, &k);
+            if (u < 0) {
+                pending_push(pending, v, &k);
+            } else {
+                keyforest_union(f, v, (uint32_t)u);
             }
         }
     }
+}
+
+/* -C: the input lines are vertices, Op2 and Op3 the edges. Rounds expand
+ * the frontier in parallel, each neighbour canonicalised once, and join the
+ * sets of a concurrent union-find; the keys of a round's new neighbours are
+ * added between rounds. Each component ends up as a whole orbit whose root
+ * is its smallest canonical key. Returns the number of components written.
+ */
+static size_t run_components(KeyStream *ks, const key128_t *first, OutRing *ring, bool binary)
+{
+    size_t count = 1, cap = 1 << 16;
+    key128_t *keys = malloc(cap * sizeof(key128_t));
+    keys[0] = *first;
+    for (key128_t k; keystream_next(ks, &k); ) {
+        if (count == cap) {
+            cap *= 2;
+            keys = realloc(keys, cap * sizeof(key128_t));
+            assert(keys != NULL);
+        }
+        keys[count++] = k;
+    }
+    printlog(1, "Read %zu elements", count);
 
-cleanup:
-    matarray_free(q);
-    flat_free(&visited_set);
-    return is_min;
+    #pragma omp parallel
+    {
+        init_nauty_data(dim);
+        #pragma omp for schedule(dynamic, MIN_CHUNK)
+        for (size_t i = 0; i < count; ++i) {
+            vec_t m[dim];
+            adjpack_to_matrix(&keys[i], m, dim);
+            canonical_key(m, &keys[i]);
+        }
+        free_nauty_data();
+    }
+    key128_t *tmp = malloc(count * sizeof(key128_t));
+    keys_radix_sort(keys, count, tmp);
+    free(tmp);
+    count = keys_unique(keys, count);
+
+    KeyForest forest;
+    keyforest_init(&forest, 2 * count);
+    bool added;
+    for (size_t i = 0; i < count; ++i) {
+        keyforest_add(&forest, &keys[i], &added);
+    }
+    free(keys);
+    printlog(1, "%zu distinct canonical keys", count);
+
+    const int threads = omp_get_max_threads();
+    PendingList *pending = calloc(threads, sizeof(PendingList));
+    size_t frontier_begin = 0, frontier_end = forest.count, round = 0;
+
+    while (frontier_begin < frontier_end) {
+        #pragma omp parallel
+        {
+            init_nauty_data(dim);
+            PendingList *mine = &pending[omp_get_thread_num()];
+            #pragma omp for schedule(dynamic, 64)
+            for (size_t v = frontier_begin; v < frontier_end; ++v) {
+                join_neighbours(&forest, (uint32_t)v, mine);
+            }
+            free_nauty_data();
+        }
+
+        // the new keys are the next frontier
+        for (int t = 0; t < threads; ++t) {
+            for (size_t e = 0; e < pending[t].len; ++e) {
+                uint32_t u = keyforest_add(&forest, &pending[t].edges[e].key, &added);
+                keyforest_union(&forest, pending[t].edges[e].from, u);
+            }
+            pending[t].len = 0;
+        }
+        frontier_begin = frontier_end;
+        frontier_end = forest.count;
+        printlog(2, "Round %zu: %zu keys, %zu new", ++round, forest.count, frontier_end - frontier_begin);
+    }
+    for (int t = 0; t < threads; ++t) {
+        free(pending[t].edges);
+    }
+    free(pending);
+
+    // the roots are the minima of their components
+    size_t roots = 0;
+    keys = malloc((forest.count + 1) * sizeof(key128_t));
+    for (size_t v = 0; v < forest.count; ++v) {
+        if (keyforest_is_root(&forest, (uint32_t)v)) {
+            keys[roots++] = forest.keys[v];
+        }
+    }
+    printlog(1, "%zu keys in %zu components after %zu rounds", forest.count, roots, round);
+    keyforest_free(&forest);
+
+    tmp = malloc((roots + 1) * sizeof(key128_t));
+    keys_radix_sort(keys, roots, tmp);
+    free(tmp);
+
+    OutputBuffer buffer;
+    buffer_init(&buffer, ring);
+    for (size_t i = 0; i < roots; ++i) {
+        buffer_add_key(&buffer, &keys[i], binary);
+    }
+    buffer_destroy(&buffer);
+    free(keys);
+    return roots;
+}
+
+static void save_snapshot(DedupSet *set, const char *path, OutRing *out, size_t lines, size_t reps)
+{
+    off_t pos = outring_tell(out);
+    uint64_t meta[G_BUCKET_SNAPSHOT_META] = { lines, reps, pos < 0 ? 0 : (uint64_t)pos, dim };
+    double start = omp_get_wtime();
+    if (dedup_save(set, path, meta)) {
+        printlog(1, "Snapshot saved after %zu lines in %.3fs", lines, omp_get_wtime() - start);
+    }
 }
 
 int main(int argc, char *argv[]) {
@@ -161,13 +602,23 @@ int main(int argc, char *argv[]) {
     int num_shards = 256;
     int num_threads = omp_get_max_threads(); // default to max threads
     bool unique = false;
+    bool ordered = false;
+    bool components = false;
+    size_t mem_budget = 0, memo_bytes = 0;
+    const char *snap_path = NULL, *out_path = NULL;
+    unsigned long snap_interval = 0;
+    bool resume = false;
+    const char *stats_path = NULL;
+    char shm_name[256] = "";
+    size_t shm_keys = 0;
 
     double time_start = omp_get_wtime();
 
     FILE *in = stdin, *out = stdout;
+    bool binary = false;
 
     int opt = 1;
-    while ((opt = getopt(argc, argv, "l:n:j:vi:o:u")) != -1) {
+    while ((opt = getopt(argc, argv, "l:n:j:vi:o:BDbuCm:M:P:x:s:c:rJ:A:")) != -1) {
         switch (opt) {
         case 'v':
             increase_verbosity();
@@ -194,15 +645,65 @@ int main(int argc, char *argv[]) {
             }
             break;
         case 'o':
-            out = fopen(optarg, "w");
-            if (out == NULL) {
-                perror("Error opening output file");
-                exit(EXIT_FAILURE);
-            }
+            out_path = optarg;
+            break;
+        case 'B':
+            binary = true;
+            break;
+        case 's':
+            snap_path = optarg;
+            break;
+        case 'c':
+            snap_interval = (unsigned long)atol(optarg);
+            break;
+        case 'r':
+            resume = true;
+            break;
+        case 'D':
+            ordered = true;
             break;
         case 'u':
             unique = true;
             break;
+        case 'b':
+            best_first = true;
+            break;
+        case 'P':
+            if (!parse_scaled_size(optarg, &parallel_walk_len)) {
+                fprintf(stderr, "Invalid -P value: %s (examples: 10k, 0)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'C':
+            components = true;
+            break;
+        case 'm':
+            if (!parse_scaled_size(optarg, &mem_budget)) {
+                fprintf(stderr, "Invalid -m value: %s (examples: 512M, 8G, 4Gi)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'M':
+            if (!parse_scaled_size(optarg, &memo_bytes)) {
+                fprintf(stderr, "Invalid -M value: %s (examples: 64M, 1G)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'x':
+            if (!shm_set_parse_spec(optarg, shm_name, sizeof(shm_name), &shm_keys)) {
+                fprintf(stderr, "Invalid -x value: %s (examples: dedup, /dedup:100M)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'J':
+            stats_path = optarg;
+            break;
+        case 'A':
+            if (!mem_policy_parse(optarg)) {
+                fprintf(stderr, "Invalid -A value: %s (use huge, hugetlb, interleave, spread, pin)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
         case 'h':
             help(argv[0]);
             exit(EXIT_SUCCESS);
@@ -212,76 +713,177 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    char *buffer = (char*)malloc(MAXLINE * lines_capacity * sizeof(char));
-    assert(buffer != NULL);
+    if ((snap_path || resume || snap_interval) && !(unique && snap_path)) {
+        fprintf(stderr, "-s requires -u, -r and -c require -s\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (snap_path && out_path && zio_codec_of_path(out_path) != ZIO_NONE) {
+        fprintf(stderr, "-s cannot resume a compressed output file\n");
+        exit(EXIT_FAILURE);
+    }
 
-    printlog(1, "Using %d threads, %d shards, batch size %zu", num_threads, num_shards, lines_capacity);
+    if (*shm_name && (!unique || mem_budget || snap_path)) {
+        fprintf(stderr, "-x requires -u and excludes -m and -s\n");
+        exit(EXIT_FAILURE);
+    }
 
-    char **lines = malloc(lines_capacity * sizeof(char*));
-    assert(lines != NULL);
-    for (size_t i = 0; i < lines_capacity; ++i) {
-        lines[i] = buffer + i * MAXLINE;
-        *lines[i] = '\0';
+    if (stats_path && !unique) {
+        fprintf(stderr, "-J requires -u\n");
+        exit(EXIT_FAILURE);
     }
 
+    if (components && (unique || ordered || memo_bytes || snap_path || *shm_name)) {
+        fprintf(stderr, "-C excludes -u, -D, -M, -s and -x\n");
+        exit(EXIT_FAILURE);
+    }
+
+    uint64_t meta[G_BUCKET_SNAPSHOT_META] = { 0 };
+    DedupSet *g_canonical_set = NULL;
+    if (resume) {
+        g_canonical_set = dedup_load(snap_path, mem_budget, meta);
+        if (g_canonical_set == NULL) {
+            exit(EXIT_FAILURE);
+        }
+        printlog(1, "Resuming after %lu lines, %lu representatives", (unsigned long)meta[SNAP_LINES], (unsigned long)meta[SNAP_REPS]);
+        if (out_path == NULL) {
+            fprintf(stderr, "Warning: representatives written after the snapshot will be repeated\n");
+        }
+    }
+
+    if (out_path != NULL) {
+        out = resume ? fopen_resume(out_path, meta[SNAP_OUTPUT]) : zio_fopen_write(out_path);
+        if (out == NULL) {
+            perror("Error opening output file");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    KeyStream ks;
+    if (!keystream_open(&ks, in)) {
+        exit(EXIT_FAILURE);
+    }
+    keystream_log(&ks, 1);
+
+    printlog(1, "Using %d threads, %d shards, batch size %zu", num_threads, num_shards, lines_capacity);
+
 #if !NAUTY_HAS_TLS
     fprintf(stderr, "Warning: nauty without TLS support, using single thread!\n");
+    if (unique && !*shm_name) {
+        fprintf(stderr, "         (several processes can share the representatives with -x)\n");
+    }
     num_threads = 1;
 #endif
     omp_set_num_threads(num_threads);
+    if (mem_policy() & MEM_PIN) {
+        mem_pin_threads();
+    }
+    mem_policy_log(1);
+    cpu_dispatch_log(1);
+    if (memo_bytes) {
+        memo = orbitmemo_new(memo_bytes);
+    }
 
-    if (!fgets(buffer, MAXLINE, in)) {
+    key128_t first;
+    if (!keystream_next(&ks, &first)) {
         fprintf(stderr, "got empty input, quitting ...\n");
         exit(0);
     }
-    // lines[line_count++] = buffer;
-    // lines[0] points to buffer anyway
-    size_t line_count = 1;
+    bool use_first = true;
 
-    dim = graphsize(lines[0]);
+    dim = d6pack_get_n(&first);
     assert(dim > 0 && dim <= 11);
 
-    // Global dedup across orbits by CANONICAL key
-    GHashBucket *g_canonical_set = NULL;
-    if (unique) {
-        g_canonical_set = g_bucket_new_128(free, num_shards);
-    }
-
     size_t batch_num = 0;
-    size_t num_of_reps = 0;
+    size_t num_of_reps = 0, num_of_canons = 0, rejected = 0, rejected_canons = 0;
     size_t total_lines_read = 0;
+
+    if (components) {
+        if (binary) {
+            keystream_write_header(out, dim, KEYSTREAM_CANONICAL | KEYSTREAM_UNIQUE | KEYSTREAM_SORTED);
+        }
+        OutRing *ring = outring_open(out, 0, 0);
+        num_of_reps = run_components(&ks, &first, ring, binary);
+        outring_close(ring);
+        printlog(1, "Done in %.3fs. Found %zu representatives", omp_get_wtime() - time_start, num_of_reps);
+        keystream_close(&ks);
+        if (in != stdin) fclose(in);
+        if (out != stdout) fclose(out);
+        return 0;
+    }
+
+    if (resume) {
+        if ((uint64_t)dim != meta[SNAP_DIM]) {
+            fprintf(stderr, "snapshot is for dimension %lu, input has %d\n", (unsigned long)meta[SNAP_DIM], (int)dim);
+            exit(EXIT_FAILURE);
+        }
+        // skip the input consumed before the snapshot, the first line included
+        if (meta[SNAP_LINES] > 0) {
+            use_first = false;
+            total_lines_read = 1 + keystream_skip(&ks, meta[SNAP_LINES] - 1);
+            if (total_lines_read < meta[SNAP_LINES]) {
+                fprintf(stderr, "input is shorter than the snapshot, quitting ...\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        num_of_reps = meta[SNAP_REPS];
+    } else if (unique && *shm_name) {
+        // Global dedup across orbits and processes
+        g_canonical_set = dedup_new_shared(shm_name, shm_keys);
+        if (g_canonical_set == NULL) {
+            exit(EXIT_FAILURE);
+        }
+    } else if (unique) {
+        // Global dedup across orbits by CANONICAL key
+        g_canonical_set = dedup_new(num_shards, mem_budget);
+    }
+    uint64_t next_snapshot = ns_now_monotonic() + snap_interval * 1000000000ull;
+    bool snap_due = false;
     double read_time = 0, comp_time = 0;
 
+    if (binary && !resume) {
+        keystream_write_header(out, dim, unique ? KEYSTREAM_UNIQUE : 0);
+    }
+    OutRing *ring = outring_open(out, 0, 0);
+
+    // -D: chunks of MIN_CHUNK lines are written in input order; with -u
+    // their keys are inserted in that order too
+    ReorderDedup order_dedup = { .set = g_canonical_set, .binary = binary, .added = num_of_reps };
+    Reorder *order = !ordered ? NULL
+                   : reorder_open(ring, 0, unique ? reorder_commit_dedup : NULL, &order_dedup);
+    uint64_t chunk_base = 0;
+
+    // the reader thread reads batch k+1 while batch k is computed and the
+    // ring writes batch k-1
+    BatchPipe *pipe = batchpipe_open(&ks, use_first ? &first : NULL, lines_capacity, 0);
+    KeyBatch *batch = NULL;
+
     #pragma omp parallel
     {
         // Per thread buffer for output lines
         OutputBuffer thread_buffer;
-        buffer_init(&thread_buffer, 5000, out);
+        buffer_init(&thread_buffer, ring);
 
         init_nauty_data(dim);
 
         for (;;) {
-            double start = 0.0;
-
-            // Single thread reads a batch
+            // One thread swaps the batch; the implied barrier publishes it
             #pragma omp single
             {
-                start = omp_get_wtime();
-                while (line_count < lines_capacity && fgets(lines[line_count], MAXLINE, in)) {
-                    ++line_count;
+                if (batch) {
+                    batchpipe_release(pipe, batch);
                 }
+                double start = omp_get_wtime();
+                batch = batchpipe_next(pipe);
                 read_time += omp_get_wtime() - start;
 
-                total_lines_read += line_count;
-                //if (line_count != 0) {
-                //    printlog(2, "Processing batch %zu; reps found: %zu.", ++batch_num, num_of_reps);
-                //}
+                if (batch) {
+                    total_lines_read += batch->count;
+                }
+                snap_due = snap_interval && ns_now_monotonic() >= next_snapshot;
             }
 
-            // Barrier synchronizing — all see line_count
-            #pragma omp barrier
-
-            if (line_count == 0) {
+            if (batch == NULL) {
                 // End of data – exit per-thread loop
                 break;
             }
@@ -289,43 +891,74 @@ int main(int argc, char *argv[]) {
             // Processing batch – each thread operates on its own buffer
             double comp_start = omp_get_wtime();
 
-            size_t local_reps = 0;
+            size_t local_reps = 0, local_canons = 0, local_rejected = 0, local_rejected_canons = 0;
+            const key128_t *keys = batch->keys;
 
-            #pragma omp for schedule(dynamic,1000)
-            for (size_t i = 0; i < line_count; ++i) {
-                char *line = lines[i];
+            const size_t nchunks = (batch->count + MIN_CHUNK - 1) / MIN_CHUNK;
 
-                key128_t seedk;
-                d6_to_key128(line, &seedk);
+            #pragma omp for schedule(monotonic: dynamic, 1)
+            for (size_t chunk = 0; chunk < nchunks; ++chunk) {
+                // without -D the chunk goes straight to the thread's buffer
+                OutputBuffer slot, *outb = &thread_buffer;
+                if (order) {
+                    reorder_begin(order, chunk_base + chunk, &slot);
+                    outb = &slot;
+                }
+                size_t end = (chunk + 1) * MIN_CHUNK < batch->count ? (chunk + 1) * MIN_CHUNK : batch->count;
+                for (size_t i = chunk * MIN_CHUNK; i < end; ++i) {
+                    const key128_t seedk = keys[i];
 
-                // Minimality test via forward orbit
-                if (is_orbit_minimum(&seedk)) {
-                    if (unique) {
-                        vec_t m[dim], c[dim];
-                        adjpack_to_matrix(&seedk, m, dim);
-                        // Canonical key for global dedup
-                        matrix_to_matrix_canon(m, dim, c);
+                    // Minimality test via forward orbit
+                    size_t canons_before = local_canons;
+                    if (is_orbit_minimum(&seedk, &local_canons)) {
+                        if (unique) {
+                            vec_t m[dim], c[dim];
+                            adjpack_to_matrix(&seedk, m, dim);
+                            // Canonical key for global dedup
+                            matrix_to_matrix_canon(m, dim, c);
 
-                        key128_t seed_can_key;
-                        adjpack_from_matrix(c, dim, &seed_can_key);
+                            key128_t seed_can_key;
+                            adjpack_from_matrix(c, dim, &seed_can_key);
 
-                        if (g_bucket_insert_copy128(g_canonical_set, &seed_can_key)) {
+                            if (order) {
+                                reorder_add_pair(outb, &seed_can_key, &seedk);
+                            } else if (dedup_insert(g_canonical_set, &seed_can_key)) {
+                                ++local_reps;
+                                buffer_add_key(outb, &seedk, binary);   // *** per-thread buf
+                            }
+                        } else {
                             ++local_reps;
-                            buffer_add(&thread_buffer, line);   // *** per-thread buf
+                            buffer_add_key(outb, &seedk, binary);
                         }
                     } else {
-                        ++local_reps;
-                        buffer_add(&thread_buffer, line);
+                        ++local_rejected;
+                        local_rejected_canons += local_canons - canons_before;
                     }
                 }
+                if (order) {
+                    reorder_end(order, chunk_base + chunk, &slot);
+                }
             }
 
             // Update global count once per batch (after reduction)
             #pragma omp atomic
             num_of_reps += local_reps;
+            #pragma omp atomic
+            num_of_canons += local_canons;
+            #pragma omp atomic
+            rejected += local_rejected;
+            #pragma omp atomic
+            rejected_canons += local_rejected_canons;
 
-            // flush thread buffer, since it depends on buffer variable, which is overwritten on every input read
-            buffer_flush(&thread_buffer);
+            // keys are encoded into the buffer; it only has to be flushed when the
+            // snapshot records the output offset
+            if (snap_due) {
+                buffer_flush(&thread_buffer);
+                #pragma omp single nowait
+                if (order) {
+                    reorder_flush(order);
+                }
+            }
 
             // *** All threads done computing
             #pragma omp barrier
@@ -333,31 +966,63 @@ int main(int argc, char *argv[]) {
             #pragma omp single
             {
                 comp_time += omp_get_wtime() - comp_start;
-                line_count = 0;
+                chunk_base += nchunks;
+                if (order && unique) {
+                    num_of_reps = order_dedup.added;
+                }
                 printlog(2, "Processed batch %zu; reps found: %zu.", ++batch_num, num_of_reps);
-
+                if (g_canonical_set) {
+                    g_bucket_stats_log(dedup_bucket(g_canonical_set), 2, "representatives");
+                }
+                if (memo) {
+                    orbitmemo_log(memo, 2, "orbit memo");
+                }
+                if (snap_due) {
+                    save_snapshot(g_canonical_set, snap_path, ring, total_lines_read, num_of_reps);
+                    next_snapshot = ns_now_monotonic() + snap_interval * 1000000000ull;
+                }
             }
-
-            // Closure of batch (not always necessary, but keeps things tidy)
-            #pragma omp barrier
         }
 
         free_nauty_data();
-        buffer_flush(&thread_buffer);
         buffer_destroy(&thread_buffer);
     }
 
-    free(lines);
-    free(buffer);
+    batchpipe_close(pipe);
+    if (order) {
+        reorder_close(order);
+    }
 
     double time_end = omp_get_wtime();
-    printlog(1, "Times. Reading: %.3fs. Computations: %.3fs. Ratio: %.4f. Total: %.3fs. Ratio: %.4f", read_time, comp_time, comp_time/(read_time+comp_time), time_end - time_start, comp_time/(time_end - time_start));
+    printlog(1, "Times. Waiting for input: %.3fs. Computations: %.3fs. Ratio: %.4f. Total: %.3fs. Ratio: %.4f", read_time, comp_time, comp_time/(read_time+comp_time), time_end - time_start, comp_time/(time_end - time_start));
     printlog(1, "Done. Read %lu elements. Found %lu representatives", total_lines_read, num_of_reps);
+    printlog(1, "Canonical forms (%s walk): %zu, %.2f per line, %.2f per rejected line",
+             best_first ? "best-first" : "breadth-first", num_of_canons,
+             total_lines_read ? (double)num_of_canons / total_lines_read : 0.0,
+             rejected ? (double)rejected_canons / rejected : 0.0);
+
+    if (snap_path) {
+        save_snapshot(g_canonical_set, snap_path, ring, total_lines_read, num_of_reps);
+    }
+    outring_close(ring);
 
     if (g_canonical_set) {
-        g_bucket_destroy(g_canonical_set);
+        g_bucket_stats_log(dedup_bucket(g_canonical_set), 1, "representatives");
+        if (stats_path) {
+            g_bucket_stats_json(dedup_bucket(g_canonical_set), stats_path, "representatives");
+        }
+        if (dedup_runs(g_canonical_set) > 0) {
+            printlog(1, "Seen set spilled to %zu run(s) on disk", dedup_runs(g_canonical_set));
+        }
+        dedup_destroy(g_canonical_set);
+    }
+
+    if (memo) {
+        orbitmemo_log(memo, 1, "orbit memo");
+        orbitmemo_free(memo);
     }
 
+    keystream_close(&ks);
     if (in != stdin) fclose(in);
     if (out != stdout) fclose(out);
 
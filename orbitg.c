@@ -1,10 +1,22 @@
 #include <omp.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 // #include "common.h"
 #include "bott.h"
 #include "dag.h"
+#include "batchpipe.h"
 #include "bucket.h"
+#include "cbloom.h"
+#include "cpudispatch.h"
+#include "flatset.h"
+#include "hugemem.h"
+#include "keystream.h"
+#include "orbitwalk.h"
 #include "adjpack11.h"
+#include "parse_scaled.h"
+#include "tlsbuf.h"
+#include "zio.h"
 
 #define INITIAL_CAPACITY 1024
 
@@ -52,92 +64,286 @@ vec_t *matarray_get(MatArray *arr, size_t index) {
 
 static ind_t dim = 0;
 
+/* Optional prefilter (-F) holding the same keys as the orbit set. Every
+ * FILTER_SAMPLE-th negative answer is also looked up in the table, timed,
+ * to estimate how much probing the filter saved.
+ */
+#define FILTER_SAMPLE 256
+
+static CountingBloom *filter = NULL;
+static uint64_t filter_samples = 0, filter_sample_ns = 0;
+
+static INLINE bool code_maybe_present(GHashBucket *b, const key128_t *k)
+{
+    if (filter == NULL || cbloom_maybe(filter, k)) {
+        return TRUE;
+    }
+    if (filter->negatives % FILTER_SAMPLE == 0) {
+        uint64_t t0 = ns_now_monotonic();
+        void *found = g_bucket_lookup(b, k);
+        filter_sample_ns += ns_now_monotonic() - t0;
+        filter_samples++;
+        assert(found == NULL);
+        (void)found;
+    }
+    return false;
+}
+
+static void filter_add_key(const key128_t *k, void *user_data)
+{
+    cbloom_add((CountingBloom*)user_data, k);
+}
+
 void help(const char *name)
 {
-    fprintf(stderr, "Usage: %s [-i input] [-o output] [-v] [-h] [-n shards] [-t interval] [-m cap]\n", name);
-    fprintf(stderr, "  -i input    Input file (default: stdin)\n");
-    fprintf(stderr, "  -o output   Output file (default: stdout)\n");
+    fprintf(stderr, "Usage: %s [-j threads] [-l lines] [-i input] [-o output] [-B] [-v] [-h] [-n shards] [-t interval] [-m cap] [-F size] [-P len] [-A list] [-J file] [-s file [-c sec] [-r]]\n", name);
+    fprintf(stderr, "  -j threads  Number of threads walking orbits (default: max available)\n");
+    fprintf(stderr, "  -l lines    Input lines per batch (default: 100000, accepts k/M/G suffixes)\n");
+    fprintf(stderr, "  -i input    Input file (default: stdin); xz or zstd input is detected\n");
+    fprintf(stderr, "  -o output   Output file (default: stdout); compressed if it ends in .xz or .zst\n");
+    fprintf(stderr, "  -B          Write a binary key stream instead of digraph6 lines\n");
     fprintf(stderr, "  -v          Increase verbosity (can be used multiple times)\n");
     fprintf(stderr, "  -h          Show this help message and exit\n");
     fprintf(stderr, "  -n shards   Number of hash table shards (default: 1023)\n");
     fprintf(stderr, "  -t interval Print stats every <interval> seconds (default: 1)\n");
     fprintf(stderr, "  -m cap      Set peak memory cap in MB (calculates shards)\n");
+    fprintf(stderr, "  -F size     Counting Bloom filter of <size> bytes in front of the orbit set;\n");
+    fprintf(stderr, "              ~5 bytes per key for a few %% false positives (accepts k/M/G)\n");
+    fprintf(stderr, "  -P len      Walk an orbit level by level with all idle threads once <len>\n");
+    fprintf(stderr, "              matrices are queued (default: 10k, 0: never)\n");
+    fprintf(stderr, "  -A list     Table memory: huge, hugetlb, interleave, spread, pin (threads over\n");
+    fprintf(stderr, "              NUMA nodes); comma separated\n");
+    fprintf(stderr, "  -J file     Write hash table statistics (JSON) to <file> when done\n");
+    fprintf(stderr, "  -s file     Save the orbit set to a snapshot file when done\n");
+    fprintf(stderr, "  -c sec      Also save a snapshot every <sec> seconds (requires -s)\n");
+    fprintf(stderr, "  -r          Resume from the snapshot given by -s; the input must be the same\n");
 }
-/**
- * @brief Checks if the output of local calculation is in the code set.
- *
- *
- * @param b     Global bucket that stores the d6 codes.
- * @param q     Queue for storing orbit of the current code.
- * @param aux   Auxiliary matrix stores temporary output of the calculations.
- * @return void
+
+/* snapshot meta data */
+enum { SNAP_LINES, SNAP_REPS, SNAP_OUTPUT, SNAP_DIM };
+
+static void save_snapshot(GHashBucket *b, const char *path, OutputBuffer *out, unsigned long lines, unsigned long reps)
+{
+    buffer_flush(out);
+    off_t pos = outring_tell(out->ring);
+    uint64_t meta[G_BUCKET_SNAPSHOT_META] = { lines, reps, pos < 0 ? 0 : (uint64_t)pos, dim };
+    uint64_t t = ns_now_monotonic();
+    if (g_bucket_save(b, path, meta)) {
+        printlog(1, "snapshot saved after %lu lines in %.3fs", lines, (ns_now_monotonic() - t) / 1e9);
+    }
+}
+/*
+ * Orbits of a batch are explored in parallel. The lines whose canonical key
+ * is not in the orbit set are the candidates: each may be the first line of
+ * a new orbit, and one thread walks its orbit. Several candidates can lie in
+ * the same orbit, so the candidate with the least line number owns it: each
+ * candidate has an owner, at first itself, and a walk that meets a later
+ * candidate's key lowers that one's owner to itself with a CAS. A walk stops
+ * as soon as it meets an earlier candidate or its own owner was lowered, so
+ * only the owner walks the whole orbit and emits its line, as the
+ * one-threaded loop did, and the output is the same for every -j.
  */
-static INLINE void add_code(GHashBucket *b, MatArray *q, vec_t *aux)
+typedef struct {
+    key128_t  key;      /* canonical */
+    uint32_t  cand;
+} Claim;
+
+typedef struct {
+    key128_t         *keys;     /* of the candidates, in line order */
+    size_t            count;
+    Claim            *sorted;   /* by key, then candidate */
+    _Atomic uint32_t *owner;
+    bool             *rep;      /* the walk went through the whole orbit */
+} Claims;
+
+static int claim_cmp(const void *a, const void *b)
+{
+    const Claim *x = a, *y = b;
+    int c = key128_cmp(&x->key, &y->key);
+    return c ? c : (x->cand > y->cand) - (x->cand < y->cand);
+}
+
+/* Sorts the claims; a candidate with the key of an earlier one is owned by it. */
+static void claims_build(Claims *cl)
+{
+    for (size_t c = 0; c < cl->count; ++c) {
+        cl->sorted[c] = (Claim){ cl->keys[c], (uint32_t)c };
+        atomic_init(&cl->owner[c], (uint32_t)c);
+        cl->rep[c] = false;
+    }
+    qsort(cl->sorted, cl->count, sizeof(Claim), claim_cmp);
+    for (size_t i = 1; i < cl->count; ++i) {
+        if (key128_equal(&cl->sorted[i].key, &cl->sorted[i - 1].key)) {
+            atomic_init(&cl->owner[cl->sorted[i].cand], atomic_load(&cl->owner[cl->sorted[i - 1].cand]));
+        }
+    }
+}
+
+/* The first candidate with key k, or -1. */
+static int64_t claims_find(const Claims *cl, const key128_t *k)
+{
+    size_t lo = 0, hi = cl->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (key128_lt(&cl->sorted[mid].key, k)) lo = mid + 1; else hi = mid;
+    }
+    return lo < cl->count && key128_equal(&cl->sorted[lo].key, k) ? (int64_t)cl->sorted[lo].cand : -1;
+}
+
+/* Candidate c met key k in its orbit; false if an earlier candidate owns it. */
+static INLINE bool claims_meet(Claims *cl, uint32_t c, const key128_t *k)
+{
+    int64_t j = claims_find(cl, k);
+    if (j < 0 || j == c) {
+        return true;
+    }
+    if (j < c) {
+        return false;
+    }
+    uint32_t cur = atomic_load_explicit(&cl->owner[j], memory_order_relaxed);
+    while (c < cur && !atomic_compare_exchange_weak_explicit(&cl->owner[j], &cur, c,
+                                                             memory_order_relaxed, memory_order_relaxed)) {
+    }
+    return true;
+}
+
+static INLINE bool claims_owned(Claims *cl, uint32_t c)
+{
+    return atomic_load_explicit(&cl->owner[c], memory_order_relaxed) == c;
+}
+
+/* Adds the canonical key of aux to the walk; false stops it. */
+static INLINE bool add_code(Claims *cl, uint32_t c, Set128MQ *visited, MatArray *q, vec_t *aux)
 {
     vec_t out[dim];
     matrix_to_matrix_canon(aux, dim, out);
     key128_t k; adjpack_from_matrix(out, dim, &k);
-    // */
-    if ( g_bucket_lookup(b, &k)!=NULL ) {
-        return;
-    }
-    if (g_bucket_insert_copy128(b, &k)) {
+    if (set128mq_insert(visited, &k)) {
+        if (!claims_meet(cl, c, &k)) {
+            return false;
+        }
         matarray_append(q, aux);
     }
+    return true;
+}
+
+/* -P: a walk with this many matrices queued goes on in parallel, see
+ * orbitwalk.h (0: never). */
+static size_t parallel_walk_len = 10000;
+
+typedef struct {
+    Claims   *cl;
+    uint32_t  c;
+} WalkClaim;
+
+static bool meet_claims(const key128_t *k, void *user_data)
+{
+    WalkClaim *w = user_data;
+    return claims_owned(w->cl, w->c) && claims_meet(w->cl, w->c, k);
+}
+
+static void insert_key(const key128_t *k, void *user_data)
+{
+    if (g_bucket_insert_copy128((GHashBucket*)user_data, k) && filter) {
+        #pragma omp critical(orbit_filter)
+        cbloom_add(filter, k);
+    }
+}
+
+/* The keys of a walked orbit go to the orbit set, to be met by later lines. */
+static void insert_orbit(GHashBucket *bucket, const Set128MQ *visited)
+{
+    for (size_t i = 0; i < visited->cap; ++i) {
+        if (visited->ctrl[i] & 0x80) {
+            insert_key(&visited->keys[i], bucket);
+        }
+    }
+}
+
+/* Finishes the walk of candidate c with orbitwalk_parallel(), which gets
+ * the keys visited and the matrices q[h..] not expanded yet. */
+static bool populate_in_parallel(GHashBucket *bucket, Claims *cl, uint32_t c,
+                                 const Set128MQ *visited_set, MatArray *q, size_t h)
+{
+    GHashBucket *visited = orbitwalk_visited_new(4 * visited_set->size);
+    for (size_t i = 0; i < visited_set->cap; ++i) {
+        if (visited_set->ctrl[i] & 0x80) {
+            g_bucket_insert_copy128(visited, &visited_set->keys[i]);
+        }
+    }
+    WalkClaim w = { cl, c };
+    key128_t stop_key;
+    bool owned = orbitwalk_parallel(&q->rows[h * dim], q->len - h, dim, visited,
+                                    meet_claims, &w, &stop_key, NULL)
+                 && claims_owned(cl, c);
+    if (owned) {
+        g_bucket_foreach128(visited, insert_key, bucket);
+    }
+    g_bucket_destroy(visited);
+    return owned;
 }
 
 /*
- * populate_orbit - Populates the orbit of a given code by exploring its transformations.
- * @bucket: Pointer to a GHashBucket used for storing unique codes.
- * @code: The initial code to start orbit generation (as a string).
- * @mat: Pointer to a matrix vector used for transformations.
- * @aux: Auxiliary vector used during transformations.
- *
- * This function generates the orbit of the given code by applying column and row
- * transformations to its matrix representation. It uses a queue to explore all reachable
- * codes, adding new codes to the orbit if they result from valid transformations.
- * The function does not add the seed code to the bucket, only its transformations.
+ * populate_orbit - Walks the orbit of candidate c by column and row
+ * transformations, collecting its canonical keys; a walk that grows past
+ * parallel_walk_len matrices goes on level by level with the idle threads.
  *
- * Returns: The original code pointer if successful, or NULL if the input code is NULL.
+ * Returns: true if c owns the orbit and the walk is complete, its keys then
+ * added to 'bucket'; false if it stopped at a candidate before c.
  */
-static char* populate_orbit(GHashBucket *bucket, char *code)
+static bool populate_orbit(GHashBucket *bucket, Claims *cl, uint32_t c)
 {
-    if (code == NULL) {
-        return NULL;
+    if (!claims_owned(cl, c)) {
+        return false;
     }
 
     vec_t aux[dim];
 
-    matrix_from_d6(code, aux, dim);
+    adjpack_to_matrix(&cl->keys[c], aux, dim);
 
     MatArray *q = matarray_create(dim);
+    Set128MQ visited;
+    set128mq_init(&visited, 1024);
 
     matarray_append(q, aux);
+    set128mq_insert(&visited, &cl->keys[c]);
 
-    for (size_t h=0; h < q->len; ++h) {
+    bool owned = true, walked = false;
+    for (size_t h=0; h < q->len && owned; ++h) {
         vec_t *cur;
 
-        for (ind_t i=0; i<dim; ++i) {
+        if (parallel_walk_len && q->len >= parallel_walk_len && omp_get_num_threads() > 1) {
+            owned = populate_in_parallel(bucket, cl, c, &visited, q, h);
+            walked = true;
+            break;
+        }
+
+        for (ind_t i=0; i<dim && owned; ++i) {
             cur = matarray_get(q, h);
             conditional_add_col(cur, aux, dim, i);
-            add_code(bucket, q, aux);
+            owned = add_code(cl, c, &visited, q, aux);
         }
-        for (ind_t i=0; i<dim; ++i) {
-            for (ind_t j=i+1; j<dim; ++j) {
+        for (ind_t i=0; i<dim && owned; ++i) {
+            for (ind_t j=i+1; j<dim && owned; ++j) {
                 cur = matarray_get(q, h);
                 if (conditional_add_row(cur, aux, dim, i, j)) {
-                    add_code(bucket, q, aux);
+                    owned = add_code(cl, c, &visited, q, aux);
                 }
                 cur = matarray_get(q, h);
-                if (conditional_add_row(cur, aux, dim, j, i)) {
-                    add_code(bucket, q, aux);
+                if (owned && conditional_add_row(cur, aux, dim, j, i)) {
+                    owned = add_code(cl, c, &visited, q, aux);
                 }
             }
         }
+        owned = owned && claims_owned(cl, c);
     }
+    if (owned && !walked) {
+        insert_orbit(bucket, &visited);
+    }
+    set128mq_free(&visited);
     matarray_free( q );
 
-    return code;
+    return owned;
 }
 
 typedef struct {
@@ -153,6 +359,7 @@ void *print_code_set_size(void *thread_data)
     GBucketThreadData *data = (GBucketThreadData*)thread_data;
     while (data->run) {
         printlog(2, "lines: %.2fM; reps: %.2fM; bucket: %.2fM", data->lines/1000000.0, data->reps/1000000.0, g_bucket_size(data->bucket)/1000000.0);
+        g_bucket_stats_log(data->bucket, 2, "orbit set");
         usleep(data->time);
     }
     return NULL;
@@ -168,14 +375,32 @@ int main(int argc, char *argv[])
     size_t  n = 1023;
     size_t  m = 0;
 
+    const char *snap_path = NULL, *out_path = NULL;
+    unsigned long snap_interval = 0;
+    bool resume = false;
+    const char *stats_path = NULL;
+    size_t filter_bytes = 0;
+    int num_threads = omp_get_max_threads();
+    size_t lines_capacity = 100000;
+
     FILE *in = stdin, *out = stdout;
+    bool binary = false;
 
-    while ((opt = getopt(argc, argv, "vhn:i:o:t:m:")) != -1) {
+    while ((opt = getopt(argc, argv, "vhj:l:n:i:o:Bt:m:F:P:s:c:rJ:A:")) != -1) {
         switch (opt) {
         case 'v':
             ++v;
             increase_verbosity();
             break;
+        case 'j':
+            num_threads = atoi(optarg);
+            break;
+        case 'l':
+            if (!parse_scaled_size(optarg, &lines_capacity) || lines_capacity == 0 || lines_capacity > UINT32_MAX) {
+                fprintf(stderr, "Invalid -l value: %s (examples: 500k, 2M)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
         case 'n':
             n = (ind_t)atoi(optarg);
             break;
@@ -185,6 +410,18 @@ int main(int argc, char *argv[])
         case 'm':
             m = (size_t)atoi(optarg);
             break;
+        case 'F':
+            if (!parse_scaled_size(optarg, &filter_bytes) || filter_bytes == 0) {
+                fprintf(stderr, "Invalid -F value: %s (examples: 16M, 256Mi)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'P':
+            if (!parse_scaled_size(optarg, &parallel_walk_len)) {
+                fprintf(stderr, "Invalid -P value: %s (examples: 10k, 0)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
         case 'i':
             in = fopen(optarg, "r");
             if (in == NULL) {
@@ -193,9 +430,26 @@ int main(int argc, char *argv[])
             }
             break;
         case 'o':
-            out = fopen(optarg, "w");
-            if (out == NULL) {
-                perror("Error opening output file");
+            out_path = optarg;
+            break;
+        case 'B':
+            binary = true;
+            break;
+        case 's':
+            snap_path = optarg;
+            break;
+        case 'c':
+            snap_interval = (unsigned long)atol(optarg);
+            break;
+        case 'r':
+            resume = true;
+            break;
+        case 'J':
+            stats_path = optarg;
+            break;
+        case 'A':
+            if (!mem_policy_parse(optarg)) {
+                fprintf(stderr, "Invalid -A value: %s (use huge, hugetlb, interleave, spread, pin)\n", optarg);
                 exit(EXIT_FAILURE);
             }
             break;
@@ -208,75 +462,230 @@ int main(int argc, char *argv[])
         }
     }
 
-    char line[MAXLINE];
-    if ( fgets(line, MAXLINE, in)==NULL ) {
+    cpu_dispatch_log(1);
+
+    if ((resume || snap_interval) && snap_path == NULL) {
+        fprintf(stderr, "-r and -c require a snapshot file (-s)\n");
+        exit(EXIT_FAILURE);
+    }
+    if (snap_path && out_path && zio_codec_of_path(out_path) != ZIO_NONE) {
+        fprintf(stderr, "-s cannot resume a compressed output file\n");
+        exit(EXIT_FAILURE);
+    }
+
+    uint64_t meta[G_BUCKET_SNAPSHOT_META] = { 0 };
+    GHashBucket* code_set = NULL;
+    if (resume) {
+        code_set = g_bucket_load(snap_path, free, false, meta);
+        if (code_set == NULL) {
+            exit(EXIT_FAILURE);
+        }
+        printlog(1, "resuming after %lu lines, %lu representatives, %zu codes pending",
+                 (unsigned long)meta[SNAP_LINES], (unsigned long)meta[SNAP_REPS], g_bucket_size(code_set));
+        if (filter_bytes) {
+            filter = cbloom_new(filter_bytes);
+            g_bucket_foreach128(code_set, filter_add_key, filter);
+        }
+        if (out_path == NULL) {
+            fprintf(stderr, "Warning: representatives written after the snapshot will be repeated\n");
+        }
+    }
+
+    if (out_path != NULL) {
+        out = resume ? fopen_resume(out_path, meta[SNAP_OUTPUT]) : zio_fopen_write(out_path);
+        if (out == NULL) {
+            perror("Error opening output file");
+            exit(EXIT_FAILURE);
+        }
+    }
+    KeyStream ks;
+    if (!keystream_open(&ks, in)) {
+        exit(EXIT_FAILURE);
+    }
+    keystream_log(&ks, 1);
+
+    key128_t key;
+    if ( !keystream_next(&ks, &key) ) {
         fprintf(stderr, "error reading input\n");
         // g_bucket_destroy(code_set);
         exit(1);
     }
 
-    dim = graphsize( line );
+    dim = d6pack_get_n( &key );
     if (dim == 0) {
         fprintf(stderr, "read dimension zero, quitting...\n");
         // g_bucket_destroy(code_set);
         exit(1);
     }
-    init_nauty_data( dim );
-
-    char d6[MAXLINE];
-    // digraph6_to_matrix(line, mat, dim);
-    d6_to_d6_canon(line, d6);
-
-    // create a hash table bucket
-    GHashBucket* code_set = g_bucket_new_128(
-        free,        // Function to free the key when the bucket is destroyed
-        n
-    );
-    g_bucket_reserve(code_set, m*1000000ULL);
+    if (resume && (uint64_t)dim != meta[SNAP_DIM]) {
+        fprintf(stderr, "snapshot is for dimension %lu, input has %d\n", (unsigned long)meta[SNAP_DIM], (int)dim);
+        exit(1);
+    }
+    if (binary && !resume) {
+        keystream_write_header(out, dim, KEYSTREAM_CANONICAL | KEYSTREAM_UNIQUE);
+    }
+    OutRing *ring = outring_open(out, 0, 0);
+    OutputBuffer obuf;
+    buffer_init(&obuf, ring);
+
+    GBucketThreadData thread_data = { code_set, TRUE, t*1000000, 0, 0 };
+
+    bool use_first = true;
+    if (resume) {
+        // skip the input consumed before the snapshot, the first line included
+        if (meta[SNAP_LINES] > 0) {
+            use_first = false;
+            thread_data.lines = 1 + keystream_skip(&ks, meta[SNAP_LINES] - 1);
+        }
+        if (thread_data.lines < meta[SNAP_LINES]) {
+            fprintf(stderr, "input is shorter than the snapshot, quitting...\n");
+            exit(1);
+        }
+        thread_data.reps = meta[SNAP_REPS];
+    } else {
+        // create a hash table bucket
+        code_set = g_bucket_new_128(
+            free,        // Function to free the key when the bucket is destroyed
+            n
+        );
+        g_bucket_reserve(code_set, m*1000000ULL);
+        if (filter_bytes) {
+            filter = cbloom_new(filter_bytes);
+        }
+        thread_data.bucket = code_set;
+    }
+    uint64_t next_snapshot = ns_now_monotonic() + snap_interval * 1000000000ull;
 
-    populate_orbit(code_set, d6);
-    fprintf(out, "%s\n", d6);
+#if !NAUTY_HAS_TLS
+    if (num_threads > 1) {
+        fprintf(stderr, "Warning: nauty without TLS support, using single thread!\n");
+    }
+    num_threads = 1;
+#endif
+    omp_set_num_threads(num_threads);
+    if (mem_policy() & MEM_PIN) {
+        mem_pin_threads();
+    }
+    mem_policy_log(1);
+    printlog(1, "Using %d threads, batch size %zu", num_threads, lines_capacity);
 
-    GBucketThreadData thread_data = { code_set, TRUE, t*1000000, 1, 1 };
+    pthread_t monitor;
+    if (v >= 2) {
+        pthread_create(&monitor, NULL, print_code_set_size, &thread_data);
+    }
 
-    omp_set_num_threads(2);
+    BatchPipe *pipe = batchpipe_open(&ks, use_first ? &key : NULL, lines_capacity, 0);
+    KeyBatch *batch = NULL;
+    key128_t *canon = malloc(lines_capacity * sizeof(key128_t));
+    Claims claims = {
+        .keys   = malloc(lines_capacity * sizeof(key128_t)),
+        .sorted = malloc(lines_capacity * sizeof(Claim)),
+        .owner  = malloc(lines_capacity * sizeof(uint32_t)),
+        .rep    = malloc(lines_capacity * sizeof(bool)),
+    };
 
     #pragma omp parallel
     {
+        init_nauty_data( dim );
 
-        #pragma omp single nowait
-        {
-            if (v>=2) print_code_set_size(&thread_data);
-        }
-        #pragma omp master
-        {
-            while (fgets(line, MAXLINE, in) != NULL) {
-                ++thread_data.lines;
-                /* transform to canonical form */
-                d6_to_d6_canon(line, d6);
-                key128_t repkey;
-                d6_to_key128(d6, &repkey);
-                // try to delete; if succesful, then continue
-                if ( g_bucket_remove(code_set, &repkey) ) {
-                    continue;
+        for (;;) {
+            #pragma omp single
+            {
+                if (batch) {
+                    batchpipe_release(pipe, batch);
+                }
+                batch = batchpipe_next(pipe);
+                if (batch && snap_interval && ns_now_monotonic() >= next_snapshot) {
+                    // the batch is not processed yet
+                    save_snapshot(code_set, snap_path, &obuf, thread_data.lines, thread_data.reps);
+                    next_snapshot = ns_now_monotonic() + snap_interval * 1000000000ull;
+                }
+            }
+            if (batch == NULL) {
+                break;
+            }
+
+            /* transform to canonical form */
+            #pragma omp for schedule(dynamic, 1024)
+            for (size_t i = 0; i < batch->count; ++i) {
+                key128_to_key128_canon(&batch->keys[i], &canon[i]);
+            }
+
+            #pragma omp single
+            {
+                // lines of orbits met before are deleted; the rest are candidates
+                claims.count = 0;
+                for (size_t i = 0; i < batch->count; ++i) {
+                    if (code_maybe_present(code_set, &canon[i])) {
+                        if ( g_bucket_remove(code_set, &canon[i]) ) {
+                            if (filter) cbloom_remove(filter, &canon[i]);
+                            continue;
+                        }
+                        if (filter) cbloom_false_positive(filter);
+                    }
+                    claims.keys[claims.count++] = canon[i];
                 }
-                // save the code
-                // line[strlen(line)-1] = 0;
-                fprintf(out, "%s\n", d6);
-                ++thread_data.reps;
-                // populate orbit
-                populate_orbit(code_set, d6);
+                claims_build(&claims);
             }
+
+            #pragma omp for schedule(dynamic, 1)
+            for (size_t c = 0; c < claims.count; ++c) {
+                claims.rep[c] = populate_orbit(code_set, &claims, (uint32_t)c);
+            }
+
+            #pragma omp single
+            {
+                // save the owners in line order; the other candidates were met
+                for (size_t c = 0; c < claims.count; ++c) {
+                    if (claims.rep[c]) {
+                        buffer_add_key(&obuf, &claims.keys[c], binary);
+                        ++thread_data.reps;
+                    } else if (g_bucket_remove(code_set, &claims.keys[c]) && filter) {
+                        cbloom_remove(filter, &claims.keys[c]);
+                    }
+                }
+                thread_data.lines += batch->count;
+            }
+        }
+        free_nauty_data();
+    }
+    batchpipe_close(pipe);
+    free(canon);
+    free(claims.keys);
+    free(claims.sorted);
+    free((void*)claims.owner);
+    free(claims.rep);
+
+    thread_data.run = false;
+    if (v >= 2) {
+        pthread_join(monitor, NULL);
+    }
+
+    printlog(1, "%lu representatives found", thread_data.reps);
+
+    g_bucket_stats_log(code_set, 1, "orbit set");
+    if (filter) {
+        cbloom_log(filter, 1, "orbit filter");
+        if (filter_samples) {
+            double miss_ns = (double)filter_sample_ns / (double)filter_samples;
+            printlog(1, "orbit filter: a table miss took %.0f ns, about %.3fs of probing saved",
+                     miss_ns, miss_ns * (double)filter->negatives / 1e9);
         }
-        thread_data.run = false;
-        #pragma omp barrier
+        cbloom_free(filter);
+    }
+    if (stats_path) {
+        g_bucket_stats_json(code_set, stats_path, "orbit set");
     }
 
-    printlog(1, "%u representatives found", thread_data.reps);
+    if (snap_path) {
+        save_snapshot(code_set, snap_path, &obuf, thread_data.lines, thread_data.reps);
+    }
 
-    free_nauty_data();
+    buffer_destroy(&obuf);
+    outring_close(ring);
 
     // final cleaning up
+    keystream_close(&ks);
     if (code_set) {
         g_bucket_destroy(code_set);
     }
@@ -0,0 +1,187 @@
+#include "common.h"
+
+#include <stdatomic.h>
+
+#include "flatset.h"   /* key128_mix */
+#include "hugemem.h"
+#include "orbitmemo.h"
+
+/* One cache line: the sequence counter (odd while a writer holds the set),
+ * the CLOCK marks and hand, the verdict bits and three keys. An all-zero
+ * key is an empty way (keys carry n >= 1 in their top nibble).
+ */
+typedef struct {
+    _Atomic uint32_t seq;
+    _Atomic uint8_t  ref;
+    uint8_t          hand;
+    _Atomic uint8_t  verdict;
+    uint8_t          pad[9];
+    _Atomic uint64_t w[2 * ORBITMEMO_WAYS];
+} __attribute__((aligned(64))) MemoSet;
+
+_Static_assert(sizeof(MemoSet) == 64, "a memo set must fill one cache line");
+
+/* Counters striped over cache lines by set index, so that threads rarely
+ * share one. */
+#define STRIPES 16
+
+typedef struct {
+    _Atomic uint64_t lookups, hits, inserts, evictions;
+} __attribute__((aligned(64))) MemoCounters;
+
+struct _OrbitMemo {
+    MemoSet      *sets;
+    size_t        nsets;    /* power of two */
+    size_t        bytes;
+    MemoCounters  cnt[STRIPES];
+};
+
+OrbitMemo *orbitmemo_new(size_t bytes)
+{
+    OrbitMemo *m = (OrbitMemo*)aligned_alloc(64, sizeof(OrbitMemo));
+    memset(m, 0, sizeof(*m));
+    m->nsets = 1;
+    while (m->nsets * 2 * sizeof(MemoSet) <= bytes) {
+        m->nsets *= 2;
+    }
+    m->bytes = m->nsets * sizeof(MemoSet);
+    m->sets  = (MemoSet*)mem_table_alloc(m->bytes, -1);
+    return m;
+}
+
+void orbitmemo_free(OrbitMemo *m)
+{
+    if (!m) return;
+    mem_table_free(m->sets, m->bytes);
+    free(m);
+}
+
+static INLINE size_t set_index(const OrbitMemo *m, const key128_t *k)
+{
+    return (size_t)key128_mix(k) & (m->nsets - 1);
+}
+
+static INLINE void key_words(const key128_t *k, uint64_t *lo, uint64_t *hi)
+{
+    memcpy(lo, k->b + 0, 8);
+    memcpy(hi, k->b + 8, 8);
+}
+
+OrbitVerdict orbitmemo_lookup(OrbitMemo *m, const key128_t *k)
+{
+    const size_t idx = set_index(m, k);
+    MemoSet *s = &m->sets[idx];
+    MemoCounters *c = &m->cnt[idx % STRIPES];
+    uint64_t lo, hi;
+    key_words(k, &lo, &hi);
+    atomic_fetch_add_explicit(&c->lookups, 1, memory_order_relaxed);
+
+    int way;
+    uint8_t verdict;
+    for (;;) {
+        uint32_t seq = atomic_load_explicit(&s->seq, memory_order_acquire);
+        if (seq & 1) {
+            continue;   // a writer holds the set
+        }
+        way = -1;
+        for (int i = 0; i < ORBITMEMO_WAYS; ++i) {
+            if (atomic_load_explicit(&s->w[2 * i], memory_order_relaxed) == lo
+                && atomic_load_explicit(&s->w[2 * i + 1], memory_order_relaxed) == hi) {
+                way = i;
+            }
+        }
+        verdict = atomic_load_explicit(&s->verdict, memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&s->seq, memory_order_relaxed) == seq) {
+            break;
+        }
+    }
+    if (way < 0) {
+        return ORBITMEMO_UNKNOWN;
+    }
+    atomic_fetch_add_explicit(&c->hits, 1, memory_order_relaxed);
+    // mark for CLOCK, without writing the line when it is marked already
+    const uint8_t bit = (uint8_t)(1u << way);
+    if (!(atomic_load_explicit(&s->ref, memory_order_relaxed) & bit)) {
+        atomic_fetch_or_explicit(&s->ref, bit, memory_order_relaxed);
+    }
+    return (verdict & bit) ? ORBITMEMO_MIN : ORBITMEMO_NOT_MIN;
+}
+
+void orbitmemo_insert(OrbitMemo *m, const key128_t *k, bool is_min)
+{
+    const size_t idx = set_index(m, k);
+    MemoSet *s = &m->sets[idx];
+    MemoCounters *c = &m->cnt[idx % STRIPES];
+    uint64_t lo, hi;
+    key_words(k, &lo, &hi);
+
+    uint32_t seq = atomic_load_explicit(&s->seq, memory_order_relaxed);
+    for (;;) {
+        if (!(seq & 1) && atomic_compare_exchange_weak_explicit(&s->seq, &seq, seq + 1,
+                                                                memory_order_acquire, memory_order_relaxed)) {
+            break;
+        }
+        seq = atomic_load_explicit(&s->seq, memory_order_relaxed);
+    }
+    atomic_thread_fence(memory_order_release);
+
+    // the key itself, else an empty way, else the CLOCK victim
+    int way = -1, empty = -1;
+    for (int i = 0; i < ORBITMEMO_WAYS; ++i) {
+        uint64_t wlo = atomic_load_explicit(&s->w[2 * i], memory_order_relaxed);
+        uint64_t whi = atomic_load_explicit(&s->w[2 * i + 1], memory_order_relaxed);
+        if (wlo == lo && whi == hi) {
+            way = i;
+        } else if (empty < 0 && wlo == 0 && whi == 0) {
+            empty = i;
+        }
+    }
+    uint8_t ref = atomic_load_explicit(&s->ref, memory_order_relaxed);
+    if (way < 0 && empty >= 0) {
+        way = empty;
+        atomic_fetch_add_explicit(&c->inserts, 1, memory_order_relaxed);
+    } else if (way < 0) {
+        while (ref & (1u << s->hand)) {
+            ref &= (uint8_t)~(1u << s->hand);
+            s->hand = (uint8_t)((s->hand + 1) % ORBITMEMO_WAYS);
+        }
+        way = s->hand;
+        s->hand = (uint8_t)((s->hand + 1) % ORBITMEMO_WAYS);
+        atomic_fetch_add_explicit(&c->inserts, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&c->evictions, 1, memory_order_relaxed);
+    }
+    const uint8_t bit = (uint8_t)(1u << way);
+    uint8_t verdict = atomic_load_explicit(&s->verdict, memory_order_relaxed);
+    verdict = is_min ? (verdict | bit) : (verdict & (uint8_t)~bit);
+    atomic_store_explicit(&s->w[2 * way], lo, memory_order_relaxed);
+    atomic_store_explicit(&s->w[2 * way + 1], hi, memory_order_relaxed);
+    atomic_store_explicit(&s->verdict, verdict, memory_order_relaxed);
+    atomic_store_explicit(&s->ref, (uint8_t)(ref & ~bit), memory_order_relaxed);
+
+    atomic_store_explicit(&s->seq, seq + 2, memory_order_release);
+}
+
+void orbitmemo_stats(const OrbitMemo *m, OrbitMemoStats *st)
+{
+    memset(st, 0, sizeof(*st));
+    for (int i = 0; i < STRIPES; ++i) {
+        st->lookups   += atomic_load_explicit(&m->cnt[i].lookups, memory_order_relaxed);
+        st->hits      += atomic_load_explicit(&m->cnt[i].hits, memory_order_relaxed);
+        st->inserts   += atomic_load_explicit(&m->cnt[i].inserts, memory_order_relaxed);
+        st->evictions += atomic_load_explicit(&m->cnt[i].evictions, memory_order_relaxed);
+    }
+    st->bytes = m->bytes;
+    st->keys  = (size_t)(st->inserts - st->evictions);
+}
+
+void orbitmemo_log(const OrbitMemo *m, unsigned int v, const char *name)
+{
+    OrbitMemoStats st;
+    orbitmemo_stats(m, &st);
+    printlog(v, "%s: %.1f MiB, %zu of %zu keys held (%.1f%%); %lu lookups, %.1f%% hits; %lu keys evicted",
+             name, st.bytes / 1048576.0, st.keys, m->nsets * ORBITMEMO_WAYS,
+             100.0 * (double)st.keys / (double)(m->nsets * ORBITMEMO_WAYS),
+             (unsigned long)st.lookups, st.lookups ? 100.0 * (double)st.hits / (double)st.lookups : 0.0,
+             (unsigned long)st.evictions);
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "common.h"
+
+/*
+ * Concurrent memo of orbit verdicts for minimalf.
+ *
+ * Orbits under the isomorphism operations are equivalence classes, so once
+ * one is explored every canonical key met there has a known answer: the
+ * seed's key is the minimum of its orbit, all others are not; an early
+ * exit at a smaller key k proves every key seen above k non-minimal. The
+ * memo keeps these verdicts, so a later line of the same class is
+ * answered with one lookup.
+ *
+ * The table has a fixed memory budget: sets of ORBITMEMO_WAYS keys, one
+ * cache line each, picked by the key's hash. A full set evicts with the
+ * CLOCK policy (a hit marks a key, the hand skips and unmarks marked
+ * keys). Readers take no lock: a sequence counter per set makes them
+ * retry while the set is written; writers lock the set with the same
+ * counter. Lost verdicts only cost a walk, never a wrong answer.
+ */
+#define ORBITMEMO_WAYS 3
+
+typedef struct _OrbitMemo OrbitMemo;
+
+typedef enum {
+    ORBITMEMO_UNKNOWN = -1,
+    ORBITMEMO_NOT_MIN =  0,
+    ORBITMEMO_MIN     =  1,
+} OrbitVerdict;
+
+/* Memo of at most 'bytes' (rounded down to a power of two sets, at least
+ * one set). */
+OrbitMemo   *orbitmemo_new(size_t bytes);
+void         orbitmemo_free(OrbitMemo *m);
+
+OrbitVerdict orbitmemo_lookup(OrbitMemo *m, const key128_t *k);
+void         orbitmemo_insert(OrbitMemo *m, const key128_t *k, bool is_min);
+
+typedef struct {
+    uint64_t lookups, hits, inserts, evictions;
+    size_t   bytes, keys;
+} OrbitMemoStats;
+
+void orbitmemo_stats(const OrbitMemo *m, OrbitMemoStats *st);
+
+/* printlog() size, fill, hit rate and evictions. */
+void orbitmemo_log(const OrbitMemo *m, unsigned int v, const char *name);
@@ -0,0 +1,131 @@
+#include <omp.h>
+#include <stdatomic.h>
+
+#include "adjpack11.h"
+#include "dag.h"
+#include "orbitwalk.h"
+
+#define VISITED_SHARDS 64
+
+typedef struct {
+    vec_t  *rows;
+    size_t  len;        /* matrices */
+    size_t  cap;
+} Level;
+
+static void level_append(Level *l, const vec_t *mat, ind_t dim)
+{
+    if (l->len == l->cap) {
+        l->cap = l->cap ? 2 * l->cap : ORBITWALK_CHUNK;
+        l->rows = realloc(l->rows, l->cap * dim * sizeof(vec_t));
+        assert(l->rows != NULL);
+    }
+    memcpy(&l->rows[l->len++ * dim], mat, dim * sizeof(vec_t));
+}
+
+typedef struct {
+    ind_t           dim;
+    GHashBucket    *visited;
+    OrbitWalkVisit  visit;
+    void           *user_data;
+    atomic_bool     stop;
+    atomic_flag     stop_taken;
+    key128_t       *stop_key;
+    atomic_size_t   canons;
+} Walk;
+
+/* Canonicalises one neighbour; false if the walk must stop. */
+static bool add_neighbour(Walk *w, const vec_t *aux, Level *next, size_t *canons)
+{
+    const ind_t dim = w->dim;
+    vec_t can[dim];
+    key128_t k;
+    matrix_to_matrix_canon(aux, dim, can);
+    ++*canons;
+    adjpack_from_matrix(can, dim, &k);
+    if (!g_bucket_insert_copy128(w->visited, &k)) {
+        return true;
+    }
+    if (!w->visit(&k, w->user_data)) {
+        if (!atomic_flag_test_and_set(&w->stop_taken)) {
+            *w->stop_key = k;
+        }
+        atomic_store_explicit(&w->stop, true, memory_order_relaxed);
+        return false;
+    }
+    level_append(next, aux, dim);
+    return true;
+}
+
+/* Op2 for every column and Op3 both ways, as in the sequential walks. */
+static void expand_chunk(Walk *w, const vec_t *mats, size_t count, Level *next)
+{
+    const ind_t dim = w->dim;
+    vec_t aux[dim];
+    size_t canons = 0;
+    for (size_t m = 0; m < count && !atomic_load_explicit(&w->stop, memory_order_relaxed); ++m) {
+        const vec_t *cur = &mats[m * dim];
+        for (ind_t i = 0; i < dim; ++i) {
+            conditional_add_col(cur, aux, dim, i);
+            if (!add_neighbour(w, aux, next, &canons)) goto done;
+        }
+        for (ind_t i = 0; i < dim; ++i) {
+            for (ind_t j = i + 1; j < dim; ++j) {
+                if (conditional_add_row(cur, aux, dim, i, j) && !add_neighbour(w, aux, next, &canons)) goto done;
+                if (conditional_add_row(cur, aux, dim, j, i) && !add_neighbour(w, aux, next, &canons)) goto done;
+            }
+        }
+    }
+done:
+    atomic_fetch_add_explicit(&w->canons, canons, memory_order_relaxed);
+}
+
+bool orbitwalk_parallel(const vec_t *frontier, size_t count, ind_t dim, GHashBucket *visited,
+                        OrbitWalkVisit visit, void *user_data, key128_t *stop_key, size_t *canons)
+{
+    Walk w = { .dim = dim, .visited = visited, .visit = visit, .user_data = user_data,
+               .stop_key = stop_key };
+    atomic_init(&w.stop, false);
+    atomic_flag_clear(&w.stop_taken);
+    atomic_init(&w.canons, 0);
+
+    Level level = { 0 };
+    for (size_t m = 0; m < count; ++m) {
+        level_append(&level, &frontier[m * dim], dim);
+    }
+
+    while (level.len > 0 && !atomic_load(&w.stop)) {
+        const size_t nchunks = (level.len + ORBITWALK_CHUNK - 1) / ORBITWALK_CHUNK;
+        Level *next = calloc(nchunks, sizeof(Level));
+        for (size_t c = 0; c < nchunks; ++c) {
+            const size_t first = c * ORBITWALK_CHUNK;
+            const size_t len = level.len - first < ORBITWALK_CHUNK ? level.len - first : ORBITWALK_CHUNK;
+            #pragma omp task default(shared) firstprivate(c, first, len)
+            expand_chunk(&w, &level.rows[first * dim], len, &next[c]);
+        }
+        #pragma omp taskwait
+
+        // the next level, in chunk order
+        level.len = 0;
+        for (size_t c = 0; c < nchunks; ++c) {
+            for (size_t m = 0; m < next[c].len; ++m) {
+                level_append(&level, &next[c].rows[m * dim], dim);
+            }
+            free(next[c].rows);
+        }
+        free(next);
+    }
+    free(level.rows);
+
+    if (canons) {
+        *canons += atomic_load(&w.canons);
+    }
+    return !atomic_load(&w.stop);
+}
+
+GHashBucket *orbitwalk_visited_new(size_t expected)
+{
+    GHashBucket *b = g_bucket_new_128(NULL, VISITED_SHARDS);
+    g_bucket_reserve(b, expected);
+    return b;
+}
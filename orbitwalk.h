@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "bott.h"
+#include "bucket.h"
+
+/*
+ * Level-synchronous parallel walk of one orbit, for the giant ones.
+ *
+ * minimalf and orbitg walk an orbit per thread; a walk that grows past a
+ * threshold hands its unexpanded matrices to orbitwalk_parallel(), which
+ * expands the orbit level by level: each level is cut into chunks of
+ * ORBITWALK_CHUNK matrices, each chunk an OpenMP task, so the threads of
+ * the team that are idle (e.g. waiting at the end of a loop) take part,
+ * and the next level is gathered after a taskwait. The canonical keys go
+ * to 'visited', a GHashBucket, which may be filled concurrently.
+ *
+ * The caller's 'visit' is called once for every new key, from any thread;
+ * when it returns false the walk stops as soon as the running chunks
+ * notice, and the key is stored in *stop_key. Every thread that runs a
+ * task must have called init_nauty_data(dim).
+ */
+#define ORBITWALK_CHUNK 32
+
+typedef bool (*OrbitWalkVisit)(const key128_t *k, void *user_data);
+
+/* Expands 'count' matrices of 'dim' rows at 'frontier' and all that they
+ * lead to. Returns true if the orbit was walked to the end; *canons (may
+ * be NULL) gets the number of canonical forms computed added.
+ */
+bool orbitwalk_parallel(const vec_t *frontier, size_t count, ind_t dim, GHashBucket *visited,
+                        OrbitWalkVisit visit, void *user_data, key128_t *stop_key, size_t *canons);
+
+/* A bucket for 'visited' with room for 'expected' keys. */
+GHashBucket *orbitwalk_visited_new(size_t expected);
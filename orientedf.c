@@ -1,35 +1,68 @@
 #include "bott.h"
 #include "dag.h"
+#include "adjpack11.h"
+#include "batchpipe.h"
+#include "keystream.h"
+#include "tlsbuf.h"
 
-int main(void) {
+int main(int argc, char *argv[]) {
     vec_t mat[64];
-    int n;
-    char s[MAXLINE];
+    unsigned n;
+    key128_t k;
     int all_even_out_degree;
+    bool binary = false;
+    KeyStream in;
 
-    // Main loop to read one line (one graph) at a time
-    while (fgets(s, sizeof(s), stdin) != NULL) {
-
-        // 1. Determine the number of vertices (n) from the graph6 string.
-        n = graphsize(s);
-        if (n == 0) {
-            fprintf(stderr, "Invalid graph6 string: %s", s);
-            continue; // Skip invalid or empty lines
+    int opt;
+    while ((opt = getopt(argc, argv, "B")) != -1) {
+        if (opt != 'B') {
+            fprintf(stderr, "Usage: %s [-B] < input > output\n  -B  write a binary key stream\n", argv[0]);
+            exit(EXIT_FAILURE);
         }
-        matrix_from_d6(s, mat, n);
-        // --- Filtering Logic ---
-        all_even_out_degree = 1;
-        for (int i = 0; i < n; ++i) {
-            int out_degree = row_sum(mat[i]);
-            if ((out_degree & 1) == 1) {
-                all_even_out_degree = 0;
-                break;
+        binary = true;
+    }
+    if (!keystream_open(&in, stdin)) {
+        exit(EXIT_FAILURE);
+    }
+    if (binary) {
+        keystream_write_header(stdout, in.n, in.flags);
+    }
+
+    // Batches are read ahead by the pipe's thread, output is written by the ring's
+    BatchPipe *pipe = batchpipe_open(&in, NULL, 0, 0);
+    OutRing *ring = outring_open(stdout, 0, 0);
+    OutputBuffer out;
+    buffer_init(&out, ring);
+
+    for (KeyBatch *b; (b = batchpipe_next(pipe)) != NULL; batchpipe_release(pipe, b)) {
+        for (size_t j = 0; j < b->count; ++j) {
+            k = b->keys[j];
+
+            // 1. Determine the number of vertices (n) from the key.
+            n = d6pack_get_n(&k);
+            adjpack_to_matrix(&k, mat, n);
+            // --- Filtering Logic ---
+            all_even_out_degree = 1;
+            for (unsigned i = 0; i < n; ++i) {
+                int out_degree = row_sum(mat[i]);
+                if ((out_degree & 1) == 1) {
+                    all_even_out_degree = 0;
+                    break;
+                }
             }
-        }
 
-        if (all_even_out_degree) {
-            printf("%s", s);
+            if (all_even_out_degree) {
+                buffer_add_key(&out, &k, binary);
+            }
         }
     }
+    buffer_destroy(&out);
+    outring_close(ring);
+    batchpipe_close(pipe);
+
+    if (in.skipped) {
+        fprintf(stderr, "Skipped %lu lines that are not digraph6\n", (unsigned long)in.skipped);
+    }
+    keystream_close(&in);
     return 0;
 }
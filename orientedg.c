@@ -1,54 +1,65 @@
 #include <omp.h>
 
 #include "bott.h"
+#include "cpudispatch.h"
 #include "dag.h"    /* matrix_to_d6 */
 #include "adjpack11.h"
-#include "bucket.h"
+#include "dedup.h"
+#include "keystream.h"
+#include "parse_scaled.h"
+#include "reorder.h"
+#include "shardset.h"
 #include "tlsbuf.h"
+#include "zio.h"
 
 static void help(const char *name)
 {
     fprintf(stderr,
-        "Usage: %s [-j njobs] [-s start_dim] [-d dimension] [-a] [-p] [-n] [-v] [-h] [-o <path>|stdout|-]\n"
+        "Usage: %s [-j njobs] [-s start_dim] [-d dimension] [-a] [-p] [-n] [-v] [-h] [-m size] [-o <path>|stdout|-] [-O dir] [-B] [-D]\n"
         "-j: number of threads\n"
         "-d: dimension to calculate\n"
         "-p: show progress during computation\n"
-        "-o: write DAG codes (d6) to file; stdout is default\n"
+        "-o: write DAG codes (d6) to file; stdout is default; a file ending in .xz\n"
+        "    or .zst is compressed\n"
+        "-O: write DAG codes to one file per thread in dir, listed in dir/MANIFEST;\n"
+        "    shardcat checks, concatenates or merges them\n"
+        "-B: write a binary key stream instead of d6 lines\n"
+        "-D: write the codes in state order, so that every run and -j give the\n"
+        "    same output\n"
+        "-m: memory budget for seen codes, spilled to $TMPDIR beyond it (k/M/G suffixes)\n"
         "-v: be verbose\n",
         name);
 }
 
-/* --- I/O buffer per‑task for d6 codes --- */
-struct out_ctx {
-    int enabled;        /* whether -o is enabled */
-    FILE *fp;           /* where to write (stdout/file) */
-    char *buf;          /* buffer for batched I/O */
-    size_t used;        /* how many bytes are used */
-    size_t cap;         /* buffer capacity */
-};
-#define OUTBUF_CAP (1u<<20) /* ~1 MiB per task */
-
-static INLINE void out_flush(struct out_ctx *out)
-{
-    if (!out || !out->enabled || out->used == 0) return;
-    #pragma omp critical(output)
-    {
-        (void)fwrite(out->buf, 1, out->used, out->fp);
-        fflush(out->fp);
-    }
-    out->used = 0;
-}
+static unsigned long progress = 0;
 
-static INLINE void out_append_line(struct out_ctx *out, const char *line)
+/* Runs the states base..end, the new canonical codes to 'out'; with 'order'
+ * they are only queued, the dedup is done in state order by the commit.
+ */
+static void run_states(unsigned long base, unsigned long end, const vec_t *cache, ind_t dim,
+                       DedupSet *seen, Reorder *order, OutputBuffer *out, bool binary)
 {
-    if (!out || !out->enabled) return;
-    size_t len = strlen(line);
-    if (out->used + len + 1 >= out->cap) {
-        out_flush(out);
+    vec_t *mat = init(dim);
+    key128_t key;
+
+    init_nauty_data(dim);
+    for (state_t s = (state_t)base; s <= (state_t)end; ++s) {
+        matrix_by_state(mat, cache, s, dim);
+        assert(is_orientable(mat, dim));
+        matrix_to_key128_canon(mat, dim, &key);
+        if (order) {
+            reorder_add_pair(out, &key, &key);
+        } else if (dedup_insert(seen, &key)) {
+            buffer_add_key(out, &key, binary);
+        }
     }
-    memcpy(out->buf + out->used, line, len);
-    out->used += len;
-    out->buf[out->used++] = '\n';
+    free_nauty_data();
+    free(mat);
+
+    /* progress: entire chunk with a single atomic update */
+    unsigned long done = (unsigned long)(end - base + 1);
+    #pragma omp atomic update
+        progress += done;
 }
 
 /* -------------------- main -------------------- */
@@ -56,24 +67,36 @@ int main(int argc, char *argv[])
 {
     int opt = 1;
     int progress_enabled = 0;
+    bool ordered = false;
     /* defaults */
     ind_t dim = 6;
     vec_t *cache;
     size_t cache_size;
 
     /* -o */
-    const char *out_path = NULL;
+    const char *out_path = NULL, *shard_dir = NULL;
     FILE *out_fp = stdout;
+    bool binary = false;
+    size_t mem_budget = 0;
 
     tic();
 
-    while ((opt = getopt(argc, argv, "vhj:d:po:")) != -1) {
+    while ((opt = getopt(argc, argv, "vhj:d:po:O:BDm:")) != -1) {
         switch (opt) {
         case 'p': progress_enabled = 1; break;
         case 'v': increase_verbosity(); break;
         case 'j': omp_set_num_threads(atoi(optarg)); break;
         case 'd': dim  = (ind_t)atoi(optarg); break;
         case 'o': out_path = optarg; break;
+        case 'O': shard_dir = optarg; break;
+        case 'B': binary = true; break;
+        case 'D': ordered = true; break;
+        case 'm':
+            if (!parse_scaled_size(optarg, &mem_budget)) {
+                fprintf(stderr, "Invalid -m value: %s (examples: 512M, 8G, 4Gi)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
         case 'h': help(argv[0]); exit(EXIT_SUCCESS);
         default: help(argv[0]); exit(EXIT_FAILURE);
         }
@@ -84,13 +107,30 @@ int main(int argc, char *argv[])
 
     state_t max_state = get_max_state(dim);
 
-    /* -o: open output */
-    if (out_path!=NULL) {
-        out_fp = fopen(out_path, "w");
-        if (!out_fp) {
-            fprintf(stderr, "Cannot open output file '%s': %s\n", out_path, strerror(errno));
-            exit(EXIT_FAILURE);
+    /* -o: open output; -O: a shard per thread */
+    if (out_path && shard_dir) {
+        fprintf(stderr, "-o and -O exclude each other\n");
+        exit(EXIT_FAILURE);
+    }
+    if (ordered && shard_dir) {
+        fprintf(stderr, "-D cannot be combined with -O, shards follow the threads\n");
+        exit(EXIT_FAILURE);
+    }
+    OutRing *ring;
+    if (shard_dir) {
+        ring = outring_open_shards(shardset_create(shard_dir, binary, dim, KEYSTREAM_CANONICAL | KEYSTREAM_UNIQUE), 0, 0);
+    } else {
+        if (out_path!=NULL) {
+            out_fp = zio_fopen_write(out_path);
+            if (!out_fp) {
+                fprintf(stderr, "Cannot open output file '%s': %s\n", out_path, strerror(errno));
+                exit(EXIT_FAILURE);
+            }
         }
+        if (binary) {
+            keystream_write_header(out_fp, dim, KEYSTREAM_CANONICAL | KEYSTREAM_UNIQUE);
+        }
+        ring = outring_open(out_fp, 0, 0);
     }
 
     const unsigned long total_iters = (unsigned long)(max_state + 1);
@@ -107,88 +147,87 @@ int main(int argc, char *argv[])
     printlog(2, "openmp task grain set to %lu iterations\n", grain);
 
     /* progress and streams */
-    static unsigned long progress = 0;
     #pragma omp atomic write
     progress = 0;
 
     FILE *progress_stream = stderr;
 
-    GHashBucket *g_canonical_set = g_bucket_new_128(NULL, 1023);
+    DedupSet *g_canonical_set = dedup_new(1023, mem_budget);
 
+    cpu_dispatch_log(1);
     printlog(1, "starting calculations");
-    /* ------------------ Parallelism (tasks) ------------------ */
-    #pragma omp parallel
-    #pragma omp single nowait
-    {
-        /* progress monitor */
-        if (progress_enabled) {
-            #pragma omp task untied firstprivate(total_iters, progress_stream)
-            {
-                monitor_progress(&progress, total_iters, progress_stream);
-            }
-        }
-
-        /* worker tasks */
-        #pragma omp taskgroup
-        {
-            for (unsigned long base = 0ul; base <= (unsigned long)max_state; ) {
+    if (ordered) {
+        /* -D: chunks of states taken in increasing order from a counter by
+         * every thread (but the one of the progress monitor), so that the
+         * reorder window cannot wait for a chunk nobody works on
+         */
+        ReorderDedup order_dedup = { .set = g_canonical_set, .binary = binary, .added = 0 };
+        Reorder *order = reorder_open(ring, 0, reorder_commit_dedup, &order_dedup);
+        const unsigned long nchunks = (total_iters + grain - 1) / grain;
+        unsigned long next_chunk = 0;
+
+        #pragma omp parallel
+        if (progress_enabled && omp_get_thread_num() == 0 && omp_get_num_threads() > 1) {
+            monitor_progress(&progress, total_iters, progress_stream);
+        } else {
+            for (;;) {
+                unsigned long c;
+                #pragma omp atomic capture
+                c = next_chunk++;
+                if (c >= nchunks) break;
+
+                unsigned long base = c * grain;
                 unsigned long end = base + grain - 1;
                 if (end > (unsigned long)max_state) end = (unsigned long)max_state;
 
-                #pragma omp task firstprivate(base, end, dim) shared(cache, progress, out_fp) \
-                                 untied
+                OutputBuffer out;
+                reorder_begin(order, c, &out);
+                run_states(base, end, cache, dim, g_canonical_set, order, &out, binary);
+                reorder_end(order, c, &out);
+            }
+        }
+        reorder_close(order);
+    } else {
+        /* ------------------ Parallelism (tasks) ------------------ */
+        #pragma omp parallel
+        #pragma omp single nowait
+        {
+            /* progress monitor */
+            if (progress_enabled) {
+                #pragma omp task untied firstprivate(total_iters, progress_stream)
                 {
-                    vec_t *mat = init(dim),
-                          *can = init(dim);
-                    key128_t key;
-                    char buf[MAXLINE];
-
-                    struct out_ctx out = {0};
-                    out.enabled = true;
-                    out.fp = out_fp;
-                    out.cap = OUTBUF_CAP;
-                    out.buf = (char*)malloc(out.cap);
-                    out.used = 0;
-                    if (!out.buf) {
-                        fprintf(stderr, "malloc failed for output buffer\n");
-                        exit(EXIT_FAILURE);
-                    }
+                    monitor_progress(&progress, total_iters, progress_stream);
+                }
+            }
 
-                    init_nauty_data(dim);
-                    for (state_t s = (state_t)base; s <= (state_t)end; ++s) {
-                        matrix_by_state(mat, cache, s, dim);
-                        assert(is_orientable(mat, dim));
-                        // matrix_to_matrix_canon(mat, dim, can);
-                        // adjpack_from_matrix(can, dim, &key);
-                        matrix_to_key128_canon(mat, dim, &key);
-                        if (g_bucket_insert_copy128(g_canonical_set, &key)) {
-                            d6pack_encode(&key, dim, buf);
-                            out_append_line(&out, buf);
-                        }
-                    }
-                    free_nauty_data();
+            /* worker tasks */
+            #pragma omp taskgroup
+            {
+                for (unsigned long base = 0ul; base <= (unsigned long)max_state; ) {
+                    unsigned long end = base + grain - 1;
+                    if (end > (unsigned long)max_state) end = (unsigned long)max_state;
 
-                    /* flush the code buffer and clean up */
-                    out_flush(&out);
-                    free(out.buf);
+                    #pragma omp task firstprivate(base, end, dim) shared(cache, ring, binary) \
+                                     untied
+                    {
+                        OutputBuffer out;
+                        buffer_init(&out, ring);
 
-                    /* progress: entire chunk with a single atomic update */
-                    unsigned long done = (unsigned long)(end - base + 1);
-                    #pragma omp atomic update
-                        progress += done;
+                        run_states(base, end, cache, dim, g_canonical_set, NULL, &out, binary);
 
-                    free(mat);
-                    free(can);
-                }
+                        /* hand the last codes to the writer */
+                        buffer_destroy(&out);
+                    }
 
-                if (end == (unsigned long)max_state) break;
-                base = end + 1;
+                    if (end == (unsigned long)max_state) break;
+                    base = end + 1;
+                }
             }
-        }
 
-        /* finalize progress */
-        #pragma omp atomic write
-            progress = total_iters;
+            /* finalize progress */
+            #pragma omp atomic write
+                progress = total_iters;
+        }
     }
 
     if (progress_enabled) {
@@ -197,9 +236,10 @@ int main(int argc, char *argv[])
     }
     printlog(1, "all calculations done");
 
-    g_bucket_destroy(g_canonical_set);
+    dedup_destroy(g_canonical_set);
 
     /* close the file if it's not stdout */
+    outring_close(ring);
     if (out_fp != stdout) {
         fclose(out_fp);
     }
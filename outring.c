@@ -0,0 +1,384 @@
+#include "common.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <omp.h>
+
+#include "outring.h"
+#include "shardset.h"
+
+#define OUTRING_BLOCK_BYTES (256u << 10)
+#define OUTRING_MIN_BLOCK   4096u
+#define OUTRING_SPINS       64
+#define OUTRING_WAIT_NS     10000000L   /* timed waits, so a lost wake-up costs 10 ms at most */
+
+typedef struct {
+    atomic_size_t  seq;
+    OutBlock      *blk;
+} RingCell;
+
+/* Bounded MPMC queue of block pointers (D. Vyukov's design). It is never
+ * full: it has a cell for every block of the pool.
+ */
+typedef struct {
+    RingCell     *cells;
+    size_t        mask;
+    _Alignas(64) atomic_size_t head;    /* next push */
+    _Alignas(64) atomic_size_t tail;    /* next pop */
+} BlockQueue;
+
+struct _OutRing {
+    BlockQueue      full, free;
+    OutBlock       *blocks;
+    char           *arena;
+    size_t          nblocks, block_bytes;
+    FILE           *fp;
+    int             fd;             /* -1 for a stream without one, see zio.h */
+    ShardSet       *shards;         /* or blocks go to the shard of their thread */
+
+    pthread_t       writer;
+    pthread_mutex_t lock;
+    pthread_cond_t  wake_writer;        /* blocks pushed, or stop */
+    pthread_cond_t  wake_waiters;       /* blocks written */
+    atomic_int      writer_idle;
+    atomic_int      waiters;
+    atomic_bool     stop;
+
+    _Alignas(64) atomic_uint_fast64_t pushed;
+    _Alignas(64) atomic_uint_fast64_t written;
+    uint64_t        bytes, writes;      /* writer only */
+    atomic_uint_fast64_t stalls;
+};
+
+static void queue_init(BlockQueue *q, size_t n)
+{
+    q->cells = (RingCell*)malloc(n * sizeof(RingCell));
+    if (q->cells == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < n; ++i) {
+        atomic_init(&q->cells[i].seq, i);
+        q->cells[i].blk = NULL;
+    }
+    q->mask = n - 1;
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+}
+
+static void queue_push(BlockQueue *q, OutBlock *b)
+{
+    size_t pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+    RingCell *c;
+    for (;;) {
+        c = &q->cells[pos & q->mask];
+        size_t seq = atomic_load_explicit(&c->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&q->head, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else {
+            /* diff < 0 would be a full queue, which the pool size rules out */
+            pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+        }
+    }
+    c->blk = b;
+    atomic_store_explicit(&c->seq, pos + 1, memory_order_release);
+}
+
+static OutBlock *queue_pop(BlockQueue *q)
+{
+    size_t pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    RingCell *c;
+    for (;;) {
+        c = &q->cells[pos & q->mask];
+        size_t seq = atomic_load_explicit(&c->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&q->tail, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return NULL;
+        } else {
+            pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+        }
+    }
+    OutBlock *b = c->blk;
+    atomic_store_explicit(&c->seq, pos + q->mask + 1, memory_order_release);
+    return b;
+}
+
+static bool queue_empty(BlockQueue *q)
+{
+    size_t pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    return atomic_load_explicit(&q->cells[pos & q->mask].seq, memory_order_acquire) != pos + 1;
+}
+
+static void timed_wait(pthread_cond_t *cond, pthread_mutex_t *lock)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += OUTRING_WAIT_NS;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait(cond, lock, &ts);
+}
+
+/* Wakes whoever sleeps on 'cond' if 'sleepers' says anyone might. The
+ * fences pair with the ones in the sleepers' re-check.
+ */
+static INLINE void wake(OutRing *r, pthread_cond_t *cond, atomic_int *sleepers)
+{
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(sleepers, memory_order_relaxed)) {
+        pthread_mutex_lock(&r->lock);
+        pthread_cond_broadcast(cond);
+        pthread_mutex_unlock(&r->lock);
+    }
+}
+
+static void write_blocks(OutRing *r, OutBlock **batch, int n)
+{
+    struct iovec iov[OUTRING_IOV];
+    int cnt = 0;
+    for (int i = 0; i < n; ++i) {
+        if (batch[i]->used) {
+            iov[cnt].iov_base = batch[i]->data;
+            iov[cnt].iov_len  = batch[i]->used;
+            r->bytes += batch[i]->used;
+            cnt++;
+        }
+    }
+    if (r->fd < 0) {
+        for (int i = 0; i < cnt; ++i) {
+            if (fwrite(iov[i].iov_base, 1, iov[i].iov_len, r->fp) != iov[i].iov_len) {
+                perror("Error writing output");
+                exit(EXIT_FAILURE);
+            }
+        }
+        r->writes++;
+        return;
+    }
+    struct iovec *v = iov;
+    while (cnt > 0) {
+        ssize_t w = writev(r->fd, v, cnt);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            perror("Error writing output");
+            exit(EXIT_FAILURE);
+        }
+        r->writes++;
+        while (cnt > 0 && (size_t)w >= v->iov_len) {
+            w -= (ssize_t)v->iov_len;
+            v++;
+            cnt--;
+        }
+        if (cnt > 0) {
+            v->iov_base = (char*)v->iov_base + w;
+            v->iov_len -= (size_t)w;
+        }
+    }
+}
+
+static void *writer_main(void *arg)
+{
+    OutRing *r = (OutRing*)arg;
+    OutBlock *batch[OUTRING_IOV];
+
+    for (;;) {
+        int n = 0;
+        OutBlock *b;
+        while (n < OUTRING_IOV && (b = queue_pop(&r->full)) != NULL) {
+            batch[n++] = b;
+        }
+        if (n == 0) {
+            if (atomic_load(&r->stop)) break;
+            pthread_mutex_lock(&r->lock);
+            atomic_store(&r->writer_idle, 1);
+            atomic_thread_fence(memory_order_seq_cst);
+            if (queue_empty(&r->full) && !atomic_load(&r->stop)) {
+                timed_wait(&r->wake_writer, &r->lock);
+            }
+            atomic_store(&r->writer_idle, 0);
+            pthread_mutex_unlock(&r->lock);
+            continue;
+        }
+        write_blocks(r, batch, n);
+        for (int i = 0; i < n; ++i) {
+            batch[i]->used = 0;
+            queue_push(&r->free, batch[i]);
+        }
+        atomic_fetch_add_explicit(&r->written, (uint_fast64_t)n, memory_order_release);
+        wake(r, &r->wake_waiters, &r->waiters);
+    }
+    return NULL;
+}
+
+/* The pool and the queues, all blocks free. */
+static OutRing *ring_new(size_t block_bytes, size_t nblocks)
+{
+    if (block_bytes == 0) block_bytes = OUTRING_BLOCK_BYTES;
+    if (block_bytes < OUTRING_MIN_BLOCK) block_bytes = OUTRING_MIN_BLOCK;
+    if (nblocks == 0) nblocks = 4 * (size_t)omp_get_max_threads();
+    if (nblocks < 8) nblocks = 8;
+    size_t n = 1;
+    while (n < nblocks) n <<= 1;
+
+    OutRing *r = (OutRing*)calloc(1, sizeof(OutRing));
+    r->arena  = (char*)malloc(n * block_bytes);
+    r->blocks = (OutBlock*)malloc(n * sizeof(OutBlock));
+    if (r->arena == NULL || r->blocks == NULL) {
+        fprintf(stderr, "Cannot allocate %zu output blocks of %zu bytes\n", n, block_bytes);
+        exit(EXIT_FAILURE);
+    }
+    r->nblocks = n;
+    r->block_bytes = block_bytes;
+
+    queue_init(&r->full, n);
+    queue_init(&r->free, n);
+    for (size_t i = 0; i < n; ++i) {
+        r->blocks[i].data = r->arena + i * block_bytes;
+        r->blocks[i].used = 0;
+        queue_push(&r->free, &r->blocks[i]);
+    }
+
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->wake_writer, NULL);
+    pthread_cond_init(&r->wake_waiters, NULL);
+    atomic_init(&r->writer_idle, 0);
+    atomic_init(&r->waiters, 0);
+    atomic_init(&r->stop, false);
+    atomic_init(&r->pushed, 0);
+    atomic_init(&r->written, 0);
+    atomic_init(&r->stalls, 0);
+    return r;
+}
+
+OutRing *outring_open(FILE *fp, size_t block_bytes, size_t nblocks)
+{
+    OutRing *r = ring_new(block_bytes, nblocks);
+    fflush(fp);
+    r->fp = fp;
+    r->fd = fileno(fp);
+
+    int err = pthread_create(&r->writer, NULL, writer_main, r);
+    if (err != 0) {
+        fprintf(stderr, "Cannot start the output thread: %s\n", strerror(err));
+        exit(EXIT_FAILURE);
+    }
+    printlog(2, "output ring: %zu blocks of %zu KiB", r->nblocks, r->block_bytes >> 10);
+    return r;
+}
+
+OutRing *outring_open_shards(ShardSet *s, size_t block_bytes, size_t nblocks)
+{
+    OutRing *r = ring_new(block_bytes, nblocks);
+    r->shards = s;
+    r->fd = -1;
+    return r;
+}
+
+void outring_close(OutRing *r)
+{
+    if (!r) return;
+    if (r->shards) {
+        shardset_close(r->shards);
+    } else {
+        outring_sync(r);
+        atomic_store(&r->stop, true);
+        pthread_mutex_lock(&r->lock);
+        pthread_cond_signal(&r->wake_writer);
+        pthread_mutex_unlock(&r->lock);
+        pthread_join(r->writer, NULL);
+        printlog(2, "output ring: %.1f MiB in %lu write calls, producers waited for a block %lu times",
+                 r->bytes / 1048576.0, (unsigned long)r->writes,
+                 (unsigned long)atomic_load_explicit(&r->stalls, memory_order_relaxed));
+    }
+
+    pthread_mutex_destroy(&r->lock);
+    pthread_cond_destroy(&r->wake_writer);
+    pthread_cond_destroy(&r->wake_waiters);
+    free(r->full.cells);
+    free(r->free.cells);
+    free(r->blocks);
+    free(r->arena);
+    free(r);
+}
+
+size_t outring_block_bytes(const OutRing *r)
+{
+    return r->block_bytes;
+}
+
+OutBlock *outring_acquire(OutRing *r)
+{
+    OutBlock *b = queue_pop(&r->free);
+    if (LIKELY(b != NULL)) return b;
+
+    atomic_fetch_add_explicit(&r->stalls, 1, memory_order_relaxed);
+    for (int i = 0; i < OUTRING_SPINS; ++i) {
+        sched_yield();
+        if ((b = queue_pop(&r->free)) != NULL) return b;
+    }
+    pthread_mutex_lock(&r->lock);
+    atomic_fetch_add(&r->waiters, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    while ((b = queue_pop(&r->free)) == NULL) {
+        timed_wait(&r->wake_waiters, &r->lock);
+    }
+    atomic_fetch_sub(&r->waiters, 1);
+    pthread_mutex_unlock(&r->lock);
+    return b;
+}
+
+void outring_push(OutRing *r, OutBlock *b)
+{
+    if (b->used == 0) {
+        queue_push(&r->free, b);
+        return;
+    }
+    if (r->shards) {
+        shardset_write(r->shards, b->data, b->used);
+        b->used = 0;
+        queue_push(&r->free, b);
+        wake(r, &r->wake_waiters, &r->waiters);
+        return;
+    }
+    queue_push(&r->full, b);
+    atomic_fetch_add_explicit(&r->pushed, 1, memory_order_relaxed);
+    wake(r, &r->wake_writer, &r->writer_idle);
+}
+
+void outring_sync(OutRing *r)
+{
+    uint_fast64_t target = atomic_load(&r->pushed);
+    if (atomic_load_explicit(&r->written, memory_order_acquire) >= target) return;
+
+    pthread_mutex_lock(&r->lock);
+    atomic_fetch_add(&r->waiters, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    while (atomic_load_explicit(&r->written, memory_order_acquire) < target) {
+        pthread_cond_signal(&r->wake_writer);
+        timed_wait(&r->wake_waiters, &r->lock);
+    }
+    atomic_fetch_sub(&r->waiters, 1);
+    pthread_mutex_unlock(&r->lock);
+}
+
+off_t outring_tell(OutRing *r)
+{
+    outring_sync(r);
+    return r->fd < 0 ? -1 : lseek(r->fd, 0, SEEK_CUR);
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdio.h>
+#include <sys/types.h>
+
+#include "common.h"
+
+/*
+ * Output ring: bounded, block-based output shared by all threads of a tool.
+ *
+ * The ring owns a fixed pool of 'nblocks' blocks of 'block_bytes' each.
+ * A producer takes a free block, fills it with whole lines and pushes it;
+ * a single writer thread pops the full blocks and issues one writev(2) for
+ * up to OUTRING_IOV of them, then returns them to the pool. Both queues are
+ * lock-free (bounded multi-producer/multi-consumer rings with per-cell
+ * sequence numbers); the mutex and condition variables are touched only when
+ * the writer has nothing to do or a producer finds the pool empty, which is
+ * the backpressure: memory never grows beyond the pool, a producer that
+ * outruns the disk waits for a block.
+ *
+ * Order is per block: lines of one block stay together and in order, blocks
+ * of different producers interleave in the order they were pushed.
+ * Producers normally use the OutputBuffer of tlsbuf.h rather than the blocks
+ * directly.
+ */
+#define OUTRING_IOV 16
+
+typedef struct {
+    char   *data;
+    size_t  used;
+} OutBlock;
+
+typedef struct _OutRing OutRing;
+
+/* Starts the writer thread on fileno(fp), after flushing fp; 0 selects the
+ * defaults: 256 KiB blocks, four per OpenMP thread (at least 8). A stream
+ * without a descriptor (a compressed one of zio.h) is written with fwrite().
+ * The ring does not close fp.
+ */
+OutRing *outring_open(FILE *fp, size_t block_bytes, size_t nblocks);
+
+typedef struct _ShardSet ShardSet;
+
+/* A ring without a writer thread: every block pushed is written to the
+ * shard of the pushing thread (see shardset.h) right away, by that thread.
+ * Closing the ring closes 's' and writes its manifest.
+ */
+OutRing *outring_open_shards(ShardSet *s, size_t block_bytes, size_t nblocks);
+
+/* Writes out everything pushed, stops the writer and frees the pool; logs
+ * the bytes, write calls and producer waits at verbosity 2.
+ */
+void outring_close(OutRing *r);
+
+size_t outring_block_bytes(const OutRing *r);
+
+/* A free block, waiting for the writer if there is none. */
+OutBlock *outring_acquire(OutRing *r);
+
+/* Hands 'b' (b->used bytes) to the writer; empty blocks go back to the pool. */
+void outring_push(OutRing *r, OutBlock *b);
+
+/* Returns once every block pushed before the call has been written. */
+void outring_sync(OutRing *r);
+
+/* outring_sync(), then the offset of the file (-1 for pipes, terminals and
+ * compressed streams).
+ */
+off_t outring_tell(OutRing *r);
+
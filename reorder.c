@@ -0,0 +1,159 @@
+#include "common.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <omp.h>
+
+#include "reorder.h"
+
+#define REORDER_SLOT_BYTES (64u << 10)   /* first size of a slot, it doubles as needed */
+
+typedef struct {
+    _Alignas(64) OutBlock block;
+    size_t   cap;
+    bool     done;
+} Slot;
+
+struct _Reorder {
+    OutRing        *ring;
+    OutputBuffer    out;            /* of the committing thread */
+    ReorderCommit   commit;
+    void           *user_data;
+    size_t          window;
+    Slot           *slots;
+
+    pthread_mutex_t lock;
+    pthread_cond_t  room;           /* chunks written */
+    uint64_t        next;           /* lowest chunk not written */
+    bool            committing;
+    uint64_t        waits;
+    size_t          slot_bytes;     /* slots only grow, so this is the peak */
+};
+
+Reorder *reorder_open(OutRing *ring, size_t window, ReorderCommit commit, void *user_data)
+{
+    Reorder *r = (Reorder*)calloc(1, sizeof(Reorder));
+    if (window == 0) {
+        window = 4 * (size_t)omp_get_max_threads();
+    }
+    r->slots = (Slot*)aligned_alloc(64, window * sizeof(Slot));
+    if (r->slots == NULL) {
+        perror("aligned_alloc");
+        exit(EXIT_FAILURE);
+    }
+    memset(r->slots, 0, window * sizeof(Slot));
+    r->ring      = ring;
+    r->commit    = commit;
+    r->user_data = user_data;
+    r->window    = window;
+    buffer_init(&r->out, ring);
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->room, NULL);
+    printlog(2, "output order: a window of %zu chunks", window);
+    return r;
+}
+
+void reorder_begin(Reorder *r, uint64_t seq, OutputBuffer *out)
+{
+    pthread_mutex_lock(&r->lock);
+    if (seq >= r->next + r->window) {
+        r->waits++;
+        do {
+            pthread_cond_wait(&r->room, &r->lock);
+        } while (seq >= r->next + r->window);
+    }
+    // the slot of seq - window has been written, so the slot is free
+    Slot *s = &r->slots[seq % r->window];
+    if (s->cap == 0) {
+        s->cap = REORDER_SLOT_BYTES;
+        s->block.data = (char*)malloc(s->cap);
+        if (s->block.data == NULL) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        r->slot_bytes += s->cap;
+    }
+    pthread_mutex_unlock(&r->lock);
+
+    // a buffer without a ring grows its block, see buffer_reserve()
+    out->ring  = NULL;
+    out->block = &s->block;
+    out->pos   = s->block.data;
+    out->end   = s->block.data + s->cap;
+}
+
+static void commit_slot(Reorder *r, Slot *s)
+{
+    if (r->commit) {
+        r->commit(s->block.data, s->block.used, &r->out, r->user_data);
+        return;
+    }
+    const size_t block_bytes = outring_block_bytes(r->ring);
+    for (size_t off = 0; off < s->block.used; off += block_bytes) {
+        size_t len = s->block.used - off < block_bytes ? s->block.used - off : block_bytes;
+        buffer_write(&r->out, s->block.data + off, len);
+    }
+}
+
+void reorder_end(Reorder *r, uint64_t seq, OutputBuffer *out)
+{
+    Slot *s = &r->slots[seq % r->window];
+    size_t cap = (size_t)(out->end - s->block.data);
+    s->block.used = (size_t)(out->pos - s->block.data);
+    out->block = NULL;
+    out->pos = out->end = NULL;
+
+    pthread_mutex_lock(&r->lock);
+    r->slot_bytes += cap - s->cap;
+    s->cap = cap;
+    s->done = true;
+    if (r->committing || seq != r->next) {
+        // the committing thread, or the one of chunk r->next, writes it
+        pthread_mutex_unlock(&r->lock);
+        return;
+    }
+    r->committing = true;
+    while ((s = &r->slots[r->next % r->window])->done) {
+        pthread_mutex_unlock(&r->lock);
+        commit_slot(r, s);
+        pthread_mutex_lock(&r->lock);
+        s->done = false;
+        r->next++;
+        pthread_cond_broadcast(&r->room);
+    }
+    r->committing = false;
+    pthread_mutex_unlock(&r->lock);
+}
+
+void reorder_flush(Reorder *r)
+{
+    buffer_flush(&r->out);
+}
+
+void reorder_close(Reorder *r)
+{
+    buffer_destroy(&r->out);
+    for (size_t i = 0; i < r->window; ++i) {
+        assert(!r->slots[i].done);
+        free(r->slots[i].block.data);
+    }
+    printlog(2, "output order: %lu chunks, at most %.1f MiB of slots, %lu waits for the window",
+             (unsigned long)r->next, r->slot_bytes / 1048576.0, (unsigned long)r->waits);
+    pthread_cond_destroy(&r->room);
+    pthread_mutex_destroy(&r->lock);
+    free(r->slots);
+    free(r);
+}
+
+void reorder_commit_dedup(const char *data, size_t len, OutputBuffer *out, void *user_data)
+{
+    ReorderDedup *d = (ReorderDedup*)user_data;
+    key128_t pair[2];
+    for (size_t off = 0; off + sizeof(pair) <= len; off += sizeof(pair)) {
+        memcpy(pair, data + off, sizeof(pair));
+        if (dedup_insert(d->set, &pair[0])) {
+            buffer_add_key(out, &pair[1], d->binary);
+            d->added++;
+        }
+    }
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "common.h"
+#include "dedup.h"
+#include "tlsbuf.h"
+
+/*
+ * Reorder buffer: output in a fixed order from threads that finish their
+ * work in any order, so that reruns give the same bytes whatever the
+ * scheduling (the -D option of the tools).
+ *
+ * The work is cut into chunks numbered 0, 1, 2, ... (lines of a batch,
+ * ranges of states). reorder_begin() points an OutputBuffer at a slot of
+ * the chunk instead of the ring; reorder_end() hands the slot in, and the
+ * thread that completes the lowest chunk not yet written commits it and
+ * every following chunk already done to the ring, in order. Only 'window'
+ * chunks may be open or done but unwritten: reorder_begin() of a chunk
+ * further ahead waits, so the memory is at most 'window' slots of the
+ * largest chunk. The threads must begin the chunks in increasing order
+ * (a monotonic dynamic schedule, or a shared counter) and not wait for each
+ * other in between; then the lowest open chunk is always being worked on.
+ *
+ * A commit function may transform the chunk on its way to the ring. With
+ * reorder_commit_dedup() a chunk holds pairs of keys and the dedup set is
+ * filled in chunk order, so the first occurrence in input order is the one
+ * written, not the first one a thread happened to insert.
+ */
+typedef struct _Reorder Reorder;
+
+typedef void (*ReorderCommit)(const char *data, size_t len, OutputBuffer *out, void *user_data);
+
+/* A reorder buffer writing to 'ring'; 'window' 0 selects four chunks per
+ * OpenMP thread, 'commit' NULL copies the chunks as they are.
+ */
+Reorder *reorder_open(OutRing *ring, size_t window, ReorderCommit commit, void *user_data);
+
+/* Points 'out' at an empty slot for chunk 'seq', after waiting until
+ * seq < (chunks written) + window. Only buffer_write(), buffer_add() and
+ * buffer_add_key() may be used on it; the slot grows as needed.
+ */
+void reorder_begin(Reorder *r, uint64_t seq, OutputBuffer *out);
+
+/* Hands in chunk 'seq' filled through 'out'; writes it, and the chunks
+ * after it that are done, if every chunk before it has been written.
+ */
+void reorder_end(Reorder *r, uint64_t seq, OutputBuffer *out);
+
+/* Pushes the chunks written so far to the ring, e.g. before outring_tell(). */
+void reorder_flush(Reorder *r);
+
+/* Every chunk begun must have ended. Flushes, frees the slots and logs the
+ * chunks, the peak slot memory and the waits at verbosity 2.
+ */
+void reorder_close(Reorder *r);
+
+/* Commit of a chunk of key pairs, see reorder_add_pair(); 'user_data' is
+ * a ReorderDedup.
+ */
+typedef struct {
+    DedupSet *set;
+    bool      binary;
+    size_t    added;    /* output keys written */
+} ReorderDedup;
+
+void reorder_commit_dedup(const char *data, size_t len, OutputBuffer *out, void *user_data);
+
+/* Queues 'key' for the output, if 'dkey' is new to the dedup set at commit. */
+static INLINE void reorder_add_pair(OutputBuffer *out, const key128_t *dkey, const key128_t *key)
+{
+    key128_t pair[2] = { *dkey, *key };
+    buffer_write(out, (const char*)pair, sizeof(pair));
+}
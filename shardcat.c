@@ -0,0 +1,373 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <omp.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <xxhash.h>
+
+#include "batchpipe.h"
+#include "bucket.h"  /* key128_cmp */
+#include "cpudispatch.h"
+#include "keystream.h"
+#include "shardset.h"
+#include "tlsbuf.h"
+#include "zio.h"
+
+#define MERGE_BATCH_KEYS 16384
+
+void help(const char *progname) {
+    if (progname == NULL) progname = "shardcat";
+    printf("Usage: %s [options] DIR\n", progname);
+    printf("Write the shards listed in DIR/MANIFEST (backtrack -O, orientedg -O) as one\n");
+    printf("stream. By default they are concatenated in the order of the manifest, each\n");
+    printf("checked against its record count and checksum; the shards are read and\n");
+    printf("checked in parallel and, into a regular file, also written in parallel.\n\n");
+    printf("Options:\n");
+    printf("  -s           Merge key-sorted shards into one sorted stream instead (a k-way\n");
+    printf("               merge, every shard read ahead by a thread of its own); checks the\n");
+    printf("               order and record count of each shard, not its checksum.\n");
+    printf("  -u           With -s, write a key found in several shards once.\n");
+    printf("  -B           With -s, write a binary key stream instead of digraph6 lines.\n");
+    printf("  -c           Only check the shards against the manifest.\n");
+    printf("  -j NUM       Number of OpenMP threads (default: %d).\n", omp_get_max_threads());
+    printf("  -v           Increase verbosity (can be repeated).\n");
+    printf("  -o FILE      Write output to FILE instead of stdout (compressed if FILE ends\n");
+    printf("               in .xz or .zst).\n");
+    printf("  -h           Show this help message and exit.\n\n");
+    printf("The exit status is 1 if a shard does not match the manifest.\n\n");
+    printf("Examples:\n");
+    printf("  ./backtrack -d 9 -n -O shards/ && %s -o 09-spinc.d6 shards/\n", progname);
+    printf("  %s -c shards/\n", progname);
+}
+
+static void shard_path(char *path, const char *dir, const ShardInfo *s)
+{
+    snprintf(path, PATH_MAX, "%s/%s", dir, s->name);
+}
+
+/* Whether the 'bytes' at 'p' are the shard 's' of the manifest. */
+static bool check_shard(const ShardManifest *m, const ShardInfo *s, const char *p, size_t bytes)
+{
+    if (bytes != s->bytes) {
+        fprintf(stderr, "%s: %zu bytes, the manifest says %lu\n", s->name, bytes, (unsigned long)s->bytes);
+        return false;
+    }
+    uint64_t records = 0;
+    if (m->binary) {
+        if (bytes < KEYSTREAM_HEADER || memcmp(p, KEYSTREAM_MAGIC, 4) != 0) {
+            fprintf(stderr, "%s: not a key stream\n", s->name);
+            return false;
+        }
+        records = (bytes - KEYSTREAM_HEADER) / sizeof(key128_t);
+    } else {
+        for (const char *q = p, *end = p + bytes; (q = memchr(q, '\n', (size_t)(end - q))) != NULL; ++q) {
+            records++;
+        }
+    }
+    if (records != s->records) {
+        fprintf(stderr, "%s: %lu records, the manifest says %lu\n", s->name,
+                (unsigned long)records, (unsigned long)s->records);
+        return false;
+    }
+    if (XXH3_64bits(p, bytes) != s->checksum) {
+        fprintf(stderr, "%s: checksum mismatch\n", s->name);
+        return false;
+    }
+    return true;
+}
+
+static void pwrite_all(int fd, const char *p, size_t len, off_t off)
+{
+    while (len > 0) {
+        ssize_t w = pwrite(fd, p, len, off);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            perror("Error writing output");
+            exit(EXIT_FAILURE);
+        }
+        p   += w;
+        len -= (size_t)w;
+        off += w;
+    }
+}
+
+/* Checks every shard and, with 'out', writes them one after the other (a
+ * binary set under a single header). Returns the number of bad shards.
+ */
+static int concatenate(const ShardManifest *m, const char *dir, FILE *out)
+{
+    size_t skip = m->binary ? KEYSTREAM_HEADER : 0;
+    if (out && m->binary) {
+        keystream_write_header(out, m->n, m->flags);
+    }
+
+    // into a regular file every shard goes to its own offset, in parallel
+    struct stat st;
+    int fd = out ? fileno(out) : -1;
+    bool seekable = fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+    off_t *offset = (off_t*)malloc((m->nshards + 1) * sizeof(off_t));
+    if (offset == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    if (out) fflush(out);
+    offset[0] = seekable ? ftello(out) : 0;
+    for (size_t i = 0; i < m->nshards; ++i) {
+        offset[i + 1] = offset[i] + (off_t)(m->shards[i].bytes > skip ? m->shards[i].bytes - skip : 0);
+    }
+
+    int bad = 0;
+    #pragma omp parallel for ordered schedule(dynamic, 1) reduction(+:bad)
+    for (size_t i = 0; i < m->nshards; ++i) {
+        const ShardInfo *s = &m->shards[i];
+        char path[PATH_MAX];
+        shard_path(path, dir, s);
+        int sfd = open(path, O_RDONLY);
+        struct stat sst;
+        char *p = NULL;
+        size_t bytes = 0;
+        bool ok = sfd >= 0 && fstat(sfd, &sst) == 0;
+        if (ok && (bytes = (size_t)sst.st_size) > 0) {
+            p = mmap(NULL, bytes, PROT_READ, MAP_PRIVATE, sfd, 0);
+            if (p == MAP_FAILED) {
+                p  = NULL;
+                ok = false;
+            } else {
+                madvise(p, bytes, MADV_SEQUENTIAL);
+            }
+        }
+        if (!ok) {
+            fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        }
+        ok = ok && check_shard(m, s, p ? p : "", bytes);
+        bad += !ok;
+        if (ok && seekable) {
+            pwrite_all(fd, p + skip, bytes - skip, offset[i]);
+        }
+
+        #pragma omp ordered
+        if (ok && out && !seekable && fwrite(p + skip, 1, bytes - skip, out) != bytes - skip) {
+            perror("Error writing output");
+            exit(EXIT_FAILURE);
+        }
+
+        if (p) munmap(p, bytes);
+        if (sfd >= 0) close(sfd);
+        printlog(2, "%s: %lu records%s", s->name, (unsigned long)s->records, ok ? "" : ", bad");
+    }
+    if (seekable) {
+        fseeko(out, offset[m->nshards], SEEK_SET);
+    }
+    free(offset);
+    return bad;
+}
+
+/* --- k-way merge --- */
+
+typedef struct {
+    const ShardInfo *info;
+    FILE            *fp;
+    KeyStream        ks;
+    BatchPipe       *pipe;
+    KeyBatch        *batch;
+    size_t           pos;
+    uint64_t         records;
+} Source;
+
+static INLINE const key128_t *source_key(const Source *s)
+{
+    return &s->batch->keys[s->pos];
+}
+
+/* Moves to the next key of 's'; false at its end. */
+static bool source_next(Source *s)
+{
+    if (s->batch && ++s->pos < s->batch->count) {
+        return true;
+    }
+    if (s->batch) {
+        batchpipe_release(s->pipe, s->batch);
+    }
+    s->batch = batchpipe_next(s->pipe);
+    s->pos = 0;
+    return s->batch != NULL;
+}
+
+static INLINE bool source_less(Source *const *h, size_t a, size_t b)
+{
+    return key128_cmp(source_key(h[a]), source_key(h[b])) < 0;
+}
+
+static void sift_down(Source **h, size_t n, size_t i)
+{
+    for (;;) {
+        size_t c = 2 * i + 1;
+        if (c >= n) break;
+        if (c + 1 < n && source_less(h, c + 1, c)) c++;
+        if (!source_less(h, c, i)) break;
+        Source *t = h[i]; h[i] = h[c]; h[c] = t;
+        i = c;
+    }
+}
+
+static int merge(const ShardManifest *m, const char *dir, FILE *out, bool unique, bool binary)
+{
+    size_t n = m->nshards;
+    Source *src = (Source*)calloc(n ? n : 1, sizeof(Source));
+    Source **heap = (Source**)malloc((n ? n : 1) * sizeof(Source*));
+    if (src == NULL || heap == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    size_t live = 0;
+    unsigned dim = m->n;
+    for (size_t i = 0; i < n; ++i) {
+        char path[PATH_MAX];
+        shard_path(path, dir, &m->shards[i]);
+        src[i].info = &m->shards[i];
+        src[i].fp = fopen(path, "r");
+        if (src[i].fp == NULL) {
+            fprintf(stderr, "%s: %s\n", path, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        if (!keystream_open(&src[i].ks, src[i].fp)) {
+            exit(EXIT_FAILURE);
+        }
+        src[i].pipe = batchpipe_open(&src[i].ks, NULL, MERGE_BATCH_KEYS, 2);
+        if (source_next(&src[i])) {
+            heap[live++] = &src[i];
+            if (dim == 0) dim = d6pack_get_n(source_key(&src[i]));
+        }
+    }
+    for (size_t i = live / 2; i-- > 0; ) {
+        sift_down(heap, live, i);
+    }
+
+    if (binary) {
+        keystream_write_header(out, dim, m->flags | KEYSTREAM_SORTED | (unique ? KEYSTREAM_UNIQUE : 0));
+    }
+    OutRing *ring = outring_open(out, 0, 0);
+    OutputBuffer buf;
+    buffer_init(&buf, ring);
+
+    key128_t last = { 0 };
+    uint64_t written = 0, dropped = 0;
+    while (live > 0) {
+        Source *s = heap[0];
+        key128_t k = *source_key(s);
+        s->records++;
+        if (unique && written && key128_cmp(&k, &last) == 0) {
+            dropped++;
+        } else {
+            buffer_add_key(&buf, &k, binary);
+            last = k;
+            written++;
+        }
+        if (source_next(s)) {
+            if (key128_cmp(source_key(s), &k) < 0) {
+                fprintf(stderr, "%s: not sorted at record %lu\n", s->info->name, (unsigned long)s->records);
+                exit(EXIT_FAILURE);
+            }
+        } else {
+            heap[0] = heap[--live];
+        }
+        sift_down(heap, live, 0);
+    }
+    buffer_destroy(&buf);
+    outring_close(ring);
+
+    int bad = 0;
+    for (size_t i = 0; i < n; ++i) {
+        batchpipe_close(src[i].pipe);
+        keystream_close(&src[i].ks);
+        fclose(src[i].fp);
+        if (src[i].records != src[i].info->records) {
+            fprintf(stderr, "%s: %lu records, the manifest says %lu\n", src[i].info->name,
+                    (unsigned long)src[i].records, (unsigned long)src[i].info->records);
+            bad++;
+        }
+    }
+    printlog(1, "Merged %zu shards: %lu keys written, %lu duplicates dropped",
+             n, (unsigned long)written, (unsigned long)dropped);
+    free(heap);
+    free(src);
+    return bad;
+}
+
+int main(int argc, char *argv[]) {
+
+    tic();
+    FILE *out = stdout;
+    bool sorted = false, unique = false, binary = false, check = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "suBcj:vo:h")) != -1) {
+        switch (opt) {
+        case 's':
+            sorted = true;
+            break;
+        case 'u':
+            unique = true;
+            break;
+        case 'B':
+            binary = true;
+            break;
+        case 'c':
+            check = true;
+            break;
+        case 'j':
+            omp_set_num_threads(atoi(optarg));
+            break;
+        case 'v':
+            increase_verbosity();
+            break;
+        case 'o':
+            out = zio_fopen_write(optarg);
+            if (out == NULL) {
+                perror("Error opening output file");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'h':
+            help(argv[0]);
+            exit(EXIT_SUCCESS);
+        default: /* '?' */
+            help(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    cpu_dispatch_log(1);
+    if (optind != argc - 1) {
+        help(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if ((unique || binary) && !sorted) {
+        fprintf(stderr, "-u and -B require -s\n");
+        exit(EXIT_FAILURE);
+    }
+    if (check && sorted) {
+        fprintf(stderr, "-c and -s cannot be combined\n");
+        exit(EXIT_FAILURE);
+    }
+
+    const char *dir = argv[optind];
+    ShardManifest m;
+    if (!shardset_read_manifest(&m, dir)) {
+        exit(EXIT_FAILURE);
+    }
+    printlog(1, "%zu shards of %s", m.nshards, m.binary ? "keys" : "digraph6 lines");
+
+    int bad = sorted ? merge(&m, dir, out, unique, binary) : concatenate(&m, dir, check ? NULL : out);
+    if (bad) {
+        fprintf(stderr, "%d of %zu shards do not match the manifest\n", bad, m.nshards);
+    } else if (check) {
+        fprintf(stderr, "%zu shards OK\n", m.nshards);
+    }
+    shardset_free_manifest(&m);
+    if (out != stdout) fclose(out);
+    printlog(1, "Total time: %.3fs", toc_sec());
+    return bad ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,230 @@
+#include "common.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <omp.h>
+#include <xxhash.h>
+
+#include "keystream.h"
+#include "shardset.h"
+
+typedef struct {
+    _Alignas(64) int fd;            /* -1 until the thread writes */
+    uint64_t     records, bytes;
+    XXH3_state_t *hash;
+} Shard;
+
+struct _ShardSet {
+    char          *dir;
+    bool           binary;
+    unsigned       n, flags;
+    unsigned char  header[KEYSTREAM_HEADER];
+    int            nshards;
+    Shard         *shards;
+};
+
+static void shard_name(char *name, int i, bool binary)
+{
+    snprintf(name, SHARDSET_NAME_MAX, "shard-%03d.%s", i, binary ? "keys" : "d6");
+}
+
+ShardSet *shardset_create(const char *dir, bool binary, unsigned n, unsigned flags)
+{
+    if (mkdir(dir, 0777) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Cannot create the shard directory '%s': %s\n", dir, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    ShardSet *s = (ShardSet*)calloc(1, sizeof(ShardSet));
+    s->dir     = strdup(dir);
+    s->binary  = binary;
+    s->n       = n;
+    s->flags   = flags;
+    s->nshards = omp_get_max_threads();
+    s->shards  = (Shard*)aligned_alloc(64, (size_t)s->nshards * sizeof(Shard));
+    if (s->dir == NULL || s->shards == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    keystream_make_header(s->header, n, flags);
+    for (int i = 0; i < s->nshards; ++i) {
+        memset(&s->shards[i], 0, sizeof(Shard));
+        s->shards[i].fd = -1;
+    }
+    // shards of an earlier run must not be mistaken for ones of this run
+    char name[SHARDSET_NAME_MAX], path[PATH_MAX];
+    for (int i = 0; ; ++i) {
+        bool found = false;
+        for (int b = 0; b < 2; ++b) {
+            shard_name(name, i, b);
+            snprintf(path, sizeof(path), "%s/%s", dir, name);
+            found |= unlink(path) == 0;
+        }
+        if (!found && i >= s->nshards) break;
+    }
+    printlog(2, "output: shards in %s, up to %d", dir, s->nshards);
+    return s;
+}
+
+static void write_all(Shard *sh, const char *data, size_t len)
+{
+    XXH3_64bits_update(sh->hash, data, len);
+    sh->bytes += len;
+    while (len > 0) {
+        ssize_t w = write(sh->fd, data, len);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            perror("Error writing a shard");
+            exit(EXIT_FAILURE);
+        }
+        data += w;
+        len  -= (size_t)w;
+    }
+}
+
+static void shard_open(ShardSet *s, int i)
+{
+    Shard *sh = &s->shards[i];
+    char name[SHARDSET_NAME_MAX], path[PATH_MAX];
+    shard_name(name, i, s->binary);
+    snprintf(path, sizeof(path), "%s/%s", s->dir, name);
+    sh->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    sh->hash = XXH3_createState();
+    if (sh->fd < 0 || sh->hash == NULL) {
+        fprintf(stderr, "Cannot create the shard '%s': %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    XXH3_64bits_reset(sh->hash);
+    if (s->binary) {
+        write_all(sh, (const char*)s->header, KEYSTREAM_HEADER);
+    }
+}
+
+static uint64_t count_lines(const char *p, size_t len)
+{
+    uint64_t lines = 0;
+    const char *end = p + len;
+    while ((p = memchr(p, '\n', (size_t)(end - p))) != NULL) {
+        ++lines;
+        ++p;
+    }
+    return lines;
+}
+
+void shardset_write(ShardSet *s, const char *data, size_t len)
+{
+    int t = omp_get_thread_num();
+    if (t >= s->nshards) {
+        fprintf(stderr, "shard set of %d threads written by thread %d\n", s->nshards, t);
+        exit(EXIT_FAILURE);
+    }
+    Shard *sh = &s->shards[t];
+    if (sh->fd < 0) {
+        shard_open(s, t);
+    }
+    sh->records += s->binary ? len / sizeof(key128_t) : count_lines(data, len);
+    write_all(sh, data, len);
+}
+
+void shardset_close(ShardSet *s)
+{
+    char path[PATH_MAX], name[SHARDSET_NAME_MAX];
+    snprintf(path, sizeof(path), "%s/%s", s->dir, SHARDSET_MANIFEST);
+    FILE *m = fopen(path, "w");
+    if (m == NULL) {
+        fprintf(stderr, "Cannot write the manifest '%s': %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    int used = 0;
+    for (int i = 0; i < s->nshards; ++i) {
+        used += s->shards[i].fd >= 0;
+    }
+    fprintf(m, "# d6 shards %d\n", SHARDSET_VERSION);
+    fprintf(m, "format\t%s\n", s->binary ? "keys" : "d6");
+    fprintf(m, "n\t%u\n", s->binary ? s->n : 0);
+    fprintf(m, "flags\t%u\n", s->flags);
+    fprintf(m, "shards\t%d\n", used);
+
+    uint64_t records = 0, bytes = 0;
+    for (int i = 0; i < s->nshards; ++i) {
+        Shard *sh = &s->shards[i];
+        if (sh->fd < 0) continue;
+        if (close(sh->fd) != 0) {
+            perror("Error closing a shard");
+            exit(EXIT_FAILURE);
+        }
+        shard_name(name, i, s->binary);
+        fprintf(m, "%s\t%" PRIu64 "\t%" PRIu64 "\t%016" PRIx64 "\n",
+                name, sh->records, sh->bytes, (uint64_t)XXH3_64bits_digest(sh->hash));
+        XXH3_freeState(sh->hash);
+        records += sh->records;
+        bytes   += sh->bytes;
+    }
+    if (fclose(m) != 0) {
+        fprintf(stderr, "Cannot write the manifest '%s': %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    printlog(2, "output: %d shards, %" PRIu64 " records, %.1f MiB", used, records, bytes / 1048576.0);
+
+    free(s->shards);
+    free(s->dir);
+    free(s);
+}
+
+static bool bad_manifest(const char *path, unsigned line, const char *what)
+{
+    fprintf(stderr, "%s:%u: %s\n", path, line, what);
+    return false;
+}
+
+bool shardset_read_manifest(ShardManifest *m, const char *dir)
+{
+    memset(m, 0, sizeof(*m));
+    char path[PATH_MAX], line[256];
+    snprintf(path, sizeof(path), "%s/%s", dir, SHARDSET_MANIFEST);
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        fprintf(stderr, "Cannot read the manifest '%s': %s\n", path, strerror(errno));
+        return false;
+    }
+
+    unsigned version = 0, lineno = 5;
+    char format[8];
+    size_t count;
+    bool ok = fgets(line, sizeof(line), f) && sscanf(line, "# d6 shards %u", &version) == 1
+           && version == SHARDSET_VERSION
+           && fgets(line, sizeof(line), f) && sscanf(line, "format\t%7s", format) == 1
+           && (strcmp(format, "d6") == 0 || strcmp(format, "keys") == 0)
+           && fgets(line, sizeof(line), f) && sscanf(line, "n\t%u", &m->n) == 1
+           && fgets(line, sizeof(line), f) && sscanf(line, "flags\t%u", &m->flags) == 1
+           && fgets(line, sizeof(line), f) && sscanf(line, "shards\t%zu", &count) == 1;
+    if (!ok) {
+        fclose(f);
+        return bad_manifest(path, 1, "not a shard manifest of a supported version");
+    }
+    m->binary = strcmp(format, "keys") == 0;
+    m->shards = (ShardInfo*)calloc(count ? count : 1, sizeof(ShardInfo));
+    for (; m->nshards < count; ++m->nshards) {
+        ShardInfo *s = &m->shards[m->nshards];
+        ++lineno;
+        if (!fgets(line, sizeof(line), f)
+            || sscanf(line, "%31[^\t]\t%" SCNu64 "\t%" SCNu64 "\t%" SCNx64,
+                      s->name, &s->records, &s->bytes, &s->checksum) != 4
+            || strchr(s->name, '/') != NULL) {
+            fclose(f);
+            shardset_free_manifest(m);
+            return bad_manifest(path, lineno, "damaged shard entry");
+        }
+    }
+    fclose(f);
+    return true;
+}
+
+void shardset_free_manifest(ShardManifest *m)
+{
+    free(m->shards);
+    memset(m, 0, sizeof(*m));
+}
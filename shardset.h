@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "common.h"
+
+/*
+ * Shard sets: the output of a tool as one file per OpenMP thread.
+ *
+ * Every thread appends the blocks it produces to a shard of its own,
+ * DIR/shard-NNN.d6 (or .keys for a binary key stream, each shard with its
+ * own header), with write(2) and without any lock or writer thread, so the
+ * output scales with the threads and the disks. A shard is created with
+ * the first block of its thread. Closing the set writes DIR/MANIFEST:
+ *
+ *   # d6 shards 1
+ *   format  d6 | keys
+ *   n       key stream n (0 for text)
+ *   flags   key stream flags (KEYSTREAM_*)
+ *   shards  count
+ *   name    records  bytes  checksum     (one line per shard)
+ *
+ * with tab separated fields, the records (lines or keys) of each shard,
+ * its size and the XXH3 64-bit hash of the whole file in hex, as printed by
+ * `xxhsum -H3`. The shardcat tool checks, concatenates or merges them.
+ */
+#define SHARDSET_MANIFEST "MANIFEST"
+#define SHARDSET_VERSION  1
+#define SHARDSET_NAME_MAX 32
+
+typedef struct _ShardSet ShardSet;
+
+/* Creates 'dir' if needed, for up to omp_get_max_threads() writers; a
+ * binary set starts every shard with a key stream header for 'n' and
+ * 'flags'. Exits if 'dir' cannot be used.
+ */
+ShardSet *shardset_create(const char *dir, bool binary, unsigned n, unsigned flags);
+
+/* Appends whole records to the shard of the calling thread. */
+void shardset_write(ShardSet *s, const char *data, size_t len);
+
+/* Closes the shards and writes the manifest; logs the shards at
+ * verbosity 2.
+ */
+void shardset_close(ShardSet *s);
+
+typedef struct {
+    char     name[SHARDSET_NAME_MAX];
+    uint64_t records, bytes, checksum;
+} ShardInfo;
+
+typedef struct {
+    bool       binary;
+    unsigned   n, flags;
+    size_t     nshards;
+    ShardInfo *shards;
+} ShardManifest;
+
+/* Reads DIR/MANIFEST; false, with a message, if it is missing or damaged. */
+bool shardset_read_manifest(ShardManifest *m, const char *dir);
+void shardset_free_manifest(ShardManifest *m);
@@ -0,0 +1,326 @@
+#include "common.h"
+
+#include <fcntl.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <xxhash.h>
+
+#include "bucket.h"
+#include "parse_scaled.h"
+#include "shmset.h"
+
+#define SHM_MAGIC   0x54455348534d4853ULL   /* "SHMSHSET" */
+#define SHM_VERSION 1
+
+/* Fill limit: beyond it probe sequences get long and inserts are refused. */
+#define SHM_MAX_LOAD 0.90
+
+/* How long a slot may stay claimed before it is considered abandoned. */
+#define SHM_CLAIM_TIMEOUT_NS 1000000000ull
+
+enum {
+    SLOT_EMPTY   = 0,
+    SLOT_FULL    = 1,
+    SLOT_DELETED = 2,
+    SLOT_CLAIMED = 3,   /* key being written */
+};
+
+/* Start of the segment; ctrl bytes and keys follow, page aligned. */
+typedef struct {
+    _Atomic uint64_t magic;     /* set last by the creator */
+    uint32_t         version;
+    uint32_t         key_size;
+    uint64_t         cap;       /* power of two */
+    uint64_t         ctrl_off, keys_off, bytes;
+    _Atomic uint64_t size;
+    _Atomic uint64_t dels;
+} ShmHeader;
+
+struct _ShmSet {
+    ShmHeader        *hdr;
+    _Atomic uint8_t  *ctrl;
+    key128_t         *keys;
+    size_t            cap;
+    size_t            limit;    /* max keys */
+    size_t            bytes;
+};
+
+static INLINE void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+static INLINE uint64_t page_align(uint64_t x)
+{
+    return (x + 4095) & ~(uint64_t)4095;
+}
+
+static size_t table_cap(size_t capacity)
+{
+    size_t cap = 1024;
+    while ((double)cap * SHM_MAX_LOAD < (double)capacity) cap <<= 1;
+    return cap;
+}
+
+/* The creator sizes and initialises the segment; 'magic' is published last. */
+static bool shm_init(int fd, const char *name, size_t capacity)
+{
+    ShmHeader h;
+    memset(&h, 0, sizeof(h));
+    h.version  = SHM_VERSION;
+    h.key_size = sizeof(key128_t);
+    h.cap      = table_cap(capacity);
+    h.ctrl_off = page_align(sizeof(ShmHeader));
+    h.keys_off = page_align(h.ctrl_off + h.cap);
+    h.bytes    = h.keys_off + h.cap * sizeof(key128_t);
+
+    /* the segment is zero-filled: all slots start empty */
+    if (ftruncate(fd, (off_t)h.bytes) != 0) {
+        fprintf(stderr, "Cannot size shared set '%s': %s\n", name, strerror(errno));
+        return false;
+    }
+    ShmHeader *p = (ShmHeader*)mmap(NULL, sizeof(ShmHeader), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        fprintf(stderr, "Cannot map shared set '%s': %s\n", name, strerror(errno));
+        return false;
+    }
+    p->version  = h.version;
+    p->key_size = h.key_size;
+    p->cap      = h.cap;
+    p->ctrl_off = h.ctrl_off;
+    p->keys_off = h.keys_off;
+    p->bytes    = h.bytes;
+    atomic_store_explicit(&p->magic, SHM_MAGIC, memory_order_release);
+    munmap(p, sizeof(ShmHeader));
+    return TRUE;
+}
+
+/* Another process may still be creating the segment: wait for its header. */
+static bool shm_wait_ready(int fd, const char *name)
+{
+    for (int i = 0; i < 1000; ++i) {
+        struct stat st;
+        if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(ShmHeader)) {
+            ShmHeader *p = (ShmHeader*)mmap(NULL, sizeof(ShmHeader), PROT_READ, MAP_SHARED, fd, 0);
+            if (p != MAP_FAILED) {
+                uint64_t magic = atomic_load_explicit(&p->magic, memory_order_acquire);
+                munmap(p, sizeof(ShmHeader));
+                if (magic == SHM_MAGIC) return TRUE;
+                if (magic != 0) break;
+            }
+        }
+        usleep(10000);
+    }
+    fprintf(stderr, "Shared set '%s' is not a valid set or was never initialised\n", name);
+    return false;
+}
+
+ShmSet *shm_set_open(const char *name, size_t capacity)
+{
+    bool created = TRUE;
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 && errno == EEXIST) {
+        created = false;
+        fd = shm_open(name, O_RDWR, 0600);
+    }
+    if (fd < 0) {
+        fprintf(stderr, "Cannot open shared set '%s': %s\n", name, strerror(errno));
+        return NULL;
+    }
+    if (created ? !shm_init(fd, name, capacity ? capacity : SHM_SET_DEFAULT_KEYS) : !shm_wait_ready(fd, name)) {
+        if (created) shm_unlink(name);
+        close(fd);
+        return NULL;
+    }
+
+    ShmHeader h;
+    if (pread(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h)) {
+        fprintf(stderr, "Cannot read shared set '%s': %s\n", name, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+    if (h.version != SHM_VERSION || h.key_size != sizeof(key128_t)) {
+        fprintf(stderr, "Shared set '%s' has an incompatible layout (version %u, %u-byte keys)\n",
+                name, h.version, h.key_size);
+        close(fd);
+        return NULL;
+    }
+
+    void *map = mmap(NULL, h.bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Cannot map shared set '%s' (%lu bytes): %s\n", name, (unsigned long)h.bytes, strerror(errno));
+        return NULL;
+    }
+    madvise(map, h.bytes, MADV_RANDOM);
+
+    ShmSet *s = (ShmSet*)malloc(sizeof(ShmSet));
+    s->hdr   = (ShmHeader*)map;
+    s->ctrl  = (_Atomic uint8_t*)((char*)map + h.ctrl_off);
+    s->keys  = (key128_t*)((char*)map + h.keys_off);
+    s->cap   = h.cap;
+    s->limit = (size_t)((double)h.cap * SHM_MAX_LOAD);
+    s->bytes = h.bytes;
+    printlog(1, "%s shared set '%s': %zu keys of at most %zu", created ? "Created" : "Attached to",
+             name, shm_set_size(s), s->limit);
+    return s;
+}
+
+void shm_set_close(ShmSet *s)
+{
+    if (!s) return;
+    munmap(s->hdr, s->bytes);
+    free(s);
+}
+
+bool shm_set_unlink(const char *name)
+{
+    if (shm_unlink(name) != 0) {
+        fprintf(stderr, "Cannot remove shared set '%s': %s\n", name, strerror(errno));
+        return false;
+    }
+    return TRUE;
+}
+
+/* Waits while slot i is claimed; returns its state. A claim older than
+ * SHM_CLAIM_TIMEOUT_NS belongs to a process that died (or is badly stalled):
+ * the slot is retired as a tombstone and its owner, if alive, starts over.
+ */
+static uint8_t slot_wait(const ShmSet *s, size_t i)
+{
+    uint8_t c = atomic_load_explicit(&s->ctrl[i], memory_order_acquire);
+    if (c != SLOT_CLAIMED) return c;
+
+    uint64_t t0 = ns_now_monotonic();
+    for (unsigned spin = 0; ; ++spin) {
+        if (spin < 64) {
+            cpu_relax();
+        } else {
+            sched_yield();
+            if (ns_now_monotonic() - t0 > SHM_CLAIM_TIMEOUT_NS) {
+                uint8_t expected = SLOT_CLAIMED;
+                if (atomic_compare_exchange_strong(&s->ctrl[i], &expected, SLOT_DELETED)) {
+                    atomic_fetch_add_explicit(&s->hdr->dels, 1, memory_order_relaxed);
+                    return SLOT_DELETED;
+                }
+            }
+        }
+        c = atomic_load_explicit(&s->ctrl[i], memory_order_acquire);
+        if (c != SLOT_CLAIMED) return c;
+    }
+}
+
+/* Probes for k; returns the slot holding it or SIZE_MAX, and in *empty the
+ * first empty slot met (SIZE_MAX if none).
+ */
+static size_t shm_probe(const ShmSet *s, const key128_t *k, size_t *empty)
+{
+    size_t m = s->cap - 1, i = (size_t)XXH3_64bits(k->b, 16) & m;
+    for (size_t n = 0; n < s->cap; ++n, i = (i + 1) & m) {
+        uint8_t c = slot_wait(s, i);
+        if (c == SLOT_EMPTY) {
+            *empty = i;
+            return SIZE_MAX;
+        }
+        if (c == SLOT_FULL && key128_equal(&s->keys[i], k)) {
+            return i;
+        }
+    }
+    *empty = SIZE_MAX;
+    return SIZE_MAX;
+}
+
+bool shm_set_insert(ShmSet *s, const key128_t *k)
+{
+    for (;;) {
+        size_t empty;
+        if (shm_probe(s, k, &empty) != SIZE_MAX) return false;
+
+        if (empty == SIZE_MAX || shm_set_size(s) + shm_set_tombstones(s) >= s->limit) {
+            fprintf(stderr, "Shared set is full (%zu keys, %zu tombstones); recreate it with a larger capacity\n",
+                    shm_set_size(s), shm_set_tombstones(s));
+            exit(EXIT_FAILURE);
+        }
+
+        uint8_t expected = SLOT_EMPTY;
+        if (!atomic_compare_exchange_strong(&s->ctrl[empty], &expected, SLOT_CLAIMED)) {
+            /* lost the slot; it may now hold our key, so probe again */
+            continue;
+        }
+        s->keys[empty] = *k;
+        expected = SLOT_CLAIMED;
+        if (atomic_compare_exchange_strong_explicit(&s->ctrl[empty], &expected, SLOT_FULL,
+                                                    memory_order_release, memory_order_relaxed)) {
+            atomic_fetch_add_explicit(&s->hdr->size, 1, memory_order_relaxed);
+            return TRUE;
+        }
+        /* our claim timed out and the slot was retired: start over */
+    }
+}
+
+bool shm_set_lookup(const ShmSet *s, const key128_t *k)
+{
+    size_t empty;
+    return shm_probe(s, k, &empty) != SIZE_MAX;
+}
+
+bool shm_set_remove(ShmSet *s, const key128_t *k)
+{
+    size_t empty, i = shm_probe(s, k, &empty);
+    if (i == SIZE_MAX) return false;
+
+    uint8_t expected = SLOT_FULL;
+    if (!atomic_compare_exchange_strong(&s->ctrl[i], &expected, SLOT_DELETED)) {
+        return false;   /* removed concurrently */
+    }
+    atomic_fetch_sub_explicit(&s->hdr->size, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&s->hdr->dels, 1, memory_order_relaxed);
+    return TRUE;
+}
+
+size_t shm_set_size(const ShmSet *s)
+{
+    return s ? (size_t)atomic_load_explicit(&s->hdr->size, memory_order_relaxed) : 0;
+}
+
+size_t shm_set_capacity(const ShmSet *s)
+{
+    return s ? s->cap : 0;
+}
+
+size_t shm_set_tombstones(const ShmSet *s)
+{
+    return s ? (size_t)atomic_load_explicit(&s->hdr->dels, memory_order_relaxed) : 0;
+}
+
+void shm_set_foreach(const ShmSet *s, void (*func)(const key128_t *key, void *user_data), void *user_data)
+{
+    for (size_t i = 0; i < s->cap; ++i) {
+        if (atomic_load_explicit(&s->ctrl[i], memory_order_acquire) == SLOT_FULL) {
+            func(&s->keys[i], user_data);
+        }
+    }
+}
+
+bool shm_set_parse_spec(const char *spec, char *name, size_t name_len, size_t *capacity)
+{
+    const char *colon = strchr(spec, ':');
+    size_t len = colon ? (size_t)(colon - spec) : strlen(spec);
+
+    *capacity = SHM_SET_DEFAULT_KEYS;
+    if (colon && (!parse_scaled_size(colon + 1, capacity) || *capacity == 0)) {
+        return false;
+    }
+    /* POSIX wants exactly one leading slash */
+    if (len == 0 || len + 2 > name_len || memchr(spec + 1, '/', len - 1) != NULL) {
+        return false;
+    }
+    snprintf(name, name_len, "%s%.*s", spec[0] == '/' ? "" : "/", (int)len, spec);
+    return TRUE;
+}
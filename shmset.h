@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "common.h"
+
+/*
+ * Set of 16-byte keys in a POSIX shared-memory segment, shared by all
+ * processes on the host that attach to the same name.
+ *
+ * The table is a single open-addressing array of fixed capacity, set by the
+ * process that creates the segment; later processes attach to it as it is.
+ * Slots are claimed with a compare-and-swap on their control byte, so no
+ * locks are taken and a process that dies mid-run cannot block the others
+ * (a slot it claimed but never filled is skipped after a short wait).
+ * Removed keys leave tombstones that are never reused.
+ *
+ * The segment outlives the processes (see /dev/shm/NAME) until
+ * shm_set_unlink() is called, so consecutive runs keep deduplicating
+ * against each other.
+ */
+typedef struct _ShmSet ShmSet;
+
+/* Attaches to segment 'name' (e.g. "/nauty-seen"), creating it with room
+ * for 'capacity' keys if it does not exist. Returns NULL with a message on
+ * stderr on failure.
+ */
+ShmSet *shm_set_open(const char *name, size_t capacity);
+
+/* Unmaps the segment; it stays alive for other processes. */
+void shm_set_close(ShmSet *s);
+
+bool shm_set_unlink(const char *name);
+
+/* Returns TRUE iff the key was not present. Exits with a message if the
+ * table is full.
+ */
+bool shm_set_insert(ShmSet *s, const key128_t *k);
+bool shm_set_lookup(const ShmSet *s, const key128_t *k);
+bool shm_set_remove(ShmSet *s, const key128_t *k);
+
+size_t shm_set_size(const ShmSet *s);
+size_t shm_set_capacity(const ShmSet *s);
+size_t shm_set_tombstones(const ShmSet *s);
+
+/* Calls 'func' for every key; keys inserted meanwhile may be missed. */
+void shm_set_foreach(const ShmSet *s, void (*func)(const key128_t *key, void *user_data), void *user_data);
+
+/* Parses "NAME[:KEYS]" as given to the -x option of the tools; KEYS
+ * accepts the suffixes of parse_scaled_size(). Returns false on a bad value.
+ */
+bool shm_set_parse_spec(const char *spec, char *name, size_t name_len, size_t *capacity);
+
+#define SHM_SET_DEFAULT_KEYS ((size_t)16 << 20)
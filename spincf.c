@@ -1,30 +1,60 @@
 #include "bott.h"
 #include "dag.h"
 #include "adjpack11.h"
+#include "batchpipe.h"
+#include "keystream.h"
+#include "tlsbuf.h"
 
-int main(void) {
+int main(int argc, char *argv[]) {
     vec_t mat[11];
-    unsigned n = 0;
-    char s[MAXLINE];
+    unsigned n;
     key128_t k;
+    bool binary = false;
+    KeyStream in;
 
-    // Main loop to read one line (one graph) at a time
-    while (fgets(s, sizeof(s), stdin) != NULL) {
-        remove_newline(s);
-        // 1. Determine the number of vertices (n) from the graph6 string.
-        if (!d6pack_decode(s, &k, &n)) {
-            continue; // Skip invalid or empty lines
+    int opt;
+    while ((opt = getopt(argc, argv, "B")) != -1) {
+        if (opt != 'B') {
+            fprintf(stderr, "Usage: %s [-B] < input > output\n  -B  write a binary key stream\n", argv[0]);
+            exit(EXIT_FAILURE);
         }
-        adjpack_to_matrix(&k, mat, n);
+        binary = true;
+    }
+    if (!keystream_open(&in, stdin)) {
+        exit(EXIT_FAILURE);
+    }
+    if (binary) {
+        keystream_write_header(stdout, in.n, in.flags);
+    }
 
-        if (!is_upper_triangular(mat,n)) {
-            fprintf(stderr, "all input matrices must be upper triangular, corrupted input, quitting...\n");
-            exit(1);
-        }
+    // Batches are read ahead by the pipe's thread, output is written by the ring's
+    BatchPipe *pipe = batchpipe_open(&in, NULL, 0, 0);
+    OutRing *ring = outring_open(stdout, 0, 0);
+    OutputBuffer out;
+    buffer_init(&out, ring);
 
-        if (is_spinc(mat, n)) {
-            printf("%s\n", s);
+    for (KeyBatch *b; (b = batchpipe_next(pipe)) != NULL; batchpipe_release(pipe, b)) {
+        for (size_t j = 0; j < b->count; ++j) {
+            k = b->keys[j];
+            // 1. Determine the number of vertices (n) from the key.
+            n = d6pack_get_n(&k);
+
+            adjpack_to_matrix(&k, mat, n);
+
+            if (!is_upper_triangular(mat,n)) {
+                fprintf(stderr, "all input matrices must be upper triangular, corrupted input, quitting...\n");
+                exit(1);
+            }
+
+            if (is_spinc(mat, n)) {
+                buffer_add_key(&out, &k, binary);
+            }
         }
     }
+    buffer_destroy(&out);
+    outring_close(ring);
+    batchpipe_close(pipe);
+
+    keystream_close(&in);
     return 0;
 }
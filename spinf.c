@@ -1,34 +1,63 @@
 #include "dag.h"
 #include "bott.h"
 #include "adjpack11.h"
+#include "batchpipe.h"
+#include "keystream.h"
+#include "tlsbuf.h"
 
-int main(void) {
+int main(int argc, char *argv[]) {
     vec_t mat[11];
     unsigned n;
-    char s[MAXLINE];
     key128_t k;
+    bool binary = false;
+    KeyStream in;
 
-    // Main loop to read one line (one graph) at a time
-    while (fgets(s, sizeof(s), stdin) != NULL) {
-        remove_newline(s);
-        // 1. Write d6 code to key128_t k and determine the number of vertices (n).
-        if (!d6pack_decode(s, &k, &n)) {
-            continue; // Skip invalid or empty lines
+    int opt;
+    while ((opt = getopt(argc, argv, "B")) != -1) {
+        if (opt != 'B') {
+            fprintf(stderr, "Usage: %s [-B] < input > output\n  -B  write a binary key stream\n", argv[0]);
+            exit(EXIT_FAILURE);
         }
+        binary = true;
+    }
+    if (!keystream_open(&in, stdin)) {
+        exit(EXIT_FAILURE);
+    }
+    if (binary) {
+        keystream_write_header(stdout, in.n, in.flags);
+    }
 
-        // 2. Convert the key128_t k to an adjacency matrix in vec_t mat.
-        adjpack_to_matrix(&k, mat, n);
+    // Batches are read ahead by the pipe's thread, output is written by the ring's
+    BatchPipe *pipe = batchpipe_open(&in, NULL, 0, 0);
+    OutRing *ring = outring_open(stdout, 0, 0);
+    OutputBuffer out;
+    buffer_init(&out, ring);
 
-        // 3. Check if the matrix is upper triangular.
-        if (!is_upper_triangular(mat,n)) {
-            fprintf(stderr, "all input matrices must be upper triangular, corrupted input, quitting...\n");
-            exit(1);
-        }
+    for (KeyBatch *b; (b = batchpipe_next(pipe)) != NULL; batchpipe_release(pipe, b)) {
+        for (size_t j = 0; j < b->count; ++j) {
+            k = b->keys[j];
+            // 1. Determine the number of vertices (n) from the key.
+            n = d6pack_get_n(&k);
 
-        // 4. Check if the matrix represents a spin real Bott manifold.
-        if (is_spin(mat, n)) {
-            printf("%s\n", s);
+            // 2. Convert the key128_t k to an adjacency matrix in vec_t mat.
+            adjpack_to_matrix(&k, mat, n);
+
+            // 3. Check if the matrix is upper triangular.
+            if (!is_upper_triangular(mat,n)) {
+                fprintf(stderr, "all input matrices must be upper triangular, corrupted input, quitting...\n");
+                exit(1);
+            }
+
+            // 4. Check if the matrix represents a spin real Bott manifold.
+            if (is_spin(mat, n)) {
+                buffer_add_key(&out, &k, binary);
+            }
         }
     }
+    buffer_destroy(&out);
+    outring_close(ring);
+    batchpipe_close(pipe);
+
+    keystream_close(&in);
     return 0;
 }
@@ -0,0 +1,83 @@
+#include "batchpipe.h"
+#include "bucket.h"
+
+#define N     100000
+#define BATCH 999
+
+static void make_key(size_t i, key128_t *k)
+{
+    memset(k, 0, sizeof(*k));
+    memcpy(k->b, &i, sizeof(i));
+    d6pack_set_n(k, 11);
+}
+
+static FILE *key_file(void)
+{
+    FILE *f = tmpfile();
+    keystream_write_header(f, 11, 0);
+    for (size_t i = 0; i < N; ++i) {
+        key128_t k;
+        make_key(i, &k);
+        keystream_put(f, &k, true);
+    }
+    rewind(f);
+    return f;
+}
+
+int main(void)
+{
+    printf("=== [batchpipe] testing read-ahead batches ===\n");
+
+    // all keys, in order, the first one taken from the stream before
+    FILE *f = key_file();
+    KeyStream ks;
+    key128_t first, want;
+    if (!keystream_open(&ks, f) || !keystream_next(&ks, &first)) {
+        fprintf(stderr, "    cannot read the key stream\n");
+        return 1;
+    }
+    BatchPipe *p = batchpipe_open(&ks, &first, BATCH, 2);
+    size_t seen = 0, batches = 0;
+    KeyBatch *b;
+    while ((b = batchpipe_next(p)) != NULL) {
+        if (b->first != seen || b->count == 0 || b->count > BATCH) {
+            fprintf(stderr, "    batch %zu: first %lu, count %zu\n", batches, (unsigned long)b->first, b->count);
+            return 1;
+        }
+        for (size_t i = 0; i < b->count; ++i) {
+            make_key(seen + i, &want);
+            if (!key128_equal(&b->keys[i], &want)) {
+                fprintf(stderr, "    key %zu out of order\n", seen + i);
+                return 1;
+            }
+        }
+        seen += b->count;
+        batches++;
+        batchpipe_release(p, b);
+    }
+    if (seen != N || batches != (N + BATCH - 1) / BATCH) {
+        fprintf(stderr, "    got %zu keys in %zu batches\n", seen, batches);
+        return 1;
+    }
+    batchpipe_close(p);
+    keystream_close(&ks);
+    fclose(f);
+    printf("    %zu keys in %zu batches\n", seen, batches);
+
+    // closing early stops a reader that waits for a free batch
+    f = key_file();
+    keystream_open(&ks, f);
+    p = batchpipe_open(&ks, NULL, BATCH, 2);
+    b = batchpipe_next(p);
+    if (b == NULL || b->count != BATCH) {
+        fprintf(stderr, "    first batch missing\n");
+        return 1;
+    }
+    batchpipe_close(p);
+    keystream_close(&ks);
+    fclose(f);
+    printf("    early close OK\n");
+
+    printf("=== [batchpipe] all tests passed ===\n");
+    return 0;
+}
@@ -57,6 +57,83 @@ static INLINE __uint128_t bitreverse128_legacy(__uint128_t x) {
     return bitreverse64(hi) | ((__uint128_t)bitreverse64(lo) << 64);
 }
 
+// The per-row packers that adjpack_from_matrix()/adjpack_to_matrix() replaced
+static INLINE void adjpack_from_matrix_legacy(const vec_t *mat, unsigned n, key128_t *out) {
+    out->u = 0;
+    for (unsigned i = 0; i < n; ++i) {
+        out->u <<= n;
+        out->u |= bitreverse64(mat[i]) >> (64 - n);
+    }
+    adjpack_zero_above_nsquare(out, n);
+    adjpack_set_n(out, n);
+}
+
+static INLINE void adjpack_to_matrix_legacy(const key128_t *k, uint64_t *mat_out, unsigned n) {
+    __uint128_t acc = k->u;
+    for (int i = n-1; i >= 0; --i) {
+        mat_out[i] = bitreverse64((uint64_t)acc) >> (64 - n);
+        acc >>= n;
+    }
+}
+
+// Bits above the diagonal one by one, as adjpack_upper_from_key() orders them
+static uint64_t adjpack_upper_from_matrix_legacy(const vec_t *mat, unsigned n) {
+    uint64_t u = 0;
+    for (unsigned i = 0; i < n; ++i)
+        for (unsigned j = i + 1; j < n; ++j)
+            u = u << 1 | ((mat[i] >> j) & 1);
+    return u;
+}
+
+#if ADJPACK_PEXT
+// adjpack_from_matrix() and adjpack_to_matrix() with a pdep or pext per row
+// in place of the shifts, to time against them: full rows are contiguous
+// bits, so there is nothing to gather or scatter that a shift cannot.
+static inline __attribute__((target("bmi2"))) void adjpack_from_matrix_pdep(const vec_t *mat, unsigned n, key128_t *out) {
+    const uint64_t row_mask = (1ull << n) - 1;
+    uint64_t lo = 0, hi = 0;
+    for (unsigned i = 0; i < n; ++i) {
+        const unsigned off = i * n;
+        const uint64_t r = mat[i] & row_mask;
+        if (off < 64) {
+            lo |= _pdep_u64(r, row_mask << off);
+            if (off + n > 64) hi |= _pdep_u64(r >> (64 - off), row_mask >> (64 - off));
+        } else {
+            hi |= _pdep_u64(r, row_mask << (off - 64));
+        }
+    }
+    out->u = bitreverse128((__uint128_t)hi << 64 | lo) >> (128 - n * n);
+    adjpack_set_n(out, n);
+}
+
+static inline __attribute__((target("bmi2"))) void adjpack_to_matrix_pext(const key128_t *k, uint64_t *mat_out, unsigned n) {
+    const uint64_t row_mask = (1ull << n) - 1;
+    const __uint128_t acc = bitreverse128(k->u << (128 - n * n));
+    const uint64_t lo = (uint64_t)acc, hi = (uint64_t)(acc >> 64);
+    for (unsigned i = 0; i < n; ++i) {
+        const unsigned off = i * n;
+        if (off < 64) {
+            mat_out[i] = _pext_u64(lo, row_mask << off);
+            if (off + n > 64) mat_out[i] |= _pext_u64(hi, row_mask >> (64 - off)) << (64 - off);
+        } else {
+            mat_out[i] = _pext_u64(hi, row_mask << (off - 64));
+        }
+    }
+}
+
+static bool have_bmi2(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("bmi2");
+}
+#endif
+
+static uint64_t xorshift(uint64_t *s) {
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return *s;
+}
+
 bool test_correctness() {
     uint64_t test_values[] = {
         0x0000000000000001ULL,
@@ -162,10 +239,142 @@ void benchmark128() {
     printf("    bitreverse128_legacy: %6.2f ms\n", 1000.0 * (end - start) / CLOCKS_PER_SEC);
 }
 
+bool test_adjpack_correctness() {
+    uint64_t seed = 0x9E3779B97F4A7C15ULL;
+    for (unsigned n = 1; n <= 11; ++n) {
+        for (int t = 0; t < 10000; ++t) {
+            vec_t mat[11], back[11], upper[11];
+            const bool tri = t & 1;
+            for (unsigned i = 0; i < n; ++i) {
+                mat[i] = xorshift(&seed) & ((1ull << n) - 1);
+                // every other matrix strictly upper triangular
+                upper[i] = mat[i] & ~((2ull << i) - 1);
+                if (tri) mat[i] = upper[i];
+            }
+            key128_t k1, k2, ku;
+            adjpack_from_matrix(mat, n, &k1);
+            adjpack_from_matrix_legacy(mat, n, &k2);
+            adjpack_to_matrix(&k1, back, n);
+            if (k1.u != k2.u || memcmp(back, mat, n * sizeof(vec_t)) != 0) {
+                printf("    adjpack n = %u, matrix %d FAILED\n", n, t);
+                return false;
+            }
+            adjpack_to_matrix_legacy(&k1, back, n);
+            if (memcmp(back, mat, n * sizeof(vec_t)) != 0) {
+                printf("    adjpack_to_matrix_legacy n = %u, matrix %d FAILED\n", n, t);
+                return false;
+            }
+
+            adjpack_from_matrix(upper, n, &k2);
+            uint64_t u = adjpack_upper_from_key(&k1, n);
+            adjpack_upper_to_key(u, n, &ku);
+            if (adjpack_is_upper(&k1, n) != is_upper_triangular(mat, n)
+                || u != adjpack_upper_from_matrix_legacy(mat, n) || ku.u != k2.u) {
+                printf("    adjpack upper n = %u, matrix %d FAILED\n", n, t);
+                return false;
+            }
+            adjpack_upper_to_key_shifts(u, n, &ku);
+            if (adjpack_upper_from_key_shifts(&k1, n) != u || ku.u != k2.u) {
+                printf("    adjpack upper shifts n = %u, matrix %d FAILED\n", n, t);
+                return false;
+            }
+#if ADJPACK_PEXT
+            if (have_bmi2()) {
+                adjpack_upper_to_key_pdep(u, n, &ku);
+                if (adjpack_upper_from_key_pext(&k1, n) != u || ku.u != k2.u) {
+                    printf("    adjpack upper pext n = %u, matrix %d FAILED\n", n, t);
+                    return false;
+                }
+                adjpack_from_matrix_pdep(mat, n, &ku);
+                adjpack_to_matrix_pext(&k1, back, n);
+                if (ku.u != k1.u || memcmp(back, mat, n * sizeof(vec_t)) != 0) {
+                    printf("    adjpack rows pext n = %u, matrix %d FAILED\n", n, t);
+                    return false;
+                }
+            }
+#endif
+        }
+    }
+    printf("    adjpack:       OK\n");
+    return true;
+}
+
+#if ADJPACK_PEXT
+// The same loops with the pext/pdep kernels inlined, built for BMI2.
+__attribute__((target("bmi2"))) static void benchmark_adjpack_bmi2(vec_t (*mats)[11], const key128_t *keys,
+                                                                  int M, int N, unsigned n) {
+    volatile uint64_t sum = 0;
+    vec_t mat[11];
+    key128_t k;
+    clock_t start;
+
+    start = clock();
+    for (int i = 0; i < N; ++i) { adjpack_from_matrix_pdep(mats[i % M], n, &k); sum += (uint64_t)k.u; }
+    printf("    full rows, pdep per row:    %6.2f ms\n", 1000.0 * (clock() - start) / CLOCKS_PER_SEC);
+    start = clock();
+    for (int i = 0; i < N; ++i) { adjpack_to_matrix_pext(&keys[i % M], mat, n); sum += mat[i % n]; }
+    printf("    full rows, pext per row:    %6.2f ms\n", 1000.0 * (clock() - start) / CLOCKS_PER_SEC);
+    start = clock();
+    for (int i = 0; i < N; ++i) { sum += adjpack_upper_from_key_pext(&keys[i % M], n); }
+    printf("    upper_from_key, pext:       %6.2f ms\n", 1000.0 * (clock() - start) / CLOCKS_PER_SEC);
+    start = clock();
+    for (int i = 0; i < N; ++i) { adjpack_upper_to_key_pdep((uint64_t)i * 0x9E3779B97F4A7C15ULL, n, &k); sum += (uint64_t)k.u; }
+    printf("    upper_to_key, pdep:         %6.2f ms\n", 1000.0 * (clock() - start) / CLOCKS_PER_SEC);
+}
+#endif
+
+void benchmark_adjpack() {
+    const unsigned n = 11;
+    const int N = 1 << 20, M = 1024;
+    static vec_t mats[1024][11];
+    static key128_t keys[1024];
+    uint64_t seed = 0x0123456789ABCDEFULL;
+    for (int m = 0; m < M; ++m) {
+        for (unsigned i = 0; i < n; ++i)
+            mats[m][i] = xorshift(&seed) & ~((2ull << i) - 1) & ((1ull << n) - 1);
+        adjpack_from_matrix(mats[m], n, &keys[m]);
+    }
+    volatile uint64_t sum = 0;
+    vec_t mat[11];
+    key128_t k;
+    clock_t start;
+
+    start = clock();
+    for (int i = 0; i < N; ++i) { adjpack_from_matrix_legacy(mats[i % M], n, &k); sum += (uint64_t)k.u; }
+    printf("    adjpack_from_matrix_legacy: %6.2f ms\n", 1000.0 * (clock() - start) / CLOCKS_PER_SEC);
+    start = clock();
+    for (int i = 0; i < N; ++i) { adjpack_from_matrix(mats[i % M], n, &k); sum += (uint64_t)k.u; }
+    printf("    adjpack_from_matrix:        %6.2f ms\n", 1000.0 * (clock() - start) / CLOCKS_PER_SEC);
+    start = clock();
+    for (int i = 0; i < N; ++i) { adjpack_to_matrix_legacy(&keys[i % M], mat, n); sum += mat[i % n]; }
+    printf("    adjpack_to_matrix_legacy:   %6.2f ms\n", 1000.0 * (clock() - start) / CLOCKS_PER_SEC);
+    start = clock();
+    for (int i = 0; i < N; ++i) { adjpack_to_matrix(&keys[i % M], mat, n); sum += mat[i % n]; }
+    printf("    adjpack_to_matrix:          %6.2f ms\n", 1000.0 * (clock() - start) / CLOCKS_PER_SEC);
+    start = clock();
+    for (int i = 0; i < N; ++i) { sum += adjpack_upper_from_matrix_legacy(mats[i % M], n); }
+    printf("    upper bits one by one:      %6.2f ms\n", 1000.0 * (clock() - start) / CLOCKS_PER_SEC);
+    start = clock();
+    for (int i = 0; i < N; ++i) { sum += adjpack_upper_from_key_shifts(&keys[i % M], n); }
+    printf("    upper_from_key, shifts:     %6.2f ms\n", 1000.0 * (clock() - start) / CLOCKS_PER_SEC);
+    start = clock();
+    for (int i = 0; i < N; ++i) { adjpack_upper_to_key_shifts((uint64_t)i * 0x9E3779B97F4A7C15ULL, n, &k); sum += (uint64_t)k.u; }
+    printf("    upper_to_key, shifts:       %6.2f ms\n", 1000.0 * (clock() - start) / CLOCKS_PER_SEC);
+    start = clock();
+    for (int i = 0; i < N; ++i) { sum += adjpack_upper_from_key(&keys[i % M], n); }
+    printf("    adjpack_upper_from_key:     %6.2f ms (%s)\n", 1000.0 * (clock() - start) / CLOCKS_PER_SEC,
+           adjpack_upper_variant());
+#if ADJPACK_PEXT
+    if (have_bmi2()) {
+        benchmark_adjpack_bmi2(mats, keys, M, N, n);
+    }
+#endif
+}
+
 int main() {
     printf("=== [bitreverse] testing 64/128 implementations ===\n");
     fflush(stdout);
-    if (!test_correctness() || !test_bitreverse128_correctness()) {
+    if (!test_correctness() || !test_bitreverse128_correctness() || !test_adjpack_correctness()) {
         printf("=== [bitreverse] some tests failed ===\n");
         return 1;
     }
@@ -175,6 +384,7 @@ int main() {
     benchmark(true);
 
     benchmark128();
+    benchmark_adjpack();
     printf("=== [bitreverse] benchmark completed ===\n");
     return 0;
 }
@@ -0,0 +1,110 @@
+#include "bucket.h"
+#include "testutil.h"
+
+/* An operation may start a resize but must not finish one by draining the
+ * old table: that happens only old_step slots at a time. This bounds the
+ * pauses; their times are only printed, as they depend on the machine.
+ */
+static void check_no_drain(const FlatSet *s, const uint8_t *old_ctrl, size_t old_cap, size_t old_pos,
+                           size_t old_step, const char *op, uint64_t i)
+{
+    if (old_ctrl == NULL) return;
+    size_t moved = s->old_ctrl == old_ctrl ? s->old_pos - old_pos : old_cap - old_pos;
+    if (moved > old_step) {
+        fprintf(stderr, "    %s of key %lu migrated %zu old slots, more than %zu\n", op, i, moved, old_step);
+        exit(1);
+    }
+}
+
+int main(void)
+{
+    const uint64_t N = 1u << 21;
+    FlatSet s;
+    key128_t k;
+    uint64_t worst = 0, resizes = 0;
+
+    printf("=== [bucket-resize] testing incremental resizing with %lu keys ===\n", N);
+
+    flat_init(&s, 16);
+
+    for (uint64_t i = 0; i < N; ++i) {
+        size_t old_cap = s.old_cap, old_pos = s.old_pos, old_step = s.old_step;
+        const uint8_t *old_ctrl = s.old_ctrl;
+        uint64_t t = ns_now_monotonic();
+        key_from_index(i, &k);
+        if (!flat_insert(&s, &k)) {
+            fprintf(stderr, "    insert of a new key %lu failed\n", i);
+            exit(1);
+        }
+        check_no_drain(&s, old_ctrl, old_cap, old_pos, old_step, "insert", i);
+        /* previously inserted keys must stay visible during migration */
+        key_from_index(i / 2, &k);
+        if (!flat_lookup(&s, &k) || flat_insert(&s, &k)) {
+            fprintf(stderr, "    key %lu lost while resizing\n", i / 2);
+            exit(1);
+        }
+        t = ns_now_monotonic() - t;
+        if (t > worst) worst = t;
+        if (s.old_cap != 0 && old_cap == 0) ++resizes;
+    }
+    if (s.size != N) {
+        fprintf(stderr, "    size mismatch: %zu != %lu\n", s.size, N);
+        exit(1);
+    }
+    printf("    inserted %lu keys, %lu incremental resizes, worst iteration: %.3f ms\n", N, resizes, worst / 1e6);
+
+    /* remove every other key, which triggers shrinking and compaction */
+    worst = 0;
+    for (uint64_t i = 0; i < N; i += 2) {
+        size_t old_cap = s.old_cap, old_pos = s.old_pos, old_step = s.old_step;
+        const uint8_t *old_ctrl = s.old_ctrl;
+        uint64_t t = ns_now_monotonic();
+        key_from_index(i, &k);
+        if (!flat_remove(&s, &k)) {
+            fprintf(stderr, "    remove of key %lu failed\n", i);
+            exit(1);
+        }
+        t = ns_now_monotonic() - t;
+        if (t > worst) worst = t;
+        check_no_drain(&s, old_ctrl, old_cap, old_pos, old_step, "remove", i);
+    }
+    for (uint64_t i = 0; i < N; ++i) {
+        key_from_index(i, &k);
+        if (flat_lookup(&s, &k) != (bool)(i & 1)) {
+            fprintf(stderr, "    wrong lookup result for key %lu after removals\n", i);
+            exit(1);
+        }
+    }
+    if (s.size != N / 2) {
+        fprintf(stderr, "    size mismatch after removals: %zu != %lu\n", s.size, N / 2);
+        exit(1);
+    }
+    printf("    removed %lu keys, remaining ones found, worst remove: %.3f ms\n", N / 2, worst / 1e6);
+
+    /* churn at a steady size: tombstones force compactions, each followed
+     * closely by more inserts, and shrinking from the removals before
+     */
+    worst = 0;
+    resizes = 0;
+    for (uint64_t i = N; i < 3 * N; ++i) {
+        size_t old_cap = s.old_cap, old_pos = s.old_pos, old_step = s.old_step;
+        const uint8_t *old_ctrl = s.old_ctrl;
+        uint64_t t = ns_now_monotonic();
+        key_from_index(i, &k);
+        if (!flat_insert(&s, &k)) {
+            fprintf(stderr, "    insert of a new key %lu failed\n", i);
+            exit(1);
+        }
+        check_no_drain(&s, old_ctrl, old_cap, old_pos, old_step, "insert", i);
+        key_from_index(i - N / 2, &k);
+        flat_remove(&s, &k);
+        t = ns_now_monotonic() - t;
+        if (t > worst) worst = t;
+        if (s.old_cap != 0 && old_cap == 0) ++resizes;
+    }
+    printf("    churn of %lu inserts and removes: %lu resizes, worst iteration: %.3f ms\n", 2 * N, resizes, worst / 1e6);
+    flat_free(&s);
+
+    printf("=== [bucket-resize] all tests passed ===\n");
+    return 0;
+}
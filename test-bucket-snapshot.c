@@ -0,0 +1,101 @@
+#include "bucket.h"
+#include "testutil.h"
+
+static void check_keys(GHashBucket *b, uint64_t n, const char *when)
+{
+    key128_t k;
+    for (uint64_t i = 0; i < n; ++i) {
+        key_from_index(i, &k);
+        if ((g_bucket_lookup(b, &k) != NULL) != (i % 3 != 0)) {
+            fprintf(stderr, "    wrong lookup result for key %lu %s\n", i, when);
+            exit(1);
+        }
+    }
+}
+
+int main(void)
+{
+    const uint64_t N = 300000;
+    char path[] = "/tmp/test-bucket-snapshot-XXXXXX";
+    uint64_t meta[G_BUCKET_SNAPSHOT_META] = { 1, 2, 3, 4 }, meta2[G_BUCKET_SNAPSHOT_META];
+    key128_t k;
+
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
+        exit(1);
+    }
+    close(fd);
+
+    printf("=== [bucket-snapshot] testing save and restore of %lu keys ===\n", N);
+
+    /* every third key removed, so the snapshot carries tombstones too */
+    GHashBucket *b = g_bucket_new_128(NULL, 61);
+    for (uint64_t i = 0; i < N; ++i) {
+        key_from_index(i, &k);
+        g_bucket_insert_copy128(b, &k);
+    }
+    for (uint64_t i = 0; i < N; i += 3) {
+        key_from_index(i, &k);
+        g_bucket_remove(b, &k);
+    }
+    size_t size = g_bucket_size(b);
+    if (!g_bucket_save(b, path, meta)) {
+        exit(1);
+    }
+    g_bucket_destroy(b);
+
+    b = g_bucket_load(path, NULL, TRUE, meta2);
+    if (b == NULL || g_bucket_size(b) != size || memcmp(meta, meta2, sizeof(meta)) != 0) {
+        fprintf(stderr, "    restored bucket differs from the saved one\n");
+        exit(1);
+    }
+    check_keys(b, N, "after restore");
+    printf("    restored %zu keys\n", g_bucket_size(b));
+
+    /* the restored bucket is fully usable, changes do not reach the file */
+    for (uint64_t i = 0; i < N; i += 3) {
+        key_from_index(i, &k);
+        if (!g_bucket_insert_copy128(b, &k)) {
+            fprintf(stderr, "    insert into restored bucket failed\n");
+            exit(1);
+        }
+    }
+    for (uint64_t i = N; i < 2 * N; ++i) {
+        key_from_index(i, &k);
+        g_bucket_insert_copy128(b, &k);
+    }
+    if (g_bucket_size(b) != 2 * N) {
+        fprintf(stderr, "    size mismatch after inserts: %zu != %lu\n", g_bucket_size(b), 2 * N);
+        exit(1);
+    }
+    g_bucket_destroy(b);
+
+    b = g_bucket_load(path, NULL, TRUE, NULL);
+    if (b == NULL || g_bucket_size(b) != size) {
+        fprintf(stderr, "    snapshot file was modified\n");
+        exit(1);
+    }
+    check_keys(b, N, "after reload");
+    g_bucket_destroy(b);
+    printf("    copy-on-write restore OK\n");
+
+    /* a damaged slot array is detected when verifying */
+    FILE *f = fopen(path, "r+");
+    /* the first slot array starts at the first page boundary */
+    fseek(f, 4096 + 7, SEEK_SET);
+    int c = fgetc(f);
+    fseek(f, 4096 + 7, SEEK_SET);
+    fputc(c ^ 0x55, f);
+    fclose(f);
+    fprintf(stderr, "    (an error message is expected below)\n");
+    if (g_bucket_load(path, NULL, TRUE, NULL) != NULL) {
+        fprintf(stderr, "    corrupted snapshot not detected\n");
+        exit(1);
+    }
+    printf("    corruption detected\n");
+    unlink(path);
+
+    printf("=== [bucket-snapshot] all tests passed ===\n");
+    return 0;
+}
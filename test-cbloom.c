@@ -0,0 +1,69 @@
+#include "cbloom.h"
+#include "testutil.h"
+
+/* Share of keys N..2N-1 (never added) reported as possibly present. */
+static double fp_rate(CountingBloom *f, uint64_t N)
+{
+    key128_t k;
+    uint64_t fp = 0;
+    for (uint64_t i = N; i < 2 * N; ++i) {
+        key_from_index(i, &k);
+        fp += cbloom_maybe(f, &k);
+    }
+    return (double)fp / (double)N;
+}
+
+int main(void)
+{
+    const uint64_t N = 200000;
+    key128_t k;
+
+    printf("=== [cbloom] testing a counting Bloom filter with %lu keys ===\n", N);
+
+    /* 5 bytes, i.e. 10 counters per key */
+    CountingBloom *f = cbloom_new(5 * N);
+    for (uint64_t i = 0; i < N; ++i) {
+        key_from_index(i, &k);
+        cbloom_add(f, &k);
+    }
+    for (uint64_t i = 0; i < N; ++i) {
+        key_from_index(i, &k);
+        if (!cbloom_maybe(f, &k)) {
+            fprintf(stderr, "    false negative for key %lu\n", i);
+            exit(1);
+        }
+    }
+    double fp_full = fp_rate(f, N);
+    printf("    false-positive rate at 10 counters per key: %.2f%%\n", 100.0 * fp_full);
+    if (fp_full > 0.05) {
+        fprintf(stderr, "    false-positive rate too high\n");
+        exit(1);
+    }
+
+    /* removing the even keys must not hide the odd ones */
+    for (uint64_t i = 0; i < N; i += 2) {
+        key_from_index(i, &k);
+        cbloom_remove(f, &k);
+    }
+    uint64_t gone = 0;
+    for (uint64_t i = 0; i < N; ++i) {
+        key_from_index(i, &k);
+        bool maybe = cbloom_maybe(f, &k);
+        if (i % 2 == 1 && !maybe) {
+            fprintf(stderr, "    false negative for key %lu after removals\n", i);
+            exit(1);
+        }
+        gone += (i % 2 == 0 && !maybe);
+    }
+    double fp_half = fp_rate(f, N);
+    printf("    after removing half: %.1f%% of the removed keys absent, false-positive rate %.2f%%\n",
+           200.0 * (double)gone / (double)N, 100.0 * fp_half);
+    if (fp_half >= fp_full) {
+        fprintf(stderr, "    removals did not lower the false-positive rate\n");
+        exit(1);
+    }
+    cbloom_free(f);
+
+    printf("=== [cbloom] all tests passed ===\n");
+    return 0;
+}
@@ -0,0 +1,140 @@
+#include "d6batch.h"
+#include "testutil.h"
+
+#define KEYS 100000
+
+static uint64_t rng = 0x9E3779B97F4A7C15ull;
+
+static uint64_t next_random(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+/* A canonical key of n vertices with random bits. */
+static void random_key(key128_t *k, unsigned n)
+{
+    uint64_t r[2] = { next_random(), next_random() };
+    memcpy(k->b, r, 16);
+    d6pack_zero_above_nsquare(k, n);
+    d6pack_set_n(k, n);
+}
+
+/* The lines of d6pack_encode_from_key(), one by one. */
+static size_t scalar_encode(const key128_t *keys, size_t count, char *out)
+{
+    size_t len = 0;
+    for (size_t i = 0; i < count; ++i) {
+        len += d6pack_encode_from_key(&keys[i], out + len);
+        out[len++] = '\n';
+    }
+    return len;
+}
+
+/* Keys of all lines: the batch decoder, and d6pack_decode_span() where it stops. */
+static size_t decode_all(const char *text, size_t bytes, key128_t *keys, size_t max)
+{
+    size_t cnt = 0, pos = 0;
+    while (pos < bytes && cnt < max) {
+        size_t used;
+        cnt += d6batch_decode(text + pos, bytes - pos, keys + cnt, max - cnt, &used);
+        pos += used;
+        if (pos >= bytes || cnt == max) break;
+        const char *nl = memchr(text + pos, '\n', bytes - pos);
+        size_t len = nl ? (size_t)(nl - text - pos) : bytes - pos;
+        if (d6pack_decode_span(text + pos, len, &keys[cnt], NULL)) {
+            cnt++;
+        }
+        pos += len + 1;
+    }
+    return cnt;
+}
+
+int main(void)
+{
+    printf("=== [d6batch] testing the batch digraph6 codec (%s) ===\n", d6batch_variant());
+
+    key128_t *keys = malloc(KEYS * sizeof(key128_t)), *back = malloc(KEYS * sizeof(key128_t));
+    char *text = malloc(KEYS * 24 + D6BATCH_SLACK), *want = malloc(KEYS * 24 + D6BATCH_SLACK);
+
+    for (unsigned n = 1; n <= 11; ++n) {
+        // mostly n, and every 1000th key of another n, so runs break
+        for (size_t i = 0; i < KEYS; ++i) {
+            random_key(&keys[i], i % 1000 == 999 ? 1 + (n + 4) % 11 : n);
+        }
+        size_t want_bytes = scalar_encode(keys, KEYS, want);
+        size_t bytes = d6batch_encode(keys, KEYS, text);
+        check(bytes == want_bytes && memcmp(text, want, bytes) == 0, "n = %u: encoded lines differ", n);
+
+        size_t got = decode_all(text, bytes, back, KEYS);
+        check(got == KEYS && memcmp(keys, back, KEYS * sizeof(key128_t)) == 0, "n = %u: decoded keys differ", n);
+
+        // single lines, the inline kernels
+        char line[MAXLINE];
+        key128_t k;
+        unsigned len = d6batch_encode_line(&keys[0], line);
+        check(len == d6pack_expected_len(n) + 1 && d6batch_decode_line(line, n, &k)
+              && memcmp(&k, &keys[0], sizeof(k)) == 0, "n = %u: single line round trip", n);
+
+        // damaged lines stop a run and are left to the scalar decoder
+        memcpy(text + 2, "\x20", 1);
+        size_t used;
+        check(d6batch_decode(text, bytes, back, KEYS, &used) == 0 && used == 0, "n = %u: bad character accepted", n);
+        text[2] = want[2];
+        const size_t stride = d6pack_expected_len(n) + 1;
+        text[stride + 1] = (char)(63 + n % 11 + 1);
+        check(d6batch_decode(text, bytes, back, KEYS, &used) == 1 && used == stride, "n = %u: another n accepted", n);
+    }
+    printf("    n = 1..11: %d keys encoded and decoded as by d6pack11.h\n", KEYS);
+
+    // lines with '\r' or trailing text are not of the fixed form, but digraph6
+    char one[MAXLINE], odd[1024];
+    key128_t k5;
+    random_key(&k5, 5);
+    int l = (int)d6batch_encode_line(&k5, one) - 1, len = 0;
+    for (int i = 0; i < 20; ++i) {
+        const char *tail = i == 8 ? "\r" : i == 9 ? "xyz" : "";
+        len += snprintf(odd + len, sizeof(odd) - (size_t)len, "%.*s%s\n", l, one, tail);
+    }
+    size_t got = decode_all(odd, (size_t)len, back, KEYS);
+    check(got == 20, "n = 5: irregular lines");
+    for (size_t i = 0; i < got; ++i) {
+        check(memcmp(&back[i], &k5, sizeof(k5)) == 0, "n = 5: irregular line decoded wrong");
+    }
+
+    // timing at n = 11
+    for (size_t i = 0; i < KEYS; ++i) {
+        random_key(&keys[i], 11);
+    }
+    uint64_t t0 = ns_now_monotonic();
+    size_t bytes = 0;
+    for (int r = 0; r < 20; ++r) bytes = scalar_encode(keys, KEYS, want);
+    uint64_t t1 = ns_now_monotonic();
+    for (int r = 0; r < 20; ++r) d6batch_encode(keys, KEYS, text);
+    uint64_t t2 = ns_now_monotonic();
+    unsigned n;
+    for (int r = 0; r < 20; ++r) {
+        size_t pos = 0;
+        for (size_t i = 0; i < KEYS; ++i) {
+            d6pack_decode(want + pos, &back[i], &n);
+            pos += 24;
+        }
+    }
+    uint64_t t3 = ns_now_monotonic();
+    size_t used;
+    for (int r = 0; r < 20; ++r) d6batch_decode(text, bytes + D6BATCH_SLACK, back, KEYS, &used);
+    uint64_t t4 = ns_now_monotonic();
+    printf("    n = 11, ns per line: encode scalar %.1f, batch %.1f; decode scalar %.1f, batch %.1f\n",
+           (t1 - t0) / (20.0 * KEYS), (t2 - t1) / (20.0 * KEYS),
+           (t3 - t2) / (20.0 * KEYS), (t4 - t3) / (20.0 * KEYS));
+    check(used == bytes && memcmp(keys, back, KEYS * sizeof(key128_t)) == 0, "n = 11: timed decode");
+
+    free(keys);
+    free(back);
+    free(text);
+    free(want);
+    printf("=== [d6batch] all tests passed ===\n");
+    return 0;
+}
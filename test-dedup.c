@@ -0,0 +1,88 @@
+#include <omp.h>
+
+#include "dedup.h"
+#include "testutil.h"
+
+typedef struct {
+    key128_t prev;
+    uint64_t count;
+    bool     sorted;
+} SortCheck;
+
+static void check_sorted(const key128_t *k, void *user_data)
+{
+    SortCheck *c = (SortCheck*)user_data;
+    if (c->count > 0 && !key128_lt(&c->prev, k)) {
+        c->sorted = false;
+    }
+    c->prev = *k;
+    c->count++;
+}
+
+int main(void)
+{
+    const uint64_t N = 200000;
+    /* a budget of a few thousand keys forces many spills and merges */
+    DedupSet *d = dedup_new(16, 4096 * 80);
+    FlatSet ref;
+    key128_t k;
+
+    printf("=== [dedup] testing %lu keys with a small memory budget ===\n", N);
+    flat_init(&ref, 1024);
+
+    /* every key is inserted twice, the second time after it was spilled */
+    for (uint64_t j = 0; j < 2 * N; ++j) {
+        uint64_t i = (j < N) ? j : (j - N) * 7 % N;
+        key_from_index(i, &k);
+        bool is_new = flat_insert(&ref, &k);
+        if (dedup_insert(d, &k) != is_new) {
+            fprintf(stderr, "    insert of key %lu disagrees with the reference set\n", i);
+            exit(1);
+        }
+    }
+    if (dedup_size(d) != N) {
+        fprintf(stderr, "    size mismatch: %zu != %lu\n", dedup_size(d), N);
+        exit(1);
+    }
+    if (dedup_runs(d) == 0) {
+        fprintf(stderr, "    nothing was spilled\n");
+        exit(1);
+    }
+    for (uint64_t i = N; i < N + 1000; ++i) {
+        key_from_index(i, &k);
+        if (dedup_lookup(d, &k)) {
+            fprintf(stderr, "    key %lu found but never inserted\n", i);
+            exit(1);
+        }
+    }
+    printf("    %zu keys, %zu run(s) on disk\n", dedup_size(d), dedup_runs(d));
+
+    SortCheck c = { .count = 0, .sorted = true };
+    dedup_foreach_sorted(d, check_sorted, &c);
+    if (!c.sorted || c.count != N) {
+        fprintf(stderr, "    sorted traversal failed (%lu keys, sorted=%d)\n", c.count, c.sorted);
+        exit(1);
+    }
+    printf("    sorted traversal OK\n");
+    dedup_destroy(d);
+    flat_free(&ref);
+
+    /* concurrent inserts of overlapping ranges: each key must be new exactly once */
+    d = dedup_new(16, 2048 * 80);
+    uint64_t new_keys = 0;
+    #pragma omp parallel for reduction(+:new_keys) schedule(dynamic, 1024)
+    for (uint64_t j = 0; j < 4 * N; ++j) {
+        key128_t key;
+        key_from_index(j % N, &key);
+        if (dedup_insert(d, &key)) new_keys++;
+    }
+    if (new_keys != N || dedup_size(d) != N) {
+        fprintf(stderr, "    concurrent inserts: %lu new keys, size %zu, expected %lu\n", new_keys, dedup_size(d), N);
+        exit(1);
+    }
+    printf("    concurrent inserts OK (%d threads)\n", omp_get_max_threads());
+    dedup_destroy(d);
+
+    printf("=== [dedup] all tests passed ===\n");
+    return 0;
+}
@@ -0,0 +1,163 @@
+#include <inttypes.h>
+
+#include "flatset.h"
+
+/*
+ * Checks the answers of every set variant on a fixed operation sequence and times
+ * them on two key distributions: random keys, and "structured" keys that
+ * differ only in a few middle bits (like packed adjacency matrices of small
+ * dimension). The fastest variant per key width is printed.
+ */
+
+#define N (1u << 18)
+
+enum { RANDOM, STRUCTURED, WORKLOADS };
+static const char *workload_name[WORKLOADS] = { "random", "structured" };
+
+static INLINE uint64_t word_from_index(uint64_t i, int w, int workload)
+{
+    if (workload == STRUCTURED) return w == 0 ? i << 20 : 0;
+    uint64_t x = (i + 1) * 0x9E3779B97F4A7C15ULL + (uint64_t)w * 0xD1B54A32D192ED03ULL;
+    x ^= x >> 29;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    return x ^ (x >> 32);
+}
+
+static INLINE void key64_from_index(uint64_t i, int workload, uint64_t *k)
+{
+    *k = word_from_index(i, 0, workload);
+}
+
+static INLINE void key128_from_index(uint64_t i, int workload, key128_t *k)
+{
+    uint64_t lo = word_from_index(i, 0, workload), hi = word_from_index(i, 1, workload);
+    memcpy(k->b + 0, &lo, 8);
+    memcpy(k->b + 8, &hi, 8);
+}
+
+static INLINE void key256_from_index(uint64_t i, int workload, key256_t *k)
+{
+    for (int w = 0; w < 4; ++w) k->w[w] = word_from_index(i, w, workload);
+}
+
+/*
+ * Inserts keys 0..N-1 twice, looks up N hits and N misses, removes the even
+ * keys and inserts them again. Exits on a wrong answer, returns seconds.
+ */
+#define DEFINE_RUN(TYPE, PREFIX, KEY, WIDTH)                                        \
+static double run_##PREFIX(int workload)                                            \
+{                                                                                   \
+    TYPE s;                                                                         \
+    KEY k;                                                                          \
+    uint64_t bad = 0;                                                               \
+    uint64_t t0 = ns_now_monotonic();                                               \
+    PREFIX##_init(&s, 16);                                                          \
+    for (uint64_t i = 0; i < N; ++i) {                                              \
+        key##WIDTH##_from_index(i, workload, &k);                                   \
+        bad += !PREFIX##_insert(&s, &k);                                            \
+    }                                                                               \
+    for (uint64_t i = 0; i < N; ++i) {                                              \
+        key##WIDTH##_from_index(i, workload, &k);                                   \
+        bad += PREFIX##_insert(&s, &k);                                             \
+    }                                                                               \
+    for (uint64_t i = 0; i < 2 * N; ++i) {                                          \
+        key##WIDTH##_from_index(i, workload, &k);                                   \
+        bad += PREFIX##_lookup(&s, &k) != (i < N);                                  \
+    }                                                                               \
+    for (uint64_t i = 0; i < N; i += 2) {                                           \
+        key##WIDTH##_from_index(i, workload, &k);                                   \
+        bad += !PREFIX##_remove(&s, &k);                                            \
+    }                                                                               \
+    bad += s.size != N / 2;                                                         \
+    for (uint64_t i = 0; i < N; ++i) {                                              \
+        key##WIDTH##_from_index(i, workload, &k);                                   \
+        bad += PREFIX##_insert(&s, &k) != (i % 2 == 0);                             \
+    }                                                                               \
+    bad += s.size != N;                                                             \
+    PREFIX##_free(&s);                                                              \
+    double sec = (double)(ns_now_monotonic() - t0) / 1e9;                           \
+    if (bad) {                                                                      \
+        fprintf(stderr, "    %s: %" PRIu64 " wrong answers (%s keys)\n",            \
+                #TYPE, bad, workload_name[workload]);                               \
+        exit(1);                                                                    \
+    }                                                                               \
+    return sec;                                                                     \
+}
+
+DEFINE_RUN(Set64M,   set64m,   uint64_t, 64)
+DEFINE_RUN(Set64X,   set64x,   uint64_t, 64)
+DEFINE_RUN(Set128M,  set128m,  key128_t, 128)
+DEFINE_RUN(Set128MQ, set128mq, key128_t, 128)
+DEFINE_RUN(Set128X,  set128x,  key128_t, 128)
+DEFINE_RUN(Set256M,  set256m,  key256_t, 256)
+DEFINE_RUN(Set256X,  set256x,  key256_t, 256)
+
+/* the generic set, for reference */
+static double run_flat(int workload)
+{
+    FlatSet s;
+    key128_t k;
+    uint64_t t0 = ns_now_monotonic();
+    flat_init(&s, 16);
+    for (uint64_t j = 0; j < 2 * N; ++j) {
+        key128_from_index(j % N, workload, &k);
+        flat_insert(&s, &k);
+    }
+    for (uint64_t i = 0; i < 2 * N; ++i) {
+        key128_from_index(i, workload, &k);
+        flat_lookup(&s, &k);
+    }
+    for (uint64_t i = 0; i < N; i += 2) {
+        key128_from_index(i, workload, &k);
+        flat_remove(&s, &k);
+    }
+    for (uint64_t i = 0; i < N; ++i) {
+        key128_from_index(i, workload, &k);
+        flat_insert(&s, &k);
+    }
+    flat_free(&s);
+    return (double)(ns_now_monotonic() - t0) / 1e9;
+}
+
+typedef struct {
+    const char *name;
+    int         width;
+    double    (*run)(int workload);
+} Variant;
+
+static const Variant variants[] = {
+    { "Set64M",   64,  run_set64m   },
+    { "Set64X",   64,  run_set64x   },
+    { "FlatSet",  128, run_flat     },
+    { "Set128M",  128, run_set128m  },
+    { "Set128MQ", 128, run_set128mq },
+    { "Set128X",  128, run_set128x  },
+    { "Set256M",  256, run_set256m  },
+    { "Set256X",  256, run_set256x  },
+};
+#define NVARIANTS (sizeof(variants) / sizeof(variants[0]))
+
+int main(void)
+{
+    double sec[NVARIANTS][WORKLOADS];
+
+    printf("=== [flatset] testing set variants with %u keys ===\n", N);
+    for (int w = 0; w < WORKLOADS; ++w) {
+        for (size_t v = 0; v < NVARIANTS; ++v) {
+            sec[v][w] = variants[v].run(w);
+            printf("    %-9s %-10s %6.3f s\n", variants[v].name, workload_name[w], sec[v][w]);
+        }
+    }
+    for (int w = 0; w < WORKLOADS; ++w) {
+        for (int width = 64; width <= 256; width *= 2) {
+            size_t best = NVARIANTS;
+            for (size_t v = 0; v < NVARIANTS; ++v) {
+                if (variants[v].width == width && (best == NVARIANTS || sec[v][w] < sec[best][w])) best = v;
+            }
+            printf("    fastest for %3d-bit %s keys: %s\n", width, workload_name[w], variants[best].name);
+        }
+    }
+
+    printf("=== [flatset] all tests passed ===\n");
+    return 0;
+}
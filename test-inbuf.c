@@ -0,0 +1,105 @@
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "inbuf.h"
+
+/* lines of every length 0..LONGEST, then one longer than a pipe block,
+ * and a last line without '\n'
+ */
+#define LINES   20000
+#define LONGEST 100
+#define HUGE    (INBUF_BLOCK + 12345)
+
+static size_t line_len(size_t i)
+{
+    return i == LINES ? HUGE : (i * 7) % (LONGEST + 1);
+}
+
+static char line_char(size_t i, size_t j)
+{
+    return (char)('!' + (i + j) % 90);
+}
+
+static void write_lines(FILE *f)
+{
+    for (size_t i = 0; i <= LINES + 1; ++i) {
+        size_t len = i == LINES + 1 ? 5 : line_len(i);
+        for (size_t j = 0; j < len; ++j) fputc(line_char(i, j), f);
+        if (i <= LINES) fputc('\n', f);
+    }
+    fflush(f);
+}
+
+static void read_lines(FILE *f, const char *what)
+{
+    InputBuffer in;
+    inbuf_open(&in, f);
+    const char *line;
+    size_t len, i = 0;
+    while (inbuf_line(&in, &line, &len)) {
+        size_t want = i == LINES + 1 ? 5 : line_len(i);
+        if (len != want) {
+            fprintf(stderr, "    %s: line %zu has %zu chars, expected %zu\n", what, i, len, want);
+            exit(1);
+        }
+        for (size_t j = 0; j < len; ++j) {
+            if (line[j] != line_char(i, j)) {
+                fprintf(stderr, "    %s: line %zu differs at %zu\n", what, i, j);
+                exit(1);
+            }
+        }
+        ++i;
+    }
+    if (i != LINES + 2) {
+        fprintf(stderr, "    %s: read %zu lines, expected %d\n", what, i, LINES + 2);
+        exit(1);
+    }
+    printf("    %s: %zu lines%s\n", what, i, in.map ? " (mapped)" : "");
+    inbuf_close(&in);
+}
+
+int main(void)
+{
+    printf("=== [inbuf] testing line spans from a file and a pipe ===\n");
+
+    FILE *f = tmpfile();
+    write_lines(f);
+    rewind(f);
+    read_lines(f, "file");
+
+    // a file read from an offset, as after a header was read with stdio
+    rewind(f);
+    for (size_t j = 0; j < line_len(0) + 1; ++j) fgetc(f);
+    InputBuffer in;
+    inbuf_open(&in, f);
+    const char *line;
+    size_t len;
+    if (!inbuf_line(&in, &line, &len) || len != line_len(1) || line[0] != line_char(1, 0)) {
+        fprintf(stderr, "    file: offset of the FILE not respected\n");
+        return 1;
+    }
+    inbuf_close(&in);
+    fclose(f);
+
+    int fd[2];
+    if (pipe(fd) != 0) {
+        perror("pipe");
+        return 1;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fd[0]);
+        FILE *w = fdopen(fd[1], "w");
+        write_lines(w);
+        fclose(w);
+        _exit(0);
+    }
+    close(fd[1]);
+    FILE *r = fdopen(fd[0], "r");
+    read_lines(r, "pipe");
+    fclose(r);
+    waitpid(pid, NULL, 0);
+
+    printf("=== [inbuf] all tests passed ===\n");
+    return 0;
+}
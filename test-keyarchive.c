@@ -0,0 +1,99 @@
+#include "keysort.h"
+#include "keystream.h"
+
+#define N     50000
+#define BLOCK 1000
+
+static void random_key(uint64_t *state, unsigned n, key128_t *k)
+{
+    uint64_t lo = (*state = *state * 6364136223846793005ULL + 1442695040888963407ULL);
+    uint64_t hi = (*state = *state * 6364136223846793005ULL + 1442695040888963407ULL);
+    memcpy(k->b + 0, &lo, 8);
+    memcpy(k->b + 8, &hi, 8);
+    d6pack_zero_above_nsquare(k, n);
+    d6pack_set_n(k, n);
+}
+
+static int cmp_key(const void *a, const void *b)
+{
+    return key128_cmp((const key128_t*)a, (const key128_t*)b);
+}
+
+int main(void)
+{
+    printf("=== [keyarchive] testing delta coded key archives ===\n");
+
+    // sorted unique keys of all sizes: big deltas between n, small ones at n = 4
+    static key128_t keys[N], tmp[N], got[BLOCK];
+    uint64_t state = 7;
+    for (size_t i = 0; i < N; ++i) {
+        random_key(&state, 1 + (unsigned)(i % 11), &keys[i]);
+    }
+    keys_radix_sort(keys, N, tmp);
+    size_t cnt = keys_unique(keys, N);
+
+    FILE *f = tmpfile();
+    KeyArchiveWriter w;
+    keyarchive_writer_init(&w, f, 0, KEYSTREAM_CANONICAL, BLOCK);
+    for (size_t i = 0; i < cnt; ++i) {
+        if (!keyarchive_put(&w, &keys[i])) {
+            fprintf(stderr, "    key %zu rejected\n", i);
+            return 1;
+        }
+    }
+    if (keyarchive_put(&w, &keys[cnt / 2]) || keyarchive_put(&w, &keys[cnt - 1])) {
+        fprintf(stderr, "    key out of order accepted\n");
+        return 1;
+    }
+    uint64_t bytes = keyarchive_writer_close(&w);
+
+    // streaming, as every tool reads it
+    KeyStream s;
+    rewind(f);
+    if (!keystream_open(&s, f) || !s.archive || s.flags != (KEYSTREAM_CANONICAL | KEYSTREAM_SORTED | KEYSTREAM_UNIQUE)) {
+        fprintf(stderr, "    archive not detected\n");
+        return 1;
+    }
+    size_t n = keystream_read(&s, tmp, 10);
+    n += keystream_skip(&s, 2 * BLOCK);
+    n += keystream_read(&s, tmp + 10, N);
+    if (n != cnt || memcmp(tmp, keys, 10 * sizeof(key128_t)) != 0 ||
+        memcmp(tmp + 10, keys + 10 + 2 * BLOCK, (cnt - 10 - 2 * BLOCK) * sizeof(key128_t)) != 0) {
+        fprintf(stderr, "    streamed %zu of %zu keys, or they differ\n", n, cnt);
+        return 1;
+    }
+
+    // random access
+    KeyArchive a;
+    if (!keyarchive_load(&a, f) || a.records != cnt || a.nblocks != (cnt + BLOCK - 1) / BLOCK ||
+        a.bytes != bytes) {
+        fprintf(stderr, "    index not read back\n");
+        return 1;
+    }
+    for (size_t b = 0; b < a.nblocks; ++b) {
+        size_t len = keyarchive_block(&a, b, got);
+        size_t want = b + 1 < a.nblocks ? BLOCK : cnt - b * BLOCK;
+        if (len != want || memcmp(got, keys + b * BLOCK, len * sizeof(key128_t)) != 0) {
+            fprintf(stderr, "    block %zu differs\n", b);
+            return 1;
+        }
+    }
+    for (size_t i = 0; i < cnt; i += 97) {
+        key128_t k = keys[i];
+        if (!keyarchive_find(&a, &k)) {
+            fprintf(stderr, "    key %zu not found\n", i);
+            return 1;
+        }
+        k.b[0] ^= 1;        // a neighbour of the same n, usually absent
+        if (keyarchive_find(&a, &k) != (bsearch(&k, keys, cnt, sizeof(key128_t), cmp_key) != NULL)) {
+            fprintf(stderr, "    neighbour of key %zu misreported\n", i);
+            return 1;
+        }
+    }
+    keyarchive_free(&a);
+    fclose(f);
+
+    printf("    %zu keys: %lu bytes, %.2f per key\n", cnt, (unsigned long)bytes, (double)bytes / cnt);
+    printf("=== [keyarchive] all tests passed ===\n");
+    return 0;
+}
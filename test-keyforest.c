@@ -0,0 +1,84 @@
+#include <omp.h>
+
+#include "keyforest.h"
+#include "testutil.h"
+
+#define THREADS 4
+#define KEYS    (1 << 16)
+#define EDGES   (KEYS / 2 + KEYS / 4)
+
+/* A sequential union-find by index, for reference. */
+static uint32_t plain_find(uint32_t *parent, uint32_t v)
+{
+    while (parent[v] != v) {
+        v = parent[v] = parent[parent[v]];
+    }
+    return v;
+}
+
+int main(void)
+{
+    printf("=== [keyforest] testing the concurrent union-find ===\n");
+
+    KeyForest f;
+    keyforest_init(&f, 0);
+    key128_t k;
+    bool added;
+    for (uint32_t i = 0; i < KEYS; ++i) {
+        key_from_index(i, &k);
+        check(keyforest_add(&f, &k, &added) == i && added, "new key not added");
+    }
+    key_from_index(17, &k);
+    check(keyforest_add(&f, &k, &added) == 17 && !added, "key added twice");
+    key_from_index(KEYS, &k);
+    check(keyforest_lookup(&f, &k) == -1, "absent key found");
+
+    // random edges, joined by all threads at once
+    uint32_t (*edges)[2] = malloc(EDGES * sizeof(*edges));
+    uint64_t rng = 0x9E3779B97F4A7C15ull;
+    for (size_t e = 0; e < EDGES; ++e) {
+        for (int s = 0; s < 2; ++s) {
+            rng ^= rng << 13;
+            rng ^= rng >> 7;
+            rng ^= rng << 17;
+            edges[e][s] = (uint32_t)(rng % KEYS);
+        }
+    }
+    uint64_t t0 = ns_now_monotonic();
+    #pragma omp parallel for num_threads(THREADS) schedule(dynamic, 256)
+    for (size_t e = 0; e < EDGES; ++e) {
+        keyforest_union(&f, edges[e][0], edges[e][1]);
+    }
+    uint64_t t1 = ns_now_monotonic();
+
+    uint32_t *parent = malloc(KEYS * sizeof(uint32_t)), *least = malloc(KEYS * sizeof(uint32_t));
+    for (uint32_t i = 0; i < KEYS; ++i) {
+        parent[i] = least[i] = i;
+    }
+    for (size_t e = 0; e < EDGES; ++e) {
+        uint32_t a = plain_find(parent, edges[e][0]), b = plain_find(parent, edges[e][1]);
+        if (a != b) {
+            parent[a] = b;
+            if (key128_lt(&f.keys[least[a]], &f.keys[least[b]])) least[b] = least[a];
+        }
+    }
+
+    // the same components, each rooted at its least key
+    size_t sets = 0, roots = 0;
+    for (uint32_t i = 0; i < KEYS; ++i) {
+        uint32_t r = plain_find(parent, i);
+        sets += r == i;
+        roots += keyforest_is_root(&f, i);
+        check(keyforest_find(&f, i) == least[r], "wrong root");
+    }
+    check(sets == roots, "wrong number of sets");
+    printf("    %d keys, %d edges: %zu sets, joined in %.3fs with %d threads\n",
+           KEYS, EDGES, sets, (t1 - t0) / 1e9, THREADS);
+
+    free(edges);
+    free(parent);
+    free(least);
+    keyforest_free(&f);
+    printf("=== [keyforest] all tests passed ===\n");
+    return 0;
+}
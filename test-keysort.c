@@ -0,0 +1,99 @@
+#include "keysort.h"
+
+/* Keys to sort: random ones, or structured ones that share their high half
+ * and repeat, as the packed matrices of one dimension do.
+ */
+static INLINE void sort_key(uint64_t i, bool structured, key128_t *k)
+{
+    uint64_t lo = (i % 100003) * 0x9E3779B97F4A7C15ULL, hi = i * 0xD1B54A32D192ED03ULL;
+    if (structured) {
+        /* like packed 7x7 matrices: 49 low bits and the dimension nibble */
+        lo &= (1ULL << 49) - 1;
+        hi = 7ULL << 60;
+    }
+    memcpy(k->b + 0, &lo, 8);
+    memcpy(k->b + 8, &hi, 8);
+}
+
+static int cmp_keys(const void *a, const void *b)
+{
+    return key128_cmp((const key128_t*)a, (const key128_t*)b);
+}
+
+static void test_sort(size_t n, bool structured)
+{
+    key128_t *keys = (key128_t*)malloc(n * sizeof(key128_t));
+    key128_t *ref  = (key128_t*)malloc(n * sizeof(key128_t));
+    key128_t *tmp  = (key128_t*)malloc(n * sizeof(key128_t));
+
+    for (size_t i = 0; i < n; ++i) sort_key(i, structured, &keys[i]);
+    memcpy(ref, keys, n * sizeof(key128_t));
+
+    uint64_t t0 = ns_now_monotonic();
+    qsort(ref, n, sizeof(key128_t), cmp_keys);
+    uint64_t t1 = ns_now_monotonic();
+    keys_radix_sort(keys, n, tmp);
+    uint64_t t2 = ns_now_monotonic();
+
+    if (memcmp(keys, ref, n * sizeof(key128_t)) != 0) {
+        fprintf(stderr, "    radix sort of %zu %s keys differs from qsort\n", n, structured ? "structured" : "random");
+        exit(1);
+    }
+    size_t m = keys_unique(keys, n);
+    for (size_t i = 1; i < m; ++i) {
+        if (!key128_lt(&keys[i - 1], &keys[i])) {
+            fprintf(stderr, "    unique pass left duplicates\n");
+            exit(1);
+        }
+    }
+    printf("    %8zu %-10s keys: qsort %7.2f ms, radix %7.2f ms, %zu distinct\n", n,
+           structured ? "structured" : "random", (t1 - t0) / 1e6, (t2 - t1) / 1e6, m);
+    free(keys);
+    free(ref);
+    free(tmp);
+}
+
+int main(void)
+{
+    printf("=== [keysort] testing radix sort, unique and merge ===\n");
+    test_sort(1, false);
+    test_sort(1000, false);
+    test_sort(1000, true);
+    test_sort(1 << 20, false);
+    test_sort(1 << 20, true);
+
+    /* three overlapping sorted runs merge into the sorted union */
+    const size_t N = 30000;
+    key128_t *runs[3];
+    size_t lens[3];
+    for (int r = 0; r < 3; ++r) {
+        key128_t *tmp = (key128_t*)malloc(N * sizeof(key128_t));
+        runs[r] = (key128_t*)malloc(N * sizeof(key128_t));
+        for (size_t i = 0; i < N; ++i) sort_key(i * (size_t)(r + 1), false, &runs[r][i]);
+        keys_radix_sort(runs[r], N, tmp);
+        lens[r] = keys_unique(runs[r], N);
+        free(tmp);
+    }
+    size_t n;
+    key128_t *merged = keys_merge_array(runs, lens, 3, &n);
+    for (size_t i = 1; i < n; ++i) {
+        if (!key128_lt(&merged[i - 1], &merged[i])) {
+            fprintf(stderr, "    merged run is not sorted and unique at %zu\n", i);
+            exit(1);
+        }
+    }
+    for (int r = 0; r < 3; ++r) {
+        for (size_t i = 0; i < lens[r]; ++i) {
+            if (bsearch(&runs[r][i], merged, n, sizeof(key128_t), cmp_keys) == NULL) {
+                fprintf(stderr, "    key %zu of run %d missing after the merge\n", i, r);
+                exit(1);
+            }
+        }
+        free(runs[r]);
+    }
+    free(merged);
+    printf("    merge of 3 runs: %zu distinct keys\n", n);
+
+    printf("=== [keysort] all tests passed ===\n");
+    return 0;
+}
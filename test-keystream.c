@@ -0,0 +1,111 @@
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bucket.h"
+#include "keystream.h"
+
+#define N 20000
+
+/* random graph on n vertices as a d6pack key */
+static void random_key(uint64_t *state, unsigned n, key128_t *k)
+{
+    uint64_t lo = (*state = *state * 6364136223846793005ULL + 1442695040888963407ULL);
+    uint64_t hi = (*state = *state * 6364136223846793005ULL + 1442695040888963407ULL);
+    memcpy(k->b + 0, &lo, 8);
+    memcpy(k->b + 8, &hi, 8);
+    d6pack_zero_above_nsquare(k, n);
+    d6pack_set_n(k, n);
+}
+
+static void read_back(FILE *f, const key128_t *keys, size_t cnt, bool binary, const char *what)
+{
+    KeyStream s;
+    rewind(f);
+    if (!keystream_open(&s, f) || s.binary != binary) {
+        fprintf(stderr, "    %s: format not detected\n", what);
+        exit(1);
+    }
+    key128_t k[N];
+    size_t got = keystream_read(&s, k, 100);
+    got += keystream_skip(&s, 50);
+    got += keystream_read(&s, k + got, N);
+    if (got != cnt || s.records != cnt) {
+        fprintf(stderr, "    %s: read %zu of %zu keys\n", what, got, cnt);
+        exit(1);
+    }
+    for (size_t i = 0; i < cnt; ++i) {
+        if ((i < 100 || i >= 150) && !key128_equal(&k[i], &keys[i])) {
+            fprintf(stderr, "    %s: key %zu differs\n", what, i);
+            exit(1);
+        }
+    }
+}
+
+int main(void)
+{
+    printf("=== [keystream] testing digraph6 and binary key streams ===\n");
+
+    static key128_t keys[N];
+    uint64_t state = 42;
+    for (size_t i = 0; i < N; ++i) {
+        random_key(&state, 1 + (unsigned)(i % 11), &keys[i]);
+    }
+
+    FILE *text = tmpfile(), *bin = tmpfile();
+    keystream_write_header(bin, 0, KEYSTREAM_UNIQUE);
+    for (size_t i = 0; i < N; ++i) {
+        keystream_put(text, &keys[i], false);
+        keystream_put(bin, &keys[i], true);
+        if (i == 7) fputs("not a digraph6 line\n", text);
+    }
+    long text_bytes = ftell(text), bin_bytes = ftell(bin);
+
+    read_back(text, keys, N, false, "text");
+    read_back(bin, keys, N, true, "binary");
+
+    /* the header survives, a damaged one is rejected */
+    KeyStream s;
+    rewind(bin);
+    if (!keystream_open(&s, bin) || s.n != 0 || s.flags != KEYSTREAM_UNIQUE) {
+        fprintf(stderr, "    header fields not read back\n");
+        exit(1);
+    }
+    rewind(bin);
+    fputc(KEYSTREAM_MAGIC[0], bin);
+    fputc('X', bin);
+    rewind(bin);
+    fflush(stdout);
+    fprintf(stderr, "    expected error: ");
+    if (keystream_open(&s, bin)) {
+        fprintf(stderr, "    damaged header accepted\n");
+        exit(1);
+    }
+
+    /* a binary stream cut inside a key is an error, not a shorter stream */
+    FILE *cut = tmpfile();
+    keystream_write_header(cut, 0, 0);
+    keystream_put(cut, &keys[0], true);
+    keystream_put(cut, &keys[1], true);
+    fwrite(&keys[2], 1, 5, cut);
+    rewind(cut);
+    fprintf(stderr, "    expected error: ");
+    pid_t pid = fork();
+    if (pid == 0) {
+        key128_t k[3];
+        if (keystream_open(&s, cut)) keystream_read(&s, k, 3);
+        _exit(0);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_FAILURE) {
+        fprintf(stderr, "    truncated key stream accepted\n");
+        exit(1);
+    }
+    fclose(cut);
+    fclose(text);
+    fclose(bin);
+
+    printf("    %d keys: %ld bytes of digraph6, %ld bytes of key stream\n", N, text_bytes, bin_bytes);
+    printf("=== [keystream] all tests passed ===\n");
+    return 0;
+}
@@ -0,0 +1,112 @@
+#include <omp.h>
+
+#include "orbitmemo.h"
+#include "testutil.h"
+
+#define THREADS 4
+
+/* Key i with n = 11 in the top nibble, as minimalf's keys. */
+static INLINE void memo_key(uint64_t i, key128_t *k)
+{
+    key_from_index(i, k);
+    k->b[15] |= 0xB0;
+}
+
+/* The verdict of key i: "minimal" for every third key. */
+static INLINE bool verdict_of(uint64_t i)
+{
+    return i % 3 == 0;
+}
+
+int main(void)
+{
+    const uint64_t N = 1 << 16;
+    key128_t k;
+    OrbitMemoStats st;
+
+    printf("=== [orbitmemo] testing the orbit verdict memo ===\n");
+
+    // room for all keys: every verdict is found again
+    OrbitMemo *m = orbitmemo_new(N * 64);
+    for (uint64_t i = 0; i < N; ++i) {
+        memo_key(i, &k);
+        check(orbitmemo_lookup(m, &k) == ORBITMEMO_UNKNOWN, "unknown key found");
+        orbitmemo_insert(m, &k, verdict_of(i));
+    }
+    uint64_t found = 0;
+    for (uint64_t i = 0; i < N; ++i) {
+        memo_key(i, &k);
+        OrbitVerdict v = orbitmemo_lookup(m, &k);
+        check(v == ORBITMEMO_UNKNOWN || v == (verdict_of(i) ? ORBITMEMO_MIN : ORBITMEMO_NOT_MIN), "wrong verdict");
+        found += v != ORBITMEMO_UNKNOWN;
+    }
+    orbitmemo_stats(m, &st);
+    printf("    %lu of %lu keys kept in %.1f MiB, %lu evicted\n",
+           (unsigned long)found, (unsigned long)N, st.bytes / 1048576.0, (unsigned long)st.evictions);
+    check(found + st.evictions == N && found > N * 9 / 10, "keys lost without eviction");
+
+    // a verdict can be replaced
+    memo_key(0, &k);
+    orbitmemo_insert(m, &k, false);
+    check(orbitmemo_lookup(m, &k) != ORBITMEMO_MIN, "verdict not replaced");
+    orbitmemo_free(m);
+
+    // a small budget: CLOCK keeps the keys that are hit
+    m = orbitmemo_new(64 * 64);
+    const uint64_t hot = 64;
+    for (uint64_t i = 0; i < hot; ++i) {
+        memo_key(i, &k);
+        orbitmemo_insert(m, &k, verdict_of(i));
+    }
+    for (uint64_t i = hot; i < 20 * hot; ++i) {
+        for (uint64_t j = 0; j < hot; ++j) {
+            memo_key(j, &k);
+            orbitmemo_lookup(m, &k);
+        }
+        memo_key(i, &k);
+        orbitmemo_insert(m, &k, verdict_of(i));
+    }
+    uint64_t hot_kept = 0;
+    for (uint64_t i = 0; i < hot; ++i) {
+        memo_key(i, &k);
+        hot_kept += orbitmemo_lookup(m, &k) != ORBITMEMO_UNKNOWN;
+    }
+    orbitmemo_stats(m, &st);
+    printf("    budget of %zu keys: %lu of %lu hot keys kept, %lu evictions\n",
+           (size_t)(64 * ORBITMEMO_WAYS), (unsigned long)hot_kept, (unsigned long)hot, (unsigned long)st.evictions);
+    check(st.keys <= 64 * ORBITMEMO_WAYS && st.evictions > 0, "budget exceeded");
+    check(hot_kept > hot / 2, "hot keys evicted");
+    orbitmemo_free(m);
+
+    // threads inserting and looking up the same keys never see a wrong verdict
+    m = orbitmemo_new(N * 16);
+    uint64_t t0 = ns_now_monotonic();
+    #pragma omp parallel num_threads(THREADS)
+    {
+        key128_t kk;
+        uint64_t seed = 0x2545F4914F6CDD1DULL * (uint64_t)(omp_get_thread_num() + 1);
+        for (int r = 0; r < 400000; ++r) {
+            seed ^= seed << 13;
+            seed ^= seed >> 7;
+            seed ^= seed << 17;
+            uint64_t i = seed % N;
+            memo_key(i, &kk);
+            OrbitVerdict v = orbitmemo_lookup(m, &kk);
+            if (v == ORBITMEMO_UNKNOWN) {
+                orbitmemo_insert(m, &kk, verdict_of(i));
+            } else if (v != (verdict_of(i) ? ORBITMEMO_MIN : ORBITMEMO_NOT_MIN)) {
+                fprintf(stderr, "    thread %d: wrong verdict for key %lu\n", omp_get_thread_num(), (unsigned long)i);
+                exit(1);
+            }
+        }
+    }
+    uint64_t t1 = ns_now_monotonic();
+    orbitmemo_stats(m, &st);
+    printf("    %d threads: %lu lookups, %.1f%% hits, %.0f ns per operation\n", THREADS,
+           (unsigned long)st.lookups, 100.0 * (double)st.hits / (double)st.lookups,
+           (double)(t1 - t0) / (double)(st.lookups + st.inserts) * THREADS);
+    orbitmemo_free(m);
+
+    printf("=== [orbitmemo] all tests passed ===\n");
+    return 0;
+}
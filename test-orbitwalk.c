@@ -0,0 +1,159 @@
+#include <omp.h>
+
+#include "adjpack11.h"
+#include "dag.h"
+#include "flatset.h"
+#include "orbitwalk.h"
+#include "testutil.h"
+
+#define THREADS 4
+#define SEEDS   40
+#define DIM     6
+
+static uint64_t rng = 0x9E3779B97F4A7C15ull;
+
+static uint64_t next_random(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+/* A random strictly upper triangular matrix, a Bott matrix. */
+static void random_seed(vec_t *mat)
+{
+    for (ind_t i = 0; i < DIM; ++i) {
+        mat[i] = 0;
+        for (ind_t j = i + 1; j < DIM; ++j) {
+            mat[i] |= (vec_t)(next_random() & 1) << j;
+        }
+    }
+}
+
+static void canonical_key(const vec_t *mat, key128_t *k)
+{
+    vec_t can[DIM];
+    matrix_to_matrix_canon(mat, DIM, can);
+    adjpack_from_matrix(can, DIM, k);
+}
+
+/* The orbit by a plain one-threaded BFS, as minimalf walks it. */
+static void sequential_orbit(const vec_t *seed, Set128MQ *orbit)
+{
+    size_t len = 1, cap = 1024;
+    vec_t *q = malloc(cap * DIM * sizeof(vec_t)), aux[DIM];
+    key128_t k;
+    memcpy(q, seed, DIM * sizeof(vec_t));
+    canonical_key(seed, &k);
+    set128mq_insert(orbit, &k);
+    for (size_t h = 0; h < len; ++h) {
+        for (ind_t i = 0; i < DIM; ++i) {
+            for (ind_t j = 0; j < DIM; ++j) {
+                if (i == j) {
+                    conditional_add_col(&q[h * DIM], aux, DIM, i);
+                } else if (!conditional_add_row(&q[h * DIM], aux, DIM, i, j)) {
+                    continue;
+                }
+                canonical_key(aux, &k);
+                if (set128mq_insert(orbit, &k)) {
+                    if (len == cap) {
+                        cap *= 2;
+                        q = realloc(q, cap * DIM * sizeof(vec_t));
+                    }
+                    memcpy(&q[len++ * DIM], aux, DIM * sizeof(vec_t));
+                }
+            }
+        }
+    }
+    free(q);
+}
+
+static bool visit_all(const key128_t *k, void *user_data)
+{
+    (void)k;
+    atomic_fetch_add((_Atomic size_t*)user_data, 1);
+    return true;
+}
+
+static bool not_below(const key128_t *k, void *seed_key)
+{
+    return !key128_lt(k, (const key128_t*)seed_key);
+}
+
+typedef struct {
+    const Set128MQ *orbit;
+    size_t          missing;
+} Compare;
+
+static void count_missing(const key128_t *k, void *user_data)
+{
+    Compare *c = user_data;
+    c->missing += !set128mq_lookup(c->orbit, k);
+}
+
+int main(void)
+{
+    printf("=== [orbitwalk] testing the parallel orbit walk with %d threads ===\n", THREADS);
+
+    size_t keys = 0, canons = 0, stopped = 0;
+    uint64_t t_seq = 0, t_par = 0;
+
+    #pragma omp parallel num_threads(THREADS)
+    {
+        init_nauty_data(DIM);
+        // one thread walks, the others run its tasks at the barrier
+        #pragma omp single
+        for (int s = 0; s < SEEDS; ++s) {
+            vec_t seed[DIM];
+            key128_t seed_key;
+            random_seed(seed);
+            canonical_key(seed, &seed_key);
+
+            Set128MQ orbit;
+            set128mq_init(&orbit, 1024);
+            uint64_t t0 = ns_now_monotonic();
+            sequential_orbit(seed, &orbit);
+            uint64_t t1 = ns_now_monotonic();
+
+            // the whole orbit, every new key visited once
+            GHashBucket *visited = orbitwalk_visited_new(orbit.size);
+            g_bucket_insert_copy128(visited, &seed_key);
+            _Atomic size_t visits = 0;
+            key128_t stop_key;
+            bool done = orbitwalk_parallel(seed, 1, DIM, visited, visit_all, (void*)&visits, &stop_key, &canons);
+            uint64_t t2 = ns_now_monotonic();
+            Compare cmp = { &orbit, 0 };
+            g_bucket_foreach128(visited, count_missing, &cmp);
+            check(done, "seed %d: walk stopped", s);
+            check(g_bucket_size(visited) == orbit.size && cmp.missing == 0, "seed %d: orbit differs", s);
+            check(visits + 1 == orbit.size, "seed %d: keys visited more than once", s);
+            g_bucket_destroy(visited);
+
+            // the minimality test: stops at a key below the seed's, if any
+            bool is_min = true;
+            for (size_t i = 0; i < orbit.cap; ++i) {
+                if ((orbit.ctrl[i] & 0x80) && key128_lt(&orbit.keys[i], &seed_key)) is_min = false;
+            }
+            visited = orbitwalk_visited_new(0);
+            g_bucket_insert_copy128(visited, &seed_key);
+            done = orbitwalk_parallel(seed, 1, DIM, visited, not_below, &seed_key, &stop_key, NULL);
+            check(done == is_min, "seed %d: wrong minimality", s);
+            check(is_min || (key128_lt(&stop_key, &seed_key) && set128mq_lookup(&orbit, &stop_key)),
+                  "seed %d: wrong stop key", s);
+            g_bucket_destroy(visited);
+
+            keys += orbit.size;
+            stopped += !is_min;
+            t_seq += t1 - t0;
+            t_par += t2 - t1;
+            set128mq_free(&orbit);
+        }
+        free_nauty_data();
+    }
+    printf("    %d seeds of dimension %d: %zu keys in their orbits, %zu canonical forms, %zu walks stopped early\n",
+           SEEDS, DIM, keys, canons, stopped);
+    printf("    whole orbits: one thread %.3fs, %d threads %.3fs\n", t_seq / 1e9, THREADS, t_par / 1e9);
+    printf("=== [orbitwalk] all tests passed ===\n");
+    return 0;
+}
@@ -0,0 +1,78 @@
+#include <omp.h>
+
+#include "tlsbuf.h"
+
+#define THREADS 4
+#define LINES   200000
+
+int main(void)
+{
+    printf("=== [outring] testing the output ring with %d threads ===\n", THREADS);
+
+    FILE *f = tmpfile();
+    if (f == NULL) {
+        perror("tmpfile");
+        return 1;
+    }
+
+    /* small blocks and a small pool, so producers have to wait for the writer */
+    OutRing *ring = outring_open(f, 4096, 8);
+    off_t mid = -1;
+    uint64_t t0 = ns_now_monotonic();
+    #pragma omp parallel num_threads(THREADS)
+    {
+        OutputBuffer out;
+        buffer_init(&out, ring);
+        char line[MAXLINE];
+        int t = omp_get_thread_num();
+        for (int i = 0; i < LINES; ++i) {
+            snprintf(line, sizeof(line), "%d %d", t, i);
+            buffer_add(&out, line);
+            if (i == LINES / 2) {
+                buffer_flush(&out);
+                #pragma omp barrier
+                #pragma omp single
+                mid = outring_tell(ring);
+            }
+        }
+        buffer_destroy(&out);
+    }
+    off_t end = outring_tell(ring);
+    outring_close(ring);
+    uint64_t t1 = ns_now_monotonic();
+
+    /* every thread wrote (LINES/2 + 1) lines before the barrier */
+    off_t expect_mid = 0;
+    for (int t = 0; t < THREADS; ++t) {
+        char line[MAXLINE];
+        for (int i = 0; i <= LINES / 2; ++i) expect_mid += snprintf(line, sizeof(line), "%d %d\n", t, i);
+    }
+    if (mid != expect_mid) {
+        fprintf(stderr, "    offset at the barrier is %ld, expected %ld\n", (long)mid, (long)expect_mid);
+        return 1;
+    }
+
+    /* all lines are there, each thread's in order */
+    rewind(f);
+    int next[THREADS] = { 0 };
+    long n = 0;
+    int t, i;
+    while (fscanf(f, "%d %d", &t, &i) == 2) {
+        if (t < 0 || t >= THREADS || i != next[t]) {
+            fprintf(stderr, "    line %ld: got '%d %d', expected line %d of thread %d\n", n, t, i, t >= 0 && t < THREADS ? next[t] : -1, t);
+            return 1;
+        }
+        next[t]++;
+        n++;
+    }
+    if (n != (long)THREADS * LINES || ftello(f) != end) {
+        fprintf(stderr, "    read %ld lines (%ld bytes), expected %ld (%ld bytes)\n",
+                n, (long)ftello(f), (long)THREADS * LINES, (long)end);
+        return 1;
+    }
+    fclose(f);
+    printf("    %ld lines, %.1f MiB in %.3fs\n", n, end / 1048576.0, (t1 - t0) / 1e9);
+
+    printf("=== [outring] all tests passed ===\n");
+    return 0;
+}
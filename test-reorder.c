@@ -0,0 +1,174 @@
+#include <omp.h>
+
+#include "reorder.h"
+
+#define THREADS 4
+#define CHUNKS  4000
+#define LINES   50      /* per chunk on average */
+
+/* Lines of chunk 'c': a varying number, so slots grow and chunks finish
+ * out of order.
+ */
+static size_t chunk_lines(size_t c)
+{
+    return (c * 2654435761u >> 7) % (2 * LINES);
+}
+
+static void fill_chunk(OutputBuffer *out, size_t c)
+{
+    char line[MAXLINE];
+    for (size_t i = 0; i < chunk_lines(c); ++i) {
+        snprintf(line, sizeof(line), "%zu %zu", c, i);
+        buffer_add(out, line);
+    }
+    if (c % 97 == 0) {
+        // a slow chunk, which the others overtake
+        struct timespec ts = { .tv_sec = 0, .tv_nsec = 200000 };
+        nanosleep(&ts, NULL);
+    }
+}
+
+static char *read_all(FILE *f, size_t *bytes)
+{
+    fflush(f);
+    fseeko(f, 0, SEEK_END);
+    *bytes = (size_t)ftello(f);
+    rewind(f);
+    char *p = malloc(*bytes + 1);
+    if (fread(p, 1, *bytes, f) != *bytes) {
+        perror("fread");
+        exit(1);
+    }
+    return p;
+}
+
+/* Writes all chunks in order through a window of 'window' slots and checks
+ * the bytes against a sequential run.
+ */
+static double ordered_copy(size_t window)
+{
+    FILE *f = tmpfile(), *g = tmpfile();
+    OutRing *ring = outring_open(f, 4096, 8);
+    Reorder *r = reorder_open(ring, window, NULL, NULL);
+    uint64_t t0 = ns_now_monotonic();
+    #pragma omp parallel num_threads(THREADS)
+    {
+        #pragma omp for schedule(monotonic: dynamic, 1)
+        for (size_t c = 0; c < CHUNKS; ++c) {
+            OutputBuffer out;
+            reorder_begin(r, c, &out);
+            fill_chunk(&out, c);
+            reorder_end(r, c, &out);
+        }
+    }
+    reorder_close(r);
+    outring_close(ring);
+    uint64_t t1 = ns_now_monotonic();
+
+    ring = outring_open(g, 4096, 8);
+    OutputBuffer out;
+    buffer_init(&out, ring);
+    for (size_t c = 0; c < CHUNKS; ++c) {
+        fill_chunk(&out, c);
+    }
+    buffer_destroy(&out);
+    outring_close(ring);
+
+    size_t got_bytes, want_bytes;
+    char *got = read_all(f, &got_bytes), *want = read_all(g, &want_bytes);
+    if (got_bytes != want_bytes || memcmp(got, want, got_bytes) != 0) {
+        fprintf(stderr, "    window %zu: output differs from the sequential one\n", window);
+        exit(1);
+    }
+    printf("    window %zu: %zu bytes in order\n", window, got_bytes);
+    free(got);
+    free(want);
+    fclose(f);
+    fclose(g);
+    return (t1 - t0) / 1e9;
+}
+
+/* The same chunks without order, each thread to its own buffer. */
+static double unordered(void)
+{
+    FILE *f = tmpfile();
+    OutRing *ring = outring_open(f, 4096, 8);
+    uint64_t t0 = ns_now_monotonic();
+    #pragma omp parallel num_threads(THREADS)
+    {
+        OutputBuffer out;
+        buffer_init(&out, ring);
+        #pragma omp for schedule(dynamic, 1)
+        for (size_t c = 0; c < CHUNKS; ++c) {
+            fill_chunk(&out, c);
+        }
+        buffer_destroy(&out);
+    }
+    outring_close(ring);
+    uint64_t t1 = ns_now_monotonic();
+    fclose(f);
+    return (t1 - t0) / 1e9;
+}
+
+/* Key pairs with repeated dedup keys: the first in chunk order must win. */
+static void dedup_order(void)
+{
+    const size_t distinct = 1000, per_chunk = 64, chunks = 500;
+    FILE *f = tmpfile();
+    OutRing *ring = outring_open(f, 4096, 8);
+    ReorderDedup d = { .set = dedup_new(16, 0), .binary = true, .added = 0 };
+    Reorder *r = reorder_open(ring, 3, reorder_commit_dedup, &d);
+    #pragma omp parallel for num_threads(THREADS) schedule(monotonic: dynamic, 1)
+    for (size_t c = 0; c < chunks; ++c) {
+        OutputBuffer out;
+        reorder_begin(r, c, &out);
+        for (size_t i = c * per_chunk; i < (c + 1) * per_chunk; ++i) {
+            key128_t dkey = { 0 }, key = { 0 };
+            size_t v = (i * 7919) % distinct;
+            memcpy(dkey.b, &v, sizeof(v));
+            memcpy(key.b, &i, sizeof(i));
+            reorder_add_pair(&out, &dkey, &key);
+        }
+        reorder_end(r, c, &out);
+    }
+    reorder_close(r);
+    outring_close(ring);
+    dedup_destroy(d.set);
+
+    size_t bytes;
+    char *p = read_all(f, &bytes);
+    if (d.added != distinct || bytes != distinct * sizeof(key128_t)) {
+        fprintf(stderr, "    dedup: %zu keys written, expected %zu\n", d.added, distinct);
+        exit(1);
+    }
+    // 7919 is prime to 1000, so the first occurrences are the keys 0..999
+    for (size_t i = 0; i < distinct; ++i) {
+        key128_t key;
+        size_t v = 0;
+        memcpy(&key, p + i * sizeof(key), sizeof(key));
+        memcpy(&v, key.b, sizeof(v));
+        if (v != i) {
+            fprintf(stderr, "    dedup: key %zu is %zu, not the first occurrence\n", i, v);
+            exit(1);
+        }
+    }
+    printf("    dedup: %zu first occurrences in order\n", distinct);
+    free(p);
+    fclose(f);
+}
+
+int main(void)
+{
+    printf("=== [reorder] testing ordered output with %d threads ===\n", THREADS);
+
+    ordered_copy(1);
+    ordered_copy(5);
+    double t_ordered = ordered_copy(0);
+    double t_unordered = unordered();
+    printf("    %d chunks: ordered %.3fs, unordered %.3fs\n", CHUNKS, t_ordered, t_unordered);
+
+    dedup_order();
+
+    printf("=== [reorder] all tests passed ===\n");
+    return 0;
+}
@@ -0,0 +1,87 @@
+#include <sys/wait.h>
+
+#include "shmset.h"
+#include "testutil.h"
+
+#define NPROC 4
+
+int main(void)
+{
+    const uint64_t N = 200000;
+    char name[64];
+    int fds[2];
+    key128_t k;
+
+    snprintf(name, sizeof(name), "/test-shmset-%d", (int)getpid());
+    printf("=== [shmset] testing %d processes sharing %lu keys ===\n", NPROC, N);
+
+    ShmSet *s = shm_set_open(name, N);
+    if (s == NULL) {
+        exit(1);
+    }
+    if (pipe(fds) != 0) {
+        perror("pipe");
+        exit(1);
+    }
+
+    /* every process inserts all keys, in a different order: each key must
+     * be new for exactly one of them
+     */
+    for (int p = 0; p < NPROC; ++p) {
+        if (fork() == 0) {
+            ShmSet *c = shm_set_open(name, 0);
+            uint64_t new_keys = 0;
+            for (uint64_t j = 0; j < N; ++j) {
+                key_from_index((j * (2 * p + 1) + (uint64_t)p * 7919) % N, &k);
+                new_keys += shm_set_insert(c, &k);
+            }
+            shm_set_close(c);
+            if (write(fds[1], &new_keys, sizeof(new_keys)) != sizeof(new_keys)) _exit(1);
+            _exit(0);
+        }
+    }
+    close(fds[1]);
+
+    uint64_t total = 0, n;
+    int failed = 0, status;
+    while (read(fds[0], &n, sizeof(n)) == sizeof(n)) total += n;
+    while (wait(&status) > 0) failed |= !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+    close(fds[0]);
+
+    if (failed || total != N || shm_set_size(s) != N) {
+        fprintf(stderr, "    %lu new keys, size %zu, expected %lu\n", total, shm_set_size(s), N);
+        shm_set_unlink(name);
+        exit(1);
+    }
+    printf("    %lu keys inserted exactly once\n", total);
+
+    for (uint64_t i = 0; i < N; i += 2) {
+        key_from_index(i, &k);
+        if (!shm_set_remove(s, &k)) {
+            fprintf(stderr, "    remove of key %lu failed\n", i);
+            exit(1);
+        }
+    }
+    /* a later process sees the same contents and capacity */
+    ShmSet *t = shm_set_open(name, 1);
+    if (shm_set_size(t) != N / 2 || shm_set_capacity(t) != shm_set_capacity(s)) {
+        fprintf(stderr, "    reattached set differs: %zu keys\n", shm_set_size(t));
+        exit(1);
+    }
+    for (uint64_t i = 0; i < N + 1000; ++i) {
+        key_from_index(i, &k);
+        if (shm_set_lookup(t, &k) != (i < N && i % 2 == 1)) {
+            fprintf(stderr, "    wrong lookup result for key %lu\n", i);
+            exit(1);
+        }
+    }
+    shm_set_close(t);
+    shm_set_close(s);
+    printf("    remove and reattach OK\n");
+
+    if (!shm_set_unlink(name)) {
+        exit(1);
+    }
+    printf("=== [shmset] all tests passed ===\n");
+    return 0;
+}
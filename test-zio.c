@@ -0,0 +1,118 @@
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "inbuf.h"
+#include "zio.h"
+
+/* enough lines for several input blocks and, with xz, several encoder blocks */
+#define LINES 400000
+
+#if HAVE_LZMA || HAVE_ZSTD
+static void line_of(size_t i, char *s, size_t *len)
+{
+    *len = (size_t)snprintf(s, 32, "%zu:%zx", i, i * 2654435761u);
+}
+
+static void read_back(FILE *f, const char *what, ZioCodec codec)
+{
+    InputBuffer in;
+    inbuf_open(&in, f);
+    if (in.codec != codec) {
+        fprintf(stderr, "    %s: detected %s\n", what, zio_codec_name(in.codec));
+        exit(1);
+    }
+    const char *line;
+    char want[32];
+    size_t len, want_len, i = 0;
+    while (inbuf_line(&in, &line, &len)) {
+        line_of(i, want, &want_len);
+        if (len != want_len || memcmp(line, want, len) != 0) {
+            fprintf(stderr, "    %s: line %zu differs\n", what, i);
+            exit(1);
+        }
+        ++i;
+    }
+    if (i != LINES) {
+        fprintf(stderr, "    %s: read %zu lines, expected %d\n", what, i, LINES);
+        exit(1);
+    }
+    inbuf_close(&in);
+}
+
+static void round_trip(ZioCodec codec, const char *suffix)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/test-zio-%d.%s", (int)getpid(), suffix);
+    FILE *f = zio_fopen_write(path);
+    if (f == NULL) {
+        perror(path);
+        exit(1);
+    }
+    char s[32];
+    size_t len;
+    for (size_t i = 0; i < LINES; ++i) {
+        line_of(i, s, &len);
+        s[len] = '\n';
+        fwrite(s, 1, len + 1, f);
+    }
+    if (fclose(f) != 0) {
+        fprintf(stderr, "    %s: closing failed\n", suffix);
+        exit(1);
+    }
+
+    f = fopen(path, "r");
+    read_back(f, suffix, codec);
+    fseeko(f, 0, SEEK_END);
+    long bytes = (long)ftello(f);
+    fclose(f);
+
+    // the same through a pipe
+    int fd[2];
+    if (pipe(fd) != 0) {
+        perror("pipe");
+        exit(1);
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fd[0]);
+        FILE *src = fopen(path, "r"), *dst = fdopen(fd[1], "w");
+        char buf[4096];
+        size_t got;
+        while ((got = fread(buf, 1, sizeof(buf), src)) > 0) fwrite(buf, 1, got, dst);
+        fclose(dst);
+        _exit(0);
+    }
+    close(fd[1]);
+    FILE *r = fdopen(fd[0], "r");
+    read_back(r, suffix, codec);
+    fclose(r);
+    waitpid(pid, NULL, 0);
+    unlink(path);
+    printf("    %s: %d lines in %ld bytes, from a file and a pipe\n", zio_codec_name(codec), LINES, bytes);
+}
+#endif
+
+int main(void)
+{
+    printf("=== [zio] testing compressed streams ===\n");
+
+    if (zio_detect("\xFD" "7zXZ", 6) != ZIO_XZ || zio_detect("(\xB5/\xFD", 4) != ZIO_ZSTD
+        || zio_detect("Gzw", 3) != ZIO_NONE || zio_codec_of_path("a.d6.zst") != ZIO_ZSTD
+        || zio_codec_of_path(".xz") != ZIO_NONE) {
+        fprintf(stderr, "    detection failed\n");
+        return 1;
+    }
+#if HAVE_LZMA
+    round_trip(ZIO_XZ, "xz");
+#else
+    printf("    xz: not built\n");
+#endif
+#if HAVE_ZSTD
+    round_trip(ZIO_ZSTD, "zst");
+#else
+    printf("    zstd: not built\n");
+#endif
+
+    printf("=== [zio] all tests passed ===\n");
+    return 0;
+}
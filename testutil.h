@@ -0,0 +1,30 @@
+#pragma once
+
+/* Helpers shared by the test-*.c programs. */
+
+#include "common.h"
+
+/* Stops the test with a printf-style message unless 'ok'. */
+static inline __attribute__((format(printf, 2, 3))) void check(bool ok, const char *fmt, ...)
+{
+    if (!ok) {
+        va_list ap;
+        va_start(ap, fmt);
+        fprintf(stderr, "    ");
+        vfprintf(stderr, fmt, ap);
+        fprintf(stderr, "\n");
+        va_end(ap);
+        exit(1);
+    }
+}
+
+/* Key i of distinct keys with scattered bits in both halves, so neither
+ * their hashes nor their order follow i. The top byte stays zero, free for
+ * the dimension nibble of packed keys.
+ */
+static INLINE void key_from_index(uint64_t i, key128_t *k)
+{
+    uint64_t lo = i * 0x9E3779B97F4A7C15ULL, hi = (i * 0xC2B2AE3D27D4EB4FULL) >> 8;
+    memcpy(k->b + 0, &lo, 8);
+    memcpy(k->b + 8, &hi, 8);
+}
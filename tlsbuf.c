@@ -2,46 +2,46 @@
 
 #include "tlsbuf.h"
 
-void buffer_init(OutputBuffer *buffer, size_t initial_capacity, FILE *out) {
-    buffer->lines = malloc(initial_capacity * sizeof(char*));
-    buffer->count = 0;
-    buffer->capacity = initial_capacity;
-    buffer->out = out;
+void buffer_init(OutputBuffer *buffer, OutRing *ring) {
+    buffer->ring = ring;
+    buffer->block = NULL;
+    buffer->pos = buffer->end = NULL;
 }
 void buffer_destroy(OutputBuffer *buffer) {
-    // if flush() has been called, count == 0 and this is a no-op
-    // for (size_t i = 0; i < buffer->count; ++i) free(buffer->lines[i]);
-    free(buffer->lines);
-    buffer->lines = NULL; buffer->count = 0; buffer->capacity = 0;
+    buffer_flush(buffer);
+    buffer->ring = NULL;
 }
-void buffer_add(OutputBuffer *buffer, char* line) {
-    if (buffer->count >= buffer->capacity) {
-        #pragma omp critical (StdoutLock)
-        {
-            for (size_t i = 0; i < buffer->count; ++i) {
-                fputs(buffer->lines[i], buffer->out);
-                if (buffer->lines[i][strlen(buffer->lines[i])-1] != '\n')
-                    fputc('\n', buffer->out);
-                //free(buffer->lines[i]);
-            }
-        }
-        buffer->count = 0;
+void buffer_flush(OutputBuffer *buffer) {
+    if (buffer->block && buffer->ring) {
+        buffer->block->used = (size_t)(buffer->pos - buffer->block->data);
+        outring_push(buffer->ring, buffer->block);
+        buffer->block = NULL;
+        buffer->pos = buffer->end = NULL;
     }
-    buffer->lines[buffer->count++] = line; //strdup(line);
 }
-void buffer_flush(OutputBuffer *buffer) {
-    if (buffer->count > 0) {
-        #pragma omp critical (StdoutLock)
-        {
-            for (size_t i = 0; i < buffer->count; ++i) {
-                fputs(buffer->lines[i], buffer->out);
-                if (buffer->lines[i][strlen(buffer->lines[i])-1] != '\n')
-                    fputc('\n', buffer->out);
-                //free(buffer->lines[i]);
-            }
+void buffer_reserve(OutputBuffer *buffer, size_t len) {
+    if (buffer->ring == NULL) {
+        // the slot of a reorder buffer (reorder.h): grows instead
+        OutBlock *b = buffer->block;
+        size_t used = (size_t)(buffer->pos - b->data), cap = (size_t)(buffer->end - b->data);
+        while (cap - used < len) cap *= 2;
+        b->data = (char*)realloc(b->data, cap);
+        if (b->data == NULL) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
         }
+        buffer->pos = b->data + used;
+        buffer->end = b->data + cap;
+        return;
+    }
+    if (len > outring_block_bytes(buffer->ring)) {
+        fprintf(stderr, "output record of %zu bytes exceeds the block size\n", len);
+        exit(EXIT_FAILURE);
     }
-    buffer->count = 0;
+    buffer_flush(buffer);
+    buffer->block = outring_acquire(buffer->ring);
+    buffer->pos = buffer->block->data;
+    buffer->end = buffer->pos + outring_block_bytes(buffer->ring);
 }
 
 /* --- Progress monitor: prints to the specified stream (stderr with -o) --- */
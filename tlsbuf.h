@@ -1,23 +1,73 @@
 #pragma once
 
+#include <stdbool.h>
+
 #include "common.h"
+#include "d6batch.h"
+#include "outring.h"
 
 /**
- * Thread-local output buffer to reduce contention on stdout.
+ * Thread-local output buffer: fills a block of the output ring and hands it
+ * to the writer thread when full, so threads never wait on the output file.
  */
 typedef struct _OutputBuffer {
-    char **lines;
-    size_t count;
-    size_t capacity;
-    FILE *out;
+    OutRing  *ring;
+    OutBlock *block;
+    char     *pos, *end;
 } OutputBuffer;
 
-void buffer_init(OutputBuffer *buffer, size_t initial_capacity, FILE *out);
+void buffer_init(OutputBuffer *buffer, OutRing *ring);
 
+/* Flushes and detaches from the ring. */
 void buffer_destroy(OutputBuffer *buffer);
 
-void buffer_add(OutputBuffer *buffer, char* line);
-
+/* Pushes the current block, if any, to the writer. */
 void buffer_flush(OutputBuffer *buffer);
 
+/* Pushes the current block and takes a new one with room for 'len' bytes;
+ * a buffer on a reorder slot (no ring) grows the slot instead.
+ */
+void buffer_reserve(OutputBuffer *buffer, size_t len);
+
+/* Copies 'len' bytes, which must fit in one block. */
+static INLINE void buffer_write(OutputBuffer *buffer, const char *s, size_t len)
+{
+    if (UNLIKELY((size_t)(buffer->end - buffer->pos) < len)) {
+        buffer_reserve(buffer, len);
+    }
+    memcpy(buffer->pos, s, len);
+    buffer->pos += len;
+}
+
+/* Copies a line shorter than MAXLINE up to its newline or NUL, and ends it
+ * with a newline; a single pass over the line.
+ */
+static INLINE void buffer_add(OutputBuffer *buffer, const char *line)
+{
+    if (UNLIKELY((size_t)(buffer->end - buffer->pos) < MAXLINE + 1)) {
+        buffer_reserve(buffer, MAXLINE + 1);
+    }
+    char *p = buffer->pos;
+    while (*line && *line != '\n') {
+        *p++ = *line++;
+    }
+    *p++ = '\n';
+    buffer->pos = p;
+}
+
+/* Writes a key as 16 bytes of a key stream, or encodes it as a digraph6 line
+ * straight into the block (with SIMD, see d6batch.h).
+ */
+static INLINE void buffer_add_key(OutputBuffer *buffer, const key128_t *k, bool binary)
+{
+    if (binary) {
+        buffer_write(buffer, (const char*)k, sizeof(key128_t));
+        return;
+    }
+    if (UNLIKELY((size_t)(buffer->end - buffer->pos) < MAXLINE + 1)) {
+        buffer_reserve(buffer, MAXLINE + 1);
+    }
+    buffer->pos += d6batch_encode_line(k, buffer->pos);
+}
+
 void monitor_progress(unsigned long *progress_ptr, unsigned long total, FILE *stream);
@@ -1,28 +1,143 @@
+#include <getopt.h>
 #include <omp.h>
 
+#include "cpudispatch.h"
 #include "dag.h"
-#include "bucket.h"
+#include "dedup.h"
+#include "hugemem.h"
+#include "keysort.h"
+#include "batchpipe.h"
+#include "keystream.h"
 #include "adjpack11.h"
 #include "parse_scaled.h"
+#include "reorder.h"
+#include "shmset.h"
 #include "tlsbuf.h"
+#include "zio.h"
 
 void help(const char *progname) {
     if (progname == NULL) progname = "uniqueg";
     printf("Usage: %s [options]\n", progname);
-    printf("Read d6-packed graphs from stdin and write unique codes to stdout.\n\n");
+    printf("Read d6-packed graphs (or a key stream) from stdin and write unique codes to stdout.\n\n");
     printf("Options:\n");
     printf("  -c           Canonicalize graphs before checking uniqueness.\n");
+    printf("  -S, --sort   Sort instead of hashing: write the distinct codes (canonical forms\n");
+    printf("               with -c) in increasing key order, deterministic and diffable.\n");
+    printf("  -D, --ordered\n");
+    printf("               Write the codes in input order, each at its first occurrence,\n");
+    printf("               so that every run and -j give the same output.\n");
+    printf("  -B           Write a binary key stream instead of digraph6 lines; the input\n");
+    printf("               format is detected.\n");
     printf("  -v           Increase verbosity (can be repeated).\n");
     printf("  -j NUM       Number of OpenMP threads (default: %d).\n", omp_get_max_threads());
     printf("  -n NUM       Number of hash shards (default: 256).\n");
     printf("  -l SIZE      Batch size (number of lines) to process at once (default: 100000).\n");
     printf("               SIZE accepts suffixes like k, M, G or binary Ki, Mi (examples: 500k, 2M, 1G, 2Mi).\n");
-    printf("  -i FILE      Read input from FILE instead of stdin.\n");
-    printf("  -o FILE      Write output to FILE instead of stdout.\n");
+    printf("  -m SIZE      Memory budget for the set of seen graphs; beyond it sorted runs\n");
+    printf("               are spilled to $TMPDIR (default: 0, unlimited, same suffixes as -l).\n");
+    printf("  -x NAME[:KEYS]  Share the set of seen graphs with other processes through the\n");
+    printf("               shared-memory set NAME, created with room for KEYS (default: 16Mi)\n");
+    printf("               if it does not exist; it persists until /dev/shm/NAME is removed.\n");
+    printf("  -J FILE      Write hash table statistics (JSON) to FILE when done.\n");
+    printf("  -A LIST      Table memory: huge, hugetlb, interleave, spread (shards over NUMA\n");
+    printf("               nodes), pin (threads over nodes); comma separated.\n");
+    printf("  -i FILE      Read input from FILE instead of stdin (xz or zstd is detected).\n");
+    printf("  -o FILE      Write output to FILE instead of stdout (compressed if FILE ends\n");
+    printf("               in .xz or .zst).\n");
     printf("  -h           Show this help message and exit.\n\n");
     printf("Examples:\n");
     printf("  cat graphs.d6 | %s -c -n 512 > uniques.d6\n", progname);
     printf("  %s -j 8 -l 500k -i input.d6 -o uniques.d6\n", progname);
+    printf("  %s --sort -c -l 10M -i input.d6 -o canonical.d6\n", progname);
+    printf("  parallel --pipe -N 1M %s -c -x seen < graphs.d6 > uniques.d6\n", progname);
+}
+
+/* Lines per chunk of the parallel loop, and per chunk of the output order (-D). */
+#define UNIQ_CHUNK 100
+
+/* Dedup key of an input key; with 'canon' that of its canonical form. */
+static INLINE void graph_key(const key128_t *k, bool canon, key128_t *key)
+{
+    if (canon) {
+        key128_to_key128_canon(k, key);
+    } else {
+        *key = *k;
+    }
+}
+
+/* Sort mode: every batch of keys is canonicalized in parallel, radix sorted and
+ * made unique into a sorted run of keys; the runs are merged into one every
+ * SORT_MAX_RUNS batches, and at the end merged once more while the codes are
+ * written. Memory is 16 bytes per distinct key of each run plus the batch.
+ */
+#define SORT_MAX_RUNS 16
+
+typedef struct {
+    OutputBuffer out;
+    bool         binary;
+    size_t       count;
+} SortEmitter;
+
+static void emit_key(const key128_t *key, void *user_data)
+{
+    SortEmitter *e = (SortEmitter*)user_data;
+    buffer_add_key(&e->out, key, e->binary);
+    e->count++;
+}
+
+static size_t sort_unique(BatchPipe *in, OutRing *out, bool binary, int dim, bool canon, size_t lines_capacity)
+{
+    key128_t *tmp  = (key128_t*)malloc(lines_capacity * sizeof(key128_t));
+    key128_t *runs[SORT_MAX_RUNS];
+    size_t lens[SORT_MAX_RUNS], nruns = 0, batch_num = 0;
+    assert(tmp != NULL);
+
+    KeyBatch *batch;
+    while ((batch = batchpipe_next(in)) != NULL) {
+        key128_t *keys = batch->keys;
+        size_t line_count = batch->count;
+
+        printlog(2, "Sorting batch %zu of %zu lines", ++batch_num, line_count);
+
+        if (canon) {
+            #pragma omp parallel
+            {
+                init_nauty_data(dim);
+
+                #pragma omp for schedule(dynamic, 100)
+                for (size_t i = 0; i < line_count; ++i) {
+                    key128_to_key128_canon(&keys[i], &keys[i]);
+                }
+
+                free_nauty_data();
+            }
+        }
+        keys_radix_sort(keys, line_count, tmp);
+        lens[nruns] = keys_unique(keys, line_count);
+        runs[nruns] = (key128_t*)malloc((lens[nruns] + 1) * sizeof(key128_t));
+        assert(runs[nruns] != NULL);
+        memcpy(runs[nruns], keys, lens[nruns] * sizeof(key128_t));
+        nruns++;
+        batchpipe_release(in, batch);
+
+        if (nruns == SORT_MAX_RUNS) {
+            size_t n;
+            key128_t *merged = keys_merge_array(runs, lens, nruns, &n);
+            for (size_t r = 0; r < nruns; ++r) free(runs[r]);
+            runs[0] = merged;
+            lens[0] = n;
+            nruns = 1;
+            printlog(2, "Merged runs: %zu distinct keys so far", n);
+        }
+    }
+    free(tmp);
+
+    SortEmitter e = { .binary = binary, .count = 0 };
+    buffer_init(&e.out, out);
+    keys_merge(runs, lens, nruns, emit_key, &e);
+    buffer_destroy(&e.out);
+    for (size_t r = 0; r < nruns; ++r) free(runs[r]);
+    return e.count;
 }
 
 int main(int argc, char *argv[]) {
@@ -34,11 +149,24 @@ int main(int argc, char *argv[]) {
     int num_shards = 256;
     int num_threads = omp_get_max_threads(); // default max threads
     bool canon = false;
+    bool sort_mode = false;
+    bool ordered = false;
+    size_t mem_budget = 0;
+    const char *stats_path = NULL;
+    char shm_name[256] = "";
+    size_t shm_keys = 0;
 
     FILE *in = stdin, *out = stdout;
+    bool binary = false;
+
+    static const struct option long_options[] = {
+        { "sort", no_argument, NULL, 'S' },
+        { "ordered", no_argument, NULL, 'D' },
+        { NULL, 0, NULL, 0 }
+    };
 
     int opt = 1;
-    while ((opt = getopt(argc, argv, "l:n:j:vi:o:c")) != -1) {
+    while ((opt = getopt_long(argc, argv, "l:n:j:vi:o:cSDBm:x:J:A:", long_options, NULL)) != -1) {
         switch (opt) {
         case 'v':
             increase_verbosity();
@@ -65,7 +193,7 @@ int main(int argc, char *argv[]) {
             }
             break;
         case 'o':
-            out = fopen(optarg, "w");
+            out = zio_fopen_write(optarg);
             if (out == NULL) {
                 perror("Error opening output file");
                 exit(EXIT_FAILURE);
@@ -74,6 +202,36 @@ int main(int argc, char *argv[]) {
         case 'c':
             canon = true;
             break;
+        case 'S':
+            sort_mode = true;
+            break;
+        case 'D':
+            ordered = true;
+            break;
+        case 'B':
+            binary = true;
+            break;
+        case 'm':
+            if (!parse_scaled_size(optarg, &mem_budget)) {
+                fprintf(stderr, "Invalid -m value: %s (examples: 512M, 8G, 4Gi)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'x':
+            if (!shm_set_parse_spec(optarg, shm_name, sizeof(shm_name), &shm_keys)) {
+                fprintf(stderr, "Invalid -x value: %s (examples: dedup, /dedup:100M)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'J':
+            stats_path = optarg;
+            break;
+        case 'A':
+            if (!mem_policy_parse(optarg)) {
+                fprintf(stderr, "Invalid -A value: %s (use huge, hugetlb, interleave, spread, pin)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
         case 'h':
             help(argv[0]);
             exit(EXIT_SUCCESS);
@@ -83,94 +241,177 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    // variables
-    size_t line_count = 0;
-    char buffer[MAXLINE];
+    if (*shm_name && mem_budget) {
+        fprintf(stderr, "-x and -m cannot be combined\n");
+        exit(EXIT_FAILURE);
+    }
+    if (sort_mode && (*shm_name || mem_budget || stats_path)) {
+        fprintf(stderr, "--sort cannot be combined with -x, -m or -J\n");
+        exit(EXIT_FAILURE);
+    }
 
-    printlog(1, "Using %d threads, %d shards, batch size %zu", num_threads, num_shards, lines_capacity);
+    KeyStream ks;
+    if (!keystream_open(&ks, in)) {
+        exit(EXIT_FAILURE);
+    }
+    keystream_log(&ks, 1);
 
-    char **lines = malloc(lines_capacity * sizeof(char*));
-    assert(lines != NULL);
+    printlog(1, "Using %d threads, %d shards, batch size %zu", num_threads, num_shards, lines_capacity);
 
 #if !NAUTY_HAS_TLS
     fprintf(stderr, "Warning: nauty without TLS support, using single thread!\n");
+    if (!*shm_name) {
+        fprintf(stderr, "         (several processes can share the set of seen graphs with -x)\n");
+    }
     num_threads = 1;
 #endif
     omp_set_num_threads(num_threads);
+    if (mem_policy() & MEM_PIN) {
+        mem_pin_threads();
+    }
+    mem_policy_log(1);
+    cpu_dispatch_log(1);
 
-    if (!fgets(buffer, MAXLINE, in)) {
+    key128_t first;
+    if (!keystream_next(&ks, &first)) {
         fprintf(stderr, "error reading input\n");
         exit(1);
     }
-    lines[line_count++] = strdup(buffer);
 
-    int dim = graphsize(buffer);
+    int dim = (int)d6pack_get_n(&first);
     assert(dim > 0 && dim <= 11);
 
+    if (canon && (ks.flags & KEYSTREAM_CANONICAL)) {
+        printlog(1, "Input keys are canonical already, -c is skipped");
+        canon = false;
+    }
+    if (binary) {
+        // the output keeps the canonical flag; -c and --sort add theirs
+        unsigned flags = KEYSTREAM_UNIQUE | (ks.flags & KEYSTREAM_CANONICAL);
+        if (sort_mode) {
+            flags |= KEYSTREAM_SORTED | (canon ? KEYSTREAM_CANONICAL : 0);
+        }
+        keystream_write_header(out, (unsigned)dim, flags);
+    }
+    OutRing *ring = outring_open(out, 0, 0);
+    BatchPipe *pipe = batchpipe_open(&ks, &first, lines_capacity, 0);
+
+    if (sort_mode) {
+        size_t num_of_codes = sort_unique(pipe, ring, binary, dim, canon, lines_capacity);
+        printlog(1, "Done. Found %zu distinct codes", num_of_codes);
+        batchpipe_close(pipe);
+        outring_close(ring);
+        keystream_close(&ks);
+        if (in != stdin) fclose(in);
+        if (out != stdout) fclose(out);
+        return 0;
+    }
+
     // Global dedup across orbits by CANONICAL key
-    GHashBucket *g_canonical_set =g_bucket_new_128(free, num_shards);
+    DedupSet *g_canonical_set = *shm_name ? dedup_new_shared(shm_name, shm_keys) : dedup_new(num_shards, mem_budget);
+    if (g_canonical_set == NULL) {
+        exit(EXIT_FAILURE);
+    }
 
     size_t batch_num = 0;
     size_t num_of_reps = 0;
 
-    while (true) {
-        // read lines_capacity lines or until EOF
-        while (line_count < lines_capacity && fgets(buffer, MAXLINE, in)) {
-            lines[line_count++] = strdup(buffer);
-        }
-        if (line_count == 0) break;
+    // -D: the output of every chunk goes through the reorder buffer
+    ReorderDedup order_dedup = { .set = g_canonical_set, .binary = binary, .added = 0 };
+    Reorder *order = ordered ? reorder_open(ring, 0, reorder_commit_dedup, &order_dedup) : NULL;
+    uint64_t chunk_base = 0;
 
-        printlog(2, "Processing batch %zu; reps found: %zu.", ++batch_num, num_of_reps);
+    KeyBatch *batch = NULL;
 
-        #pragma omp parallel
-        {
-            OutputBuffer thread_buffer;
-            buffer_init(&thread_buffer, 1000, out);
+    // one parallel region for the whole input; the reader thread fills the
+    // next batch meanwhile
+    #pragma omp parallel
+    {
+        OutputBuffer thread_buffer;
+        buffer_init(&thread_buffer, ring);
 
-            init_nauty_data(dim);
+        init_nauty_data(dim);
 
-            size_t local_reps = 0;
+        key128_t key;
 
-            char *line;
-            key128_t key;
-            unsigned n = 0;
-
-            #pragma omp for schedule(dynamic, 100)
-            for (size_t i = 0; i < line_count; ++i) {
-                line = lines[i];
-
-                d6pack_decode(line, &key, &n);
-                if (canon){
-                    vec_t m[11], c[11]; // max n = 11
-                    adjpack_to_matrix(&key, m, n);
-                    // Canonical key
-                    matrix_to_matrix_canon(m, n, c);
-                    adjpack_from_matrix(c, n, &key);
+        for (;;) {
+            #pragma omp single
+            {
+                if (batch) {
+                    batchpipe_release(pipe, batch);
+                    g_bucket_stats_log(dedup_bucket(g_canonical_set), 2, "seen set");
+                }
+                batch = batchpipe_next(pipe);
+                if (batch) {
+                    printlog(2, "Processing batch %zu; reps found: %zu.", ++batch_num, num_of_reps);
                 }
-                if ( g_bucket_insert_copy128(g_canonical_set, &key) ) {
+            }
+            if (batch == NULL) {
+                break;
+            }
+
+            if (order) {
+                // chunks of UNIQ_CHUNK lines in input order; the commit inserts
+                // their keys, so the first occurrence of a graph is written
+                const size_t nchunks = (batch->count + UNIQ_CHUNK - 1) / UNIQ_CHUNK;
+
+                #pragma omp for schedule(monotonic: dynamic, 1)
+                for (size_t c = 0; c < nchunks; ++c) {
+                    OutputBuffer chunk;
+                    size_t end = (c + 1) * UNIQ_CHUNK < batch->count ? (c + 1) * UNIQ_CHUNK : batch->count;
+                    reorder_begin(order, chunk_base + c, &chunk);
+                    for (size_t i = c * UNIQ_CHUNK; i < end; ++i) {
+                        graph_key(&batch->keys[i], canon, &key);
+                        reorder_add_pair(&chunk, &key, &batch->keys[i]);
+                    }
+                    reorder_end(order, chunk_base + c, &chunk);
+                }
+
+                #pragma omp single
+                {
+                    chunk_base += nchunks;
+                    num_of_reps = order_dedup.added;
+                }
+                continue;
+            }
+
+            size_t local_reps = 0;
+
+            #pragma omp for schedule(dynamic, UNIQ_CHUNK)
+            for (size_t i = 0; i < batch->count; ++i) {
+                graph_key(&batch->keys[i], canon, &key);
+                if ( dedup_insert(g_canonical_set, &key) ) {
                     ++local_reps;
-                    buffer_add(&thread_buffer, line);
+                    buffer_add_key(&thread_buffer, &batch->keys[i], binary);
                 }
             }
 
             #pragma omp atomic
                 num_of_reps += local_reps;
+        }
 
-            free_nauty_data();
+        free_nauty_data();
 
-            buffer_flush(&thread_buffer);
-            buffer_destroy(&thread_buffer);
-        }
-        for (size_t i = 0; i < line_count; ++i) free(lines[i]);
-        line_count = 0; // reset for next batch
+        buffer_destroy(&thread_buffer);
+    }
+    batchpipe_close(pipe);
+    if (order) {
+        reorder_close(order);
     }
-
-    free(lines);
 
     printlog(1, "Done. Found %lu representatives", num_of_reps); //g_bucket_size(g_canonical_set));
 
-    g_bucket_destroy(g_canonical_set);
+    g_bucket_stats_log(dedup_bucket(g_canonical_set), 1, "seen set");
+    if (stats_path) {
+        g_bucket_stats_json(dedup_bucket(g_canonical_set), stats_path, "seen set");
+    }
+    if (dedup_runs(g_canonical_set) > 0) {
+        printlog(1, "Seen set spilled to %zu run(s) on disk", dedup_runs(g_canonical_set));
+    }
+    dedup_destroy(g_canonical_set);
 
+    outring_close(ring);
+    keystream_close(&ks);
     if (in != stdin) fclose(in);
     if (out != stdout) fclose(out);
 
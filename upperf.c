@@ -1,24 +1,53 @@
 #include "bott.h"
 #include "dag.h"
+#include "adjpack11.h"
+#include "batchpipe.h"
+#include "keystream.h"
+#include "tlsbuf.h"
 
-int main(void) {
-    vec_t mat[11];
-    int n;
-    char s[MAXLINE];
+int main(int argc, char *argv[]) {
+    unsigned n;
+    key128_t k;
+    bool binary = false;
+    KeyStream in;
 
-    // Main loop to read one line (one graph) at a time
-    while (fgets(s, sizeof(s), stdin) != NULL) {
-        remove_newline(s);
-        // 1. Determine the number of vertices (n) from the graph6 string.
-        n = graphsize(s);
-        if (n == 0) {
-            continue; // Skip invalid or empty lines
+    int opt;
+    while ((opt = getopt(argc, argv, "B")) != -1) {
+        if (opt != 'B') {
+            fprintf(stderr, "Usage: %s [-B] < input > output\n  -B  write a binary key stream\n", argv[0]);
+            exit(EXIT_FAILURE);
         }
-        matrix_from_d6(s, mat, n);
+        binary = true;
+    }
+    if (!keystream_open(&in, stdin)) {
+        exit(EXIT_FAILURE);
+    }
+    if (binary) {
+        keystream_write_header(stdout, in.n, in.flags);
+    }
 
-        if (is_upper_triangular(mat, n)) {
-            printf("%s\n", s);
+    // Batches are read ahead by the pipe's thread, output is written by the ring's
+    BatchPipe *pipe = batchpipe_open(&in, NULL, 0, 0);
+    OutRing *ring = outring_open(stdout, 0, 0);
+    OutputBuffer out;
+    buffer_init(&out, ring);
+
+    for (KeyBatch *b; (b = batchpipe_next(pipe)) != NULL; batchpipe_release(pipe, b)) {
+        for (size_t j = 0; j < b->count; ++j) {
+            k = b->keys[j];
+            // 1. Determine the number of vertices (n) from the key.
+            n = d6pack_get_n(&k);
+
+            // 2. Nothing on or below the diagonal, checked on the key.
+            if (adjpack_is_upper(&k, n)) {
+                buffer_add_key(&out, &k, binary);
+            }
         }
     }
+    buffer_destroy(&out);
+    outring_close(ring);
+    batchpipe_close(pipe);
+
+    keystream_close(&in);
     return 0;
 }
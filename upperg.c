@@ -1,32 +1,66 @@
 #include "dag.h"
+#include "batchpipe.h"
+#include "keystream.h"
+#include "tlsbuf.h"
 
-int main(void)
+int main(int argc, char *argv[])
 {
-    int   n;
-    char  s[MAXLINE];
-    char d6[MAXLINE];
+    unsigned n;
+    key128_t k, upper;
+    bool binary = false;
+    KeyStream in;
 
-    if ( fgets(s, sizeof(s), stdin)==NULL ) {
+    int opt;
+    while ((opt = getopt(argc, argv, "B")) != -1) {
+        if (opt != 'B') {
+            fprintf(stderr, "Usage: %s [-B] < input > output\n  -B  write a binary key stream\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        binary = true;
+    }
+    if (!keystream_open(&in, stdin)) {
+        exit(EXIT_FAILURE);
+    }
+
+    if ( !keystream_next(&in, &k) ) {
         fprintf(stderr, "file read error, quitting...\n");
         exit(1);
     }
-    n = graphsize(s);
-    if (n <= 0) {
+    n = d6pack_get_n(&k);
+    if (n == 0) {
         fprintf(stderr, "read non-positive number of vertices, quitting...\n");
         exit(1);
     }
     init_nauty_data(n);
+    if (binary) {
+        // relabelling keeps none of the stream properties
+        keystream_write_header(stdout, n, 0);
+    }
+
+    // Batches are read ahead by the pipe's thread, output is written by the ring's
+    BatchPipe *pipe = batchpipe_open(&in, &k, 0, 0);
+    OutRing *ring = outring_open(stdout, 0, 0);
+    OutputBuffer out;
+    buffer_init(&out, ring);
 
-    do {
-        if (d6_to_d6_upper(s, d6)==NULL) {
-            fprintf(stderr, "%s: error in converting graph to topological order, quitting...\n", s);
-            free_nauty_data();
-            exit(1);
+    for (KeyBatch *b; (b = batchpipe_next(pipe)) != NULL; batchpipe_release(pipe, b)) {
+        for (size_t j = 0; j < b->count; ++j) {
+            k = b->keys[j];
+            if (key128_to_key128_upper(&k, &upper)==NULL) {
+                char d6[MAXLINE];
+                fprintf(stderr, "%s: error in converting graph to topological order, quitting...\n", key128_to_d6(&k, d6));
+                free_nauty_data();
+                exit(1);
+            }
+            buffer_add_key(&out, &upper, binary);
         }
-        printf("%s\n", d6);
-    } while (fgets(s, sizeof(s), stdin) != NULL);
+    }
+    buffer_destroy(&out);
+    outring_close(ring);
+    batchpipe_close(pipe);
 
     free_nauty_data();
 
+    keystream_close(&in);
     return 0;
 }
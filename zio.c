@@ -0,0 +1,376 @@
+#include "common.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+
+#ifndef HAVE_LZMA
+#   define HAVE_LZMA 0
+#endif
+#ifndef HAVE_ZSTD
+#   define HAVE_ZSTD 0
+#endif
+
+#if HAVE_LZMA
+#   include <lzma.h>
+#endif
+#if HAVE_ZSTD
+#   include <zstd.h>
+#endif
+
+#include "zio.h"
+
+#define ZIO_OUT_BYTES  ((size_t)1 << 20)
+#define ZIO_XZ_PRESET  3        /* 4 MiB dictionary, 12 MiB blocks */
+#define ZIO_ZSTD_LEVEL 3
+
+static const unsigned char xz_magic[6]   = { 0xFD, '7', 'z', 'X', 'Z', 0x00 };
+static const unsigned char zstd_magic[4] = { 0x28, 0xB5, 0x2F, 0xFD };
+
+ZioCodec zio_detect(const void *p, size_t len)
+{
+    if (len >= sizeof(xz_magic) && memcmp(p, xz_magic, sizeof(xz_magic)) == 0) {
+        return ZIO_XZ;
+    }
+    if (len >= sizeof(zstd_magic) && memcmp(p, zstd_magic, sizeof(zstd_magic)) == 0) {
+        return ZIO_ZSTD;
+    }
+    return ZIO_NONE;
+}
+
+static bool has_suffix(const char *s, const char *suffix)
+{
+    size_t n = strlen(s), m = strlen(suffix);
+    return n > m && strcmp(s + n - m, suffix) == 0;
+}
+
+ZioCodec zio_codec_of_path(const char *path)
+{
+    if (has_suffix(path, ".xz"))  return ZIO_XZ;
+    if (has_suffix(path, ".zst")) return ZIO_ZSTD;
+    return ZIO_NONE;
+}
+
+const char *zio_codec_name(ZioCodec c)
+{
+    switch (c) {
+    case ZIO_XZ:   return "xz";
+    case ZIO_ZSTD: return "zstd";
+    default:       return "none";
+    }
+}
+
+static void __attribute__((noreturn)) missing_codec(ZioCodec c)
+{
+    fprintf(stderr, "%s streams are not supported by this build (configure found no lib%s)\n",
+            zio_codec_name(c), c == ZIO_XZ ? "lzma" : "zstd");
+    exit(EXIT_FAILURE);
+}
+
+static void *zio_alloc(size_t bytes)
+{
+    void *p = calloc(1, bytes);
+    if (p == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+/* --- decoding --- */
+
+struct _ZioDecoder {
+    ZioCodec      codec;
+#if HAVE_LZMA
+    lzma_stream   xz;
+#endif
+#if HAVE_ZSTD
+    ZSTD_DStream *zs;
+    size_t        more;         /* nonzero inside a frame */
+#endif
+};
+
+ZioDecoder *zio_decoder_new(ZioCodec c)
+{
+    ZioDecoder *d = (ZioDecoder*)zio_alloc(sizeof(ZioDecoder));
+    d->codec = c;
+    switch (c) {
+#if HAVE_LZMA
+    case ZIO_XZ: {
+        lzma_stream init = LZMA_STREAM_INIT;
+        d->xz = init;
+        lzma_mt mt;
+        memset(&mt, 0, sizeof(mt));
+        mt.flags               = LZMA_CONCATENATED;
+        mt.threads             = (uint32_t)omp_get_max_threads();
+        mt.memlimit_threading  = lzma_physmem() / 4;
+        mt.memlimit_stop       = UINT64_MAX;
+        if (lzma_stream_decoder_mt(&d->xz, &mt) != LZMA_OK) {
+            fprintf(stderr, "cannot start the xz decoder\n");
+            exit(EXIT_FAILURE);
+        }
+        printlog(2, "input: xz, up to %u decoder threads", mt.threads);
+        break;
+    }
+#endif
+#if HAVE_ZSTD
+    case ZIO_ZSTD:
+        d->zs = ZSTD_createDStream();
+        if (d->zs == NULL) {
+            fprintf(stderr, "cannot start the zstd decoder\n");
+            exit(EXIT_FAILURE);
+        }
+        printlog(2, "input: zstd");
+        break;
+#endif
+    default:
+        missing_codec(c);
+    }
+    return d;
+}
+
+void zio_decoder_free(ZioDecoder *d)
+{
+    if (d == NULL) return;
+#if HAVE_LZMA
+    if (d->codec == ZIO_XZ) lzma_end(&d->xz);
+#endif
+#if HAVE_ZSTD
+    if (d->codec == ZIO_ZSTD) ZSTD_freeDStream(d->zs);
+#endif
+    free(d);
+}
+
+#if HAVE_LZMA || HAVE_ZSTD
+static void truncated(const ZioDecoder *d)
+{
+    fprintf(stderr, "%s input ends in the middle of a stream\n", zio_codec_name(d->codec));
+    exit(EXIT_FAILURE);
+}
+#endif
+
+bool zio_decode(ZioDecoder *d, const void *in, size_t in_bytes, size_t *in_used,
+                void *out, size_t out_bytes, size_t *out_used, bool last)
+{
+    switch (d->codec) {
+#if HAVE_LZMA
+    case ZIO_XZ: {
+        d->xz.next_in   = (const uint8_t*)in + *in_used;
+        d->xz.avail_in  = in_bytes - *in_used;
+        d->xz.next_out  = (uint8_t*)out + *out_used;
+        d->xz.avail_out = out_bytes - *out_used;
+        lzma_ret r = lzma_code(&d->xz, last ? LZMA_FINISH : LZMA_RUN);
+        *in_used  = in_bytes - d->xz.avail_in;
+        *out_used = out_bytes - d->xz.avail_out;
+        if (r == LZMA_STREAM_END) {
+            return true;
+        }
+        if (r == LZMA_BUF_ERROR) {
+            truncated(d);
+        }
+        if (r != LZMA_OK) {
+            fprintf(stderr, "xz input is damaged or unsupported (liblzma error %d)\n", (int)r);
+            exit(EXIT_FAILURE);
+        }
+        return false;
+    }
+#endif
+#if HAVE_ZSTD
+    case ZIO_ZSTD: {
+        ZSTD_inBuffer  ib = { in, in_bytes, *in_used };
+        ZSTD_outBuffer ob = { out, out_bytes, *out_used };
+        if (ib.pos < ib.size || d->more) {
+            size_t r = ZSTD_decompressStream(d->zs, &ob, &ib);
+            if (ZSTD_isError(r)) {
+                fprintf(stderr, "zstd input is damaged: %s\n", ZSTD_getErrorName(r));
+                exit(EXIT_FAILURE);
+            }
+            d->more = r;
+        }
+        *in_used  = ib.pos;
+        *out_used = ob.pos;
+        if (last && ib.pos == ib.size) {
+            // with room left in 'out', an open frame can only lack input
+            if (d->more && ob.pos < ob.size) {
+                truncated(d);
+            }
+            return d->more == 0;
+        }
+        return false;
+    }
+#endif
+    default:
+        missing_codec(d->codec);
+    }
+    return true;
+}
+
+/* --- encoding, behind a stdio stream --- */
+
+typedef struct {
+    FILE          *fp;
+    ZioCodec       codec;
+#if HAVE_LZMA
+    lzma_stream    xz;
+#endif
+#if HAVE_ZSTD
+    ZSTD_CCtx     *zs;
+#endif
+    unsigned char *out;
+} ZioWriter;
+
+#if HAVE_LZMA || HAVE_ZSTD
+static bool emit(ZioWriter *w, size_t bytes)
+{
+    if (bytes && fwrite(w->out, 1, bytes, w->fp) != bytes) {
+        perror("Error writing compressed output");
+        return false;
+    }
+    return true;
+}
+#endif
+
+/* Compresses 'size' bytes; 'finish' ends the stream. */
+static bool encode(ZioWriter *w, const void *data, size_t size, bool finish)
+{
+    switch (w->codec) {
+#if HAVE_LZMA
+    case ZIO_XZ: {
+        w->xz.next_in  = (const uint8_t*)data;
+        w->xz.avail_in = size;
+        for (;;) {
+            w->xz.next_out  = w->out;
+            w->xz.avail_out = ZIO_OUT_BYTES;
+            lzma_ret r = lzma_code(&w->xz, finish ? LZMA_FINISH : LZMA_RUN);
+            if (r != LZMA_OK && r != LZMA_STREAM_END) {
+                fprintf(stderr, "xz encoder failed (liblzma error %d)\n", (int)r);
+                errno = EIO;
+                return false;
+            }
+            if (!emit(w, ZIO_OUT_BYTES - w->xz.avail_out)) return false;
+            if (finish ? r == LZMA_STREAM_END : w->xz.avail_in == 0 && w->xz.avail_out > 0) return true;
+        }
+    }
+#endif
+#if HAVE_ZSTD
+    case ZIO_ZSTD: {
+        ZSTD_inBuffer ib = { data, size, 0 };
+        for (;;) {
+            ZSTD_outBuffer ob = { w->out, ZIO_OUT_BYTES, 0 };
+            size_t r = ZSTD_compressStream2(w->zs, &ob, &ib, finish ? ZSTD_e_end : ZSTD_e_continue);
+            if (ZSTD_isError(r)) {
+                fprintf(stderr, "zstd encoder failed: %s\n", ZSTD_getErrorName(r));
+                errno = EIO;
+                return false;
+            }
+            if (!emit(w, ob.pos)) return false;
+            if (finish ? r == 0 : ib.pos == ib.size) return true;
+        }
+    }
+#endif
+    default:
+        errno = EINVAL;
+        return false;
+    }
+}
+
+static ssize_t writer_write(void *cookie, const char *data, size_t size)
+{
+    return encode((ZioWriter*)cookie, data, size, false) ? (ssize_t)size : -1;
+}
+
+static int writer_close(void *cookie)
+{
+    ZioWriter *w = (ZioWriter*)cookie;
+    bool ok = encode(w, NULL, 0, true);
+#if HAVE_LZMA
+    if (w->codec == ZIO_XZ) lzma_end(&w->xz);
+#endif
+#if HAVE_ZSTD
+    if (w->codec == ZIO_ZSTD) ZSTD_freeCCtx(w->zs);
+#endif
+    if (fclose(w->fp) != 0) ok = false;
+    free(w->out);
+    free(w);
+    return ok ? 0 : EOF;
+}
+
+static void start_encoder(ZioWriter *w)
+{
+    switch (w->codec) {
+#if HAVE_LZMA
+    case ZIO_XZ: {
+        lzma_stream init = LZMA_STREAM_INIT;
+        w->xz = init;
+        lzma_mt mt;
+        memset(&mt, 0, sizeof(mt));
+        mt.preset  = ZIO_XZ_PRESET;
+        mt.check   = LZMA_CHECK_CRC64;
+        mt.threads = (uint32_t)omp_get_max_threads();
+        // every thread holds a block in and out: stay within a quarter of the memory
+        while (mt.threads > 1 && lzma_stream_encoder_mt_memusage(&mt) > lzma_physmem() / 4) {
+            mt.threads /= 2;
+        }
+        if (lzma_stream_encoder_mt(&w->xz, &mt) != LZMA_OK) {
+            fprintf(stderr, "cannot start the xz encoder\n");
+            exit(EXIT_FAILURE);
+        }
+        printlog(2, "output: xz, %u encoder threads", mt.threads);
+        break;
+    }
+#endif
+#if HAVE_ZSTD
+    case ZIO_ZSTD: {
+        int threads = omp_get_max_threads();
+        w->zs = ZSTD_createCCtx();
+        if (w->zs == NULL) {
+            fprintf(stderr, "cannot start the zstd encoder\n");
+            exit(EXIT_FAILURE);
+        }
+        ZSTD_CCtx_setParameter(w->zs, ZSTD_c_compressionLevel, ZIO_ZSTD_LEVEL);
+        // fails in a libzstd built without threads, which then compresses inline
+        if (ZSTD_isError(ZSTD_CCtx_setParameter(w->zs, ZSTD_c_nbWorkers, threads))) {
+            threads = 0;
+        }
+        printlog(2, "output: zstd, %d encoder threads", threads);
+        break;
+    }
+#endif
+    default:
+        missing_codec(w->codec);
+    }
+}
+
+FILE *zio_fopen_write(const char *path)
+{
+    ZioCodec c = zio_codec_of_path(path);
+    if ((c == ZIO_XZ && !HAVE_LZMA) || (c == ZIO_ZSTD && !HAVE_ZSTD)) {
+        missing_codec(c);
+    }
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL || c == ZIO_NONE) {
+        return fp;
+    }
+
+    ZioWriter *w = (ZioWriter*)zio_alloc(sizeof(ZioWriter));
+    w->fp    = fp;
+    w->codec = c;
+    w->out   = (unsigned char*)malloc(ZIO_OUT_BYTES);
+    if (w->out == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    start_encoder(w);
+
+    cookie_io_functions_t io = { .read = NULL, .write = writer_write, .seek = NULL, .close = writer_close };
+    FILE *z = fopencookie(w, "w", io);
+    if (z == NULL) {
+        int err = errno;
+        writer_close(w);
+        errno = err;
+        return NULL;
+    }
+    setvbuf(z, NULL, _IOFBF, ZIO_OUT_BYTES);
+    return z;
+}
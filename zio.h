@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "common.h"
+
+/*
+ * Compressed streams: xz and zstd, read and written by the tools themselves.
+ *
+ * Input is recognised by its magic bytes, whatever its name: the input
+ * buffer (inbuf.h) decodes it in place of reading it, so a compressed file
+ * or pipe goes wherever plain input goes. Decoding happens where reading
+ * happens, i.e. in the reader thread of a batch pipe for the tools that use
+ * one, and overlaps with the computation. The xz decoder runs one thread per
+ * OpenMP thread on the blocks of a multi-block stream (as written by
+ * `xz -T` or by zio_fopen_write()); zstd decodes one frame after another,
+ * which is fast enough to keep up with the tools.
+ *
+ * Output is compressed when the name of the output file ends in ".xz" or
+ * ".zst": zio_fopen_write() returns a stdio stream whose writes go through
+ * a multithreaded encoder (one worker per OpenMP thread). It has no file
+ * descriptor and cannot seek; fclose() finishes the compressed stream.
+ *
+ * Each codec is available if its library was found by configure (HAVE_LZMA,
+ * HAVE_ZSTD); a stream of a missing one is an error with a message.
+ */
+typedef enum {
+    ZIO_NONE = 0,
+    ZIO_XZ,
+    ZIO_ZSTD,
+} ZioCodec;
+
+#define ZIO_MAGIC_MAX 6     /* bytes needed by zio_detect() */
+
+/* Codec of a stream starting with the 'len' bytes at 'p'. */
+ZioCodec zio_detect(const void *p, size_t len);
+
+/* Codec selected by the suffix of 'path' (".xz", ".zst"). */
+ZioCodec zio_codec_of_path(const char *path);
+
+const char *zio_codec_name(ZioCodec c);
+
+typedef struct _ZioDecoder ZioDecoder;
+
+/* A decoder of (concatenated) streams of 'c'; exits if 'c' is not built in. */
+ZioDecoder *zio_decoder_new(ZioCodec c);
+void zio_decoder_free(ZioDecoder *d);
+
+/* Decodes input from in[*in_used..in_bytes) into out[*out_used..out_bytes)
+ * and advances both counts. 'last' says that no input follows the given
+ * one. Returns true once the input is completely decoded; exits on damaged
+ * or truncated input.
+ */
+bool zio_decode(ZioDecoder *d, const void *in, size_t in_bytes, size_t *in_used,
+                void *out, size_t out_bytes, size_t *out_used, bool last);
+
+/* Opens 'path' for writing, compressed as zio_codec_of_path() says;
+ * NULL with errno set if it cannot be opened.
+ */
+FILE *zio_fopen_write(const char *path);